@@ -0,0 +1,72 @@
+// description of one captured frame as it travels between pipeline stages
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include "FramePool.h"
+
+class LatencyTracker;
+
+// a monotonic clock shared by all stages, so lags can be measured across threads
+inline int64_t steadyClockMicroseconds()
+{
+	return (int64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+enum CaptureEye
+{
+	kEyeLeft = 0,
+	kEyeRight = 1,
+	kEyeCount = 2
+};
+
+// Everything a downstream stage needs to know about a frame, copied out of the
+// IDeckLinkVideoInputFrame on the callback thread. Pixel data lives in pooled buffers;
+// a right eye buffer is only present for dual-stream 3D capture. The same struct, with no
+// buffers and formatEyeCount set, describes the frames to come when the stages are opened
+struct CaptureFrame
+{
+	unsigned		deviceIndex;
+	uint64_t		frameNumber;
+	int64_t			streamTime;			// in timeScale units, from GetStreamTime()
+	int64_t			streamDuration;
+	int64_t			timeScale;
+	int64_t			hardwareTime;		// in microseconds, from GetHardwareReferenceTimestamp()
+	int64_t			arrivalTime;		// steadyClockMicroseconds() when the callback got the frame, for measuring stage lag
+	int64_t			anchorTime;			// hardwareTime moved onto the steady clock, which stage latencies are measured from
+	uint32_t		flags;				// BMDFrameFlags
+	uint32_t		pixelFormat;		// BMDPixelFormat of the payload
+	int32_t			width;
+	int32_t			height;
+	int32_t			rowBytes;
+	FrameBuffer*	eye[kEyeCount];
+	LatencyTracker*	latency;			// the device's, or nullptr; stages record when they are done with the frame
+	uint32_t		formatEyeCount;		// eyes of the frames a format descriptor describes; 0 on a frame, which counts its buffers
+
+	unsigned eyeCount() const
+	{
+		if (formatEyeCount != 0)
+			return formatEyeCount;
+		return (eye[kEyeRight] != nullptr) ? 2 : 1;
+	}
+
+	// take an additional reference on every buffer, for a stage that keeps its own copy of the descriptor
+	void retain() const
+	{
+		for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		{
+			if (eye[eyeIdx])
+				eye[eyeIdx]->AddRef();
+		}
+	}
+
+	void release()
+	{
+		for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		{
+			if (eye[eyeIdx])
+				eye[eyeIdx]->Release();
+			eye[eyeIdx] = nullptr;
+		}
+	}
+};
@@ -0,0 +1,284 @@
+// clock drift: how a device's card clock and each eye's stream clock run against the host, and the card-to-host time mapping
+#include "ClockDriftTracker.h"
+#include "BinaryLog.h"
+
+#include <stdio.h>
+#include <cmath>
+
+// samples the fits are weighted over: about a minute of frames, long enough to see parts per million
+static const double kDriftWindowSamples = 3600.0;
+
+// samples the jitter is smoothed over
+static const double kJitterWindowSamples = 300.0;
+
+// a frame whose hardware timestamp interval is further than this fraction of a frame from its stream duration is off cadence
+static const double kCadenceTolerance = 0.05;
+
+// a drift rate past this is logged; free-running broadcast clocks are good to a few ppm
+static const double kDriftTolerancePpm = 50.0;
+
+// drift rates are not checked until a fit spans this much card time, in microseconds
+static const double kDriftSettleUs = 30e6;
+
+// a stream time this far from where the hardware timestamp puts it restarts that eye's fit
+static const double kStreamResetUs = 1e6;
+
+static const char* const kEyeNames[kEyeCount] = { "left", "right" };
+
+DriftRegression::DriftRegression() :
+	m_samples(0),
+	m_originX(0),
+	m_originY(0),
+	m_lastX(0),
+	m_meanX(0),
+	m_meanY(0),
+	m_varX(0),
+	m_covXY(0)
+{
+}
+
+void DriftRegression::add(int64_t x, int64_t y, double windowSamples)
+{
+	if (m_samples == 0)
+	{
+		m_originX = x;
+		m_originY = y;
+	}
+	m_lastX = x;
+	++m_samples;
+
+	// a plain average until the window fills, then an exponentially weighted one
+	const double weight = std::fmax(1.0 / m_samples, 1.0 / windowSamples);
+	const double dx = (double)(x - m_originX) - m_meanX;
+	const double dy = (double)(y - m_originY) - m_meanY;
+	m_meanX += weight * dx;
+	m_meanY += weight * dy;
+	m_varX = (1.0 - weight) * (m_varX + weight * dx * dx);
+	m_covXY = (1.0 - weight) * (m_covXY + weight * dx * dy);
+}
+
+double DriftRegression::predict(int64_t x) const
+{
+	return (double)m_originY + m_meanY + slope() * ((double)(x - m_originX) - m_meanX);
+}
+
+ClockDriftTracker::ClockDriftTracker(unsigned deviceIndex) :
+	m_deviceIndex(deviceIndex),
+	m_leftStreamUs(0),
+	m_haveLeft(false),
+	m_drifting(false),
+	m_sequence(0),
+	m_mapOriginX(0),
+	m_mapBaseY(0),
+	m_mapSlope(1.0),
+	m_mapReady(false),
+	m_cardDriftPpm(0),
+	m_eyeDriftPpm(0),
+	m_eyeOffsetMs(0),
+	m_cadenceEvents(0),
+	m_driftEvents(0)
+{
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		m_eyes[eyeIdx].started = false;
+		m_eyes[eyeIdx].meanSquareJitter = 0;
+		m_eyes[eyeIdx].offCadence = false;
+		m_frames[eyeIdx] = 0;
+		m_streamDriftPpm[eyeIdx] = 0;
+		m_jitterMs[eyeIdx] = 0;
+		m_maxCadenceErrorMs[eyeIdx] = 0;
+	}
+}
+
+void ClockDriftTracker::addFrame(CaptureEye eye, int64_t hardwareTime, int64_t streamTime, int64_t streamDuration, int64_t timeScale, int64_t hostTime)
+{
+	if (timeScale <= 0)
+		return;
+
+	EyeState& state = m_eyes[eye];
+	const int64_t streamUs = (int64_t)((double)streamTime * 1e6 / timeScale);
+	const double frameUs = (double)streamDuration * 1e6 / timeScale;
+
+	if (state.started)
+	{
+		const double hardwareInterval = (double)(hardwareTime - state.lastHardwareTime);
+		const double streamInterval = (double)(streamUs - state.lastStreamTime);
+		const double cadenceError = hardwareInterval - streamInterval;
+
+		if (streamInterval <= 0 || std::fabs(cadenceError) > kStreamResetUs)
+		{
+			// the stream restarted; the old fit says nothing about the new one
+			state.stream = DriftRegression();
+		}
+		else
+		{
+			const double cadenceErrorMs = std::fabs(cadenceError) / 1000.0;
+			if (cadenceErrorMs > m_maxCadenceErrorMs[eye].load(std::memory_order_relaxed))
+				m_maxCadenceErrorMs[eye].store(cadenceErrorMs, std::memory_order_relaxed);
+
+			const bool offCadence = std::fabs(cadenceError) > kCadenceTolerance * frameUs;
+			if (offCadence && !state.offCadence)
+			{
+				m_cadenceEvents.fetch_add(1, std::memory_order_relaxed);
+				logWarning("Device #%u: %s eye hardware timestamps %.3f ms off the stream cadence at %.3f s\n", m_deviceIndex, kEyeNames[eye],
+					cadenceError / 1000.0, streamUs / 1e6);
+			}
+			state.offCadence = offCadence;
+
+			// the callback's lateness changing from one frame to the next
+			const double jitter = (double)(hostTime - state.lastHostTime) - hardwareInterval;
+			state.meanSquareJitter += (jitter * jitter - state.meanSquareJitter) / std::fmin((double)state.stream.samples() + 1.0, kJitterWindowSamples);
+		}
+	}
+	state.started = true;
+	state.lastHardwareTime = hardwareTime;
+	state.lastStreamTime = streamUs;
+	state.lastHostTime = hostTime;
+	state.stream.add(hardwareTime, streamUs, kDriftWindowSamples);
+
+	if (eye == kEyeLeft)
+	{
+		m_leftStreamUs = streamUs;
+		m_haveLeft = true;
+	}
+	else if (m_haveLeft)
+	{
+		m_eyeOffset.add(hardwareTime, streamUs - m_leftStreamUs, kDriftWindowSamples);
+		m_haveLeft = false;
+	}
+
+	m_frames[eye].fetch_add(1, std::memory_order_relaxed);
+	checkDrift();
+	publish();
+}
+
+void ClockDriftTracker::addClockReading(int64_t cardTime, int64_t hostTime)
+{
+	m_card.add(cardTime, hostTime, kDriftWindowSamples);
+	publish();
+}
+
+void ClockDriftTracker::checkDrift()
+{
+	bool drifting = false;
+	if (m_card.isReady() && m_card.spanX() >= kDriftSettleUs)
+		drifting |= std::fabs((1.0 / m_card.slope() - 1.0) * 1e6) > kDriftTolerancePpm;
+	for (const EyeState& state : m_eyes)
+	{
+		if (state.stream.isReady() && state.stream.spanX() >= kDriftSettleUs)
+			drifting |= std::fabs((state.stream.slope() - 1.0) * 1e6) > kDriftTolerancePpm;
+	}
+	if (m_eyeOffset.isReady() && m_eyeOffset.spanX() >= kDriftSettleUs)
+		drifting |= std::fabs(m_eyeOffset.slope() * 1e6) > kDriftTolerancePpm;
+
+	if (drifting && !m_drifting)
+	{
+		m_driftEvents.fetch_add(1, std::memory_order_relaxed);
+		logWarning("Device #%u: clock drift past %.0f ppm: card %+.1f ppm against the host, left stream %+.1f, right stream %+.1f, eyes %+.1f apart\n",
+			m_deviceIndex, kDriftTolerancePpm, m_card.isReady() ? (1.0 / m_card.slope() - 1.0) * 1e6 : 0.0,
+			(m_eyes[kEyeLeft].stream.slope() - 1.0) * 1e6, (m_eyes[kEyeRight].stream.slope() - 1.0) * 1e6,
+			m_eyeOffset.isReady() ? m_eyeOffset.slope() * 1e6 : 0.0);
+	}
+	m_drifting = drifting;
+}
+
+void ClockDriftTracker::publish()
+{
+	const uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+	m_sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	// the mapping is kept about the latest reading, where it is most accurate
+	if (m_card.isReady())
+	{
+		m_mapOriginX.store(m_card.lastX(), std::memory_order_relaxed);
+		m_mapBaseY.store(m_card.predict(m_card.lastX()), std::memory_order_relaxed);
+		m_mapSlope.store(m_card.slope(), std::memory_order_relaxed);
+		m_mapReady.store(true, std::memory_order_relaxed);
+		m_cardDriftPpm.store((1.0 / m_card.slope() - 1.0) * 1e6, std::memory_order_relaxed);
+	}
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		const EyeState& state = m_eyes[eyeIdx];
+		if (state.stream.isReady())
+			m_streamDriftPpm[eyeIdx].store((state.stream.slope() - 1.0) * 1e6, std::memory_order_relaxed);
+		m_jitterMs[eyeIdx].store(std::sqrt(state.meanSquareJitter) / 1000.0, std::memory_order_relaxed);
+	}
+	if (m_eyeOffset.isReady())
+	{
+		m_eyeDriftPpm.store(m_eyeOffset.slope() * 1e6, std::memory_order_relaxed);
+		m_eyeOffsetMs.store(m_eyeOffset.predict(m_eyes[kEyeRight].lastHardwareTime) / 1000.0, std::memory_order_relaxed);
+	}
+
+	m_sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool ClockDriftTracker::hardwareToHost(int64_t hardwareTime, int64_t* hostTime) const
+{
+	for (;;)
+	{
+		const uint32_t before = m_sequence.load(std::memory_order_acquire);
+		if (before & 1)
+			continue;
+
+		const bool ready = m_mapReady.load(std::memory_order_relaxed);
+		const int64_t originX = m_mapOriginX.load(std::memory_order_relaxed);
+		const double baseY = m_mapBaseY.load(std::memory_order_relaxed);
+		const double slope = m_mapSlope.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_sequence.load(std::memory_order_relaxed) != before)
+			continue;
+
+		if (!ready)
+			return false;
+		*hostTime = (int64_t)std::llround(baseY + slope * (double)(hardwareTime - originX));
+		return true;
+	}
+}
+
+ClockDriftStats ClockDriftTracker::stats() const
+{
+	ClockDriftStats stats;
+	for (;;)
+	{
+		const uint32_t before = m_sequence.load(std::memory_order_acquire);
+		if (before & 1)
+			continue;
+
+		for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		{
+			stats.frames[eyeIdx] = m_frames[eyeIdx].load(std::memory_order_relaxed);
+			stats.streamDriftPpm[eyeIdx] = m_streamDriftPpm[eyeIdx].load(std::memory_order_relaxed);
+			stats.jitterMs[eyeIdx] = m_jitterMs[eyeIdx].load(std::memory_order_relaxed);
+			stats.maxCadenceErrorMs[eyeIdx] = m_maxCadenceErrorMs[eyeIdx].load(std::memory_order_relaxed);
+		}
+		stats.cardDriftPpm = m_cardDriftPpm.load(std::memory_order_relaxed);
+		stats.eyeDriftPpm = m_eyeDriftPpm.load(std::memory_order_relaxed);
+		stats.eyeOffsetMs = m_eyeOffsetMs.load(std::memory_order_relaxed);
+		stats.cadenceEvents = m_cadenceEvents.load(std::memory_order_relaxed);
+		stats.driftEvents = m_driftEvents.load(std::memory_order_relaxed);
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (m_sequence.load(std::memory_order_relaxed) == before)
+			return stats;
+	}
+}
+
+void ClockDriftTracker::printStats() const
+{
+	const ClockDriftStats current = stats();
+
+	printf("Device #%u clocks: card %+.2f ppm against the host, %llu cadence and %llu drift events\n", m_deviceIndex, current.cardDriftPpm,
+		(unsigned long long)current.cadenceEvents, (unsigned long long)current.driftEvents);
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		if (current.frames[eyeIdx] == 0)
+			continue;
+
+		printf("  %s eye: stream %+.2f ppm against the card, arrival jitter %.3f ms rms, cadence off by up to %.3f ms\n", kEyeNames[eyeIdx],
+			current.streamDriftPpm[eyeIdx], current.jitterMs[eyeIdx], current.maxCadenceErrorMs[eyeIdx]);
+	}
+	if (current.frames[kEyeRight] > 0)
+		printf("  right eye %+.3f ms from the left, drifting %+.2f ppm\n", current.eyeOffsetMs, current.eyeDriftPpm);
+}
@@ -0,0 +1,155 @@
+// frame continuity: finds dropped, repeated and out-of-sequence frames from their stream times as they arrive
+#include "ContinuityTracker.h"
+#include "BinaryLog.h"
+
+#include <stdio.h>
+
+// a gap of more than this many frames is the stream restarting, not frames going missing
+static const int64_t kMaxDropRun = 300;
+
+// frames queued behind the current one before the callback counts as falling behind
+static const unsigned kBacklogEventFrames = 2;
+
+static const char* const kEyeNames[kEyeCount] = { "left", "right" };
+
+ContinuityTracker::ContinuityTracker(unsigned deviceIndex) :
+	m_deviceIndex(deviceIndex),
+	m_backlogged(false),
+	m_backlogEvents(0),
+	m_maxBacklog(0)
+{
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		m_eyes[eyeIdx] = {};
+		m_frames[eyeIdx] = 0;
+		m_framesDropped[eyeIdx] = 0;
+		m_duplicates[eyeIdx] = 0;
+		m_discontinuities[eyeIdx] = 0;
+	}
+	for (std::atomic<uint64_t>& blamed : m_blamed)
+		blamed = 0;
+}
+
+void ContinuityTracker::check(CaptureEye eye, int64_t streamTime, int64_t streamDuration, int64_t timeScale, unsigned driverBacklog,
+	const std::function<SaturatedStage()>& saturatedStage)
+{
+	EyeState& state = m_eyes[eye];
+	++m_frames[eye];
+
+	// the backlog is the callback's, so it is only looked at once per frame
+	if (eye == kEyeLeft)
+	{
+		if (driverBacklog > m_maxBacklog)
+			m_maxBacklog = driverBacklog;
+		if (driverBacklog >= kBacklogEventFrames && !m_backlogged)
+			report(kContinuityBacklog, eye, streamTime, timeScale, driverBacklog, saturatedStage());
+		m_backlogged = driverBacklog >= kBacklogEventFrames;
+	}
+
+	if (!state.started || streamDuration <= 0)
+	{
+		state.started = true;
+		state.lastStreamTime = streamTime;
+		return;
+	}
+
+	// whole frames since the last one, allowing for the odd tick of rounding in the stream time
+	const int64_t delta = streamTime - state.lastStreamTime;
+	const int64_t frames = (delta + streamDuration / 2) / streamDuration;
+	const int64_t offCadence = delta - frames * streamDuration;
+	state.lastStreamTime = streamTime;
+
+	if (delta == 0)
+		report(kContinuityDuplicate, eye, streamTime, timeScale, 1, saturatedStage());
+	else if (delta < 0 || frames > kMaxDropRun || offCadence > streamDuration / 4 || offCadence < -streamDuration / 4)
+		report(kContinuityDiscontinuity, eye, streamTime, timeScale, 1, saturatedStage());
+	else if (frames > 1)
+		report(kContinuityDrop, eye, streamTime, timeScale, (uint64_t)(frames - 1), saturatedStage());
+}
+
+void ContinuityTracker::report(ContinuityEvent event, CaptureEye eye, int64_t streamTime, int64_t timeScale, uint64_t count, SaturatedStage stage)
+{
+	const double seconds = (timeScale > 0) ? (double)streamTime / timeScale : 0.0;
+
+	++m_blamed[stage];
+	switch (event)
+	{
+	case kContinuityDrop:
+		m_framesDropped[eye] += count;
+		logWarning("Device #%u: %llu %s eye frames missing before %.3f s, %s\n", m_deviceIndex, (unsigned long long)count, kEyeNames[eye], seconds, stageName(stage));
+		break;
+
+	case kContinuityDuplicate:
+		++m_duplicates[eye];
+		logWarning("Device #%u: %s eye frame at %.3f s repeated, %s\n", m_deviceIndex, kEyeNames[eye], seconds, stageName(stage));
+		break;
+
+	case kContinuityDiscontinuity:
+		++m_discontinuities[eye];
+		logWarning("Device #%u: %s eye stream time jumped to %.3f s, %s\n", m_deviceIndex, kEyeNames[eye], seconds, stageName(stage));
+		break;
+
+	case kContinuityBacklog:
+		++m_backlogEvents;
+		logWarning("Device #%u: driver holding %llu frames behind %.3f s, %s\n", m_deviceIndex, (unsigned long long)count, seconds, stageName(stage));
+		break;
+
+	default:
+		break;
+	}
+}
+
+const char* ContinuityTracker::stageName(SaturatedStage stage)
+{
+	switch (stage)
+	{
+	case kSaturatedNone:		return "nothing saturated here";
+	case kSaturatedCallback:	return "capture callback behind";
+	case kSaturatedFramePool:	return "frame pool exhausted";
+	case kSaturatedRecorder:	return "recorder queue full";
+	case kSaturatedEncoder:		return "encoder queue full";
+	case kSaturatedStills:		return "still writers busy";
+	case kSaturatedPublisher:	return "publisher busy";
+	case kSaturatedProcessing:	return "processing stages busy";
+	default:					return "unknown";
+	}
+}
+
+ContinuityStats ContinuityTracker::stats()
+{
+	ContinuityStats stats = {};
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		stats.frames[eyeIdx] = m_frames[eyeIdx];
+		stats.framesDropped[eyeIdx] = m_framesDropped[eyeIdx];
+		stats.duplicates[eyeIdx] = m_duplicates[eyeIdx];
+		stats.discontinuities[eyeIdx] = m_discontinuities[eyeIdx];
+	}
+	stats.backlogEvents = m_backlogEvents;
+	stats.maxBacklog = m_maxBacklog;
+	for (unsigned stageIdx = 0; stageIdx < kSaturatedStageCount; stageIdx++)
+		stats.blamed[stageIdx] = m_blamed[stageIdx];
+	return stats;
+}
+
+void ContinuityTracker::printStats()
+{
+	ContinuityStats current = stats();
+
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		if (current.frames[eyeIdx] == 0)
+			continue;
+
+		printf("Device #%u %s eye continuity: %llu frames, %llu missing, %llu repeated, %llu discontinuities\n", m_deviceIndex, kEyeNames[eyeIdx],
+			(unsigned long long)current.frames[eyeIdx], (unsigned long long)current.framesDropped[eyeIdx],
+			(unsigned long long)current.duplicates[eyeIdx], (unsigned long long)current.discontinuities[eyeIdx]);
+	}
+	printf("Device #%u driver backlog: %llu times, at most %u frames\n", m_deviceIndex, (unsigned long long)current.backlogEvents, current.maxBacklog);
+
+	for (unsigned stageIdx = 0; stageIdx < kSaturatedStageCount; stageIdx++)
+	{
+		if (current.blamed[stageIdx] > 0)
+			printf("  %llu events with %s\n", (unsigned long long)current.blamed[stageIdx], stageName((SaturatedStage)stageIdx));
+	}
+}
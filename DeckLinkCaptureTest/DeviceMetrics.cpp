@@ -0,0 +1,143 @@
+// device metrics: what one capture device and its pipeline stages report to the metrics registry
+#include "DeviceMetrics.h"
+#include "ClockDriftTracker.h"
+#include "FramePool.h"
+#include "FramePublisher.h"
+#include "ProcessingPipeline.h"
+#include "RawRecorder.h"
+#include "StillWriterPool.h"
+#include "VideoEncoder.h"
+
+#include <string>
+
+// upper bounds of the decode time buckets, in seconds: a 1080 frame takes a few milliseconds
+static const double kDecodeTimeBounds[] = { 0.0005, 0.001, 0.002, 0.004, 0.008, 0.016, 0.032, 0.064, 0.128, 0.256 };
+
+// label values of the stages that can drop a frame or queue one, by SaturatedStage
+static const char* const kStageLabels[kSaturatedStageCount] = { nullptr, nullptr, "pool", "recorder", "encoder", "stills", "publisher", "processing" };
+
+static const char* const kEyeLabels[kEyeCount] = { "left", "right" };
+
+DeviceMetrics::DeviceMetrics(unsigned deviceIndex) :
+	m_lastCollect(std::chrono::steady_clock::now()),
+	m_lastFramesCaptured(0),
+	m_lastBytesWritten(0)
+{
+	const std::string device = "device=\"" + std::to_string(deviceIndex) + "\"";
+
+	m_framesCaptured = MetricsRegistry::counter("decklink_frames_captured_total", "Frames handed to the capture callback.", device);
+	m_signalLocked = MetricsRegistry::gauge("decklink_signal_locked", "1 while the input is locked to a signal.", device);
+	m_captureFps = MetricsRegistry::gauge("decklink_capture_fps", "Frames captured per second since the last export.", device);
+
+	// the pool has no queue, and nothing before it drops frames
+	for (unsigned stageIdx = 0; stageIdx < kSaturatedStageCount; stageIdx++)
+	{
+		m_framesDropped[stageIdx] = nullptr;
+		m_queueDepth[stageIdx] = nullptr;
+		if (kStageLabels[stageIdx] == nullptr)
+			continue;
+
+		const std::string labels = device + ",stage=\"" + kStageLabels[stageIdx] + "\"";
+		m_framesDropped[stageIdx] = MetricsRegistry::counter("decklink_frames_dropped_total", "Frames a stage refused because it was full.", labels);
+		if (stageIdx != kSaturatedFramePool)
+			m_queueDepth[stageIdx] = MetricsRegistry::gauge("decklink_queue_depth", "Frames waiting for a stage.", labels);
+	}
+
+	m_poolBuffers = MetricsRegistry::gauge("decklink_pool_buffers", "Buffers in the frame pool, one per eye per frame.", device);
+	m_poolBuffersInUse = MetricsRegistry::gauge("decklink_pool_buffers_in_use", "Frame pool buffers held by a stage.", device);
+	m_bytesWritten = MetricsRegistry::counter("decklink_recorder_bytes_written_total", "Bytes of frame records written to the recording.", device);
+	m_writeMBps = MetricsRegistry::gauge("decklink_recorder_write_mbps", "Megabytes written to the recording per second since the last export.", device);
+	m_writesInFlight = MetricsRegistry::gauge("decklink_recorder_writes_in_flight", "Writes handed to the write backend and not yet complete.", device);
+	m_writeErrors = MetricsRegistry::counter("decklink_recorder_write_errors_total", "Frame records lost to a failed write.", device);
+	m_repeatRecords = MetricsRegistry::counter("decklink_recorder_repeat_records_total", "Unchanged frames stored as a repeat of an earlier record.", device);
+
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		const std::string labels = device + ",eye=\"" + kEyeLabels[eyeIdx] + "\"";
+		m_framesMissing[eyeIdx] = MetricsRegistry::counter("decklink_frames_missing_total", "Frames missing from the sequence of stream times.", labels);
+		m_framesRepeated[eyeIdx] = MetricsRegistry::counter("decklink_frames_repeated_total", "Frames arriving with the stream time of the one before.", labels);
+		m_discontinuities[eyeIdx] = MetricsRegistry::counter("decklink_stream_discontinuities_total", "Jumps in stream time that are not whole frames.", labels);
+		m_streamDrift[eyeIdx] = MetricsRegistry::gauge("decklink_stream_drift_ppm", "Stream time against the card clock, in parts per million.", labels);
+		m_arrivalJitter[eyeIdx] = MetricsRegistry::gauge("decklink_arrival_jitter_ms", "RMS of the callback arrival interval less the hardware timestamp interval.", labels);
+	}
+
+	m_cardDrift = MetricsRegistry::gauge("decklink_card_clock_drift_ppm", "Card reference clock against the host steady clock, in parts per million.", device);
+	m_eyeDrift = MetricsRegistry::gauge("decklink_eye_drift_ppm", "Right eye stream time against the left, in parts per million.", device);
+	m_eyeOffset = MetricsRegistry::gauge("decklink_eye_offset_ms", "Right eye stream time less the left.", device);
+	m_cadenceEvents = MetricsRegistry::counter("decklink_cadence_events_total", "Frames whose hardware timestamps left the stream cadence.", device);
+
+	m_videoDecodeTime = MetricsRegistry::histogram("decklink_decode_seconds", "Time to unpack one eye of v210 for a stage.", device + ",stage=\"encoder\"",
+		kDecodeTimeBounds, sizeof(kDecodeTimeBounds) / sizeof(kDecodeTimeBounds[0]));
+	m_stillsDecodeTime = MetricsRegistry::histogram("decklink_decode_seconds", "Time to unpack one eye of v210 for a stage.", device + ",stage=\"stills\"",
+		kDecodeTimeBounds, sizeof(kDecodeTimeBounds) / sizeof(kDecodeTimeBounds[0]));
+}
+
+void DeviceMetrics::collect(FramePool* pool, RawRecorder* recorder, VideoEncoder* encoder, StillWriterPool* stills, FramePublisher* publisher, ContinuityTracker* continuity,
+	ClockDriftTracker* clocks, ProcessingPipeline* processing)
+{
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const double seconds = std::chrono::duration<double>(now - m_lastCollect).count();
+	m_lastCollect = now;
+
+	const uint64_t framesCaptured = m_framesCaptured->value();
+	if (seconds > 0)
+		m_captureFps->set((framesCaptured - m_lastFramesCaptured) / seconds);
+	m_lastFramesCaptured = framesCaptured;
+
+	m_poolBuffers->set(pool ? pool->capacity() : 0);
+	m_poolBuffersInUse->set(pool ? pool->capacity() - pool->available() : 0);
+
+	if (recorder)
+	{
+		const RecorderStats current = recorder->stats();
+
+		// a new recorder starts counting again
+		if (current.bytesWritten < m_lastBytesWritten)
+			m_lastBytesWritten = 0;
+		if (seconds > 0)
+			m_writeMBps->set((current.bytesWritten - m_lastBytesWritten) / seconds / 1e6);
+		m_bytesWritten->add(current.bytesWritten - m_lastBytesWritten);
+		m_lastBytesWritten = current.bytesWritten;
+
+		m_queueDepth[kSaturatedRecorder]->set(current.queueDepth);
+		m_writesInFlight->set(current.writesInFlight);
+		m_writeErrors->set(current.writeErrors);
+		m_repeatRecords->set(current.framesRepeated);
+	}
+	else
+	{
+		m_queueDepth[kSaturatedRecorder]->set(0);
+		m_writeMBps->set(0);
+		m_writesInFlight->set(0);
+	}
+
+	m_queueDepth[kSaturatedEncoder]->set(encoder ? encoder->stats().queueDepth : 0);
+	m_queueDepth[kSaturatedStills]->set(stills ? stills->stats().queueDepth : 0);
+	m_queueDepth[kSaturatedPublisher]->set(publisher ? publisher->stats().queueDepth : 0);
+	m_queueDepth[kSaturatedProcessing]->set(processing ? processing->queueDepth() : 0);
+
+	if (continuity)
+	{
+		const ContinuityStats current = continuity->stats();
+		for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		{
+			m_framesMissing[eyeIdx]->set(current.framesDropped[eyeIdx]);
+			m_framesRepeated[eyeIdx]->set(current.duplicates[eyeIdx]);
+			m_discontinuities[eyeIdx]->set(current.discontinuities[eyeIdx]);
+		}
+	}
+
+	if (clocks)
+	{
+		const ClockDriftStats current = clocks->stats();
+		m_cardDrift->set(current.cardDriftPpm);
+		for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		{
+			m_streamDrift[eyeIdx]->set(current.streamDriftPpm[eyeIdx]);
+			m_arrivalJitter[eyeIdx]->set(current.jitterMs[eyeIdx]);
+		}
+		m_eyeDrift->set(current.eyeDriftPpm);
+		m_eyeOffset->set(current.eyeOffsetMs);
+		m_cadenceEvents->set(current.cadenceEvents);
+	}
+}
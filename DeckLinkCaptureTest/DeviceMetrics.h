@@ -0,0 +1,67 @@
+// device metrics: what one capture device and its pipeline stages report to the metrics registry
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include "ContinuityTracker.h"
+#include "MetricsRegistry.h"
+
+class FramePool;
+class RawRecorder;
+class VideoEncoder;
+class StillWriterPool;
+class FramePublisher;
+class ClockDriftTracker;
+class ProcessingPipeline;
+
+// The callback and the stages update their metrics directly, with relaxed atomics; what the stages
+// already count for their own statistics is copied in by collect() on the export thread instead
+class DeviceMetrics
+{
+public:
+	explicit DeviceMetrics(unsigned deviceIndex);
+
+	void	frameCaptured() { m_framesCaptured->add(); }
+
+	// stage is the pool or one of the stages after it
+	void	frameDropped(SaturatedStage stage) { m_framesDropped[stage]->add(); }
+	void	setSignalLocked(bool locked) { m_signalLocked->set(locked ? 1.0 : 0.0); }
+
+	// for the stages to time their v210 unpacking into, in seconds
+	MetricHistogram*	videoDecodeTime() { return m_videoDecodeTime; }
+	MetricHistogram*	stillsDecodeTime() { return m_stillsDecodeTime; }
+
+	// reads the stages' statistics; any of them may be nullptr
+	void	collect(FramePool* pool, RawRecorder* recorder, VideoEncoder* encoder, StillWriterPool* stills, FramePublisher* publisher, ContinuityTracker* continuity,
+				ClockDriftTracker* clocks, ProcessingPipeline* processing);
+
+private:
+	MetricCounter*		m_framesCaptured;
+	MetricCounter*		m_framesDropped[kSaturatedStageCount];
+	MetricGauge*		m_signalLocked;
+	MetricGauge*		m_captureFps;
+	MetricGauge*		m_queueDepth[kSaturatedStageCount];
+	MetricGauge*		m_poolBuffers;
+	MetricGauge*		m_poolBuffersInUse;
+	MetricCounter*		m_bytesWritten;
+	MetricGauge*		m_writeMBps;
+	MetricGauge*		m_writesInFlight;
+	MetricCounter*		m_writeErrors;
+	MetricCounter*		m_repeatRecords;
+	MetricCounter*		m_framesMissing[kEyeCount];
+	MetricCounter*		m_framesRepeated[kEyeCount];
+	MetricCounter*		m_discontinuities[kEyeCount];
+	MetricGauge*		m_cardDrift;
+	MetricGauge*		m_streamDrift[kEyeCount];
+	MetricGauge*		m_eyeDrift;
+	MetricGauge*		m_eyeOffset;
+	MetricGauge*		m_arrivalJitter[kEyeCount];
+	MetricCounter*		m_cadenceEvents;
+	MetricHistogram*	m_videoDecodeTime;
+	MetricHistogram*	m_stillsDecodeTime;
+
+	// the export thread's, for turning counts into rates
+	std::chrono::steady_clock::time_point	m_lastCollect;
+	uint64_t			m_lastFramesCaptured;
+	uint64_t			m_lastBytesWritten;
+};
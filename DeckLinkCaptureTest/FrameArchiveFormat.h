@@ -0,0 +1,164 @@
+// on-disk layout of the frame archives written by RawRecorder and read by FrameArchive
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Frame archive layout (all integers little endian, every block starts on a 4096 byte page)
+//
+//   [file header page]
+//   [frame record][frame record]...[index checkpoint][frame record]...[index checkpoint]...[final index]
+//
+// File header (RecordingFileHeader, padded to one page)
+//   Describes the video format and the fixed stride of a frame record. It is rewritten after
+//   every index checkpoint, and once more on close to point at the final index.
+//
+// Frame record (recordBytes, at most recordStride bytes)
+//   A FrameRecordHeader padded to one page, then one payload per eye (left, then right), each
+//   padded to a page. Payloads are the untouched bytes the SDK delivered, so for
+//   bmdFormat10BitYUV a payload is height rows of rowBytes bytes of v210.
+//
+// Compressed payloads (RecordingFileHeader::compression other than kArchiveCompressionNone)
+//   Each eye is cut into stripes of whole rows that are compressed independently, so that
+//   both compression and decompression can run one stripe per thread. A stored payload is
+//   a StripeTableHeader, stripeCount StripeEntry structs, then the stripes back to back.
+//   A stripe that did not shrink is stored raw (storedBytes == rawBytes). The stored size of
+//   each eye is in FrameRecordHeader::storedBytes, so records vary in size. Compression can be
+//   switched on and off while recording; records written while it was off carry
+//   kFrameRecordStoredRaw and hold untouched payloads, as in an uncompressed archive.
+//
+// Repeat records (kFrameRecordRepeat)
+//   A frame whose picture had not changed since an earlier record, the reference, may be stored
+//   as its header page alone. It keeps its own frame number and times, and its referenceOffset
+//   and referenceFrame name the record whose payloads stand in for its own. A reference is
+//   always a full record, and comes before every repeat of it.
+//
+// Index block (index checkpoints and the final index)
+//   An IndexRecordHeader padded to one page, then entryCount ArchiveIndexEntry structs,
+//   padded to a page. Entries are in file order, so frame numbers, stream times and hardware
+//   times all increase, and any of them can be binary searched.
+//   - A checkpoint is written every kIndexCheckpointFrames frames. It holds the entries since
+//     the previous checkpoint and links back to it, and RecordingFileHeader::lastCheckpoint
+//     points at the newest one. After a crash the chain gives the index of everything up to
+//     the last checkpoint; the few records after it are found by walking recordBytes.
+//   - The final index is written on close and holds every entry. RecordingFileHeader::indexOffset
+//     points at it; zero means the recording was not closed cleanly.
+
+const size_t	kArchivePageBytes = 4096;
+const size_t	kRecordHeaderBytes = kArchivePageBytes;
+const char		kRecordingMagic[8] = { 'D', 'L', 'K', 'R', 'A', 'W', '0', '1' };
+const uint32_t	kRecordingVersion = 5;				// 3 added compression, 4 raw records in compressed files, 5 repeat records; version 2 files read as uncompressed
+const uint32_t	kRecordingMinVersion = 2;
+const uint32_t	kFrameRecordMagic = 0x4D415246;		// "FRAM"
+const uint32_t	kIndexRecordMagic = 0x58444E49;		// "INDX"
+const uint32_t	kStripeTableMagic = 0x50525453;		// "STRP"
+const unsigned	kArchiveMaxEyes = 2;
+
+// pixel formats we store, with the same values as the SDK's BMDPixelFormat
+const uint32_t	kArchivePixelFormatV210 = 0x76323130;	// bmdFormat10BitYUV
+const uint32_t	kArchivePixelFormatUYVY = 0x32767579;	// bmdFormat8BitYUV
+
+// payload compression codecs
+const uint32_t	kArchiveCompressionNone = 0;
+const uint32_t	kArchiveCompressionLZ4 = 1;
+const uint32_t	kArchiveCompressionZstd = 2;
+
+struct RecordingFileHeader
+{
+	char		magic[8];			// kRecordingMagic
+	uint32_t	version;			// kRecordingVersion
+	uint32_t	headerBytes;		// kRecordHeaderBytes
+	uint32_t	pixelFormat;		// BMDPixelFormat of the payloads
+	int32_t		width;
+	int32_t		height;
+	int32_t		rowBytes;
+	uint32_t	eyeCount;			// 1 for mono, 2 for dual-stream 3D
+	uint32_t	compression;		// kArchiveCompression...
+	int64_t		timeScale;			// units of the stream times in the frame headers
+	uint64_t	payloadBytes;		// bytes of one eye, before padding
+	uint64_t	recordStride;		// bytes of the largest possible frame record
+	uint64_t	indexOffset;		// final index block, or 0 while recording
+	uint64_t	lastCheckpoint;		// newest index checkpoint, or 0 if none yet
+	uint64_t	frameCount;			// frames covered by indexOffset / lastCheckpoint
+};
+
+struct FrameRecordHeader
+{
+	uint32_t	magic;				// kFrameRecordMagic
+	uint32_t	eyeCount;
+	uint64_t	frameNumber;
+	int64_t		streamTime;			// in RecordingFileHeader::timeScale units
+	int64_t		streamDuration;
+	int64_t		hardwareTime;		// microseconds
+	uint32_t	flags;				// BMDFrameFlags
+	uint32_t	recordFlags;		// kFrameRecord...
+	uint64_t	payloadBytes;		// bytes of one eye, before padding
+	uint64_t	recordBytes;		// bytes of the whole record, header page included
+	uint64_t	storedBytes[kArchiveMaxEyes];		// bytes of each eye as stored, before padding; payloadBytes when uncompressed
+	uint64_t	referenceOffset;	// of the record holding the payloads, for a repeat record
+	uint64_t	referenceFrame;		// its frame number
+};
+
+// frame record flags
+const uint32_t	kFrameRecordStoredRaw = 1 << 0;		// payloads are uncompressed although the archive is not
+const uint32_t	kFrameRecordRepeat = 1 << 1;		// no payloads; those of the reference record stand in for them
+
+struct StripeTableHeader
+{
+	uint32_t	magic;				// kStripeTableMagic
+	uint32_t	stripeCount;
+	uint64_t	rawBytes;			// of the whole eye
+};
+
+struct StripeEntry
+{
+	uint64_t	rawOffset;			// in the decompressed payload
+	uint64_t	storedOffset;		// from the start of the stored payload
+	uint32_t	rawBytes;
+	uint32_t	storedBytes;		// equal to rawBytes if the stripe is stored uncompressed
+};
+
+struct IndexRecordHeader
+{
+	uint32_t	magic;				// kIndexRecordMagic
+	uint32_t	isFinal;			// 1 for the final index, 0 for a checkpoint
+	uint64_t	entryCount;
+	uint64_t	previousCheckpoint;	// offset of the previous checkpoint, or 0
+	uint64_t	recordBytes;		// bytes of the whole block, header page included
+};
+
+// index entry flags
+const uint32_t	kIndexEntryWriteFailed = 1 << 0;	// the record was allocated but never completely written
+const uint32_t	kIndexEntryRepeat = 1 << 1;			// a repeat record
+
+struct ArchiveIndexEntry
+{
+	uint64_t	frameNumber;
+	int64_t		streamTime;
+	int64_t		hardwareTime;
+	uint64_t	offset;				// of the frame record
+	uint32_t	recordBytes;
+	uint32_t	flags;				// kIndexEntry...
+};
+
+static_assert(sizeof(RecordingFileHeader) <= kRecordHeaderBytes, "file header must fit its page");
+static_assert(sizeof(FrameRecordHeader) <= kRecordHeaderBytes, "frame header must fit its page");
+static_assert(sizeof(IndexRecordHeader) <= kRecordHeaderBytes, "index header must fit its page");
+static_assert(sizeof(ArchiveIndexEntry) == 40, "index entries are part of the file format");
+static_assert(sizeof(StripeEntry) == 24, "stripe entries are part of the file format");
+
+inline uint64_t alignToPage(uint64_t bytes)
+{
+	return (bytes + kArchivePageBytes - 1) & ~(uint64_t)(kArchivePageBytes - 1);
+}
+
+inline bool isPayloadCompressed(const RecordingFileHeader& fileHeader, const FrameRecordHeader& frameHeader)
+{
+	return fileHeader.compression != kArchiveCompressionNone && !(frameHeader.recordFlags & kFrameRecordStoredRaw);
+}
+
+// bytes of one eye as it sits in the file, before padding
+inline uint64_t storedPayloadBytes(const RecordingFileHeader& fileHeader, const FrameRecordHeader& frameHeader, unsigned eye)
+{
+	return isPayloadCompressed(fileHeader, frameHeader) ? frameHeader.storedBytes[eye] : frameHeader.payloadBytes;
+}
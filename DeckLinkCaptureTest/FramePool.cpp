@@ -0,0 +1,202 @@
+// preallocated pool of aligned frame buffers shared by the capture pipeline stages
+#include "FramePool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef HAVE_MEMFD
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static uint8_t* allocateAligned(size_t size)
+{
+#ifdef _WIN32
+	return (uint8_t*)_aligned_malloc(size, kFramePoolAlignment);
+#else
+	void* data = nullptr;
+	if (posix_memalign(&data, kFramePoolAlignment, size) != 0)
+		return nullptr;
+	return (uint8_t*)data;
+#endif
+}
+
+static void freeAligned(uint8_t* data)
+{
+#ifdef _WIN32
+	_aligned_free(data);
+#else
+	free(data);
+#endif
+}
+
+#ifdef HAVE_MEMFD
+// A memfd the size of one buffer, mapped for us to write. The seals stop whoever it is passed to
+// from resizing it, which would fault our own mapping. Where the kernel has F_SEAL_FUTURE_WRITE
+// (5.1) the memfd is also sealed against new writable mappings and writes, and is shared itself;
+// elsewhere the shared descriptor is a read-only reopening of it, and the memfd is closed once
+// mapped, so no writable descriptor ever leaves the pool
+static uint8_t* allocateShared(size_t size, int* sharedFd)
+{
+	const int fd = memfd_create("DeckLinkFrame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return nullptr;
+
+	void* data = MAP_FAILED;
+	if (ftruncate(fd, (off_t)size) == 0)
+		data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		close(fd);
+		return nullptr;
+	}
+
+	bool sealed = false;
+#ifdef F_SEAL_FUTURE_WRITE
+	sealed = (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) == 0);
+#endif
+	if (sealed)
+	{
+		*sharedFd = fd;
+		return (uint8_t*)data;
+	}
+
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	const int readOnlyFd = open(path, O_RDONLY | O_CLOEXEC);
+	if (readOnlyFd < 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+	{
+		if (readOnlyFd >= 0)
+			close(readOnlyFd);
+		munmap(data, size);
+		close(fd);
+		return nullptr;
+	}
+
+	close(fd);
+	*sharedFd = readOnlyFd;
+	return (uint8_t*)data;
+}
+
+static void freeShared(uint8_t* data, size_t size, int sharedFd)
+{
+	munmap(data, size);
+	close(sharedFd);
+}
+#endif
+
+/* FrameBuffer class */
+
+FrameBuffer::FrameBuffer(FramePool* pool, uint8_t* data, size_t capacity, unsigned index, int sharedFd) :
+	m_pool(pool), m_data(data), m_capacity(capacity), m_size(0), m_index(index), m_sharedFd(sharedFd), m_refCount(0)
+{
+}
+
+uint32_t FrameBuffer::AddRef()
+{
+	return ++m_refCount;
+}
+
+uint32_t FrameBuffer::Release()
+{
+	uint32_t newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		m_pool->recycle(this);
+
+	return newRefValue;
+}
+
+/* FramePool class */
+
+// Constructor allocates every buffer up front so that nothing is allocated while capturing
+FramePool::FramePool(size_t bufferSize, unsigned bufferCount, bool shareable) :
+	m_bufferSize((bufferSize + kFramePoolAlignment - 1) & ~(kFramePoolAlignment - 1)),
+	m_shareable(false)
+{
+	m_buffers.reserve(bufferCount);
+	m_freeList.reserve(bufferCount);
+
+#ifdef HAVE_MEMFD
+	// all or nothing, so a shareable pool never hands out a buffer that cannot be shared
+	m_shareable = shareable;
+	for (unsigned bufferIdx = 0; m_shareable && bufferIdx < bufferCount; bufferIdx++)
+	{
+		int sharedFd = -1;
+		uint8_t* data = allocateShared(m_bufferSize, &sharedFd);
+		if (data == nullptr)
+		{
+			fprintf(stderr, "Could not create shareable frame pool buffer %u of %u, using private memory\n", bufferIdx, bufferCount);
+			for (FrameBuffer* buffer : m_buffers)
+			{
+				freeShared(buffer->m_data, m_bufferSize, buffer->m_sharedFd);
+				delete buffer;
+			}
+			m_buffers.clear();
+			m_shareable = false;
+			break;
+		}
+		m_buffers.push_back(new FrameBuffer(this, data, m_bufferSize, bufferIdx, sharedFd));
+	}
+	if (m_shareable)
+	{
+		m_freeList = m_buffers;
+		return;
+	}
+#endif
+
+	for (unsigned bufferIdx = 0; bufferIdx < bufferCount; bufferIdx++)
+	{
+		uint8_t* data = allocateAligned(m_bufferSize);
+		if (data == nullptr)
+		{
+			fprintf(stderr, "Could not allocate frame pool buffer %u of %u\n", bufferIdx, bufferCount);
+			break;
+		}
+
+		FrameBuffer* buffer = new FrameBuffer(this, data, m_bufferSize, bufferIdx, -1);
+		m_buffers.push_back(buffer);
+		m_freeList.push_back(buffer);
+	}
+}
+
+FramePool::~FramePool()
+{
+	for (FrameBuffer* buffer : m_buffers)
+	{
+#ifdef HAVE_MEMFD
+		if (buffer->m_sharedFd >= 0)
+			freeShared(buffer->m_data, m_bufferSize, buffer->m_sharedFd);
+#endif
+		if (buffer->m_sharedFd < 0)
+			freeAligned(buffer->m_data);
+		delete buffer;
+	}
+}
+
+FrameBuffer* FramePool::acquire()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	if (m_freeList.empty())
+		return nullptr;
+
+	FrameBuffer* buffer = m_freeList.back();
+	m_freeList.pop_back();
+
+	buffer->m_size = 0;
+	buffer->m_refCount = 1;
+	return buffer;
+}
+
+unsigned FramePool::available()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	return (unsigned)m_freeList.size();
+}
+
+void FramePool::recycle(FrameBuffer* buffer)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_freeList.push_back(buffer);
+}
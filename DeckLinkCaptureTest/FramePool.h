@@ -0,0 +1,85 @@
+// preallocated pool of aligned frame buffers shared by the capture pipeline stages
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// alignment of every pooled buffer; a full page keeps buffers usable for unbuffered/direct file I/O
+const size_t kFramePoolAlignment = 4096;
+
+// Linux can back buffers with memfds, whose descriptors can be handed to other processes
+#if defined(__linux__)
+#define HAVE_MEMFD 1
+#endif
+
+class FramePool;
+
+// One pooled buffer. Reference counted in the same way as the SDK frame objects:
+// the pool hands it out with a count of one, and the final Release() returns it to the pool
+class FrameBuffer
+{
+public:
+	uint8_t*	GetBytes() { return m_data; }
+	size_t		GetCapacity() const { return m_capacity; }
+	size_t		GetSize() const { return m_size; }
+	void		SetSize(size_t size) { m_size = size; }
+	unsigned	GetIndex() const { return m_index; }
+
+	// read-only descriptor of the memfd holding the buffer when the pool is shareable, otherwise -1
+	int			GetSharedFd() const { return m_sharedFd; }
+
+	uint32_t	AddRef();
+	uint32_t	Release();
+
+private:
+	friend class FramePool;
+
+	FrameBuffer(FramePool* pool, uint8_t* data, size_t capacity, unsigned index, int sharedFd);
+
+	FramePool*				m_pool;
+	uint8_t*				m_data;
+	size_t					m_capacity;
+	size_t					m_size;
+	unsigned				m_index;
+	int						m_sharedFd;
+	std::atomic<uint32_t>	m_refCount;
+};
+
+class FramePool
+{
+public:
+	// A shareable pool puts every buffer in its own sealed memfd, so FrameServer can pass
+	// buffers to other processes without copying them. Where memfds are not available, or
+	// cannot be created, the buffers are ordinary memory and isShareable() says so
+	FramePool(size_t bufferSize, unsigned bufferCount, bool shareable = false);
+	~FramePool();
+
+	// returns nullptr when every buffer is in use; never blocks, so it is safe on the SDK callback thread
+	FrameBuffer*	acquire();
+
+	unsigned		capacity() const { return (unsigned)m_buffers.size(); }
+	unsigned		available();
+	size_t			bufferSize() const { return m_bufferSize; }
+	bool			isShareable() const { return m_shareable; }
+	FrameBuffer*	buffer(unsigned index) { return m_buffers[index]; }
+
+private:
+	friend class FrameBuffer;
+
+	void			recycle(FrameBuffer* buffer);
+
+	size_t						m_bufferSize;
+	bool						m_shareable;
+	std::vector<FrameBuffer*>	m_buffers;
+	std::vector<FrameBuffer*>	m_freeList;
+	std::mutex					m_mutex;
+};
+
+// Row bytes of a v210 (bmdFormat10BitYUV) frame: 6 pixels per 16 bytes, rows padded to 128 bytes
+inline long rowBytesForV210(long width)
+{
+	return ((width + 47) / 48) * 128;
+}
@@ -0,0 +1,270 @@
+// frame publication: copies captured frames into a shared-memory ring that other local processes read
+#include "FramePublisher.h"
+#include "LatencyTracker.h"
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// how often the publisher prints its statistics while publishing
+static const std::chrono::seconds kStatsInterval(10);
+
+FramePublisher::FramePublisher(unsigned queueDepth) :
+	m_queue(queueDepth),
+	m_running(false),
+	m_data(nullptr),
+	m_size(0),
+	m_header(nullptr),
+#ifdef _WIN32
+	m_mapping(NULL),
+#else
+	m_file(-1),
+#endif
+	m_framesPublished(0),
+	m_copyTotalUs(0),
+	m_copyMaxUs(0),
+	m_lagTotalUs(0),
+	m_lagLastUs(0)
+{
+}
+
+FramePublisher::~FramePublisher()
+{
+	close();
+}
+
+bool FramePublisher::open(const std::string& name, const CaptureFrame& format, unsigned slotCount)
+{
+	if (m_running || slotCount == 0 || format.eyeCount() > kSharedRingMaxEyes)
+		return false;
+
+	const uint64_t payloadBytes = (uint64_t)format.rowBytes * format.height;
+	const uint64_t slotStride = kSharedRingPageBytes + format.eyeCount() * alignToSharedRingPage(payloadBytes);
+
+	m_objectName = sharedRingObjectName(name);
+	m_size = kSharedRingHeaderBytes + slotCount * slotStride;
+
+#ifdef _WIN32
+	// the section goes away with its last handle or view, so a stale one cannot be left behind
+	m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)(m_size >> 32), (DWORD)m_size, m_objectName.c_str());
+	if (m_mapping == NULL)
+	{
+		fprintf(stderr, "Could not create shared memory %s - error = %lu\n", m_objectName.c_str(), GetLastError());
+		goto bail;
+	}
+	if (GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		// another publisher, or readers still holding on to one that has gone
+		fprintf(stderr, "Shared memory %s is still open elsewhere\n", m_objectName.c_str());
+		goto bail;
+	}
+	m_data = (uint8_t*)MapViewOfFile((HANDLE)m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (m_data == nullptr)
+		goto bail;
+#else
+	// a publisher that crashed leaves its object behind; readers still attached to it keep their mapping
+	shm_unlink(m_objectName.c_str());
+	m_file = shm_open(m_objectName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (m_file < 0 || ftruncate(m_file, (off_t)m_size) != 0)
+	{
+		fprintf(stderr, "Could not create shared memory %s\n", m_objectName.c_str());
+		goto bail;
+	}
+	m_data = (uint8_t*)mmap(nullptr, (size_t)m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+	if (m_data == MAP_FAILED)
+	{
+		m_data = nullptr;
+		goto bail;
+	}
+#endif
+
+	// fresh pages are zero, so every slot starts out with generation 0: never written
+	m_header = new (m_data) SharedRingHeader();
+	m_header->version = kSharedRingVersion;
+	m_header->headerBytes = (uint32_t)kSharedRingHeaderBytes;
+	m_header->slotCount = slotCount;
+	m_header->eyeCount = format.eyeCount();
+	m_header->pixelFormat = format.pixelFormat;
+	m_header->width = format.width;
+	m_header->height = format.height;
+	m_header->rowBytes = format.rowBytes;
+	m_header->timeScale = format.timeScale;
+	m_header->payloadBytes = payloadBytes;
+	m_header->slotStride = slotStride;
+	m_header->deviceIndex = format.deviceIndex;
+	m_header->framesPublished.store(0);
+	m_header->publishing.store(1);
+	for (unsigned slotIdx = 0; slotIdx < slotCount; slotIdx++)
+		new (m_data + kSharedRingHeaderBytes + slotIdx * slotStride) SharedSlotHeader();
+
+	// readers do not look any further until they see the magic
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(m_header->magic, kSharedRingMagic, sizeof(kSharedRingMagic));
+
+	m_framesPublished = 0;
+	m_copyTotalUs = 0;
+	m_copyMaxUs = 0;
+	m_lagTotalUs = 0;
+	m_lagLastUs = 0;
+
+	printf("Publishing device #%u as %s, %u slots of %.1f MB\n", format.deviceIndex, m_objectName.c_str(), slotCount, slotStride / 1e6);
+
+	m_running = true;
+	m_publisher = std::thread(&FramePublisher::publisherThread, this);
+	return true;
+
+bail:
+	unmap();
+	return false;
+}
+
+bool FramePublisher::submit(const CaptureFrame& frame)
+{
+	if (m_running && m_queue.tryPush(frame))
+		return true;
+
+	CaptureFrame dropped = frame;
+	dropped.release();
+	return false;
+}
+
+void FramePublisher::close()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	m_queue.close();
+	if (m_publisher.joinable())
+		m_publisher.join();
+
+	m_header->publishing.store(0, std::memory_order_release);
+	printStats();
+	unmap();
+}
+
+PublisherStats FramePublisher::stats()
+{
+	PublisherStats stats = {};
+	const uint64_t framesPublished = m_framesPublished;
+
+	stats.framesPublished = framesPublished;
+	stats.framesDropped = m_queue.dropCount();
+	stats.queueDepth = m_queue.depth();
+	stats.meanCopyMs = framesPublished ? (m_copyTotalUs / 1000.0) / framesPublished : 0.0;
+	stats.maxCopyMs = m_copyMaxUs / 1000.0;
+	stats.lastLagMs = m_lagLastUs / 1000.0;
+	stats.meanLagMs = framesPublished ? (m_lagTotalUs / 1000.0) / framesPublished : 0.0;
+	return stats;
+}
+
+void FramePublisher::publisherThread()
+{
+	TraceRecorder::nameThread("publisher");
+	std::chrono::steady_clock::time_point lastStats = std::chrono::steady_clock::now();
+	CaptureFrame frame;
+
+	// keep going after close() until the queue has been drained
+	while (m_running || m_queue.depth() > 0)
+	{
+		if (m_queue.pop(frame, std::chrono::milliseconds(100)))
+		{
+			publishFrame(frame);
+			frame.release();
+		}
+
+		if (std::chrono::steady_clock::now() - lastStats >= kStatsInterval)
+		{
+			printStats();
+			lastStats = std::chrono::steady_clock::now();
+		}
+	}
+}
+
+void FramePublisher::publishFrame(const CaptureFrame& frame)
+{
+	TraceSpan publishSpan("publish", frame.frameNumber);
+	const int64_t startUs = steadyClockMicroseconds();
+	const uint64_t sequence = m_header->framesPublished.load(std::memory_order_relaxed);
+	uint8_t* slot = m_data + kSharedRingHeaderBytes + (sequence % m_header->slotCount) * m_header->slotStride;
+	SharedSlotHeader* slotHeader = (SharedSlotHeader*)slot;
+	const size_t payloadBytes = (size_t)frame.rowBytes * frame.height;
+
+	// odd: a reader that started on the frame this slot held before will find its read torn
+	slotHeader->generation.store(sharedSlotGeneration(sequence, false), std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (unsigned eyeIdx = 0; eyeIdx < m_header->eyeCount; eyeIdx++)
+	{
+		uint8_t* payload = slot + kSharedRingPageBytes + eyeIdx * alignToSharedRingPage(m_header->payloadBytes);
+		if (eyeIdx < frame.eyeCount() && payloadBytes <= m_header->payloadBytes)
+			memcpy(payload, frame.eye[eyeIdx]->GetBytes(), payloadBytes);
+	}
+
+	const int64_t doneUs = steadyClockMicroseconds();
+	slotHeader->sequence = sequence;
+	slotHeader->frameNumber = frame.frameNumber;
+	slotHeader->streamTime = frame.streamTime;
+	slotHeader->streamDuration = frame.streamDuration;
+	slotHeader->hardwareTime = frame.hardwareTime;
+	slotHeader->publishTime = doneUs;
+	slotHeader->flags = frame.flags;
+
+	// complete, then counted; a reader that sees the count also sees the slot
+	slotHeader->generation.store(sharedSlotGeneration(sequence, true), std::memory_order_release);
+	m_header->framesPublished.store(sequence + 1, std::memory_order_release);
+	recordLatency(frame, kLatencyPublished);
+
+	const uint64_t copyUs = (uint64_t)(doneUs - startUs);
+	m_copyTotalUs += copyUs;
+	if (copyUs > m_copyMaxUs)
+		m_copyMaxUs = copyUs;
+	if (frame.arrivalTime != 0)
+	{
+		const uint64_t lagUs = (uint64_t)(doneUs - frame.arrivalTime);
+		m_lagLastUs = lagUs;
+		m_lagTotalUs += lagUs;
+	}
+	++m_framesPublished;
+}
+
+void FramePublisher::unmap()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != NULL)
+		CloseHandle((HANDLE)m_mapping);
+	m_mapping = NULL;
+#else
+	if (m_data)
+		munmap(m_data, (size_t)m_size);
+	if (m_file >= 0)
+	{
+		::close(m_file);
+		shm_unlink(m_objectName.c_str());
+	}
+	m_file = -1;
+#endif
+	m_data = nullptr;
+	m_header = nullptr;
+}
+
+void FramePublisher::printStats()
+{
+	PublisherStats current = stats();
+	printf("Publisher: %llu frames published, %llu dropped, queue %u, copy mean %.2f / max %.2f ms, lag last %.1f / mean %.1f ms\n",
+		(unsigned long long)current.framesPublished, (unsigned long long)current.framesDropped, current.queueDepth,
+		current.meanCopyMs, current.maxCopyMs, current.lastLagMs, current.meanLagMs);
+}
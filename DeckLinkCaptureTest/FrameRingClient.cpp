@@ -0,0 +1,240 @@
+// frame ring client: zero-copy access to the frames a FramePublisher places in shared memory, from another process
+#include "FrameRingClient.h"
+#include "FrameArchiveFormat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// how often nextFrame() looks for a new frame while it waits
+static const std::chrono::microseconds kPollInterval(500);
+
+FrameRingClient::FrameRingClient() :
+	m_data(nullptr),
+	m_size(0),
+	m_header(nullptr),
+	m_nextSequence(0),
+	m_framesMissed(0),
+	m_framesTorn(0),
+#ifdef _WIN32
+	m_mapping(NULL)
+#else
+	m_file(-1)
+#endif
+{
+}
+
+FrameRingClient::~FrameRingClient()
+{
+	detach();
+}
+
+bool FrameRingClient::attach(const std::string& name)
+{
+	const std::string objectName = sharedRingObjectName(name);
+	const SharedRingHeader* header = nullptr;
+
+	detach();
+
+#ifdef _WIN32
+	MEMORY_BASIC_INFORMATION region;
+	m_mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, objectName.c_str());
+	if (m_mapping == NULL)
+	{
+		fprintf(stderr, "Could not open shared memory %s - error = %lu\n", objectName.c_str(), GetLastError());
+		goto bail;
+	}
+	m_data = (const uint8_t*)MapViewOfFile((HANDLE)m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_data == nullptr || VirtualQuery(m_data, &region, sizeof(region)) == 0)
+		goto bail;
+	m_size = (uint64_t)region.RegionSize;
+#else
+	struct stat fileStat;
+	m_file = shm_open(objectName.c_str(), O_RDONLY, 0);
+	if (m_file < 0 || fstat(m_file, &fileStat) != 0)
+	{
+		fprintf(stderr, "Could not open shared memory %s\n", objectName.c_str());
+		goto bail;
+	}
+	m_size = (uint64_t)fileStat.st_size;
+	if (m_size < kSharedRingHeaderBytes)
+		goto bail;
+
+	m_data = (const uint8_t*)mmap(nullptr, (size_t)m_size, PROT_READ, MAP_SHARED, m_file, 0);
+	if (m_data == MAP_FAILED)
+	{
+		m_data = nullptr;
+		goto bail;
+	}
+#endif
+
+	header = (const SharedRingHeader*)m_data;
+	if (memcmp(header->magic, kSharedRingMagic, sizeof(kSharedRingMagic)) != 0 || header->version != kSharedRingVersion)
+	{
+		fprintf(stderr, "Shared memory %s is not a frame ring we can read\n", objectName.c_str());
+		goto bail;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (header->eyeCount == 0 || header->eyeCount > kSharedRingMaxEyes || header->slotCount == 0 ||
+		header->slotStride < kSharedRingPageBytes + header->eyeCount * alignToSharedRingPage(header->payloadBytes) ||
+		kSharedRingHeaderBytes + header->slotCount * header->slotStride > m_size)
+	{
+		fprintf(stderr, "Shared memory %s has a damaged ring header\n", objectName.c_str());
+		goto bail;
+	}
+
+	m_header = header;
+	m_nextSequence = m_header->framesPublished.load(std::memory_order_acquire);
+	m_framesMissed = 0;
+	m_framesTorn = 0;
+	return true;
+
+bail:
+	detach();
+	return false;
+}
+
+void FrameRingClient::detach()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != NULL)
+		CloseHandle((HANDLE)m_mapping);
+	m_mapping = NULL;
+#else
+	if (m_data)
+		munmap((void*)m_data, (size_t)m_size);
+	if (m_file >= 0)
+		::close(m_file);
+	m_file = -1;
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_header = nullptr;
+}
+
+bool FrameRingClient::isPublishing() const
+{
+	return m_header != nullptr && m_header->publishing.load(std::memory_order_acquire) != 0;
+}
+
+bool FrameRingClient::latestFrame(SharedFrameView& view)
+{
+	if (m_header == nullptr)
+		return false;
+
+	// the newest frame can be overtaken while we look at it, but only by an even newer one
+	for (;;)
+	{
+		const uint64_t published = m_header->framesPublished.load(std::memory_order_acquire);
+		if (published == 0)
+			return false;
+		if (takeView(published - 1, view))
+		{
+			m_nextSequence = published;
+			return true;
+		}
+	}
+}
+
+bool FrameRingClient::nextFrame(SharedFrameView& view, unsigned timeoutMs)
+{
+	const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+
+	if (m_header == nullptr)
+		return false;
+
+	for (;;)
+	{
+		const uint64_t published = m_header->framesPublished.load(std::memory_order_acquire);
+		if (published > m_nextSequence)
+		{
+			// the slot after the newest is the oldest one left, and the next to be overwritten;
+			// start from the newest so there is a whole ring's time to read it
+			if (published - m_nextSequence >= m_header->slotCount)
+			{
+				m_framesMissed += published - 1 - m_nextSequence;
+				m_nextSequence = published - 1;
+			}
+
+			if (takeView(m_nextSequence, view))
+			{
+				m_nextSequence++;
+				return true;
+			}
+
+			// overwritten before we got there
+			m_framesMissed++;
+			m_nextSequence++;
+			continue;
+		}
+
+		if (!isPublishing() || std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(kPollInterval);
+	}
+}
+
+bool FrameRingClient::isIntact(const SharedFrameView& view) const
+{
+	const uint8_t* slot = m_data + kSharedRingHeaderBytes + (view.sequence % m_header->slotCount) * m_header->slotStride;
+	const SharedSlotHeader* slotHeader = (const SharedSlotHeader*)slot;
+
+	// whatever was read from the images has to be done before the generation is looked at again
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slotHeader->generation.load(std::memory_order_relaxed) == view.generation)
+		return true;
+
+	m_framesTorn++;
+	return false;
+}
+
+bool FrameRingClient::takeView(uint64_t sequence, SharedFrameView& view)
+{
+	const uint8_t* slot = m_data + kSharedRingHeaderBytes + (sequence % m_header->slotCount) * m_header->slotStride;
+	const SharedSlotHeader* slotHeader = (const SharedSlotHeader*)slot;
+	const uint64_t generation = slotHeader->generation.load(std::memory_order_acquire);
+
+	if (generation != sharedSlotGeneration(sequence, true))
+		return false;
+
+	view.sequence = sequence;
+	view.generation = generation;
+	view.frameNumber = slotHeader->frameNumber;
+	view.streamTime = slotHeader->streamTime;
+	view.streamDuration = slotHeader->streamDuration;
+	view.hardwareTime = slotHeader->hardwareTime;
+	view.publishTime = slotHeader->publishTime;
+	view.flags = slotHeader->flags;
+	view.eyeCount = m_header->eyeCount;
+	for (unsigned eyeIdx = 0; eyeIdx < kSharedRingMaxEyes; eyeIdx++)
+	{
+		if (eyeIdx < m_header->eyeCount)
+			view.eye[eyeIdx] = wrapPayload(slot + kSharedRingPageBytes + eyeIdx * alignToSharedRingPage(m_header->payloadBytes));
+		else
+			view.eye[eyeIdx] = cv::Mat();
+	}
+
+	// the header fields above are only good if the slot was not rewritten while we copied them
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slotHeader->generation.load(std::memory_order_relaxed) == generation;
+}
+
+cv::Mat FrameRingClient::wrapPayload(const uint8_t* bytes) const
+{
+	if (m_header->pixelFormat == kArchivePixelFormatUYVY)
+		return cv::Mat(m_header->height, m_header->width, CV_8UC2, (void*)bytes, (size_t)m_header->rowBytes);
+
+	return cv::Mat(m_header->height, m_header->rowBytes, CV_8UC1, (void*)bytes, (size_t)m_header->rowBytes);
+}
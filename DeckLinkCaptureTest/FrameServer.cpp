@@ -0,0 +1,481 @@
+// frame server: lends captured frames to local processes by passing their memfd-backed pool buffers over a Unix domain socket
+#include "FrameServer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#ifdef HAVE_MEMFD
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// how often the server thread looks at lease times when nothing else wakes it
+static const int kPollTimeoutMs = 100;
+
+// how often the server prints its statistics while clients are connected
+static const std::chrono::seconds kStatsInterval(10);
+
+// connections waiting to be accepted
+static const int kListenBacklog = 8;
+
+FrameServer::FrameServer(unsigned maxLeasesPerClient, unsigned maxLeasesTotal, unsigned leaseMilliseconds) :
+	m_maxLeasesPerClient(maxLeasesPerClient),
+	m_maxLeasesTotal(maxLeasesTotal),
+	m_leaseMilliseconds(leaseMilliseconds),
+	m_listenSocket(-1),
+	m_wakeFd(-1),
+	m_running(false),
+	m_newest(),
+	m_nextLeaseId(1),
+	m_clientsConnected(0),
+	m_clientsAccepted(0),
+	m_framesLeased(0),
+	m_framesReturned(0),
+	m_leasesRevoked(0),
+	m_grabsRefused(0),
+	m_leasesHeld(0)
+{
+}
+
+FrameServer::~FrameServer()
+{
+	stop();
+}
+
+FrameServerStats FrameServer::stats()
+{
+	FrameServerStats stats = {};
+
+	stats.clientsConnected = m_clientsConnected;
+	stats.clientsAccepted = m_clientsAccepted;
+	stats.framesLeased = m_framesLeased;
+	stats.framesReturned = m_framesReturned;
+	stats.leasesRevoked = m_leasesRevoked;
+	stats.grabsRefused = m_grabsRefused;
+	stats.leasesHeld = m_leasesHeld;
+	return stats;
+}
+
+void FrameServer::printStats()
+{
+	FrameServerStats current = stats();
+	printf("Frame server: %u clients (%llu accepted), %llu frames leased, %llu returned, %llu revoked, %llu grabs over quota, %u held\n",
+		current.clientsConnected, (unsigned long long)current.clientsAccepted, (unsigned long long)current.framesLeased,
+		(unsigned long long)current.framesReturned, (unsigned long long)current.leasesRevoked, (unsigned long long)current.grabsRefused,
+		current.leasesHeld);
+}
+
+#ifdef HAVE_MEMFD
+
+bool FrameServer::isAvailable()
+{
+	return true;
+}
+
+bool FrameServer::start(const std::string& socketPath)
+{
+	struct sockaddr_un address = {};
+
+	if (m_running || socketPath.size() >= sizeof(address.sun_path))
+		return false;
+
+	m_socketPath = socketPath;
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+	// a server that crashed leaves its socket file behind
+	unlink(socketPath.c_str());
+	m_listenSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (m_listenSocket < 0 || bind(m_listenSocket, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(m_listenSocket, kListenBacklog) != 0)
+	{
+		fprintf(stderr, "Could not listen on %s - errno = %d\n", socketPath.c_str(), errno);
+		goto bail;
+	}
+
+	m_wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (m_wakeFd < 0)
+		goto bail;
+
+	m_nextLeaseId = 1;
+	m_clientsConnected = 0;
+	m_clientsAccepted = 0;
+	m_framesLeased = 0;
+	m_framesReturned = 0;
+	m_leasesRevoked = 0;
+	m_grabsRefused = 0;
+	m_leasesHeld = 0;
+
+	printf("Frame server on %s, %u leases per client, %u in all, %u ms each\n", socketPath.c_str(), m_maxLeasesPerClient, m_maxLeasesTotal, m_leaseMilliseconds);
+
+	m_running = true;
+	m_server = std::thread(&FrameServer::serverThread, this);
+	return true;
+
+bail:
+	if (m_listenSocket >= 0)
+	{
+		close(m_listenSocket);
+		unlink(socketPath.c_str());
+	}
+	m_listenSocket = -1;
+	return false;
+}
+
+void FrameServer::submit(const CaptureFrame& frame)
+{
+	CaptureFrame replaced;
+
+	if (!m_running)
+	{
+		replaced = frame;
+		replaced.release();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(m_newestMutex);
+		replaced = m_newest;
+		m_newest = frame;
+	}
+	replaced.release();
+
+	const uint64_t one = 1;
+	if (write(m_wakeFd, &one, sizeof(one)) < 0)
+	{
+		// the counter is already set; the server thread will look
+	}
+}
+
+void FrameServer::stop()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	if (m_server.joinable())
+		m_server.join();
+
+	// the server thread has gone, so the clients are ours
+	for (Client& client : m_clients)
+		disconnect(client);
+	m_clients.clear();
+
+	close(m_listenSocket);
+	unlink(m_socketPath.c_str());
+	close(m_wakeFd);
+	m_listenSocket = -1;
+	m_wakeFd = -1;
+
+	{
+		std::lock_guard<std::mutex> guard(m_newestMutex);
+		m_newest.release();
+	}
+
+	printStats();
+}
+
+void FrameServer::serverThread()
+{
+	std::chrono::steady_clock::time_point lastStats = std::chrono::steady_clock::now();
+	std::vector<struct pollfd> pollFds;
+
+	while (m_running)
+	{
+		// the listening socket, the wake-up counter, then one per client in m_clients order
+		pollFds.clear();
+		pollFds.push_back({ m_listenSocket, POLLIN, 0 });
+		pollFds.push_back({ m_wakeFd, POLLIN, 0 });
+		for (const Client& client : m_clients)
+			pollFds.push_back({ client.socket, POLLIN, 0 });
+
+		if (poll(pollFds.data(), (nfds_t)pollFds.size(), kPollTimeoutMs) < 0 && errno != EINTR)
+			break;
+
+		for (size_t clientIdx = 0; clientIdx < m_clients.size(); clientIdx++)
+		{
+			Client& client = m_clients[clientIdx];
+			const short events = pollFds[2 + clientIdx].revents;
+
+			if ((events & POLLIN) && !handleRequest(client))
+				disconnect(client);
+			else if (events & (POLLHUP | POLLERR | POLLNVAL))
+				disconnect(client);
+		}
+
+		if (pollFds[1].revents & POLLIN)
+		{
+			uint64_t count;
+			if (read(m_wakeFd, &count, sizeof(count)) < 0)
+			{
+				// nothing to read after all
+			}
+		}
+
+		// a new frame, a grab, or both; every waiting client gets the newest frame it has not had
+		for (Client& client : m_clients)
+		{
+			if (client.socket >= 0 && client.waitingForFrame && !sendFrame(client))
+				disconnect(client);
+		}
+
+		// a stuck client gives up everything it holds, and its connection
+		const int64_t nowUs = steadyClockMicroseconds();
+		for (Client& client : m_clients)
+		{
+			for (const Lease& lease : client.leases)
+			{
+				if (client.socket >= 0 && lease.expiresUs <= nowUs)
+				{
+					fprintf(stderr, "Frame server: lease %llu on frame %llu ran out, disconnecting the client\n",
+						(unsigned long long)lease.id, (unsigned long long)lease.frame.frameNumber);
+					disconnect(client);
+					break;
+				}
+			}
+		}
+
+		if (pollFds[0].revents & POLLIN)
+		{
+			const int socket = accept4(m_listenSocket, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (socket >= 0)
+			{
+				m_clients.push_back({ socket, false, 0, false, {} });
+				++m_clientsConnected;
+				++m_clientsAccepted;
+			}
+		}
+
+		for (size_t clientIdx = 0; clientIdx < m_clients.size(); )
+		{
+			if (m_clients[clientIdx].socket < 0)
+				m_clients.erase(m_clients.begin() + clientIdx);
+			else
+				clientIdx++;
+		}
+
+		if (std::chrono::steady_clock::now() - lastStats >= kStatsInterval)
+		{
+			if (!m_clients.empty())
+				printStats();
+			lastStats = std::chrono::steady_clock::now();
+		}
+	}
+}
+
+bool FrameServer::handleRequest(Client& client)
+{
+	FrameServerRequest request;
+	FrameServerReply reply = {};
+
+	const ssize_t received = recv(client.socket, &request, sizeof(request), MSG_DONTWAIT);
+	if (received == 0)
+		return false;	// hung up
+	if (received < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+	reply.magic = kFrameServerMagic;
+	if (received != sizeof(request) || request.magic != kFrameServerMagic || request.version != kFrameServerVersion)
+	{
+		reply.status = kFrameReplyBadRequest;
+		return sendReply(client, reply, nullptr, 0);
+	}
+
+	switch (request.type)
+	{
+	case kFrameRequestGrab:
+		if (client.waitingForFrame || client.leases.size() >= m_maxLeasesPerClient || m_leasesHeld >= m_maxLeasesTotal)
+		{
+			++m_grabsRefused;
+			reply.status = kFrameReplyOverQuota;
+			return sendReply(client, reply, nullptr, 0);
+		}
+		client.waitingForFrame = true;
+		return true;	// answered by the server loop once there is a frame for it
+
+	case kFrameRequestRelease:
+		reply.leaseId = request.leaseId;
+		reply.status = kFrameReplyUnknownLease;
+		for (size_t leaseIdx = 0; leaseIdx < client.leases.size(); leaseIdx++)
+		{
+			if (client.leases[leaseIdx].id == request.leaseId)
+			{
+				client.leases[leaseIdx].frame.release();
+				client.leases.erase(client.leases.begin() + leaseIdx);
+				--m_leasesHeld;
+				++m_framesReturned;
+				reply.status = kFrameReplyReleased;
+				break;
+			}
+		}
+		return sendReply(client, reply, nullptr, 0);
+	}
+
+	reply.status = kFrameReplyBadRequest;
+	return sendReply(client, reply, nullptr, 0);
+}
+
+bool FrameServer::sendFrame(Client& client)
+{
+	FrameServerReply reply = {};
+	CaptureFrame frame;
+	int fds[kFrameServerMaxEyes];
+
+	{
+		std::lock_guard<std::mutex> guard(m_newestMutex);
+		if (m_newest.eye[kEyeLeft] == nullptr || (client.hadFrame && m_newest.frameNumber == client.lastFrameNumber))
+			return true;	// keep waiting
+		frame = m_newest;
+		frame.retain();
+	}
+
+	reply.magic = kFrameServerMagic;
+	client.waitingForFrame = false;
+
+	// other clients may have taken leases since this grab was accepted
+	if (m_leasesHeld >= m_maxLeasesTotal)
+	{
+		frame.release();
+		++m_grabsRefused;
+		reply.status = kFrameReplyOverQuota;
+		return sendReply(client, reply, nullptr, 0);
+	}
+
+	for (unsigned eyeIdx = 0; eyeIdx < frame.eyeCount(); eyeIdx++)
+	{
+		fds[eyeIdx] = frame.eye[eyeIdx]->GetSharedFd();
+		if (fds[eyeIdx] < 0)
+		{
+			fprintf(stderr, "Frame server: frame %llu is not in a shareable pool\n", (unsigned long long)frame.frameNumber);
+			frame.release();
+			reply.status = kFrameReplyBadRequest;
+			return sendReply(client, reply, nullptr, 0);
+		}
+	}
+
+	reply.status = kFrameReplyFrame;
+	reply.leaseId = m_nextLeaseId++;
+	reply.leaseMilliseconds = m_leaseMilliseconds;
+	reply.eyeCount = frame.eyeCount();
+	reply.bufferBytes = frame.eye[kEyeLeft]->GetCapacity();
+	reply.frameNumber = frame.frameNumber;
+	reply.streamTime = frame.streamTime;
+	reply.streamDuration = frame.streamDuration;
+	reply.timeScale = frame.timeScale;
+	reply.hardwareTime = frame.hardwareTime;
+	reply.flags = frame.flags;
+	reply.pixelFormat = frame.pixelFormat;
+	reply.width = frame.width;
+	reply.height = frame.height;
+	reply.rowBytes = frame.rowBytes;
+
+	if (!sendReply(client, reply, fds, frame.eyeCount()))
+	{
+		frame.release();
+		return false;
+	}
+
+	client.leases.push_back({ reply.leaseId, frame, steadyClockMicroseconds() + (int64_t)m_leaseMilliseconds * 1000 });
+	client.lastFrameNumber = frame.frameNumber;
+	client.hadFrame = true;
+	++m_leasesHeld;
+	++m_framesLeased;
+	return true;
+}
+
+bool FrameServer::sendReply(Client& client, const FrameServerReply& reply, const int* fds, unsigned fdCount)
+{
+	struct iovec data = { (void*)&reply, sizeof(reply) };
+	struct msghdr message = {};
+	union
+	{
+		char			buffer[CMSG_SPACE(sizeof(int) * kFrameServerMaxEyes)];
+		struct cmsghdr	align;
+	} control;
+
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	if (fdCount > 0)
+	{
+		memset(&control, 0, sizeof(control));
+		message.msg_control = control.buffer;
+		message.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+		struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+		memcpy(CMSG_DATA(header), fds, sizeof(int) * fdCount);
+	}
+
+	// a client that does not read its replies is not worth waiting for
+	return sendmsg(client.socket, &message, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t)sizeof(reply);
+}
+
+void FrameServer::disconnect(Client& client)
+{
+	if (client.socket < 0)
+		return;
+
+	for (Lease& lease : client.leases)
+	{
+		lease.frame.release();
+		--m_leasesHeld;
+		++m_leasesRevoked;
+	}
+	client.leases.clear();
+
+	close(client.socket);
+	client.socket = -1;
+	--m_clientsConnected;
+}
+
+#else
+
+bool FrameServer::isAvailable()
+{
+	return false;
+}
+
+bool FrameServer::start(const std::string& socketPath)
+{
+	return false;
+}
+
+void FrameServer::submit(const CaptureFrame& frame)
+{
+	CaptureFrame dropped = frame;
+	dropped.release();
+}
+
+void FrameServer::stop()
+{
+}
+
+void FrameServer::serverThread()
+{
+}
+
+bool FrameServer::handleRequest(Client& client)
+{
+	return false;
+}
+
+bool FrameServer::sendFrame(Client& client)
+{
+	return false;
+}
+
+bool FrameServer::sendReply(Client& client, const FrameServerReply& reply, const int* fds, unsigned fdCount)
+{
+	return false;
+}
+
+void FrameServer::disconnect(Client& client)
+{
+}
+
+#endif
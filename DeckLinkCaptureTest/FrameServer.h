@@ -0,0 +1,94 @@
+// frame server: lends captured frames to local processes by passing their memfd-backed pool buffers over a Unix domain socket
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CaptureFrame.h"
+#include "FrameServerProtocol.h"
+
+struct FrameServerStats
+{
+	unsigned	clientsConnected;
+	uint64_t	clientsAccepted;
+	uint64_t	framesLeased;
+	uint64_t	framesReturned;		// released by their clients
+	uint64_t	leasesRevoked;		// held past the lease time, or left behind by a disconnect
+	uint64_t	grabsRefused;		// over a quota
+	unsigned	leasesHeld;			// buffers currently kept out of the pool for clients
+};
+
+// For tools that connect, take a few frames and go. The server keeps a reference on the newest
+// frame, and a client's grab is answered with the descriptors of that frame's pool buffers, so
+// the client maps the very pixels the card delivered. Leased buffers stay out of the capture pool
+// until they are released, so leases are bounded per client and in total, and each only lasts
+// leaseMilliseconds; the pool has to be sized for maxLeasesTotal frames more than capture needs.
+// Needs a shareable FramePool, and memfds, so Linux only
+class FrameServer
+{
+public:
+	FrameServer(unsigned maxLeasesPerClient, unsigned maxLeasesTotal, unsigned leaseMilliseconds);
+	~FrameServer();
+
+	static bool	isAvailable();
+
+	// listens on a socket at socketPath, replacing a stale one. Frames must come from a shareable pool
+	bool		start(const std::string& socketPath);
+
+	// makes frame the one the next grabs get. Never blocks for long; the server takes over the
+	// caller's buffer references and releases those of the frame it replaces
+	void		submit(const CaptureFrame& frame);
+
+	// revokes every lease, disconnects the clients and removes the socket
+	void		stop();
+
+	bool		isRunning() const { return m_running; }
+	FrameServerStats	stats();
+
+private:
+	struct Lease
+	{
+		uint64_t		id;
+		CaptureFrame	frame;
+		int64_t			expiresUs;
+	};
+
+	struct Client
+	{
+		int					socket;
+		bool				waitingForFrame;
+		uint64_t			lastFrameNumber;	// of the newest frame it has been sent, for the next grab
+		bool				hadFrame;
+		std::vector<Lease>	leases;
+	};
+
+	void		serverThread();
+	bool		handleRequest(Client& client);
+	bool		sendFrame(Client& client);
+	bool		sendReply(Client& client, const FrameServerReply& reply, const int* fds, unsigned fdCount);
+	void		disconnect(Client& client);
+	void		printStats();
+
+	unsigned					m_maxLeasesPerClient;
+	unsigned					m_maxLeasesTotal;
+	unsigned					m_leaseMilliseconds;
+	std::string					m_socketPath;
+	int							m_listenSocket;
+	int							m_wakeFd;			// eventfd the capture side bumps when a frame arrives
+	std::thread					m_server;
+	std::atomic<bool>			m_running;
+	std::mutex					m_newestMutex;
+	CaptureFrame				m_newest;			// guarded by m_newestMutex; no buffers until the first frame
+	std::vector<Client>			m_clients;			// server thread only
+	uint64_t					m_nextLeaseId;
+	std::atomic<unsigned>		m_clientsConnected;
+	std::atomic<uint64_t>		m_clientsAccepted;
+	std::atomic<uint64_t>		m_framesLeased;
+	std::atomic<uint64_t>		m_framesReturned;
+	std::atomic<uint64_t>		m_leasesRevoked;
+	std::atomic<uint64_t>		m_grabsRefused;
+	std::atomic<unsigned>		m_leasesHeld;
+};
@@ -0,0 +1,96 @@
+// metrics registry: counters, gauges and histograms, exported in the Prometheus text format to a file and over HTTP on loopback
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
+
+const unsigned	kMetricMaxBuckets = 16;
+
+// only ever goes up, except when set() mirrors a count kept elsewhere
+class MetricCounter
+{
+public:
+	MetricCounter() : m_value(0) {}
+
+	void		add(uint64_t count = 1) { m_value.fetch_add(count, std::memory_order_relaxed); }
+	void		set(uint64_t value) { m_value.store(value, std::memory_order_relaxed); }
+	uint64_t	value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t>	m_value;
+};
+
+class MetricGauge
+{
+public:
+	MetricGauge() : m_bits(0) {}
+
+	void		set(double value);
+	double		value() const;
+
+private:
+	std::atomic<uint64_t>	m_bits;		// the double's bits
+};
+
+// counts observations into fixed buckets, each counting those no larger than its upper bound
+class MetricHistogram
+{
+public:
+	MetricHistogram(const double* upperBounds, unsigned boundCount);
+
+	void		observe(double value);
+
+	unsigned	bucketCount() const { return m_boundCount + 1; }
+	double		upperBound(unsigned bucketIdx) const { return m_bounds[bucketIdx]; }
+	uint64_t	bucket(unsigned bucketIdx) const { return m_buckets[bucketIdx].load(std::memory_order_relaxed); }
+	double		sum() const;
+
+private:
+	unsigned				m_boundCount;
+	double					m_bounds[kMetricMaxBuckets];
+	std::atomic<uint64_t>	m_buckets[kMetricMaxBuckets + 1];	// the last one is +Inf
+	std::atomic<uint64_t>	m_sumBits;
+};
+
+// Metrics are looked up by name and labels once, under a lock, and live until the program exits, so
+// the pointers handed out can be updated from any thread with nothing but relaxed atomics, and asking
+// again for the same name and labels gives the same metric. labels is Prometheus label syntax without
+// the braces, such as device="0",stage="recorder", or empty. Values that are cheaper to read than to
+// keep up to date, like queue depths, are set by collectors, which run just before each export
+// to the file and each HTTP request
+class MetricsRegistry
+{
+public:
+	static MetricCounter*	counter(const char* name, const char* help, const std::string& labels);
+	static MetricGauge*		gauge(const char* name, const char* help, const std::string& labels);
+	static MetricHistogram*	histogram(const char* name, const char* help, const std::string& labels, const double* upperBounds, unsigned boundCount);
+
+	// runs collect before every export until removeCollectors is called with the same owner,
+	// which waits for an export in progress so that what collect reads can be destroyed after it
+	static void		addCollector(const void* owner, const std::function<void()>& collect);
+	static void		removeCollectors(const void* owner);
+
+	// runs the collectors and formats every metric
+	static std::string	exposition();
+
+	// rewrites path every interval, when set, and answers GET /metrics on 127.0.0.1:port, when not 0
+	static bool		startExport(const char* path, unsigned short port, unsigned intervalMs);
+	static void		stopExport();
+};
+
+// exports metrics for as long as it is in scope, for main()
+class MetricsScope
+{
+public:
+	MetricsScope(bool enable, const char* path, unsigned short port, unsigned intervalMs)
+	{
+		if (enable)
+			MetricsRegistry::startExport(path, port, intervalMs);
+	}
+	~MetricsScope()
+	{
+		MetricsRegistry::stopExport();
+	}
+};
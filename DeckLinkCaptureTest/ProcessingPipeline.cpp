@@ -0,0 +1,302 @@
+// per-frame processing stages: user plugins that run on the pipeline's own threads, sharing one decode of each frame, within a time budget
+#include "ProcessingPipeline.h"
+#include "BinaryLog.h"
+#include "LatencyTracker.h"
+#include "MetricsRegistry.h"
+#include "TraceRecorder.h"
+#include "V210Unpack.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <string>
+
+static const int64_t kStatsIntervalUs = 10 * 1000000;
+
+// upper bounds of the stage time buckets, in seconds
+static const double kStageTimeBounds[] = { 0.001, 0.002, 0.004, 0.008, 0.016, 0.032, 0.064, 0.128, 0.256 };
+
+// each eye's decoded representations take a byte of the mask
+static unsigned decodedBits(unsigned inputs, unsigned eyeIdx)
+{
+	return (inputs & ~kInputStereoPair) << (8 * eyeIdx);
+}
+
+ProcessingPipeline::ProcessingPipeline(unsigned deviceIndex, unsigned threadCount, unsigned queueDepth) :
+	m_deviceIndex(deviceIndex),
+	m_threadCount(threadCount ? threadCount : 1),
+	m_queue(queueDepth),
+	m_running(false),
+	m_framesProcessed(0),
+	m_decodeTotalUs(0),
+	m_lastStatsUs(0)
+{
+}
+
+ProcessingPipeline::~ProcessingPipeline()
+{
+	stop();
+}
+
+void ProcessingPipeline::addStage(const std::shared_ptr<ProcessingStage>& stage)
+{
+	std::unique_ptr<StageSlot> slot(new StageSlot());
+	slot->stage = stage;
+	slot->inputs = 0;
+	slot->budgetMs = 0;
+	slot->policy = kOverrunSkip;
+	slot->busy = false;
+	slot->resumeFrame = 0;
+	slot->framesProcessed = 0;
+	slot->skippedBusy = 0;
+	slot->skippedBudget = 0;
+	slot->overruns = 0;
+	slot->totalUs = 0;
+	slot->maxUs = 0;
+
+	const std::string labels = "device=\"" + std::to_string(m_deviceIndex) + "\",stage=\"" + stage->name() + "\"";
+	slot->runMetric = MetricsRegistry::counter("decklink_processing_runs_total", "Frames a processing stage ran on.", labels);
+	slot->skipBusyMetric = MetricsRegistry::counter("decklink_processing_skipped_total", "Frames a processing stage did not run on.", labels + ",reason=\"busy\"");
+	slot->skipBudgetMetric = MetricsRegistry::counter("decklink_processing_skipped_total", "Frames a processing stage did not run on.", labels + ",reason=\"budget\"");
+	slot->overrunMetric = MetricsRegistry::counter("decklink_processing_overruns_total", "Runs of a processing stage that took longer than its budget.", labels);
+	slot->timeMetric = MetricsRegistry::histogram("decklink_processing_seconds", "Time a processing stage took over one frame.", labels,
+		kStageTimeBounds, sizeof(kStageTimeBounds) / sizeof(kStageTimeBounds[0]));
+	m_stages.push_back(std::move(slot));
+}
+
+bool ProcessingPipeline::start(const CaptureFrame& format)
+{
+	if (m_running)
+		return false;
+
+	// a stage that cannot start, or needs a pair there is not, sits this capture out
+	for (auto slotIt = m_stages.begin(); slotIt != m_stages.end();)
+	{
+		ProcessingStage* stage = (*slotIt)->stage.get();
+		if (!stage->start(format))
+		{
+			fprintf(stderr, "Could not start processing stage %s\n", stage->name());
+			slotIt = m_stages.erase(slotIt);
+			continue;
+		}
+
+		(*slotIt)->inputs = stage->inputs();
+		(*slotIt)->budgetMs = stage->budgetMs();
+		(*slotIt)->policy = stage->overrunPolicy();
+		if (((*slotIt)->inputs & kInputStereoPair) && format.eyeCount() < 2)
+		{
+			fprintf(stderr, "Processing stage %s needs dual-stream 3D capture, leaving it out\n", stage->name());
+			stage->stop();
+			slotIt = m_stages.erase(slotIt);
+		}
+		else
+		{
+			printf("Processing stage %s on device #%u: %.1f ms budget, %s on overrun\n", stage->name(), m_deviceIndex, (*slotIt)->budgetMs,
+				((*slotIt)->policy == kOverrunSkip) ? "skipping frames" : "flagging");
+			++slotIt;
+		}
+	}
+	if (m_stages.empty())
+		return false;
+
+	m_lastStatsUs = steadyClockMicroseconds();
+	m_running = true;
+	for (unsigned threadIdx = 0; threadIdx < m_threadCount; threadIdx++)
+		m_threads.push_back(std::thread(&ProcessingPipeline::processingThread, this, threadIdx));
+	return true;
+}
+
+bool ProcessingPipeline::submit(const CaptureFrame& frame)
+{
+	if (m_running && m_queue.tryPush(frame))
+		return true;
+
+	CaptureFrame dropped = frame;
+	dropped.release();
+	return false;
+}
+
+void ProcessingPipeline::stop()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	m_queue.close();
+	for (std::thread& thread : m_threads)
+	{
+		if (thread.joinable())
+			thread.join();
+	}
+	m_threads.clear();
+
+	for (std::unique_ptr<StageSlot>& slot : m_stages)
+		slot->stage->stop();
+	printStats();
+}
+
+ProcessingStats ProcessingPipeline::stats()
+{
+	ProcessingStats stats = {};
+	stats.framesProcessed = m_framesProcessed;
+	stats.framesDropped = m_queue.dropCount();
+	stats.queueDepth = m_queue.depth();
+	stats.meanDecodeMs = stats.framesProcessed ? (m_decodeTotalUs / 1000.0) / stats.framesProcessed : 0.0;
+
+	for (const std::unique_ptr<StageSlot>& slot : m_stages)
+	{
+		ProcessingStageStats stage = {};
+		stage.name = slot->stage->name();
+		stage.framesProcessed = slot->framesProcessed;
+		stage.skippedBusy = slot->skippedBusy;
+		stage.skippedBudget = slot->skippedBudget;
+		stage.overruns = slot->overruns;
+		stage.budgetMs = slot->budgetMs;
+		stage.meanMs = stage.framesProcessed ? (slot->totalUs / 1000.0) / stage.framesProcessed : 0.0;
+		stage.maxMs = slot->maxUs / 1000.0;
+		stats.stages.push_back(stage);
+	}
+	return stats;
+}
+
+void ProcessingPipeline::printStats()
+{
+	const ProcessingStats current = stats();
+
+	printf("Processing on device #%u: %llu frames, %llu dropped, queue %u, decode mean %.2f ms\n", m_deviceIndex,
+		(unsigned long long)current.framesProcessed, (unsigned long long)current.framesDropped, current.queueDepth, current.meanDecodeMs);
+	for (const ProcessingStageStats& stage : current.stages)
+	{
+		printf("  %s: %llu frames, mean %.2f / max %.2f of %.1f ms, %llu overruns, skipped %llu busy and %llu for budget\n", stage.name,
+			(unsigned long long)stage.framesProcessed, stage.meanMs, stage.maxMs, stage.budgetMs, (unsigned long long)stage.overruns,
+			(unsigned long long)stage.skippedBusy, (unsigned long long)stage.skippedBudget);
+	}
+}
+
+void ProcessingPipeline::processingThread(unsigned threadIdx)
+{
+	TraceRecorder::nameThread("processing", threadIdx);
+
+	// reused for every frame this thread processes
+	ProcessingInput input;
+	CaptureFrame frame;
+
+	// keep going after stop() until the queue has been drained
+	while (m_running || m_queue.depth() > 0)
+	{
+		if (!m_queue.pop(frame, std::chrono::milliseconds(100)))
+			continue;
+
+		// representations are decoded as the first stage that wants them gets its turn
+		unsigned decoded = 0;
+		input.frame = &frame;
+		for (std::unique_ptr<StageSlot>& slot : m_stages)
+			runStage(*slot, frame, input, decoded);
+
+		recordLatency(frame, kLatencyProcessed);
+		frame.release();
+		++m_framesProcessed;
+
+		// whichever thread notices first prints the statistics
+		const int64_t nowUs = steadyClockMicroseconds();
+		int64_t lastStatsUs = m_lastStatsUs;
+		if (nowUs - lastStatsUs >= kStatsIntervalUs && m_lastStatsUs.compare_exchange_strong(lastStatsUs, nowUs))
+			printStats();
+	}
+}
+
+void ProcessingPipeline::runStage(StageSlot& slot, const CaptureFrame& frame, ProcessingInput& input, unsigned& decoded)
+{
+	if (frame.frameNumber < slot.resumeFrame)
+	{
+		++slot.skippedBudget;
+		slot.skipBudgetMetric->add();
+		return;
+	}
+
+	// a stage is never waited for: if another thread has it, this frame goes past
+	bool idle = false;
+	if (!slot.busy.compare_exchange_strong(idle, true))
+	{
+		++slot.skippedBusy;
+		slot.skipBusyMetric->add();
+		return;
+	}
+
+	input.eyeCount = (slot.inputs & kInputStereoPair) ? frame.eyeCount() : 1;
+	decode(frame, input, slot.inputs, input.eyeCount, decoded);
+
+	const int64_t startUs = steadyClockMicroseconds();
+	{
+		TraceSpan span(slot.stage->name(), frame.frameNumber);
+		slot.stage->process(input);
+	}
+	const uint64_t runUs = (uint64_t)(steadyClockMicroseconds() - startUs);
+
+	uint64_t maxUs = slot.maxUs;
+	while (runUs > maxUs && !slot.maxUs.compare_exchange_weak(maxUs, runUs))
+		;
+	slot.totalUs += runUs;
+	++slot.framesProcessed;
+	slot.runMetric->add();
+	slot.timeMetric->observe(runUs / 1e6);
+
+	const double runMs = runUs / 1000.0;
+	if (runMs > slot.budgetMs)
+	{
+		++slot.overruns;
+		slot.overrunMetric->add();
+		if (slot.policy == kOverrunSkip && frame.streamDuration > 0 && frame.timeScale > 0)
+		{
+			// the frames that arrived while it was over budget go past, as they would have queued behind it
+			const double frameMs = 1000.0 * frame.streamDuration / frame.timeScale;
+			const uint64_t skipFrames = (uint64_t)ceil((runMs - slot.budgetMs) / frameMs);
+			slot.resumeFrame = frame.frameNumber + 1 + skipFrames;
+			logWarning("Processing stage %s took %.1f ms of its %.1f ms budget on frame %llu, skipping %llu frames\n", slot.stage->name(), runMs, slot.budgetMs,
+				frame.frameNumber, skipFrames);
+		}
+		else
+		{
+			logWarning("Processing stage %s took %.1f ms of its %.1f ms budget on frame %llu\n", slot.stage->name(), runMs, slot.budgetMs, frame.frameNumber);
+		}
+	}
+
+	slot.busy = false;
+}
+
+void ProcessingPipeline::decode(const CaptureFrame& frame, ProcessingInput& input, unsigned inputs, unsigned eyeCount, unsigned& decoded)
+{
+	// 8-bit BGR is made from the 16-bit, and luma from the planes
+	if (inputs & kInputBgr8)
+		inputs |= kInputBgr16;
+	if (inputs & kInputLuma)
+		inputs |= kInputYuvPlanes;
+
+	const int64_t startUs = steadyClockMicroseconds();
+	for (unsigned eyeIdx = 0; eyeIdx < eyeCount; eyeIdx++)
+	{
+		const unsigned needed = decodedBits(inputs, eyeIdx) & ~decoded;
+		if (needed == 0)
+			continue;
+
+		const uint8_t* v210 = frame.eye[eyeIdx]->GetBytes();
+		if (needed & decodedBits(kInputYuvPlanes, eyeIdx))
+		{
+			input.y[eyeIdx].create(frame.height, frame.width, CV_16UC1);
+			input.cb[eyeIdx].create(frame.height, (frame.width + 1) / 2, CV_16UC1);
+			input.cr[eyeIdx].create(frame.height, (frame.width + 1) / 2, CV_16UC1);
+			unpackV210(v210, (size_t)frame.rowBytes, frame.width, frame.height, (uint16_t*)input.y[eyeIdx].data, input.y[eyeIdx].step,
+				(uint16_t*)input.cb[eyeIdx].data, input.cb[eyeIdx].step, (uint16_t*)input.cr[eyeIdx].data, input.cr[eyeIdx].step);
+		}
+		if (needed & decodedBits(kInputLuma, eyeIdx))
+			input.y[eyeIdx].convertTo(input.luma[eyeIdx], CV_8U, 1.0 / 4.0);
+		if (needed & decodedBits(kInputBgr16, eyeIdx))
+		{
+			input.bgr16[eyeIdx].create(frame.height, frame.width, CV_16UC3);
+			convertV210ToBgr48(v210, (size_t)frame.rowBytes, frame.width, frame.height, (uint16_t*)input.bgr16[eyeIdx].data, input.bgr16[eyeIdx].step);
+		}
+		if (needed & decodedBits(kInputBgr8, eyeIdx))
+			input.bgr16[eyeIdx].convertTo(input.bgr8[eyeIdx], CV_8U, 1.0 / 257.0);
+		decoded |= needed;
+	}
+	m_decodeTotalUs += (uint64_t)(steadyClockMicroseconds() - startUs);
+}
@@ -0,0 +1,153 @@
+// per-frame processing stages: user plugins that run on the pipeline's own threads, sharing one decode of each frame, within a time budget
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "CaptureFrame.h"
+#include "FrameQueue.h"
+
+class MetricCounter;
+class MetricHistogram;
+
+// representations a processing stage can take, combined
+const unsigned	kInputBgr8 = 1 << 0;		// CV_8UC3
+const unsigned	kInputBgr16 = 1 << 1;		// CV_16UC3, full range, as the 16-bit stills
+const unsigned	kInputLuma = 1 << 2;		// CV_8UC1, video range luma
+const unsigned	kInputYuvPlanes = 1 << 3;	// CV_16UC1 Y, Cb and Cr at 10 bits, video range; chroma is half width
+const unsigned	kInputStereoPair = 1 << 4;	// both eyes of a dual-stream 3D frame, rather than the left alone
+
+// what a stage that ran past its budget does next
+enum OverrunPolicy
+{
+	kOverrunSkip,		// skips the frames that arrived in the time it overran by, so it keeps up with capture
+	kOverrunFlag		// runs on every frame it can, and only counts and logs the overrun
+};
+
+// One frame, decoded into the representations the stages running on it asked for. Matrices the
+// stage did not ask for may be empty; all of them belong to the pipeline and are only valid for the
+// duration of process(), so a stage copies whatever it keeps
+struct ProcessingInput
+{
+	const CaptureFrame*	frame;
+	unsigned	eyeCount;			// 2 for a stage taking kInputStereoPair on dual-stream capture, otherwise 1
+	cv::Mat		bgr8[kEyeCount];
+	cv::Mat		bgr16[kEyeCount];
+	cv::Mat		luma[kEyeCount];
+	cv::Mat		y[kEyeCount];
+	cv::Mat		cb[kEyeCount];
+	cv::Mat		cr[kEyeCount];
+};
+
+// The interface a processing plugin implements. The pipeline never calls one stage from two
+// threads at once, but successive frames may come from different threads, and when a stage is
+// still busy with one frame the next frame goes past it. name() must stay valid for as long as
+// the stage exists, as traces and metrics refer to it. inputs(), budgetMs() and overrunPolicy()
+// are asked after start(), so a stage may choose them by the format of the capture
+class ProcessingStage
+{
+public:
+	virtual ~ProcessingStage() {}
+
+	virtual const char*		name() const = 0;
+	virtual unsigned		inputs() const = 0;			// kInput flags
+	virtual double			budgetMs() const = 0;		// per frame, all eyes
+	virtual OverrunPolicy	overrunPolicy() const { return kOverrunSkip; }
+
+	// before the first frame of a capture, and after its last, on the thread that prepares the capture;
+	// format holds no buffers, only the size, pixel format and eye count of the frames to come
+	virtual bool			start(const CaptureFrame& format) { return true; }
+	virtual void			stop() {}
+
+	virtual void			process(const ProcessingInput& input) = 0;
+};
+
+struct ProcessingStageStats
+{
+	const char*	name;
+	uint64_t	framesProcessed;
+	uint64_t	skippedBusy;		// frames that went past while the stage was still on an earlier one
+	uint64_t	skippedBudget;		// frames skipped to make up for an overrun
+	uint64_t	overruns;			// runs longer than the budget
+	double		budgetMs;
+	double		meanMs;
+	double		maxMs;
+};
+
+struct ProcessingStats
+{
+	uint64_t	framesProcessed;	// taken off the queue, whichever stages ran on them
+	uint64_t	framesDropped;		// refused because the queue was full
+	unsigned	queueDepth;
+	double		meanDecodeMs;		// every representation of every eye a frame needed
+	std::vector<ProcessingStageStats>	stages;
+};
+
+// Runs the processing stages registered with a device on a few threads of its own, fed from
+// the capture callback through a queue it never waits on: when the threads fall behind, frames
+// are dropped for processing and still recorded. Each thread decodes a frame into only the
+// representations the stages that will run on it need, once, and runs those stages one after
+// the other on the same decode. A stage's run is timed against its budget
+class ProcessingPipeline
+{
+public:
+	ProcessingPipeline(unsigned deviceIndex, unsigned threadCount, unsigned queueDepth);
+	~ProcessingPipeline();
+
+	// before start(); a stage asking for kInputStereoPair is left out of a capture with one eye
+	void		addStage(const std::shared_ptr<ProcessingStage>& stage);
+
+	// starts every stage and then the threads; false when no stage would run
+	bool		start(const CaptureFrame& format);
+
+	// hands a frame over without blocking. The pipeline takes over the caller's buffer
+	// references, and releases them itself if the frame has to be dropped
+	bool		submit(const CaptureFrame& frame);
+
+	// processes what is still queued, then stops the threads and the stages
+	void		stop();
+
+	unsigned	queueDepth() { return m_queue.depth(); }
+	unsigned	queueCapacity() const { return m_queue.capacity(); }
+	ProcessingStats	stats();
+
+private:
+	struct StageSlot
+	{
+		std::shared_ptr<ProcessingStage>	stage;
+		unsigned				inputs;
+		double					budgetMs;
+		OverrunPolicy			policy;
+		std::atomic<bool>		busy;
+		std::atomic<uint64_t>	resumeFrame;		// frames numbered below this are skipped after an overrun
+		std::atomic<uint64_t>	framesProcessed;
+		std::atomic<uint64_t>	skippedBusy;
+		std::atomic<uint64_t>	skippedBudget;
+		std::atomic<uint64_t>	overruns;
+		std::atomic<uint64_t>	totalUs;
+		std::atomic<uint64_t>	maxUs;
+		MetricCounter*			runMetric;
+		MetricCounter*			skipBusyMetric;
+		MetricCounter*			skipBudgetMetric;
+		MetricCounter*			overrunMetric;
+		MetricHistogram*		timeMetric;
+	};
+
+	void		processingThread(unsigned threadIdx);
+	void		runStage(StageSlot& slot, const CaptureFrame& frame, ProcessingInput& input, unsigned& decoded);
+	void		decode(const CaptureFrame& frame, ProcessingInput& input, unsigned inputs, unsigned eyeCount, unsigned& decoded);
+	void		printStats();
+
+	unsigned					m_deviceIndex;
+	unsigned					m_threadCount;
+	FrameQueue					m_queue;
+	std::vector<std::unique_ptr<StageSlot>>	m_stages;
+	std::vector<std::thread>	m_threads;
+	std::atomic<bool>			m_running;
+	std::atomic<uint64_t>		m_framesProcessed;
+	std::atomic<uint64_t>		m_decodeTotalUs;
+	std::atomic<int64_t>		m_lastStatsUs;
+};
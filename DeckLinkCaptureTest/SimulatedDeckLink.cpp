@@ -0,0 +1,809 @@
+// simulated DeckLink card: generates v210 test patterns through the SDK interfaces, for running without hardware
+#include "SimulatedDeckLink.h"
+#include "CaptureFrame.h"
+#include "FramePool.h"
+#include "V210Unpack.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+static const int64_t kMicrosecondsPerSecond = 1000000;
+
+// how often each simulated card prints its statistics while streaming
+static const std::chrono::seconds kStatsInterval(10);
+
+// the OS sleeps in coarse steps; the last stretch before a frame is due is spent yielding instead
+static const int64_t kSpinUs = 2000;
+
+// frames a card holds for a callback that has not returned; once further behind, frames are dropped
+static const int64_t kCardFrameBuffers = 4;
+
+// frames in the pattern cycle; the moving bar crosses the picture once per cycle
+static const unsigned kPatternFrames = 8;
+
+// how far right the moving bar sits in the right eye, in pixels
+static const int kStereoDisparity = 24;
+
+struct SimulatedMode
+{
+	BMDDisplayMode		mode;
+	const char*			name;
+	long				width;
+	long				height;
+	BMDTimeValue		frameDuration;
+	BMDTimeScale		timeScale;
+	BMDFieldDominance	fieldDominance;
+};
+
+static const SimulatedMode kSimulatedModes[] =
+{
+	{ bmdModeNTSC,			"NTSC",			720,	486,	1001,	30000,	bmdLowerFieldFirst },
+	{ bmdModePAL,			"PAL",			720,	576,	1000,	25000,	bmdUpperFieldFirst },
+	{ bmdModeHD720p50,		"720p50",		1280,	720,	1000,	50000,	bmdProgressiveFrame },
+	{ bmdModeHD720p5994,	"720p59.94",	1280,	720,	1001,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD720p60,		"720p60",		1280,	720,	1000,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p2398,	"1080p23.98",	1920,	1080,	1001,	24000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p24,		"1080p24",		1920,	1080,	1000,	24000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p25,		"1080p25",		1920,	1080,	1000,	25000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p2997,	"1080p29.97",	1920,	1080,	1001,	30000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p30,		"1080p30",		1920,	1080,	1000,	30000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p50,		"1080p50",		1920,	1080,	1000,	50000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p5994,	"1080p59.94",	1920,	1080,	1001,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p6000,	"1080p60",		1920,	1080,	1000,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD1080i50,		"1080i50",		1920,	1080,	1000,	25000,	bmdUpperFieldFirst },
+	{ bmdModeHD1080i5994,	"1080i59.94",	1920,	1080,	1001,	30000,	bmdUpperFieldFirst },
+	{ bmdModeHD1080i6000,	"1080i60",		1920,	1080,	1000,	30000,	bmdUpperFieldFirst },
+	{ bmdMode4K2160p2398,	"2160p23.98",	3840,	2160,	1001,	24000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p24,		"2160p24",		3840,	2160,	1000,	24000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p25,		"2160p25",		3840,	2160,	1000,	25000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p2997,	"2160p29.97",	3840,	2160,	1001,	30000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p30,		"2160p30",		3840,	2160,	1000,	30000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p50,		"2160p50",		3840,	2160,	1000,	50000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p5994,	"2160p59.94",	3840,	2160,	1001,	60000,	bmdProgressiveFrame },
+	{ bmdMode4K2160p60,		"2160p60",		3840,	2160,	1000,	60000,	bmdProgressiveFrame },
+};
+
+// 75% colour bars in 10-bit BT.709 video range: white, yellow, cyan, green, magenta, red, blue, black
+static const uint16_t kBarY[8] = { 721, 646, 525, 450, 335, 260, 139, 64 };
+static const uint16_t kBarCb[8] = { 512, 176, 625, 289, 735, 399, 848, 512 };
+static const uint16_t kBarCr[8] = { 512, 567, 176, 231, 793, 848, 457, 512 };
+
+static const SimulatedMode* findMode(BMDDisplayMode displayMode)
+{
+	for (const SimulatedMode& mode : kSimulatedModes)
+	{
+		if (mode.mode == displayMode)
+			return &mode;
+	}
+	return nullptr;
+}
+
+// value in units of 1/from, in units of 1/to; split so that microsecond hardware times do not overflow
+static int64_t rescaleTime(int64_t value, int64_t from, int64_t to)
+{
+	return (value / from) * to + (value % from) * to / from;
+}
+
+// one mode's IDeckLinkDisplayMode, as GetDisplayMode hands out
+class SimulatedDisplayMode : public IDeckLinkDisplayMode
+{
+private:
+	const SimulatedMode&	m_mode;
+	std::atomic<ULONG>		m_refCount;
+
+public:
+	explicit SimulatedDisplayMode(const SimulatedMode& mode) : m_mode(mode), m_refCount(1) {}
+	virtual ~SimulatedDisplayMode() {}
+
+	// IDeckLinkDisplayMode interface
+	virtual HRESULT				STDMETHODCALLTYPE	GetName(SdkString* name) { *name = newSdkString(m_mode.name); return S_OK; };
+	virtual BMDDisplayMode		STDMETHODCALLTYPE	GetDisplayMode(void) { return m_mode.mode; };
+	virtual long				STDMETHODCALLTYPE	GetWidth(void) { return m_mode.width; };
+	virtual long				STDMETHODCALLTYPE	GetHeight(void) { return m_mode.height; };
+	virtual BMDFieldDominance	STDMETHODCALLTYPE	GetFieldDominance(void) { return m_mode.fieldDominance; };
+	virtual BMDDisplayModeFlags	STDMETHODCALLTYPE	GetFlags(void) { return (BMDDisplayModeFlags)((m_mode.height > 576) ? bmdDisplayModeColorspaceRec709 : bmdDisplayModeColorspaceRec601); };
+
+	virtual HRESULT				STDMETHODCALLTYPE	GetFrameRate(BMDTimeValue* frameDuration, BMDTimeScale* timeScale)
+	{
+		*frameDuration = m_mode.frameDuration;
+		*timeScale = m_mode.timeScale;
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID* ppv)
+	{
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+		if (isSameIid(iid, IID_IUnknown) || isSameIid(iid, IID_IDeckLinkDisplayMode))
+			*ppv = (IDeckLinkDisplayMode*)this;
+		else
+			return E_NOINTERFACE;
+
+		AddRef();
+		return S_OK;
+	}
+
+	virtual ULONG			STDMETHODCALLTYPE	AddRef(void)
+	{
+		return ++m_refCount;
+	}
+
+	virtual ULONG			STDMETHODCALLTYPE	Release(void)
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+
+		return newRefValue;
+	}
+};
+
+// one eye of one generated frame; the left eye carries the right one for the 3D extensions
+class SimulatedVideoFrame : public IDeckLinkVideoInputFrame, public IDeckLinkVideoFrame3DExtensions
+{
+private:
+	const SimulatedMode&	m_mode;
+	long					m_rowBytes;
+	const uint8_t*			m_pattern;			// shared by every frame of the cycle, never written
+	BMDFrameFlags			m_flags;
+	BMDTimeValue			m_streamTime;		// in m_mode.timeScale units
+	int64_t					m_hardwareTime;		// in microseconds
+	SimulatedVideoFrame*	m_rightEye;
+
+	std::atomic<ULONG>	m_refCount;
+
+public:
+	SimulatedVideoFrame(const SimulatedMode& mode, long rowBytes, const uint8_t* pattern, BMDFrameFlags flags,
+		BMDTimeValue streamTime, int64_t hardwareTime, SimulatedVideoFrame* rightEye) :
+		m_mode(mode), m_rowBytes(rowBytes), m_pattern(pattern), m_flags(flags), m_streamTime(streamTime),
+		m_hardwareTime(hardwareTime), m_rightEye(rightEye), m_refCount(1)
+	{
+	}
+	virtual ~SimulatedVideoFrame()
+	{
+		if (m_rightEye)
+			m_rightEye->Release();
+	}
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void) { return m_mode.width; };
+	virtual long			STDMETHODCALLTYPE	GetHeight(void) { return m_mode.height; };
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void) { return m_rowBytes; };
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void) { return m_flags; };
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void) { return bmdFormat10BitYUV; };
+
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer)
+	{
+		*buffer = (void*)m_pattern;
+		return S_OK;
+	}
+
+	// Dummy implementations of remaining methods in IDeckLinkVideoFrame
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode) { return E_NOTIMPL; };
+
+	// IDeckLinkVideoInputFrame interface
+	virtual HRESULT			STDMETHODCALLTYPE	GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale)
+	{
+		*frameTime = rescaleTime(m_streamTime, m_mode.timeScale, timeScale);
+		*frameDuration = rescaleTime(m_mode.frameDuration, m_mode.timeScale, timeScale);
+		return S_OK;
+	}
+
+	virtual HRESULT			STDMETHODCALLTYPE	GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration)
+	{
+		*frameTime = rescaleTime(m_hardwareTime, kMicrosecondsPerSecond, timeScale);
+		if (frameDuration)
+			*frameDuration = rescaleTime(m_mode.frameDuration, m_mode.timeScale, timeScale);
+		return S_OK;
+	}
+
+	// IDeckLinkVideoFrame3DExtensions interface, for dual-stream 3D input
+	virtual BMDVideo3DPackingFormat	STDMETHODCALLTYPE	Get3DPackingFormat(void) { return bmdVideo3DPackingLeftOnly; };
+
+	virtual HRESULT			STDMETHODCALLTYPE	GetFrameForRightEye(IDeckLinkVideoFrame** rightEyeFrame)
+	{
+		if (m_rightEye == nullptr)
+			return E_FAIL;
+
+		m_rightEye->AddRef();
+		*rightEyeFrame = (IDeckLinkVideoInputFrame*)m_rightEye;
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID* ppv)
+	{
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+		if (isSameIid(iid, IID_IUnknown) || isSameIid(iid, IID_IDeckLinkVideoFrame) || isSameIid(iid, IID_IDeckLinkVideoInputFrame))
+			*ppv = (IDeckLinkVideoInputFrame*)this;
+		else if (isSameIid(iid, IID_IDeckLinkVideoFrame3DExtensions) && m_rightEye != nullptr)
+			*ppv = (IDeckLinkVideoFrame3DExtensions*)this;
+		else
+			return E_NOINTERFACE;
+
+		AddRef();
+		return S_OK;
+	}
+
+	virtual ULONG			STDMETHODCALLTYPE	AddRef(void)
+	{
+		return ++m_refCount;
+	}
+
+	virtual ULONG			STDMETHODCALLTYPE	Release(void)
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+
+		return newRefValue;
+	}
+};
+
+SimulatedDeckLink::SimulatedDeckLink(BMDDisplayMode signalMode, double speed, unsigned index) :
+	m_refCount(1),
+	m_index(index),
+	m_signalMode(signalMode),
+	m_speed(speed > 0.0 ? speed : 0.0),
+	m_callback(nullptr),
+	m_mode(nullptr),
+	m_inputFlags(bmdVideoInputFlagDefault),
+	m_rowBytes(0),
+	m_streaming(false),
+	m_framesDelivered(0),
+	m_framesDropped(0),
+	m_callbackTotalUs(0),
+	m_callbackMaxUs(0),
+	m_startUs(0)
+{
+}
+
+SimulatedDeckLink::~SimulatedDeckLink()
+{
+	StopStreams();
+
+	if (m_callback)
+		m_callback->Release();
+	for (IDeckLinkNotificationCallback* subscriber : m_subscribers)
+		subscriber->Release();
+}
+
+bool SimulatedDeckLink::isModeSupported(BMDDisplayMode displayMode)
+{
+	return findMode(displayMode) != nullptr;
+}
+
+SimulatedDeckLinkStats SimulatedDeckLink::stats()
+{
+	SimulatedDeckLinkStats stats = {};
+	const uint64_t framesDelivered = m_framesDelivered;
+	const double elapsedSeconds = (m_startUs != 0) ? (steadyClockMicroseconds() - m_startUs) / 1e6 : 0.0;
+
+	stats.framesDelivered = framesDelivered;
+	stats.framesDropped = m_framesDropped;
+	stats.deliveredFps = (elapsedSeconds > 0.0) ? framesDelivered / elapsedSeconds : 0.0;
+	stats.meanCallbackMs = framesDelivered ? (m_callbackTotalUs / 1000.0) / framesDelivered : 0.0;
+	stats.maxCallbackMs = m_callbackMaxUs / 1000.0;
+	return stats;
+}
+
+void SimulatedDeckLink::printStats()
+{
+	SimulatedDeckLinkStats current = stats();
+	printf("Simulated card #%u: %llu frames (%.1f fps), %llu dropped, callback mean %.2f / max %.2f ms\n",
+		m_index, (unsigned long long)current.framesDelivered, current.deliveredFps, (unsigned long long)current.framesDropped,
+		current.meanCallbackMs, current.maxCallbackMs);
+}
+
+// IUnknown interface
+
+HRESULT SimulatedDeckLink::QueryInterface(REFIID iid, LPVOID* ppv)
+{
+	if (ppv == NULL)
+		return E_INVALIDARG;
+
+	*ppv = NULL;
+	if (isSameIid(iid, IID_IUnknown) || isSameIid(iid, IID_IDeckLink))
+		*ppv = (IDeckLink*)this;
+	else if (isSameIid(iid, IID_IDeckLinkInput))
+		*ppv = (IDeckLinkInput*)this;
+	else if (isSameIid(iid, IID_IDeckLinkStatus))
+		*ppv = (IDeckLinkStatus*)this;
+	else if (isSameIid(iid, IID_IDeckLinkNotification))
+		*ppv = (IDeckLinkNotification*)this;
+	else if (isSameIid(iid, IID_IDeckLinkConfiguration))
+		*ppv = (IDeckLinkConfiguration*)this;
+	else
+		return E_NOINTERFACE;
+
+	AddRef();
+	return S_OK;
+}
+
+ULONG SimulatedDeckLink::AddRef()
+{
+	return ++m_refCount;
+}
+
+ULONG SimulatedDeckLink::Release()
+{
+	ULONG newRefValue = --m_refCount;
+	if (newRefValue == 0)
+		delete this;
+
+	return newRefValue;
+}
+
+// IDeckLink interface
+
+HRESULT SimulatedDeckLink::GetModelName(SdkString* modelName)
+{
+	*modelName = newSdkString("Simulated DeckLink");
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetDisplayName(SdkString* displayName)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "Simulated DeckLink (%u)", m_index);
+	*displayName = newSdkString(name);
+	return S_OK;
+}
+
+// IDeckLinkInput interface
+
+HRESULT SimulatedDeckLink::DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat, BMDVideoInputConversionMode conversionMode, BMDSupportedVideoModeFlags flags, BMDDisplayMode* actualMode, SdkBool* supported)
+{
+	*supported = isModeSupported(requestedMode) && requestedPixelFormat == bmdFormat10BitYUV;
+	if (actualMode)
+		*actualMode = requestedMode;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode)
+{
+	const SimulatedMode* mode = findMode(displayMode);
+	if (mode == nullptr)
+		return E_INVALIDARG;
+
+	*resultDisplayMode = new SimulatedDisplayMode(*mode);
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback* previewCallback)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags)
+{
+	const SimulatedMode* mode = findMode(displayMode);
+
+	if (mode == nullptr || pixelFormat != bmdFormat10BitYUV)
+		return E_INVALIDARG;
+	if (m_streaming)
+		return E_ACCESSDENIED;
+
+	m_mode = mode;
+	m_inputFlags = flags;
+	m_rowBytes = rowBytesForV210(mode->width);
+	generatePatterns(*mode, (flags & bmdVideoInputDualStream3D) != 0, displayMode == m_signalMode);
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::DisableVideoInput()
+{
+	if (m_streaming)
+		return E_ACCESSDENIED;
+
+	m_mode = nullptr;
+	m_patterns[kEyeLeft].clear();
+	m_patterns[kEyeRight].clear();
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetAvailableVideoFrameCount(unsigned int* availableFrameCount)
+{
+	*availableFrameCount = 0;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::EnableAudioInput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, unsigned int channelCount)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::DisableAudioInput()
+{
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetAvailableAudioSampleFrameCount(unsigned int* availableSampleFrameCount)
+{
+	*availableSampleFrameCount = 0;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::StartStreams()
+{
+	if (m_mode == nullptr)
+		return E_ACCESSDENIED;
+	if (m_streaming)
+		return S_OK;
+
+	m_framesDelivered = 0;
+	m_framesDropped = 0;
+	m_callbackTotalUs = 0;
+	m_callbackMaxUs = 0;
+	m_startUs = steadyClockMicroseconds();
+
+	m_streaming = true;
+	m_stream = std::thread(&SimulatedDeckLink::streamThread, this);
+
+	// the signal locks as soon as streaming starts
+	notifySubscribers(bmdStatusChanged, bmdDeckLinkStatusDetectedVideoInputMode, 0);
+	notifySubscribers(bmdStatusChanged, bmdDeckLinkStatusVideoInputSignalLocked, 0);
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::StopStreams()
+{
+	if (!m_streaming)
+		return S_OK;
+
+	m_streaming = false;
+	if (m_stream.joinable())
+		m_stream.join();
+
+	printStats();
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::PauseStreams()
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::FlushStreams()
+{
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::SetCallback(IDeckLinkInputCallback* theCallback)
+{
+	IDeckLinkInputCallback* previous;
+
+	if (theCallback)
+		theCallback->AddRef();
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		previous = m_callback;
+		m_callback = theCallback;
+	}
+	if (previous)
+		previous->Release();
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame)
+{
+	const int64_t nowUs = steadyClockMicroseconds();
+	const SimulatedMode* mode = m_mode;
+
+	*hardwareTime = rescaleTime(nowUs, kMicrosecondsPerSecond, desiredTimeScale);
+	if (mode == nullptr)
+	{
+		*timeInFrame = 0;
+		*ticksPerFrame = 0;
+		return S_OK;
+	}
+
+	*ticksPerFrame = rescaleTime(mode->frameDuration, mode->timeScale, desiredTimeScale);
+	*timeInFrame = (*ticksPerFrame > 0) ? *hardwareTime % *ticksPerFrame : 0;
+	return S_OK;
+}
+
+// IDeckLinkStatus interface
+
+HRESULT SimulatedDeckLink::GetFlag(BMDDeckLinkStatusID statusID, SdkBool* value)
+{
+	if (statusID != bmdDeckLinkStatusVideoInputSignalLocked)
+		return E_NOTIMPL;
+
+	*value = m_streaming && m_mode != nullptr && m_mode->mode == m_signalMode;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetInt(BMDDeckLinkStatusID statusID, SdkInt64* value)
+{
+	switch (statusID)
+	{
+	case bmdDeckLinkStatusDetectedVideoInputMode:
+		*value = m_signalMode;
+		return S_OK;
+
+	case bmdDeckLinkStatusCurrentVideoInputMode:
+		*value = m_mode ? m_mode->mode : bmdModeUnknown;
+		return S_OK;
+
+	case bmdDeckLinkStatusCurrentVideoInputPixelFormat:
+		*value = bmdFormat10BitYUV;
+		return S_OK;
+
+	case bmdDeckLinkStatusCurrentVideoInputFlags:
+		*value = m_inputFlags;
+		return S_OK;
+
+	default:
+		return E_NOTIMPL;
+	}
+}
+
+HRESULT SimulatedDeckLink::GetFloat(BMDDeckLinkStatusID statusID, double* value)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::GetString(BMDDeckLinkStatusID statusID, SdkString* value)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::GetBytes(BMDDeckLinkStatusID statusID, void* buffer, unsigned int* bufferSize)
+{
+	return E_NOTIMPL;
+}
+
+// IDeckLinkNotification interface
+
+HRESULT SimulatedDeckLink::Subscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback)
+{
+	if (theCallback == nullptr)
+		return E_INVALIDARG;
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+	theCallback->AddRef();
+	m_subscribers.push_back(theCallback);
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::Unsubscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	std::vector<IDeckLinkNotificationCallback*>::iterator subscriber = std::find(m_subscribers.begin(), m_subscribers.end(), theCallback);
+	if (subscriber == m_subscribers.end())
+		return E_INVALIDARG;
+
+	(*subscriber)->Release();
+	m_subscribers.erase(subscriber);
+	return S_OK;
+}
+
+// IDeckLinkConfiguration interface
+
+HRESULT SimulatedDeckLink::SetFlag(BMDDeckLinkConfigurationID cfgID, SdkBool value)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_settings[cfgID] = value ? 1 : 0;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetFlag(BMDDeckLinkConfigurationID cfgID, SdkBool* value)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	std::map<BMDDeckLinkConfigurationID, SdkInt64>::const_iterator setting = m_settings.find(cfgID);
+	if (setting == m_settings.end())
+		return E_INVALIDARG;
+
+	*value = setting->second != 0;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::SetInt(BMDDeckLinkConfigurationID cfgID, SdkInt64 value)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_settings[cfgID] = value;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::GetInt(BMDDeckLinkConfigurationID cfgID, SdkInt64* value)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	std::map<BMDDeckLinkConfigurationID, SdkInt64>::const_iterator setting = m_settings.find(cfgID);
+	if (setting == m_settings.end())
+		return E_INVALIDARG;
+
+	*value = setting->second;
+	return S_OK;
+}
+
+HRESULT SimulatedDeckLink::SetFloat(BMDDeckLinkConfigurationID cfgID, double value)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::GetFloat(BMDDeckLinkConfigurationID cfgID, double* value)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::SetString(BMDDeckLinkConfigurationID cfgID, SdkString value)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::GetString(BMDDeckLinkConfigurationID cfgID, SdkString* value)
+{
+	return E_NOTIMPL;
+}
+
+HRESULT SimulatedDeckLink::WriteConfigurationToPreferences()
+{
+	return S_OK;
+}
+
+// The upper two thirds are colour bars and the rest a luma ramp, with a white bar crossing the
+// whole picture once per cycle. Every line of a band is the same, so each band is packed once per
+// frame and copied down. Without a signal, frames are black
+void SimulatedDeckLink::generatePatterns(const SimulatedMode& mode, bool stereo, bool signal)
+{
+	const int width = (int)mode.width;
+	const int height = (int)mode.height;
+	const int barsHeight = height * 2 / 3;
+	const int movingWidth = std::max(width / 32, 2);
+	std::vector<uint16_t> y(width), cb((width + 1) / 2), cr((width + 1) / 2);
+	std::vector<uint8_t> barsRow(m_rowBytes), rampRow(m_rowBytes);
+
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		m_patterns[eyeIdx].clear();
+		if (eyeIdx == kEyeRight && !stereo)
+			continue;
+
+		for (unsigned frameIdx = 0; frameIdx < (signal ? kPatternFrames : 1); frameIdx++)
+		{
+			const int movingLeft = (int)(frameIdx * (width - movingWidth) / kPatternFrames) + ((eyeIdx == kEyeRight) ? kStereoDisparity : 0);
+			std::vector<uint8_t> pattern((size_t)m_rowBytes * height);
+
+			for (unsigned band = 0; band < 2; band++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					const bool moving = signal && x >= movingLeft && x < movingLeft + movingWidth;
+					uint16_t luma, blue, red;
+					if (!signal)
+					{
+						luma = kBarY[7]; blue = kBarCb[7]; red = kBarCr[7];
+					}
+					else if (moving)
+					{
+						luma = 940; blue = 512; red = 512;
+					}
+					else if (band == 0)
+					{
+						const int bar = x * 8 / width;
+						luma = kBarY[bar]; blue = kBarCb[bar]; red = kBarCr[bar];
+					}
+					else
+					{
+						luma = (uint16_t)(64 + (940 - 64) * x / std::max(width - 1, 1)); blue = 512; red = 512;
+					}
+
+					y[x] = luma;
+					if (x % 2 == 0)
+					{
+						cb[x / 2] = blue;
+						cr[x / 2] = red;
+					}
+				}
+				packV210Row(y.data(), cb.data(), cr.data(), width, (band == 0) ? barsRow.data() : rampRow.data());
+			}
+
+			for (int row = 0; row < height; row++)
+				memcpy(pattern.data() + (size_t)row * m_rowBytes, (row < barsHeight) ? barsRow.data() : rampRow.data(), m_rowBytes);
+			m_patterns[eyeIdx].push_back(std::move(pattern));
+		}
+	}
+}
+
+void SimulatedDeckLink::streamThread()
+{
+	const SimulatedMode& mode = *m_mode;
+	const bool stereo = !m_patterns[kEyeRight].empty();
+	const BMDFrameFlags flags = (mode.mode == m_signalMode) ? bmdFrameFlagDefault : bmdFrameHasNoInputSource;
+	const double frameDurationUs = (m_speed > 0.0) ? mode.frameDuration * (double)kMicrosecondsPerSecond / mode.timeScale / m_speed : 0.0;
+	std::chrono::steady_clock::time_point lastStats = std::chrono::steady_clock::now();
+	const int64_t startUs = m_startUs;
+	int64_t frameIdx = 0;
+
+	while (m_streaming)
+	{
+		int64_t nowUs = steadyClockMicroseconds();
+
+		if (frameDurationUs > 0.0)
+		{
+			const int64_t dueUs = startUs + (int64_t)(frameIdx * frameDurationUs);
+			if (dueUs - nowUs > kSpinUs)
+				std::this_thread::sleep_for(std::chrono::microseconds(dueUs - nowUs - kSpinUs));
+			while ((nowUs = steadyClockMicroseconds()) < dueUs && m_streaming)
+				std::this_thread::yield();
+
+			// the card only buffers a few frames for a callback that keeps it waiting
+			const int64_t behind = (int64_t)((nowUs - dueUs) / frameDurationUs);
+			if (behind >= kCardFrameBuffers)
+			{
+				m_framesDropped += behind;
+				frameIdx += behind;
+			}
+		}
+
+		const size_t patternIdx = (size_t)(frameIdx % (int64_t)m_patterns[kEyeLeft].size());
+		SimulatedVideoFrame* rightEye = stereo ?
+			new SimulatedVideoFrame(mode, m_rowBytes, m_patterns[kEyeRight][patternIdx].data(), flags, frameIdx * mode.frameDuration, nowUs, nullptr) : nullptr;
+		SimulatedVideoFrame* frame = new SimulatedVideoFrame(mode, m_rowBytes, m_patterns[kEyeLeft][patternIdx].data(), flags, frameIdx * mode.frameDuration, nowUs, rightEye);
+
+		IDeckLinkInputCallback* callback;
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			callback = m_callback;
+			if (callback)
+				callback->AddRef();
+		}
+		if (callback)
+		{
+			const int64_t callbackStartUs = steadyClockMicroseconds();
+			callback->VideoInputFrameArrived(frame, nullptr);
+			const uint64_t callbackUs = (uint64_t)(steadyClockMicroseconds() - callbackStartUs);
+			callback->Release();
+
+			m_callbackTotalUs += callbackUs;
+			if (callbackUs > m_callbackMaxUs)
+				m_callbackMaxUs = callbackUs;
+			++m_framesDelivered;
+		}
+		frame->Release();
+		frameIdx++;
+
+		if (std::chrono::steady_clock::now() - lastStats >= kStatsInterval)
+		{
+			printStats();
+			lastStats = std::chrono::steady_clock::now();
+		}
+	}
+}
+
+void SimulatedDeckLink::notifySubscribers(BMDNotifications topic, uint64_t param1, uint64_t param2)
+{
+	std::vector<IDeckLinkNotificationCallback*> subscribers;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		subscribers = m_subscribers;
+		for (IDeckLinkNotificationCallback* subscriber : subscribers)
+			subscriber->AddRef();
+	}
+
+	for (IDeckLinkNotificationCallback* subscriber : subscribers)
+	{
+		subscriber->Notify(topic, param1, param2);
+		subscriber->Release();
+	}
+}
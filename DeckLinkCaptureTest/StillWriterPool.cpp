@@ -0,0 +1,324 @@
+// still image export: a pool of threads that convert frames to BGR and write TIFF/PNG files
+#include "StillWriterPool.h"
+#include "FrameArchiveFormat.h"
+#include "LatencyTracker.h"
+#include "MetricsRegistry.h"
+#include "TraceRecorder.h"
+#include "V210Unpack.h"
+
+#include <stdio.h>
+
+// how often the pool prints its statistics while writing
+static const int64_t kStatsIntervalUs = 10 * 1000000;
+
+// libtiff compression schemes, as taken by cv::IMWRITE_TIFF_COMPRESSION
+static const int kTiffCompressionNone = 1;
+static const int kTiffCompressionLzw = 5;
+
+// pixels between an overlay label and the bottom left corner of the still
+static const int kOverlayMargin = 24;
+
+// HH:MM:SS:FF of a frame's stream time
+static void splitTimecode(const CaptureFrame& frame, unsigned& hours, unsigned& minutes, unsigned& seconds, unsigned& frames)
+{
+	const int64_t timeScale = (frame.timeScale > 0) ? frame.timeScale : 1;
+	const int64_t frameDuration = (frame.streamDuration > 0) ? frame.streamDuration : timeScale;
+	frames = (unsigned)((frame.streamTime % timeScale) / frameDuration);
+	seconds = (unsigned)((frame.streamTime / timeScale) % 60);
+	minutes = (unsigned)((frame.streamTime / timeScale / 60) % 60);
+	hours = (unsigned)(frame.streamTime / timeScale / 60 / 60);
+}
+
+StillWriterPool::StillWriterPool(unsigned threadCount, unsigned queueDepth) :
+	m_queue(queueDepth),
+	m_threadCount(threadCount > 0 ? threadCount : 1),
+	m_running(false),
+	m_depths(kStillDepth16),
+	m_decodeTime(nullptr),
+	m_overlay(false),
+	m_overlayFont(cv::FONT_HERSHEY_SIMPLEX),
+	m_overlayScale(1.0),
+	m_overlayThickness(1),
+	m_overlayCount(0),
+	m_overlayTotalUs(0),
+	m_stillsWritten(0),
+	m_writeErrors(0),
+	m_framesWritten(0),
+	m_writeTotalUs(0),
+	m_writeMaxUs(0),
+	m_lagTotalUs(0),
+	m_lagLastUs(0),
+	m_lastStatsUs(0)
+{
+}
+
+StillWriterPool::~StillWriterPool()
+{
+	stop();
+}
+
+bool StillWriterPool::start(const std::string& pathTemplate, unsigned depths, int compressionLevel)
+{
+	if (m_running || depths == 0)
+		return false;
+
+	m_pathTemplate = pathTemplate;
+	m_depths = depths;
+	m_writeParams = {
+		cv::IMWRITE_PNG_COMPRESSION, compressionLevel,
+		cv::IMWRITE_TIFF_COMPRESSION, (compressionLevel > 0) ? kTiffCompressionLzw : kTiffCompressionNone
+	};
+
+	m_stillsWritten = 0;
+	m_writeErrors = 0;
+	m_framesWritten = 0;
+	m_writeTotalUs = 0;
+	m_writeMaxUs = 0;
+	m_lagTotalUs = 0;
+	m_lagLastUs = 0;
+	m_overlayCount = 0;
+	m_overlayTotalUs = 0;
+	m_lastStatsUs = steadyClockMicroseconds();
+
+	printf("Stills: %u threads writing %s%s\n", m_threadCount, pathTemplate.c_str(), m_overlay ? ", labelled" : "");
+
+	m_running = true;
+	for (unsigned threadIdx = 0; threadIdx < m_threadCount; threadIdx++)
+		m_writers.push_back(std::thread(&StillWriterPool::writerThread, this));
+	return true;
+}
+
+bool StillWriterPool::submit(const CaptureFrame& frame)
+{
+	if (m_running && m_depths == 0)
+	{
+		// nothing to write; not a drop
+		CaptureFrame skipped = frame;
+		skipped.release();
+		return true;
+	}
+
+	if (m_running && m_queue.tryPush(frame))
+		return true;
+
+	CaptureFrame dropped = frame;
+	dropped.release();
+	return false;
+}
+
+void StillWriterPool::setOverlay(int fontFace, double fontScale, int thickness, const cv::Scalar& color)
+{
+	if (m_running)
+		return;
+
+	m_overlay = true;
+	m_overlayFont = fontFace;
+	m_overlayScale = fontScale;
+	m_overlayThickness = thickness;
+	m_overlayColor = color;
+}
+
+void StillWriterPool::setDepths(unsigned depths)
+{
+	m_depths = depths;
+}
+
+void StillWriterPool::stop()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	m_queue.close();
+	for (std::thread& writer : m_writers)
+		writer.join();
+	m_writers.clear();
+
+	printStats();
+}
+
+StillWriterStats StillWriterPool::stats()
+{
+	StillWriterStats stats = {};
+	const uint64_t framesWritten = m_framesWritten;
+
+	stats.stillsWritten = m_stillsWritten;
+	stats.framesDropped = m_queue.dropCount();
+	stats.writeErrors = m_writeErrors;
+	stats.queueDepth = m_queue.depth();
+	stats.meanWriteMs = framesWritten ? (m_writeTotalUs / 1000.0) / framesWritten : 0.0;
+	stats.maxWriteMs = m_writeMaxUs / 1000.0;
+	stats.lastLagMs = m_lagLastUs / 1000.0;
+	stats.meanLagMs = framesWritten ? (m_lagTotalUs / 1000.0) / framesWritten : 0.0;
+	stats.meanOverlayUs = m_overlayCount ? (double)m_overlayTotalUs / m_overlayCount : 0.0;
+	return stats;
+}
+
+std::string StillWriterPool::expandPath(const std::string& pathTemplate, const CaptureFrame& frame, unsigned eye, unsigned depth)
+{
+	unsigned hours, minutes, seconds, frames;
+	splitTimecode(frame, hours, minutes, seconds, frames);
+	std::string path;
+	char value[64];
+	size_t position = 0;
+
+	while (position < pathTemplate.size())
+	{
+		const size_t open = pathTemplate.find('{', position);
+		const size_t close = (open == std::string::npos) ? std::string::npos : pathTemplate.find('}', open);
+		if (close == std::string::npos)
+		{
+			path.append(pathTemplate, position, std::string::npos);
+			break;
+		}
+
+		path.append(pathTemplate, position, open - position);
+		const std::string token = pathTemplate.substr(open + 1, close - open - 1);
+		if (token == "device")
+			snprintf(value, sizeof(value), "%u", frame.deviceIndex);
+		else if (token == "frame")
+			snprintf(value, sizeof(value), "%06llu", (unsigned long long)frame.frameNumber);
+		else if (token == "timecode")
+			snprintf(value, sizeof(value), "%02u-%02u-%02u-%02u", hours, minutes, seconds, frames);
+		else if (token == "eye")
+			snprintf(value, sizeof(value), "%s", (eye == kEyeLeft) ? "L" : "R");
+		else if (token == "depth")
+			snprintf(value, sizeof(value), "%u", depth);
+		else
+			snprintf(value, sizeof(value), "{%s}", token.c_str());	// not ours; leave it alone
+		path += value;
+		position = close + 1;
+	}
+
+	return path;
+}
+
+void StillWriterPool::writerThread()
+{
+	TraceRecorder::nameThread("still writer");
+
+	// reused for every frame this thread writes
+	WriterState state;
+	CaptureFrame frame;
+
+	// keep going after stop() until the queue has been drained
+	while (m_running || m_queue.depth() > 0)
+	{
+		if (!m_queue.pop(frame, std::chrono::milliseconds(100)))
+			continue;
+
+		const int64_t startUs = steadyClockMicroseconds();
+		if (writeFrame(frame, state))
+			recordLatency(frame, kLatencyStillsWritten);
+		else
+			++m_writeErrors;
+
+		const int64_t doneUs = steadyClockMicroseconds();
+		const uint64_t writeUs = (uint64_t)(doneUs - startUs);
+		uint64_t maxUs = m_writeMaxUs;
+		while (writeUs > maxUs && !m_writeMaxUs.compare_exchange_weak(maxUs, writeUs))
+			;
+		m_writeTotalUs += writeUs;
+		if (frame.arrivalTime != 0)
+		{
+			const uint64_t lagUs = (uint64_t)(doneUs - frame.arrivalTime);
+			m_lagLastUs = lagUs;
+			m_lagTotalUs += lagUs;
+		}
+		++m_framesWritten;
+		frame.release();
+
+		// whichever thread notices first prints the statistics
+		int64_t lastStatsUs = m_lastStatsUs;
+		if (doneUs - lastStatsUs >= kStatsIntervalUs && m_lastStatsUs.compare_exchange_strong(lastStatsUs, doneUs))
+			printStats();
+	}
+}
+
+bool StillWriterPool::writeFrame(const CaptureFrame& frame, WriterState& state)
+{
+	cv::Mat& bgr16 = state.bgr16;
+	cv::Mat& bgr8 = state.bgr8;
+	const unsigned depths = m_depths;
+	bool ok = true;
+
+	if (frame.pixelFormat != kArchivePixelFormatV210)
+		return false;
+
+	for (unsigned eyeIdx = 0; eyeIdx < frame.eyeCount(); eyeIdx++)
+	{
+		{
+			TraceSpan convertSpan("v210 to BGR48", frame.frameNumber);
+			const std::chrono::steady_clock::time_point convertStart = std::chrono::steady_clock::now();
+			bgr16.create(frame.height, frame.width, CV_16UC3);
+			convertV210ToBgr48(frame.eye[eyeIdx]->GetBytes(), (size_t)frame.rowBytes, frame.width, frame.height, (uint16_t*)bgr16.data, bgr16.step);
+			if (m_decodeTime)
+				m_decodeTime->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - convertStart).count());
+		}
+		if (eyeIdx + 1 == frame.eyeCount())
+			recordLatency(frame, kLatencyStillsDecoded);
+
+		if (depths & kStillDepth16)
+		{
+			// drawn at 16 bits, the label carries over into the 8-bit still as well
+			if (m_overlay)
+				drawOverlay(frame, eyeIdx, bgr16, state.overlay16);
+
+			TraceSpan writeSpan("imwrite 16-bit", frame.frameNumber);
+			if (cv::imwrite(expandPath(m_pathTemplate, frame, eyeIdx, 16), bgr16, m_writeParams))
+				++m_stillsWritten;
+			else
+				ok = false;
+		}
+
+		if (depths & kStillDepth8)
+		{
+			{
+				TraceSpan convertSpan("convert to 8-bit", frame.frameNumber);
+				bgr16.convertTo(bgr8, CV_8U, 1.0 / 257.0);
+			}
+			if (m_overlay && !(depths & kStillDepth16))
+				drawOverlay(frame, eyeIdx, bgr8, state.overlay8);
+
+			TraceSpan writeSpan("imwrite 8-bit", frame.frameNumber);
+			if (cv::imwrite(expandPath(m_pathTemplate, frame, eyeIdx, 8), bgr8, m_writeParams))
+				++m_stillsWritten;
+			else
+				ok = false;
+		}
+	}
+
+	return ok;
+}
+
+void StillWriterPool::drawOverlay(const CaptureFrame& frame, unsigned eye, cv::Mat& image, std::unique_ptr<TextOverlay>& overlay)
+{
+	// the atlas for the depth is rendered once, by whichever thread needs it first
+	if (!overlay)
+		overlay.reset(new TextOverlay(GlyphAtlas::get(m_overlayFont, m_overlayScale, m_overlayThickness, image.depth()), m_overlayColor));
+
+	TraceSpan overlaySpan("overlay", frame.frameNumber);
+	const int64_t startUs = steadyClockMicroseconds();
+	unsigned hours, minutes, seconds, frames;
+	splitTimecode(frame, hours, minutes, seconds, frames);
+
+	char label[64];
+	if (frame.eyeCount() > 1)
+		snprintf(label, sizeof(label), "%02u:%02u:%02u:%02u  #%u %s", hours, minutes, seconds, frames, frame.deviceIndex, (eye == kEyeLeft) ? "L" : "R");
+	else
+		snprintf(label, sizeof(label), "%02u:%02u:%02u:%02u  #%u", hours, minutes, seconds, frames, frame.deviceIndex);
+	overlay->draw(image, label, cv::Point(kOverlayMargin, image.rows - kOverlayMargin - overlay->height()));
+
+	m_overlayTotalUs += (uint64_t)(steadyClockMicroseconds() - startUs);
+	++m_overlayCount;
+}
+
+void StillWriterPool::printStats()
+{
+	StillWriterStats current = stats();
+	printf("Stills: %llu written, %llu frames dropped, %llu errors, queue %u, per frame mean %.1f / max %.1f ms, lag last %.1f / mean %.1f ms\n",
+		(unsigned long long)current.stillsWritten, (unsigned long long)current.framesDropped, (unsigned long long)current.writeErrors,
+		current.queueDepth, current.meanWriteMs, current.maxWriteMs, current.lastLagMs, current.meanLagMs);
+	if (m_overlay)
+		printf("Stills: label overlay mean %.1f us per still\n", current.meanOverlayUs);
+}
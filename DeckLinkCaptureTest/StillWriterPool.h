@@ -0,0 +1,109 @@
+// still image export: a pool of threads that convert frames to BGR and write TIFF/PNG files
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "CaptureFrame.h"
+#include "FrameQueue.h"
+#include "TextOverlay.h"
+
+class MetricHistogram;
+
+// bit depths to write, combined
+const unsigned	kStillDepth8 = 1 << 0;		// CV_8UC3
+const unsigned	kStillDepth16 = 1 << 1;		// CV_16UC3
+
+struct StillWriterStats
+{
+	uint64_t	stillsWritten;
+	uint64_t	framesDropped;		// refused because the queue was full
+	uint64_t	writeErrors;
+	unsigned	queueDepth;			// frames waiting for a writer thread
+	double		meanWriteMs;		// conversion and encoding of one frame, all eyes and depths
+	double		maxWriteMs;
+	double		lastLagMs;			// frame arrival to its last file being written
+	double		meanLagMs;
+	double		meanOverlayUs;		// drawing the label into one image, when there is one
+};
+
+// Every thread takes whole frames off one shared queue, so frames are written in parallel and
+// each thread converts into its own reused images. File names come from a template with
+//   {device} {frame} {timecode} {eye} {depth}
+// where {timecode} is HH-MM-SS-FF from the stream time, {eye} is L or R and {depth} is 8 or 16.
+// The extension picks the encoder (.tif, .png). With an overlay, the timecode, device and eye are
+// burned into the stills; only the stills, as they are decoded copies, never the frames themselves
+class StillWriterPool
+{
+public:
+	StillWriterPool(unsigned threadCount, unsigned queueDepth);
+	~StillWriterPool();
+
+	// compressionLevel is the PNG zlib level (0-9); TIFF is written uncompressed at 0 and LZW otherwise
+	bool		start(const std::string& pathTemplate, unsigned depths, int compressionLevel);
+
+	// hands a frame to the pool without blocking. The pool takes over the caller's buffer
+	// references, and releases them itself if the frame has to be dropped
+	bool		submit(const CaptureFrame& frame);
+
+	// changes the depths written from the next frame on; with none, frames are turned away unqueued
+	void		setDepths(unsigned depths);
+	unsigned	depths() const { return m_depths; }
+
+	// times the conversion of every eye to BGR into decodeTime, in seconds; set before start()
+	void		setDecodeTimeMetric(MetricHistogram* decodeTime) { m_decodeTime = decodeTime; }
+
+	// labels every still with its timecode, device and eye in a Hershey font; set before start()
+	void		setOverlay(int fontFace, double fontScale, int thickness, const cv::Scalar& color);
+
+	// writes everything still queued, then stops the threads
+	void		stop();
+
+	bool		isRunning() const { return m_running; }
+	StillWriterStats	stats();
+
+	static std::string	expandPath(const std::string& pathTemplate, const CaptureFrame& frame, unsigned eye, unsigned depth);
+
+private:
+	// what one writer thread reuses from frame to frame
+	struct WriterState
+	{
+		cv::Mat		bgr16;
+		cv::Mat		bgr8;
+		std::unique_ptr<TextOverlay>	overlay16;
+		std::unique_ptr<TextOverlay>	overlay8;
+	};
+
+	void		writerThread();
+	bool		writeFrame(const CaptureFrame& frame, WriterState& state);
+	void		drawOverlay(const CaptureFrame& frame, unsigned eye, cv::Mat& image, std::unique_ptr<TextOverlay>& overlay);
+	void		printStats();
+
+	FrameQueue					m_queue;
+	std::vector<std::thread>	m_writers;
+	unsigned					m_threadCount;
+	std::atomic<bool>			m_running;
+	std::string					m_pathTemplate;
+	std::atomic<unsigned>		m_depths;
+	std::vector<int>			m_writeParams;
+	MetricHistogram*			m_decodeTime;
+	bool						m_overlay;
+	int							m_overlayFont;
+	double						m_overlayScale;
+	int							m_overlayThickness;
+	cv::Scalar					m_overlayColor;
+	std::atomic<uint64_t>		m_overlayCount;
+	std::atomic<uint64_t>		m_overlayTotalUs;
+	std::atomic<uint64_t>		m_stillsWritten;
+	std::atomic<uint64_t>		m_writeErrors;
+	std::atomic<uint64_t>		m_framesWritten;
+	std::atomic<uint64_t>		m_writeTotalUs;
+	std::atomic<uint64_t>		m_writeMaxUs;
+	std::atomic<uint64_t>		m_lagTotalUs;
+	std::atomic<uint64_t>		m_lagLastUs;
+	std::atomic<int64_t>		m_lastStatsUs;
+};
@@ -0,0 +1,375 @@
+// lossless compression of frame payloads in independent stripes, one stripe per thread
+#include "StripeCompressor.h"
+#include "TraceRecorder.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "lz4.lib")
+#endif
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "zstd.lib")
+#endif
+#endif
+
+static uint64_t elapsedUs(std::chrono::steady_clock::time_point start)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+StripeCompressor::StripeCompressor(CompressionCodec codec, int level, unsigned threadCount) :
+	m_codec(codec),
+	m_level(level),
+	m_generation(0),
+	m_activeWorkers(0),
+	m_stopping(false),
+	m_task(nullptr),
+	m_taskStripes(0),
+	m_nextStripe(0),
+	m_stripesDone(0),
+	m_source(nullptr),
+	m_destination(nullptr),
+	m_destinationBytes(0),
+	m_stripes(nullptr),
+	m_stripeFailed(false),
+	m_payloadsCompressed(0),
+	m_rawBytes(0),
+	m_storedBytes(0),
+	m_stripeCount(0),
+	m_stripeTotalUs(0),
+	m_stripeMaxUs(0),
+	m_stripeLastUs(0),
+	m_wallTotalUs(0),
+	m_lastPayloadBytes(0),
+	m_lastPayloadUs(0)
+{
+	if (threadCount == 0)
+		threadCount = 1;
+
+	m_compressContexts.resize(threadCount, nullptr);
+	m_decompressContexts.resize(threadCount, nullptr);
+#ifdef HAVE_ZSTD
+	if (m_codec == kCompressionZstd)
+	{
+		for (unsigned threadIdx = 0; threadIdx < threadCount; threadIdx++)
+		{
+			m_compressContexts[threadIdx] = ZSTD_createCCtx();
+			m_decompressContexts[threadIdx] = ZSTD_createDCtx();
+		}
+	}
+#endif
+
+	for (unsigned threadIdx = 0; threadIdx + 1 < threadCount; threadIdx++)
+		m_workers.push_back(std::thread(&StripeCompressor::workerThread, this, threadIdx));
+}
+
+StripeCompressor::~StripeCompressor()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_workReady.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+
+#ifdef HAVE_ZSTD
+	for (void* context : m_compressContexts)
+		ZSTD_freeCCtx((ZSTD_CCtx*)context);
+	for (void* context : m_decompressContexts)
+		ZSTD_freeDCtx((ZSTD_DCtx*)context);
+#endif
+}
+
+bool StripeCompressor::isAvailable(CompressionCodec codec)
+{
+	switch (codec)
+	{
+	case kCompressionNone:
+		return true;
+#ifdef HAVE_LZ4
+	case kCompressionLZ4:
+		return true;
+#endif
+#ifdef HAVE_ZSTD
+	case kCompressionZstd:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* StripeCompressor::codecName(CompressionCodec codec)
+{
+	switch (codec)
+	{
+	case kCompressionNone:	return "none";
+	case kCompressionLZ4:	return "LZ4";
+	case kCompressionZstd:	return "zstd";
+	default:				return "unknown";
+	}
+}
+
+size_t StripeCompressor::maxStoredBytes(size_t rawBytes, unsigned stripeCount)
+{
+	// a stripe that does not shrink is stored raw, so only the table is overhead
+	return sizeof(StripeTableHeader) + std::max(stripeCount, 1u) * sizeof(StripeEntry) + rawBytes;
+}
+
+size_t StripeCompressor::compress(const uint8_t* raw, size_t rawBytes, size_t rowBytes, unsigned stripeCount, uint8_t* stored, size_t storedCapacity)
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const size_t rows = (rowBytes > 0) ? std::max(rawBytes / rowBytes, (size_t)1) : 1;
+	size_t rowsPerStripe;
+	size_t tableBytes;
+	size_t storedOffset;
+
+	if (rowBytes == 0)
+		rowBytes = rawBytes;
+	stripeCount = (unsigned)std::min(std::max((size_t)stripeCount, (size_t)1), rows);
+	rowsPerStripe = (rows + stripeCount - 1) / stripeCount;
+	stripeCount = (unsigned)((rows + rowsPerStripe - 1) / rowsPerStripe);
+
+	tableBytes = sizeof(StripeTableHeader) + stripeCount * sizeof(StripeEntry);
+	if (storedCapacity < tableBytes)
+		return 0;
+
+	StripeTableHeader* table = (StripeTableHeader*)stored;
+	table->magic = kStripeTableMagic;
+	table->stripeCount = stripeCount;
+	table->rawBytes = rawBytes;
+
+	m_stripes = (StripeEntry*)(stored + sizeof(StripeTableHeader));
+	if (m_scratch.size() < stripeCount)
+		m_scratch.resize(stripeCount);
+	for (unsigned stripeIdx = 0; stripeIdx < stripeCount; stripeIdx++)
+	{
+		// the last stripe also takes any bytes after the last whole row
+		StripeEntry& stripe = m_stripes[stripeIdx];
+		stripe.rawOffset = stripeIdx * rowsPerStripe * rowBytes;
+		stripe.rawBytes = (uint32_t)((stripeIdx + 1 == stripeCount) ? rawBytes - stripe.rawOffset : rowsPerStripe * rowBytes);
+		stripe.storedOffset = 0;
+		stripe.storedBytes = 0;
+		if (m_scratch[stripeIdx].size() < stripe.rawBytes)
+			m_scratch[stripeIdx].resize(stripe.rawBytes);
+	}
+
+	m_source = raw;
+	runStripes(stripeCount, &StripeCompressor::compressStripe);
+
+	// pack the stripes behind the table
+	storedOffset = tableBytes;
+	for (unsigned stripeIdx = 0; stripeIdx < stripeCount; stripeIdx++)
+	{
+		StripeEntry& stripe = m_stripes[stripeIdx];
+		const uint8_t* data = (stripe.storedBytes == stripe.rawBytes) ? raw + stripe.rawOffset : m_scratch[stripeIdx].data();
+		if (storedOffset + stripe.storedBytes > storedCapacity)
+			return 0;
+
+		memcpy(stored + storedOffset, data, stripe.storedBytes);
+		stripe.storedOffset = storedOffset;
+		storedOffset += stripe.storedBytes;
+	}
+
+	const uint64_t wallUs = elapsedUs(start);
+	++m_payloadsCompressed;
+	m_rawBytes += rawBytes;
+	m_storedBytes += storedOffset;
+	m_wallTotalUs += wallUs;
+	m_lastPayloadBytes = rawBytes;
+	m_lastPayloadUs = wallUs;
+	return storedOffset;
+}
+
+bool StripeCompressor::decompress(const uint8_t* stored, size_t storedBytes, uint8_t* raw, size_t rawBytes)
+{
+	const StripeTableHeader* table = (const StripeTableHeader*)stored;
+
+	if (storedBytes < sizeof(StripeTableHeader) || table->magic != kStripeTableMagic || table->rawBytes != rawBytes
+		|| table->stripeCount == 0 || sizeof(StripeTableHeader) + table->stripeCount * sizeof(StripeEntry) > storedBytes)
+		return false;
+
+	// the table is only read while decompressing
+	m_stripes = (StripeEntry*)(stored + sizeof(StripeTableHeader));
+	for (unsigned stripeIdx = 0; stripeIdx < table->stripeCount; stripeIdx++)
+	{
+		const StripeEntry& stripe = m_stripes[stripeIdx];
+		if (stripe.rawOffset + stripe.rawBytes > rawBytes || stripe.storedOffset + stripe.storedBytes > storedBytes)
+			return false;
+	}
+
+	m_source = stored;
+	m_destination = raw;
+	m_destinationBytes = rawBytes;
+	m_stripeFailed = false;
+	runStripes(table->stripeCount, &StripeCompressor::decompressStripe);
+	return !m_stripeFailed;
+}
+
+CompressionStats StripeCompressor::stats() const
+{
+	CompressionStats stats = {};
+	const uint64_t stripeCount = m_stripeCount;
+	const uint64_t lastPayloadUs = m_lastPayloadUs;
+	const uint64_t wallTotalUs = m_wallTotalUs;
+
+	stats.payloadsCompressed = m_payloadsCompressed;
+	stats.rawBytes = m_rawBytes;
+	stats.storedBytes = m_storedBytes;
+	stats.ratio = stats.storedBytes ? (double)stats.rawBytes / stats.storedBytes : 0.0;
+	stats.lastStripeMs = m_stripeLastUs / 1000.0;
+	stats.meanStripeMs = stripeCount ? (m_stripeTotalUs / 1000.0) / stripeCount : 0.0;
+	stats.maxStripeMs = m_stripeMaxUs / 1000.0;
+	stats.lastMBps = lastPayloadUs ? (double)m_lastPayloadBytes / lastPayloadUs : 0.0;
+	stats.meanMBps = wallTotalUs ? (double)stats.rawBytes / wallTotalUs : 0.0;
+	stats.threadCount = threadCount();
+	return stats;
+}
+
+// hands stripeCount stripes to the workers and works on them from this thread too; returns when all are done
+void StripeCompressor::runStripes(unsigned stripeCount, StripeTask task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = task;
+		m_taskStripes = stripeCount;
+		m_nextStripe = 0;
+		m_stripesDone = 0;
+		++m_generation;
+	}
+	m_workReady.notify_all();
+
+	workOnStripes((unsigned)m_workers.size(), task, stripeCount);
+
+	// the job may only change again once every worker has left it
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_workDone.wait(lock, [this] { return m_stripesDone == m_taskStripes && m_activeWorkers == 0; });
+}
+
+void StripeCompressor::workOnStripes(unsigned threadIdx, StripeTask task, unsigned stripeCount)
+{
+	unsigned stripeIdx;
+	while ((stripeIdx = m_nextStripe++) < stripeCount)
+	{
+		(this->*task)(stripeIdx, threadIdx);
+		++m_stripesDone;
+	}
+}
+
+void StripeCompressor::workerThread(unsigned threadIdx)
+{
+	TraceRecorder::nameThread("stripe compressor", threadIdx);
+
+	uint64_t seenGeneration = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		m_workReady.wait(lock, [&] { return m_stopping || m_generation != seenGeneration; });
+		if (m_stopping)
+			return;
+
+		// a worker waking after every stripe was taken is too late for this job, which runStripes()
+		// may already have returned from; joining it could race the next one being set up
+		seenGeneration = m_generation;
+		if (m_nextStripe >= m_taskStripes)
+			continue;
+
+		const StripeTask task = m_task;
+		const unsigned stripeCount = m_taskStripes;
+		++m_activeWorkers;
+		lock.unlock();
+
+		workOnStripes(threadIdx, task, stripeCount);
+
+		lock.lock();
+		--m_activeWorkers;
+		m_workDone.notify_all();
+	}
+}
+
+void StripeCompressor::compressStripe(unsigned stripeIdx, unsigned threadIdx)
+{
+	TraceSpan stripeSpan("compress stripe");
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	StripeEntry& stripe = m_stripes[stripeIdx];
+	size_t compressed = 0;
+
+	// the output buffer is only as large as the input, so a stripe that would grow fails and is stored raw
+	switch (m_codec)
+	{
+#ifdef HAVE_LZ4
+	case kCompressionLZ4:
+	{
+		const uint8_t* source = m_source + stripe.rawOffset;
+		uint8_t* destination = m_scratch[stripeIdx].data();
+		const int written = LZ4_compress_fast((const char*)source, (char*)destination, (int)stripe.rawBytes, (int)stripe.rawBytes, std::max(m_level, 1));
+		compressed = (written > 0) ? (size_t)written : 0;
+		break;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case kCompressionZstd:
+	{
+		const uint8_t* source = m_source + stripe.rawOffset;
+		uint8_t* destination = m_scratch[stripeIdx].data();
+		const size_t written = ZSTD_compressCCtx((ZSTD_CCtx*)m_compressContexts[threadIdx], destination, stripe.rawBytes, source, stripe.rawBytes, m_level);
+		compressed = ZSTD_isError(written) ? 0 : written;
+		break;
+	}
+#endif
+	default:
+		break;
+	}
+
+	stripe.storedBytes = (compressed > 0 && compressed < stripe.rawBytes) ? (uint32_t)compressed : stripe.rawBytes;
+
+	const uint64_t stripeUs = elapsedUs(start);
+	uint64_t maxUs = m_stripeMaxUs;
+	while (stripeUs > maxUs && !m_stripeMaxUs.compare_exchange_weak(maxUs, stripeUs))
+		;
+	m_stripeLastUs = stripeUs;
+	m_stripeTotalUs += stripeUs;
+	++m_stripeCount;
+}
+
+void StripeCompressor::decompressStripe(unsigned stripeIdx, unsigned threadIdx)
+{
+	const StripeEntry& stripe = m_stripes[stripeIdx];
+	const uint8_t* source = m_source + stripe.storedOffset;
+	uint8_t* destination = m_destination + stripe.rawOffset;
+	bool ok = false;
+
+	if (stripe.storedBytes == stripe.rawBytes)
+	{
+		memcpy(destination, source, stripe.rawBytes);
+		return;
+	}
+
+	switch (m_codec)
+	{
+#ifdef HAVE_LZ4
+	case kCompressionLZ4:
+		ok = LZ4_decompress_safe((const char*)source, (char*)destination, (int)stripe.storedBytes, (int)stripe.rawBytes) == (int)stripe.rawBytes;
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case kCompressionZstd:
+		ok = ZSTD_decompressDCtx((ZSTD_DCtx*)m_decompressContexts[threadIdx], destination, stripe.rawBytes, source, stripe.storedBytes) == stripe.rawBytes;
+		break;
+#endif
+	default:
+		break;
+	}
+
+	if (!ok)
+		m_stripeFailed = true;
+}
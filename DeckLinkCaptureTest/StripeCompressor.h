@@ -0,0 +1,112 @@
+// lossless compression of frame payloads in independent stripes, one stripe per thread
+// (stored layout described in FrameArchiveFormat.h)
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FrameArchiveFormat.h"
+
+#if __has_include(<lz4.h>)
+#define HAVE_LZ4 1
+#endif
+#if __has_include(<zstd.h>)
+#define HAVE_ZSTD 1
+#endif
+
+enum CompressionCodec
+{
+	kCompressionNone = kArchiveCompressionNone,
+	kCompressionLZ4 = kArchiveCompressionLZ4,		// level is the LZ4 acceleration; 1 is the default, higher is faster
+	kCompressionZstd = kArchiveCompressionZstd		// level is the zstd level; keep it at 1-3 for capture rates
+};
+
+struct CompressionStats
+{
+	uint64_t	payloadsCompressed;
+	uint64_t	rawBytes;
+	uint64_t	storedBytes;
+	double		ratio;				// raw / stored
+	double		lastStripeMs;
+	double		meanStripeMs;
+	double		maxStripeMs;
+	double		lastMBps;			// raw bytes per second of wall time, for the last payload
+	double		meanMBps;
+	unsigned	threadCount;
+};
+
+class StripeCompressor
+{
+public:
+	// threadCount includes the calling thread, which works on stripes too
+	StripeCompressor(CompressionCodec codec, int level, unsigned threadCount);
+	~StripeCompressor();
+
+	static bool			isAvailable(CompressionCodec codec);
+	static const char*	codecName(CompressionCodec codec);
+
+	CompressionCodec	codec() const { return m_codec; }
+	unsigned			threadCount() const { return (unsigned)m_workers.size() + 1; }
+
+	// largest stored size of a rawBytes payload cut into stripeCount stripes
+	static size_t		maxStoredBytes(size_t rawBytes, unsigned stripeCount);
+
+	// compresses rawBytes of rows rowBytes long into stored, cutting at row boundaries.
+	// Returns the stored size, or 0 if stored is too small
+	size_t		compress(const uint8_t* raw, size_t rawBytes, size_t rowBytes, unsigned stripeCount, uint8_t* stored, size_t storedCapacity);
+
+	// reverses compress(); rawBytes must match the size that was compressed
+	bool		decompress(const uint8_t* stored, size_t storedBytes, uint8_t* raw, size_t rawBytes);
+
+	CompressionStats	stats() const;
+
+private:
+	typedef void (StripeCompressor::*StripeTask)(unsigned stripeIdx, unsigned threadIdx);
+
+	void		runStripes(unsigned stripeCount, StripeTask task);
+	void		workOnStripes(unsigned threadIdx, StripeTask task, unsigned stripeCount);
+	void		workerThread(unsigned threadIdx);
+	void		compressStripe(unsigned stripeIdx, unsigned threadIdx);
+	void		decompressStripe(unsigned stripeIdx, unsigned threadIdx);
+
+	CompressionCodec			m_codec;
+	int							m_level;
+	std::vector<std::thread>	m_workers;
+	std::vector<void*>			m_compressContexts;		// per thread codec state (zstd)
+	std::vector<void*>			m_decompressContexts;
+	std::vector<std::vector<uint8_t>>	m_scratch;	// per stripe compression output
+
+	// the current job. A worker only joins a job while some of its stripes are still untaken, and
+	// runStripes() waits for every worker that joined to leave, so the job never changes under one;
+	// workers still take their copy of the task under m_mutex
+	std::mutex					m_mutex;
+	std::condition_variable		m_workReady;
+	std::condition_variable		m_workDone;
+	uint64_t					m_generation;
+	unsigned					m_activeWorkers;
+	bool						m_stopping;
+	StripeTask					m_task;
+	unsigned					m_taskStripes;
+	std::atomic<unsigned>		m_nextStripe;
+	std::atomic<unsigned>		m_stripesDone;
+	const uint8_t*				m_source;
+	uint8_t*					m_destination;
+	size_t						m_destinationBytes;
+	StripeEntry*				m_stripes;
+	std::atomic<bool>			m_stripeFailed;
+
+	std::atomic<uint64_t>		m_payloadsCompressed;
+	std::atomic<uint64_t>		m_rawBytes;
+	std::atomic<uint64_t>		m_storedBytes;
+	std::atomic<uint64_t>		m_stripeCount;
+	std::atomic<uint64_t>		m_stripeTotalUs;
+	std::atomic<uint64_t>		m_stripeMaxUs;
+	std::atomic<uint64_t>		m_stripeLastUs;
+	std::atomic<uint64_t>		m_wallTotalUs;
+	std::atomic<uint64_t>		m_lastPayloadBytes;
+	std::atomic<uint64_t>		m_lastPayloadUs;
+};
@@ -0,0 +1,150 @@
+// text overlays: labels burned into preview images from glyphs rendered once into a cached atlas
+#include "TextOverlay.h"
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+static const char kFirstGlyph = ' ';
+static const char kLastGlyph = '~';
+static const int kGlyphCount = kLastGlyph - kFirstGlyph + 1;
+
+std::shared_ptr<const GlyphAtlas> GlyphAtlas::get(int fontFace, double fontScale, int thickness, int depth)
+{
+	typedef std::tuple<int, double, int, int> AtlasKey;
+	static std::mutex s_mutex;
+	static std::map<AtlasKey, std::shared_ptr<const GlyphAtlas>> s_atlases;
+
+	std::lock_guard<std::mutex> guard(s_mutex);
+	std::shared_ptr<const GlyphAtlas>& atlas = s_atlases[AtlasKey(fontFace, fontScale, thickness, depth)];
+	if (!atlas)
+		atlas.reset(new GlyphAtlas(fontFace, fontScale, thickness, depth));
+	return atlas;
+}
+
+GlyphAtlas::GlyphAtlas(int fontFace, double fontScale, int thickness, int depth) :
+	m_depth(depth),
+	m_cellWidth(0),
+	m_cellHeight(0),
+	m_weightShift((depth == CV_16U) ? 16 : 8)
+{
+	// the widest glyph and the tallest ascent and descent make the cell, with room for the stroke
+	int ascent = 0;
+	int descent = 0;
+	for (char character = kFirstGlyph; character <= kLastGlyph; character++)
+	{
+		int baseline = 0;
+		const cv::Size size = cv::getTextSize(std::string(1, character), fontFace, fontScale, thickness, &baseline);
+		m_cellWidth = std::max(m_cellWidth, size.width);
+		ascent = std::max(ascent, size.height);
+		descent = std::max(descent, baseline);
+	}
+	const int margin = thickness / 2 + 1;
+	m_cellWidth += 2 * margin;
+	m_cellHeight = ascent + descent + 2 * margin;
+
+	const size_t cellWeights = (size_t)m_cellWidth * m_cellHeight;
+	const uint32_t opaque = 1u << m_weightShift;
+	m_weights.assign(cellWeights * kGlyphCount, 0);
+
+	cv::Mat coverage(m_cellHeight, m_cellWidth, CV_8UC1);
+	for (int glyphIdx = 0; glyphIdx < kGlyphCount; glyphIdx++)
+	{
+		coverage.setTo(cv::Scalar(0));
+		cv::putText(coverage, std::string(1, (char)(kFirstGlyph + glyphIdx)), cv::Point(margin, margin + ascent), fontFace, fontScale, cv::Scalar(255),
+			thickness, cv::LINE_AA);
+
+		uint32_t* weights = &m_weights[glyphIdx * cellWeights];
+		for (int row = 0; row < m_cellHeight; row++)
+		{
+			const uint8_t* alpha = coverage.ptr<uint8_t>(row);
+			for (int col = 0; col < m_cellWidth; col++)
+				*weights++ = (alpha[col] * opaque + 127) / 255;
+		}
+	}
+}
+
+const uint32_t* GlyphAtlas::glyph(char character) const
+{
+	if (character < kFirstGlyph || character > kLastGlyph)
+		character = kFirstGlyph;
+	return &m_weights[(size_t)(character - kFirstGlyph) * m_cellWidth * m_cellHeight];
+}
+
+TextOverlay::TextOverlay(const std::shared_ptr<const GlyphAtlas>& atlas, const cv::Scalar& color) :
+	m_atlas(atlas)
+{
+	const double scale = (atlas->depth() == CV_16U) ? 257.0 : 1.0;
+	for (int channel = 0; channel < 3; channel++)
+		m_color[channel] = (uint32_t)cv::saturate_cast<uint16_t>(color[channel] * scale);
+}
+
+void TextOverlay::layout(const char* text)
+{
+	const size_t length = strlen(text);
+	const int cellWidth = m_atlas->cellWidth();
+	const int cellHeight = m_atlas->cellHeight();
+	const size_t lineWidth = length * cellWidth;
+
+	// a line of another length is laid out again from scratch
+	if (length != m_text.size())
+	{
+		m_text.assign(length, '\0');
+		m_line.assign(lineWidth * cellHeight, 0);
+	}
+
+	for (size_t cellIdx = 0; cellIdx < length; cellIdx++)
+	{
+		if (text[cellIdx] == m_text[cellIdx])
+			continue;
+
+		const uint32_t* glyph = m_atlas->glyph(text[cellIdx]);
+		for (int row = 0; row < cellHeight; row++)
+			memcpy(&m_line[row * lineWidth + cellIdx * cellWidth], glyph + row * cellWidth, cellWidth * sizeof(uint32_t));
+		m_text[cellIdx] = text[cellIdx];
+	}
+}
+
+template <typename Pixel>
+void TextOverlay::blend(cv::Mat& image, cv::Point origin) const
+{
+	const int lineWidth = width(m_text.size());
+	const int left = std::max(origin.x, 0);
+	const int right = std::min(origin.x + lineWidth, image.cols);
+	const int top = std::max(origin.y, 0);
+	const int bottom = std::min(origin.y + height(), image.rows);
+	const unsigned shift = m_atlas->weightShift();
+	const uint32_t opaque = 1u << shift;
+
+	for (int y = top; y < bottom; y++)
+	{
+		const uint32_t* weights = &m_line[(size_t)(y - origin.y) * lineWidth + (left - origin.x)];
+		Pixel* pixel = image.ptr<Pixel>(y) + 3 * left;
+		for (int x = left; x < right; x++, weights++, pixel += 3)
+		{
+			const uint32_t weight = *weights;
+			if (weight == 0)
+				continue;
+
+			// fits 32 bits at 16-bit depth too: at most 65535 * 65536
+			const uint32_t keep = opaque - weight;
+			pixel[0] = (Pixel)((pixel[0] * keep + m_color[0] * weight) >> shift);
+			pixel[1] = (Pixel)((pixel[1] * keep + m_color[1] * weight) >> shift);
+			pixel[2] = (Pixel)((pixel[2] * keep + m_color[2] * weight) >> shift);
+		}
+	}
+}
+
+void TextOverlay::draw(cv::Mat& image, const char* text, cv::Point origin)
+{
+	if (image.depth() != m_atlas->depth() || image.channels() != 3)
+		return;
+
+	layout(text);
+	if (image.depth() == CV_16U)
+		blend<uint16_t>(image, origin);
+	else
+		blend<uint8_t>(image, origin);
+}
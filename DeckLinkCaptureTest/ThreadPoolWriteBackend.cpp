@@ -0,0 +1,103 @@
+// portable write backend: positional writes issued from a small pool of threads
+#include "ThreadPoolWriteBackend.h"
+#include "TraceRecorder.h"
+
+ThreadPoolWriteBackend::ThreadPoolWriteBackend(unsigned threadCount) :
+	m_threadCount(threadCount > 0 ? threadCount : 1),
+	m_stopping(false)
+{
+}
+
+ThreadPoolWriteBackend::~ThreadPoolWriteBackend()
+{
+	stop();
+}
+
+bool ThreadPoolWriteBackend::start()
+{
+	m_stopping = false;
+	for (unsigned threadIdx = 0; threadIdx < m_threadCount; threadIdx++)
+		m_workers.emplace_back(&ThreadPoolWriteBackend::workerThread, this);
+
+	return true;
+}
+
+void ThreadPoolWriteBackend::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_pendingMutex);
+		m_stopping = true;
+	}
+	m_pendingCondition.notify_all();
+
+	for (std::thread& worker : m_workers)
+	{
+		if (worker.joinable())
+			worker.join();
+	}
+	m_workers.clear();
+}
+
+bool ThreadPoolWriteBackend::submit(const WriteRequest* requests, unsigned count)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_pendingMutex);
+		if (m_stopping)
+			return false;
+
+		for (unsigned requestIdx = 0; requestIdx < count; requestIdx++)
+			m_pending.push_back(requests[requestIdx]);
+		m_inFlight += count;
+	}
+	m_pendingCondition.notify_all();
+	return true;
+}
+
+unsigned ThreadPoolWriteBackend::reap(WriteCompletion* completions, unsigned maxCompletions, bool wait)
+{
+	std::unique_lock<std::mutex> guard(m_completedMutex);
+	if (wait)
+		m_completedCondition.wait(guard, [this]() { return !m_completed.empty() || m_inFlight == 0; });
+
+	unsigned count = 0;
+	while (count < maxCompletions && !m_completed.empty())
+	{
+		completions[count++] = m_completed.back();
+		m_completed.pop_back();
+	}
+
+	m_inFlight -= count;
+	return count;
+}
+
+void ThreadPoolWriteBackend::workerThread()
+{
+	TraceRecorder::nameThread("write worker");
+
+	for (;;)
+	{
+		WriteRequest request;
+		{
+			std::unique_lock<std::mutex> guard(m_pendingMutex);
+			m_pendingCondition.wait(guard, [this]() { return m_stopping || !m_pending.empty(); });
+			if (m_pending.empty())
+				return;
+
+			request = m_pending.front();
+			m_pending.pop_front();
+		}
+
+		WriteCompletion completion;
+		completion.tag = request.tag;
+		{
+			TraceSpan writeSpan("write");
+			completion.ok = writeSync(request.data, request.bytes, request.offset);
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(m_completedMutex);
+			m_completed.push_back(completion);
+		}
+		m_completedCondition.notify_one();
+	}
+}
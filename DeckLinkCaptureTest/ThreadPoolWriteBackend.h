@@ -0,0 +1,38 @@
+// portable write backend: positional writes issued from a small pool of threads
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "WriteBackend.h"
+
+class ThreadPoolWriteBackend : public WriteBackend
+{
+public:
+	explicit ThreadPoolWriteBackend(unsigned threadCount);
+	virtual ~ThreadPoolWriteBackend();
+
+	virtual const char*	name() const override { return "thread pool"; }
+
+	virtual bool		submit(const WriteRequest* requests, unsigned count) override;
+	virtual unsigned	reap(WriteCompletion* completions, unsigned maxCompletions, bool wait) override;
+
+protected:
+	virtual bool		start() override;
+	virtual void		stop() override;
+
+private:
+	void				workerThread();
+
+	unsigned						m_threadCount;
+	std::vector<std::thread>		m_workers;
+	bool							m_stopping;
+	std::deque<WriteRequest>		m_pending;
+	std::mutex						m_pendingMutex;
+	std::condition_variable			m_pendingCondition;
+	std::vector<WriteCompletion>	m_completed;
+	std::mutex						m_completedMutex;
+	std::condition_variable			m_completedCondition;
+};
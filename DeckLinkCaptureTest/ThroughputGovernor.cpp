@@ -0,0 +1,280 @@
+// recorder throughput governor: gives up optional work, one step at a time, before the recorder has to drop frames
+#include "ThroughputGovernor.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <deque>
+
+// how often the recorder is sampled
+static const std::chrono::milliseconds kSampleInterval(250);
+
+// samples the queue trend is fitted over; two seconds
+static const size_t kTrendSamples = 8;
+
+// a step is taken when the trend says the queue fills up within this
+static const double kLeadSeconds = 3.0;
+
+// writing below this share of the offered frame rate, with a queue a quarter full, is falling behind
+static const double kBehindRatio = 0.95;
+
+// how long a step gets to show its effect before the next one
+static const std::chrono::seconds kSettleTime(2);
+
+// weight of the newest sample in the smoothed rates; about a second's worth of samples
+static const double kRateSmoothing = 0.25;
+
+// how often the governor prints its statistics
+static const std::chrono::seconds kStatsInterval(10);
+
+struct QueueSample
+{
+	double		seconds;
+	double		depth;
+};
+
+// least-squares slope of the queue depth, in frames per second
+static double queueTrend(const std::deque<QueueSample>& samples)
+{
+	double meanSeconds = 0.0, meanDepth = 0.0, covariance = 0.0, variance = 0.0;
+
+	if (samples.size() < 2)
+		return 0.0;
+
+	for (const QueueSample& sample : samples)
+	{
+		meanSeconds += sample.seconds;
+		meanDepth += sample.depth;
+	}
+	meanSeconds /= samples.size();
+	meanDepth /= samples.size();
+
+	for (const QueueSample& sample : samples)
+	{
+		covariance += (sample.seconds - meanSeconds) * (sample.depth - meanDepth);
+		variance += (sample.seconds - meanSeconds) * (sample.seconds - meanSeconds);
+	}
+	return (variance > 0.0) ? covariance / variance : 0.0;
+}
+
+// local wall-clock time with milliseconds, for the transition log
+static void formatTimestamp(char* text, size_t size)
+{
+	const std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+	const time_t seconds = std::chrono::system_clock::to_time_t(now);
+	const int milliseconds = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000);
+	struct tm local;
+
+#ifdef _WIN32
+	localtime_s(&local, &seconds);
+#else
+	localtime_r(&seconds, &local);
+#endif
+	const size_t length = strftime(text, size, "%Y-%m-%d %H:%M:%S", &local);
+	snprintf(text + length, size - length, ".%03d", milliseconds);
+}
+
+const char* governorStepName(GovernorStep step)
+{
+	switch (step)
+	{
+	case kGovernorCompressRecording:	return "compress the recording";
+	case kGovernorStills8Bit:			return "8-bit stills only";
+	case kGovernorStopStills:			return "stop writing stills";
+	case kGovernorHalveVideoRate:		return "halve the video file frame rate";
+	}
+	return "unknown";
+}
+
+ThroughputGovernor::ThroughputGovernor(RawRecorder* recorder) :
+	m_recorder(recorder),
+	m_running(false),
+	m_recoverSeconds(0),
+	m_level(0),
+	m_transitions(0),
+	m_offeredFps(0.0),
+	m_writtenFps(0.0),
+	m_writtenMBps(0.0),
+	m_queueDepth(0),
+	m_queueTrend(0.0)
+{
+}
+
+ThroughputGovernor::~ThroughputGovernor()
+{
+	stop();
+}
+
+void ThroughputGovernor::addStep(GovernorStep step, StepAction action)
+{
+	if (!m_running)
+		m_ladder.push_back({ step, action });
+}
+
+bool ThroughputGovernor::start(unsigned recoverSeconds)
+{
+	if (m_running || m_recorder == nullptr || m_ladder.empty())
+		return false;
+
+	m_recoverSeconds = recoverSeconds;
+	printf("Governor: %zu steps:", m_ladder.size());
+	for (size_t rungIdx = 0; rungIdx < m_ladder.size(); rungIdx++)
+		printf("%s %s", (rungIdx > 0) ? "," : "", governorStepName(m_ladder[rungIdx].step));
+	printf("\n");
+
+	m_running = true;
+	m_governor = std::thread(&ThroughputGovernor::governorThread, this);
+	return true;
+}
+
+void ThroughputGovernor::stop()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	if (m_governor.joinable())
+		m_governor.join();
+
+	printStats();
+}
+
+GovernorStats ThroughputGovernor::stats()
+{
+	GovernorStats stats = {};
+	std::lock_guard<std::mutex> guard(m_statsMutex);
+
+	stats.level = m_level;
+	stats.ladderSteps = (unsigned)m_ladder.size();
+	stats.transitions = m_transitions;
+	stats.offeredFps = m_offeredFps;
+	stats.writtenFps = m_writtenFps;
+	stats.writtenMBps = m_writtenMBps;
+	stats.queueDepth = m_queueDepth;
+	stats.queueTrend = m_queueTrend;
+	return stats;
+}
+
+void ThroughputGovernor::governorThread()
+{
+	const std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point previousTime = started;
+	std::chrono::steady_clock::time_point lastTransition = started - kSettleTime;
+	std::chrono::steady_clock::time_point calmSince = started;
+	std::chrono::steady_clock::time_point lastStats = started;
+	RecorderStats previous = m_recorder->stats();
+	std::deque<QueueSample> samples;
+	bool warnedExhausted = false;
+	char cause[256];
+
+	while (m_running)
+	{
+		std::this_thread::sleep_for(kSampleInterval);
+
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		const double elapsed = std::chrono::duration<double>(now - previousTime).count();
+		const RecorderStats current = m_recorder->stats();
+		const uint64_t dropped = current.framesDropped - previous.framesDropped;
+		const unsigned depth = current.queueDepth;
+		const unsigned capacity = current.queueCapacity;
+
+		samples.push_back({ std::chrono::duration<double>(now - started).count(), (double)depth });
+		if (samples.size() > kTrendSamples)
+			samples.pop_front();
+		const double trend = queueTrend(samples);
+
+		double offeredFps, writtenFps, writtenMBps;
+		{
+			std::lock_guard<std::mutex> guard(m_statsMutex);
+			m_offeredFps += kRateSmoothing * ((current.framesOffered - previous.framesOffered) / elapsed - m_offeredFps);
+			m_writtenFps += kRateSmoothing * ((current.framesWritten - previous.framesWritten) / elapsed - m_writtenFps);
+			m_writtenMBps += kRateSmoothing * ((current.bytesWritten - previous.bytesWritten) / elapsed / 1e6 - m_writtenMBps);
+			m_queueDepth = depth;
+			m_queueTrend = trend;
+			offeredFps = m_offeredFps;
+			writtenFps = m_writtenFps;
+			writtenMBps = m_writtenMBps;
+		}
+		previous = current;
+		previousTime = now;
+
+		// in order of urgency; the first that applies is the cause
+		cause[0] = '\0';
+		if (dropped > 0)
+			snprintf(cause, sizeof(cause), "recorder dropped %llu frames", (unsigned long long)dropped);
+		else if (trend > 0.0 && depth > 0 && (capacity - depth) / trend < kLeadSeconds)
+			snprintf(cause, sizeof(cause), "queue %u/%u rising %.1f frames/s, full in %.1f s", depth, capacity, trend, (capacity - depth) / trend);
+		else if (depth >= capacity / 4 && writtenFps < offeredFps * kBehindRatio)
+			snprintf(cause, sizeof(cause), "queue %u/%u and falling behind", depth, capacity);
+
+		if (cause[0] != '\0')
+		{
+			const size_t length = strlen(cause);
+			snprintf(cause + length, sizeof(cause) - length, " (writing %.1f of %.1f fps offered, %.0f MB/s)", writtenFps, offeredFps, writtenMBps);
+
+			calmSince = now;
+			if (now - lastTransition >= kSettleTime)
+			{
+				if (m_level < m_ladder.size())
+				{
+					transition(true, cause);
+					lastTransition = now;
+				}
+				else if (!warnedExhausted)
+				{
+					char timestamp[32];
+					formatTimestamp(timestamp, sizeof(timestamp));
+					printf("[%s] Governor: no steps left - %s\n", timestamp, cause);
+					warnedExhausted = true;
+				}
+			}
+		}
+		else if (depth > 1 || trend > 0.0)
+		{
+			calmSince = now;
+		}
+		else if (m_level > 0 && m_recoverSeconds > 0 &&
+			now - calmSince >= std::chrono::seconds(m_recoverSeconds) && now - lastTransition >= std::chrono::seconds(m_recoverSeconds))
+		{
+			snprintf(cause, sizeof(cause), "queue idle for %u s (writing %.1f of %.1f fps offered, %.0f MB/s)", m_recoverSeconds, writtenFps, offeredFps, writtenMBps);
+			transition(false, cause);
+			lastTransition = now;
+			calmSince = now;
+			warnedExhausted = false;
+		}
+
+		if (now - lastStats >= kStatsInterval)
+		{
+			printStats();
+			lastStats = now;
+		}
+	}
+}
+
+void ThroughputGovernor::transition(bool degrade, const char* cause)
+{
+	const Rung& rung = degrade ? m_ladder[m_level] : m_ladder[m_level - 1];
+	char timestamp[32];
+
+	rung.action(degrade);
+	{
+		std::lock_guard<std::mutex> guard(m_statsMutex);
+		m_level += degrade ? 1 : -1;
+		++m_transitions;
+	}
+
+	formatTimestamp(timestamp, sizeof(timestamp));
+	if (degrade)
+		printf("[%s] Governor: step %u of %zu, %s - %s\n", timestamp, m_level, m_ladder.size(), governorStepName(rung.step), cause);
+	else
+		printf("[%s] Governor: undid %s, back to step %u - %s\n", timestamp, governorStepName(rung.step), m_level, cause);
+}
+
+void ThroughputGovernor::printStats()
+{
+	GovernorStats current = stats();
+	printf("Governor: step %u of %u, %llu transitions, offered %.1f fps, writing %.1f fps (%.0f MB/s), queue %u trending %+.1f frames/s\n",
+		current.level, current.ladderSteps, (unsigned long long)current.transitions, current.offeredFps,
+		current.writtenFps, current.writtenMBps, current.queueDepth, current.queueTrend);
+}
@@ -0,0 +1,87 @@
+// recorder throughput governor: gives up optional work, one step at a time, before the recorder has to drop frames
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RawRecorder.h"
+
+// the ways a capture pipeline can lighten the load on the disks, as listed in a ladder
+enum GovernorStep
+{
+	kGovernorCompressRecording,		// switch on the recorder's standby compression
+	kGovernorStills8Bit,			// write 8-bit stills only
+	kGovernorStopStills,
+	kGovernorHalveVideoRate,		// encode every second frame into the video file
+};
+
+const char*	governorStepName(GovernorStep step);
+
+struct GovernorStats
+{
+	unsigned	level;				// steps taken
+	unsigned	ladderSteps;
+	uint64_t	transitions;		// down and back up
+	double		offeredFps;			// frames handed to the recorder, smoothed over about a second
+	double		writtenFps;
+	double		writtenMBps;
+	unsigned	queueDepth;
+	double		queueTrend;			// frames per second the recorder queue grows by, over the trend window
+};
+
+// Samples the recorder a few times a second. The queue depth is fitted with a line over the last
+// couple of seconds, and a step down the ladder is taken as soon as that line says the queue will
+// be full within the lead time, or the recorder writes fewer frames than it is offered while its
+// queue builds. Frames dropped by the recorder are a step down too, should the prediction miss.
+// Each step gets a moment to take effect before the next. After recoverSeconds of an idle queue
+// the last step is undone. Every transition is printed with the time and its cause
+class ThroughputGovernor
+{
+public:
+	// called with true to take the step and false to undo it, from the governor's thread
+	typedef std::function<void(bool degrade)>	StepAction;
+
+	explicit ThroughputGovernor(RawRecorder* recorder);
+	~ThroughputGovernor();
+
+	// the ladder is climbed down in the order the steps are added
+	void		addStep(GovernorStep step, StepAction action);
+
+	// recoverSeconds of 0 never undoes a step
+	bool		start(unsigned recoverSeconds);
+
+	// stops watching; steps already taken stay taken
+	void		stop();
+
+	bool		isRunning() const { return m_running; }
+	GovernorStats	stats();
+
+private:
+	struct Rung
+	{
+		GovernorStep	step;
+		StepAction		action;
+	};
+
+	void		governorThread();
+	void		transition(bool degrade, const char* cause);
+	void		printStats();
+
+	RawRecorder*				m_recorder;
+	std::vector<Rung>			m_ladder;
+	std::thread					m_governor;
+	std::atomic<bool>			m_running;
+	unsigned					m_recoverSeconds;
+	std::mutex					m_statsMutex;		// the smoothed rates below are doubles
+	unsigned					m_level;
+	uint64_t					m_transitions;
+	double						m_offeredFps;
+	double						m_writtenFps;
+	double						m_writtenMBps;
+	unsigned					m_queueDepth;
+	double						m_queueTrend;
+};
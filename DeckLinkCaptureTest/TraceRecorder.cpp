@@ -0,0 +1,254 @@
+// pipeline tracing: scoped spans from every thread, written as a Chrome JSON trace for chrome://tracing or Perfetto
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// how long the writer thread sleeps between passes over the rings
+static const std::chrono::milliseconds kTraceWriteInterval(20);
+
+// one thread's spans; only that thread writes head, only the writer thread writes tail
+struct TraceRing
+{
+	std::vector<TraceEvent>			events;			// a power of two of them
+	uint64_t						mask;
+	unsigned						index;			// the thread id in the trace
+	const char*						name;			// guarded by s_ringsMutex
+	unsigned						number;
+	alignas(64) std::atomic<uint64_t>	head;
+	uint64_t						cachedTail;		// owning thread only
+	std::atomic<uint64_t>			dropped;
+	alignas(64) std::atomic<uint64_t>	tail;
+	uint64_t						droppedReported;	// writer thread only
+	bool							named;			// writer thread only: its name is in the current file
+};
+
+std::atomic<bool> TraceRecorder::s_tracing(false);
+
+// rings outlive each trace, so a thread that still has one never writes to freed memory
+static std::mutex							s_ringsMutex;
+static std::vector<std::unique_ptr<TraceRing>>	s_rings;
+static thread_local TraceRing*				s_threadRing = nullptr;
+static thread_local const char*				s_threadName = nullptr;
+static thread_local unsigned				s_threadNumber = UINT32_MAX;
+
+static std::mutex		s_controlMutex;		// start() and stop()
+static std::atomic<bool>	s_writing(false);
+static std::thread		s_writer;
+static FILE*			s_file = nullptr;
+static std::atomic<unsigned>	s_eventsPerThread(0);
+static int64_t			s_startTime = 0;
+static bool				s_firstEvent = true;
+static uint64_t			s_eventsWritten = 0;
+
+static double ticksToMicroseconds(int64_t ticks)
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::duration(ticks)).count();
+}
+
+static std::string jsonString(const char* text)
+{
+	std::string quoted("\"");
+	for (const char* c = text; *c != '\0'; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			quoted += '\\';
+		if ((unsigned char)*c >= 0x20)
+			quoted += *c;
+	}
+	return quoted + "\"";
+}
+
+static void beginEvent()
+{
+	fputs(s_firstEvent ? "\n" : ",\n", s_file);
+	s_firstEvent = false;
+}
+
+static void writeThreadName(const TraceRing& ring, const char* name, unsigned number)
+{
+	std::string fullName(name ? name : "thread");
+	if (number != UINT32_MAX)
+		fullName += " " + std::to_string(number);
+
+	beginEvent();
+	fprintf(s_file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":%s}}", ring.index, jsonString(fullName.c_str()).c_str());
+}
+
+static void writeOnce()
+{
+	struct RingView
+	{
+		TraceRing*	ring;
+		const char*	name;
+		unsigned	number;
+	};
+	std::vector<RingView> rings;
+	{
+		std::lock_guard<std::mutex> guard(s_ringsMutex);
+		for (std::unique_ptr<TraceRing>& ring : s_rings)
+			rings.push_back({ ring.get(), ring->name, ring->number });
+	}
+
+	for (RingView& view : rings)
+	{
+		TraceRing* ring = view.ring;
+		const uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+
+		for (; tail != head; tail++)
+		{
+			const TraceEvent& event = ring->events[tail & ring->mask];
+
+			// left over from before this trace started
+			if (event.begin < s_startTime)
+				continue;
+
+			if (!ring->named)
+			{
+				writeThreadName(*ring, view.name, view.number);
+				ring->named = true;
+			}
+
+			beginEvent();
+			fprintf(s_file, "{\"name\":%s,\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f", jsonString(event.name).c_str(), ring->index,
+				ticksToMicroseconds(event.begin - s_startTime), ticksToMicroseconds(event.end - event.begin));
+			if (event.frameNumber != kTraceNoFrame)
+				fprintf(s_file, ",\"args\":{\"frame\":%llu}", (unsigned long long)event.frameNumber);
+			fputc('}', s_file);
+			++s_eventsWritten;
+		}
+		ring->tail.store(tail, std::memory_order_release);
+
+		const uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+		if (dropped != ring->droppedReported)
+		{
+			fprintf(stderr, "Trace ring of thread %u full, %llu spans lost\n", ring->index, (unsigned long long)(dropped - ring->droppedReported));
+			ring->droppedReported = dropped;
+		}
+	}
+	fflush(s_file);
+}
+
+static void writerThread()
+{
+	while (s_writing)
+	{
+		writeOnce();
+		std::this_thread::sleep_for(kTraceWriteInterval);
+	}
+	writeOnce();
+}
+
+bool TraceRecorder::start(const char* path, unsigned eventsPerThread)
+{
+	std::lock_guard<std::mutex> control(s_controlMutex);
+	if (s_tracing)
+		return true;
+
+	s_file = fopen(path, "w");
+	if (s_file == nullptr)
+	{
+		fprintf(stderr, "Could not create trace file %s\n", path);
+		return false;
+	}
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", s_file);
+
+	{
+		std::lock_guard<std::mutex> guard(s_ringsMutex);
+		for (std::unique_ptr<TraceRing>& ring : s_rings)
+			ring->named = false;
+	}
+	s_eventsPerThread = std::max(eventsPerThread, 2u);
+	s_startTime = now();
+	s_firstEvent = true;
+	s_eventsWritten = 0;
+
+	s_writing = true;
+	s_writer = std::thread(writerThread);
+	s_tracing = true;
+	printf("Tracing to %s\n", path);
+	return true;
+}
+
+void TraceRecorder::stop()
+{
+	std::lock_guard<std::mutex> control(s_controlMutex);
+	if (!s_tracing)
+		return;
+
+	s_tracing = false;
+	s_writing = false;
+	s_writer.join();
+
+	fputs("\n]}\n", s_file);
+	fclose(s_file);
+	s_file = nullptr;
+	printf("Trace finished, %llu spans\n", (unsigned long long)s_eventsWritten);
+}
+
+void TraceRecorder::nameThread(const char* name, unsigned number)
+{
+	if (s_threadName == name && s_threadNumber == number)
+		return;
+
+	s_threadName = name;
+	s_threadNumber = number;
+	if (s_threadRing != nullptr)
+	{
+		std::lock_guard<std::mutex> guard(s_ringsMutex);
+		s_threadRing->name = name;
+		s_threadRing->number = number;
+	}
+}
+
+void TraceRecorder::addSpan(const char* name, int64_t begin, int64_t end, uint64_t frameNumber)
+{
+	TraceRing* ring = s_threadRing;
+	if (ring == nullptr)
+	{
+		std::unique_ptr<TraceRing> newRing(new TraceRing());
+		unsigned capacity = 1;
+		const unsigned eventsPerThread = s_eventsPerThread;
+		while (capacity < eventsPerThread)
+			capacity <<= 1;
+		newRing->events.resize(capacity);
+		newRing->mask = capacity - 1;
+		newRing->name = s_threadName;
+		newRing->number = s_threadNumber;
+		newRing->head = 0;
+		newRing->cachedTail = 0;
+		newRing->dropped = 0;
+		newRing->tail = 0;
+		newRing->droppedReported = 0;
+		newRing->named = false;
+
+		std::lock_guard<std::mutex> guard(s_ringsMutex);
+		newRing->index = (unsigned)s_rings.size() + 1;
+		ring = s_threadRing = newRing.get();
+		s_rings.push_back(std::move(newRing));
+	}
+
+	const uint64_t head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->cachedTail > ring->mask)
+	{
+		ring->cachedTail = ring->tail.load(std::memory_order_acquire);
+		if (head - ring->cachedTail > ring->mask)
+		{
+			ring->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	TraceEvent& event = ring->events[head & ring->mask];
+	event.name = name;
+	event.begin = begin;
+	event.end = end;
+	event.frameNumber = frameNumber;
+	ring->head.store(head + 1, std::memory_order_release);
+}
@@ -0,0 +1,88 @@
+// background lossless encoding of captured frames to a video file (FFV1 in Matroska, via FFmpeg)
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CaptureFrame.h"
+#include "FrameQueue.h"
+
+#if __has_include(<libavcodec/avcodec.h>) && __has_include(<libavformat/avformat.h>)
+#define HAVE_FFMPEG 1
+#endif
+
+class MetricHistogram;
+
+struct EncoderStats
+{
+	uint64_t	framesEncoded;
+	uint64_t	framesDropped;		// refused because the queue was full
+	uint64_t	framesSkipped;		// left out by decimation
+	uint64_t	encodeErrors;
+	uint64_t	bytesWritten;		// compressed, all eyes
+	unsigned	queueDepth;			// frames waiting for the encoder thread
+	double		lastLagMs;			// frame arrival to its last packet being handed to the muxer
+	double		meanLagMs;
+	double		maxLagMs;
+};
+
+// Encodes every eye of every frame as its own FFV1 video stream of one Matroska file.
+// v210 payloads are unpacked straight into the yuv422p10 planes the encoder takes, with no
+// RGB step, and FFV1 spreads each frame over sliceThreads threads
+class VideoEncoder
+{
+public:
+	VideoEncoder(unsigned queueDepth, unsigned sliceThreads);
+	~VideoEncoder();
+
+	static bool	isAvailable();
+
+	// creates the file and one stream per eye of format; only v210 payloads are supported
+	bool		open(const std::string& path, const CaptureFrame& format);
+
+	// hands a frame to the encoder thread without blocking. The encoder takes over the
+	// caller's buffer references, and releases them itself if the frame has to be dropped
+	bool		submit(const CaptureFrame& frame);
+
+	// encodes only every decimation-th frame from now on; 1 encodes them all. Frames keep their
+	// stream times, so the file stays in time at the lower rate
+	void		setDecimation(unsigned decimation);
+	unsigned	decimation() const { return m_decimation; }
+
+	// times the unpacking of every eye into decodeTime, in seconds; set before open()
+	void		setDecodeTimeMetric(MetricHistogram* decodeTime) { m_decodeTime = decodeTime; }
+
+	// encodes everything still queued, flushes the encoder and finishes the file
+	void		close();
+
+	bool		isOpen() const { return m_running; }
+	EncoderStats	stats();
+
+private:
+	struct EyeStream;
+
+	void		encoderThread();
+	bool		encodeFrame(const CaptureFrame& frame);
+	bool		drainPackets(EyeStream& eye);
+	void		releaseStreams();
+	void		printStats();
+
+	FrameQueue					m_queue;
+	std::thread					m_encoder;
+	std::atomic<bool>			m_running;
+	unsigned					m_sliceThreads;
+	std::atomic<unsigned>		m_decimation;
+	void*						m_formatContext;	// AVFormatContext
+	std::vector<EyeStream*>		m_eyes;
+	MetricHistogram*			m_decodeTime;
+	std::atomic<uint64_t>		m_framesEncoded;
+	std::atomic<uint64_t>		m_framesSkipped;
+	std::atomic<uint64_t>		m_encodeErrors;
+	std::atomic<uint64_t>		m_bytesWritten;
+	std::atomic<uint64_t>		m_lagCount;
+	std::atomic<uint64_t>		m_lagTotalUs;
+	std::atomic<uint64_t>		m_lagMaxUs;
+	std::atomic<uint64_t>		m_lagLastUs;
+};
@@ -0,0 +1,432 @@
+// conversion benchmarks: every pixel conversion path against memcpy at 720p, 1080 and UHD, warm and cold cache, on Google Benchmark
+//
+// Runs anywhere Google Benchmark does; no card is needed. Without Visual Studio, from this directory:
+//   g++ -O2 -std=c++17 -I../DeckLinkStereoCaptureTest main.cpp ../DeckLinkStereoCaptureTest/V210Unpack.cpp -lbenchmark -lpthread
+// adding `pkg-config --cflags --libs opencv4` for the cvtColor path. The SDK's ConvertFrame is only
+// measured in the Windows build, where the SDK is. --benchmark_format=json gives machine-readable results
+#include "FramePool.h"
+#include "V210Unpack.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+
+#if defined(__has_include)
+#if __has_include(<opencv2/imgproc.hpp>)
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#define HAVE_OPENCV 1
+#endif
+#endif
+
+#ifdef _WIN32
+#include "platform.h"
+#include "Uyvy8VideoFrame.h"
+#include "Xle10VideoFrame.h"
+#endif
+
+struct ConversionSize
+{
+	const char*	name;
+	int			width;
+	int			height;
+};
+
+static const ConversionSize	kSizes[] = { { "720p", 1280, 720 }, { "1080", 1920, 1080 }, { "uhd", 3840, 2160 } };
+static const size_t			kMinEvictBytes = 64 << 20;			// read through between cold iterations; at least four times the largest cache
+static const size_t			kBandwidthProbeBytes = 256 << 20;
+
+static double				s_peakBytesPerSecond = 0.0;		// memcpy of kBandwidthProbeBytes, bytes read and written
+static std::vector<uint8_t>	s_evictBuffer;
+
+enum PixelLayout
+{
+	kLayoutV210,			// bmdFormat10BitYUV, as the card delivers it
+	kLayoutUyvy8,			// bmdFormat8BitYUV, what ConvertFrame made for extractCVMat8
+	kLayoutXle10			// bmdFormat10BitRGBXLE, what ConvertFrame made for extractCVMat16
+};
+
+static size_t rowBytesFor(PixelLayout layout, int width)
+{
+	switch (layout)
+	{
+		case kLayoutV210:	return (size_t)rowBytesForV210(width);
+		case kLayoutUyvy8:	return (size_t)width * 2;
+		default:			return (size_t)width * 4;
+	}
+}
+
+// One conversion at one size. The input is made once, in the layout the conversion takes; run()
+// converts it into an output buffer that is also made once, so only the conversion is timed
+class ConversionKernel
+{
+public:
+	ConversionKernel(PixelLayout input, size_t outputBytes, int width, int height) :
+		m_width(width),
+		m_height(height),
+		m_inputRowBytes(rowBytesFor(input, width)),
+		m_input(m_inputRowBytes * height),
+		m_output(outputBytes)
+	{
+		fillInput(input);
+	}
+	virtual ~ConversionKernel() {}
+
+	virtual void	run() = 0;
+
+	// nullptr when the kernel can run here, otherwise why it cannot
+	virtual const char*	unavailableReason() const { return nullptr; }
+
+	virtual uint64_t	bytesMoved() const { return (uint64_t)m_input.size() + m_output.size(); }
+
+protected:
+	void			fillInput(PixelLayout input)
+	{
+		if (input == kLayoutV210)
+		{
+			// a ramp in every component, so no row packs to the same words as the next
+			const int chromaWidth = (m_width + 1) / 2;
+			std::vector<uint16_t> y(m_width), cb(chromaWidth), cr(chromaWidth);
+			for (int row = 0; row < m_height; row++)
+			{
+				for (int x = 0; x < m_width; x++)
+					y[x] = (uint16_t)(64 + (x + row) % 877);
+				for (int x = 0; x < chromaWidth; x++)
+				{
+					cb[x] = (uint16_t)(64 + (x * 3 + row) % 897);
+					cr[x] = (uint16_t)(64 + (x * 5 + row) % 897);
+				}
+				packV210Row(y.data(), cb.data(), cr.data(), m_width, m_input.data() + (size_t)row * m_inputRowBytes);
+			}
+		}
+		else
+		{
+			uint32_t state = 0x12345678;
+			for (uint8_t& byte : m_input)
+			{
+				state = state * 1664525u + 1013904223u;
+				byte = (uint8_t)(state >> 24);
+			}
+		}
+	}
+
+	int						m_width;
+	int						m_height;
+	size_t					m_inputRowBytes;
+	std::vector<uint8_t>	m_input;
+	std::vector<uint8_t>	m_output;
+};
+
+// the floor every conversion is measured against: the v210 frame copied as it is
+class MemcpyKernel : public ConversionKernel
+{
+public:
+	MemcpyKernel(int width, int height) : ConversionKernel(kLayoutV210, rowBytesFor(kLayoutV210, width) * height, width, height) {}
+
+	virtual void	run() override
+	{
+		memcpy(m_output.data(), m_input.data(), m_input.size());
+	}
+};
+
+// extractCVMat8's copy of the converted UYVY frame into the cv::Mat, a byte at a time, as it was
+class Extract8CopyKernel : public ConversionKernel
+{
+public:
+	Extract8CopyKernel(int width, int height) : ConversionKernel(kLayoutUyvy8, (size_t)width * height * 2, width, height) {}
+
+	virtual void	run() override
+	{
+		const uint8_t* source = m_input.data();
+		uint8_t* frameData = m_output.data();
+		for (unsigned long writeByteIdx = 0; writeByteIdx < 2 * (unsigned long)(m_height * m_width); ++writeByteIdx)
+		{
+			*frameData = (uint8_t)*((const char*)source);
+			++frameData;
+			++source;
+		}
+	}
+};
+
+// extractCVMat16's unpacking of the converted 10-bit RGB words into 16-bit components, as it was
+class Extract16UnpackKernel : public ConversionKernel
+{
+public:
+	Extract16UnpackKernel(int width, int height) : ConversionKernel(kLayoutXle10, (size_t)width * height * 3 * sizeof(uint16_t), width, height) {}
+
+	virtual void	run() override
+	{
+		const uint8_t* source = m_input.data();
+		uint16_t* frameData = (uint16_t*)m_output.data();
+		uint32_t localPixelData = 0;
+		for (unsigned int pixelIdx = 0; pixelIdx < (unsigned int)(m_width * m_height); pixelIdx++)
+		{
+			char* p_localPixelData = (char*)&localPixelData;
+			for (unsigned int byteIdx = 0; byteIdx < 4; byteIdx++)
+			{
+				*p_localPixelData = (char)*((const char*)source);
+				++source;
+				++p_localPixelData;
+			}
+
+			for (unsigned int componentIdx = 0; componentIdx < 3; componentIdx++)
+			{
+				const uint32_t bitMask = 0xFFC << (10 * componentIdx);
+				const uint32_t componentValue10Bit = (localPixelData & bitMask) >> (10 * componentIdx + 2);
+				*frameData = (uint16_t)(((double)componentValue10Bit) * (65535.0 / 1023.0));
+				++frameData;
+			}
+		}
+	}
+};
+
+// what the video encoder does with every frame
+class UnpackV210Kernel : public ConversionKernel
+{
+public:
+	UnpackV210Kernel(int width, int height) : ConversionKernel(kLayoutV210, (size_t)height * (width + 2 * ((width + 1) / 2)) * sizeof(uint16_t), width, height) {}
+
+	virtual void	run() override
+	{
+		const size_t chromaWidth = (size_t)(m_width + 1) / 2;
+		uint16_t* y = (uint16_t*)m_output.data();
+		uint16_t* cb = y + (size_t)m_width * m_height;
+		uint16_t* cr = cb + chromaWidth * m_height;
+		unpackV210(m_input.data(), m_inputRowBytes, m_width, m_height, y, m_width * sizeof(uint16_t),
+			cb, chromaWidth * sizeof(uint16_t), cr, chromaWidth * sizeof(uint16_t));
+	}
+};
+
+// what the stills writers do, in place of ConvertFrame and extractCVMat16
+class V210ToBgr48Kernel : public ConversionKernel
+{
+public:
+	V210ToBgr48Kernel(int width, int height) : ConversionKernel(kLayoutV210, (size_t)width * height * 3 * sizeof(uint16_t), width, height) {}
+
+	virtual void	run() override
+	{
+		convertV210ToBgr48(m_input.data(), m_inputRowBytes, m_width, m_height, (uint16_t*)m_output.data(), m_width * 3 * sizeof(uint16_t));
+	}
+};
+
+#ifdef HAVE_OPENCV
+// extractCVMat8's last step, UYVY to 8-bit BGR
+class CvtColorKernel : public ConversionKernel
+{
+public:
+	CvtColorKernel(int width, int height) : ConversionKernel(kLayoutUyvy8, (size_t)width * height * 3, width, height) {}
+
+	virtual void	run() override
+	{
+		const cv::Mat uyvy(m_height, m_width, CV_8UC2, m_input.data());
+		cv::Mat bgr(m_height, m_width, CV_8UC3, m_output.data());
+		cv::cvtColor(uyvy, bgr, cv::COLOR_YUV2BGR_UYVY);
+	}
+};
+#endif
+
+#ifdef _WIN32
+// the input buffer as the SDK sees a captured frame
+class V210SourceFrame : public IDeckLinkVideoFrame
+{
+public:
+	V210SourceFrame(uint8_t* bytes, long width, long height, long rowBytes) : m_bytes(bytes), m_width(width), m_height(height), m_rowBytes(rowBytes) {}
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void) { return m_width; }
+	virtual long			STDMETHODCALLTYPE	GetHeight(void) { return m_height; }
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void) { return m_rowBytes; }
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer) { *buffer = m_bytes; return S_OK; }
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void) { return bmdFrameFlagDefault; }
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void) { return bmdFormat10BitYUV; }
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; }
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode) { return E_NOTIMPL; }
+
+	// IUnknown interface; the frame lives on the kernel's stack frame, so counting is not needed
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID* ppv) { *ppv = nullptr; return E_NOINTERFACE; }
+	virtual ULONG			STDMETHODCALLTYPE	AddRef() { return 1; }
+	virtual ULONG			STDMETHODCALLTYPE	Release() { return 1; }
+
+private:
+	uint8_t*	m_bytes;
+	long		m_width;
+	long		m_height;
+	long		m_rowBytes;
+};
+
+// the SDK's ConvertFrame, from v210 into the frame classes extractCVMat8 and extractCVMat16 used
+class SdkConvertKernel : public ConversionKernel
+{
+public:
+	SdkConvertKernel(BMDPixelFormat target, int width, int height) :
+		ConversionKernel(kLayoutV210, 0, width, height),
+		m_source(m_input.data(), width, height, (long)m_inputRowBytes),
+		m_converter(nullptr)
+	{
+		if (target == bmdFormat8BitYUV)
+			m_target = new Uyvy8VideoFrame(width, height, bmdFrameFlagDefault);
+		else
+			m_target = new Xle10VideoFrame(width, height, bmdFrameFlagDefault);
+		m_output.clear();
+		m_targetBytes = (size_t)m_target->GetRowBytes() * height;
+		GetDeckLinkVideoConversion(&m_converter);
+	}
+	virtual ~SdkConvertKernel()
+	{
+		m_target->Release();
+		if (m_converter)
+			m_converter->Release();
+	}
+
+	virtual void	run() override
+	{
+		m_converter->ConvertFrame(&m_source, m_target);
+	}
+
+	virtual const char*	unavailableReason() const override
+	{
+		return m_converter ? nullptr : "the DeckLink video conversion interface could not be created";
+	}
+
+	virtual uint64_t	bytesMoved() const override { return (uint64_t)m_input.size() + m_targetBytes; }
+
+private:
+	V210SourceFrame			m_source;
+	IDeckLinkVideoFrame*	m_target;
+	IDeckLinkVideoConversion*	m_converter;
+	size_t					m_targetBytes;
+};
+#endif
+
+typedef std::function<ConversionKernel*(int width, int height)>	KernelFactory;
+
+struct ConversionPath
+{
+	const char*		name;
+	KernelFactory	create;
+};
+
+// reads through s_evictBuffer, so the next iteration finds neither its input nor its output in cache
+static void evictCaches()
+{
+	const uint64_t* words = (const uint64_t*)s_evictBuffer.data();
+	uint64_t sum = 0;
+	for (size_t wordIdx = 0; wordIdx < s_evictBuffer.size() / sizeof(uint64_t); wordIdx += 8)
+		sum += words[wordIdx];
+	benchmark::DoNotOptimize(sum);
+}
+
+static void runConversion(benchmark::State& state, const ConversionPath* path, const ConversionSize* size, bool cold)
+{
+	std::unique_ptr<ConversionKernel> kernel(path->create(size->width, size->height));
+	if (kernel->unavailableReason())
+	{
+		state.SkipWithError(kernel->unavailableReason());
+		return;
+	}
+
+	// the first run faults the output pages in; a capture program's buffers are long since touched
+	kernel->run();
+	double seconds = 0.0;
+	for (auto _ : state)
+	{
+		if (cold)
+		{
+			state.PauseTiming();
+			evictCaches();
+			state.ResumeTiming();
+		}
+		const auto startTime = std::chrono::steady_clock::now();
+		kernel->run();
+		benchmark::ClobberMemory();
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	}
+
+	// bytes read and written, so memcpy moves twice its frame and the roofline compares like with like
+	const double bytes = (double)kernel->bytesMoved() * state.iterations();
+	const double cyclesPerSecond = benchmark::CPUInfo::Get().cycles_per_second;
+	state.SetBytesProcessed((int64_t)bytes);
+	state.SetItemsProcessed((int64_t)state.iterations() * size->width * size->height);
+	if (seconds > 0.0 && cyclesPerSecond > 0.0)
+		state.counters["bytes_per_cycle"] = bytes / (seconds * cyclesPerSecond);
+	if (seconds > 0.0 && s_peakBytesPerSecond > 0.0)
+		state.counters["pct_bandwidth"] = 100.0 * bytes / seconds / s_peakBytesPerSecond;
+}
+
+// the best of a few copies far larger than any cache
+static double measurePeakBandwidth()
+{
+	std::vector<uint8_t> source(kBandwidthProbeBytes, 0x5A);
+	std::vector<uint8_t> destination(kBandwidthProbeBytes, 0);
+	double bestSeconds = 0.0;
+
+	for (int pass = 0; pass < 5; pass++)
+	{
+		const auto startTime = std::chrono::steady_clock::now();
+		memcpy(destination.data(), source.data(), kBandwidthProbeBytes);
+		benchmark::ClobberMemory();
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		if (pass == 0 || seconds < bestSeconds)
+			bestSeconds = seconds;
+	}
+
+	return (bestSeconds > 0.0) ? 2.0 * kBandwidthProbeBytes / bestSeconds : 0.0;
+}
+
+int main(int argc, char** argv)
+{
+	static const ConversionPath kPaths[] =
+	{
+		{ "memcpy", [](int width, int height) { return (ConversionKernel*)new MemcpyKernel(width, height); } },
+		{ "extractCVMat8_copy", [](int width, int height) { return (ConversionKernel*)new Extract8CopyKernel(width, height); } },
+#ifdef HAVE_OPENCV
+		{ "cvtColor_uyvy_to_bgr", [](int width, int height) { return (ConversionKernel*)new CvtColorKernel(width, height); } },
+#endif
+		{ "extractCVMat16_unpack", [](int width, int height) { return (ConversionKernel*)new Extract16UnpackKernel(width, height); } },
+#ifdef _WIN32
+		{ "ConvertFrame_v210_to_uyvy", [](int width, int height) { return (ConversionKernel*)new SdkConvertKernel(bmdFormat8BitYUV, width, height); } },
+		{ "ConvertFrame_v210_to_r10l", [](int width, int height) { return (ConversionKernel*)new SdkConvertKernel(bmdFormat10BitRGBXLE, width, height); } },
+#endif
+		{ "unpackV210", [](int width, int height) { return (ConversionKernel*)new UnpackV210Kernel(width, height); } },
+		{ "convertV210ToBgr48", [](int width, int height) { return (ConversionKernel*)new V210ToBgr48Kernel(width, height); } },
+	};
+
+#ifdef _WIN32
+	if (FAILED(Initialize()))
+		return 1;
+#endif
+
+	benchmark::Initialize(&argc, argv);
+	if (benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+
+	size_t evictBytes = kMinEvictBytes;
+	for (const benchmark::CPUInfo::CacheInfo& cache : benchmark::CPUInfo::Get().caches)
+		evictBytes = std::max(evictBytes, (size_t)cache.size * 4);
+	s_evictBuffer.assign(evictBytes, 1);
+
+	s_peakBytesPerSecond = measurePeakBandwidth();
+	benchmark::AddCustomContext("memcpy_peak_gbps", std::to_string(s_peakBytesPerSecond / 1e9));
+
+	for (const ConversionPath& path : kPaths)
+	{
+		for (const ConversionSize& size : kSizes)
+		{
+			for (int cold = 0; cold < 2; cold++)
+			{
+				const std::string name = std::string(path.name) + "/" + size.name + (cold ? "/cold" : "/warm");
+				benchmark::RegisterBenchmark(name.c_str(), runConversion, &path, &size, cold != 0)->Unit(benchmark::kMillisecond)->UseRealTime();
+			}
+		}
+	}
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
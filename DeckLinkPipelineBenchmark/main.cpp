@@ -0,0 +1,509 @@
+// pipeline benchmark: drives the capture pipeline stages with synthetic v210 frames as fast as they will go and writes the results as JSON
+#include "CaptureFrame.h"
+#include "FramePool.h"
+#include "FrameQueue.h"
+#include "RawRecorder.h"
+#include "V210Unpack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Frame parameters
+const int                 kFrameWidth = 1920;
+const int                 kFrameHeight = 1080;
+const unsigned            kEyeCountToRun = 2;			// 2 runs the stereo split, as with bmdVideoInputDualStream3D
+const int64_t             kTimeScale = 25000;
+const int64_t             kFrameDuration = 1000;
+const unsigned            kSourceFrames = 8;			// distinct synthetic frames per eye, cycled through
+const uint32_t            kPixelFormatV210 = 0x76323130;	// bmdFormat10BitYUV, 'v210'
+
+// Run parameters
+const char* const         kResultsPath = "DeckLinkPipelineBenchmark.json";	// overridden by the first argument
+const unsigned            kWarmupSeconds = 2;			// run but not measured, so the pool, queues and page cache settle
+const unsigned            kMeasureSeconds = 10;
+const unsigned            kFramePoolBuffers = 32;		// one buffer per eye per frame, as in the capture programs
+const unsigned            kStageQueueDepth = 8;
+const unsigned            kDecodeThreads = 1;			// per decode path; the encoder and stills stages each run one
+const size_t              kBandwidthProbeBytes = 256 << 20;	// copied to measure what plain memcpy gets out of this host
+
+// Recorder parameters
+// nullptr records to the null device; a path on tmpfs (/dev/shm/bench.dlraw) measures the page cache copy as well
+const char* const         kSinkPath = nullptr;
+const WriteBackendType    kRecorderBackend = kWriteBackendIoUring;
+const unsigned            kRecorderQueueDepth = 16;
+const unsigned            kRecordsInFlight = 4;
+const uint64_t            kRecordPreallocateBytes = 1ull << 30;
+
+#ifdef _WIN32
+static const char* const  kNullSinkPath = "NUL";
+#else
+static const char* const  kNullSinkPath = "/dev/null";
+#endif
+
+// every operator new in the process is counted, to report allocations per frame; allocations
+// made with malloc by C libraries, and aligned operator new, are not
+static std::atomic<uint64_t>	s_allocations(0);
+static std::atomic<uint64_t>	s_allocatedBytes(0);
+
+void* operator new(size_t bytes)
+{
+	s_allocations.fetch_add(1, std::memory_order_relaxed);
+	s_allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+	void* memory = malloc(bytes > 0 ? bytes : 1);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+// user and kernel time of the whole process, in seconds
+static double processCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0.0;
+
+	ULARGE_INTEGER kernel, user;
+	kernel.LowPart = kernelTime.dwLowDateTime;
+	kernel.HighPart = kernelTime.dwHighDateTime;
+	user.LowPart = userTime.dwLowDateTime;
+	user.HighPart = userTime.dwHighDateTime;
+	return (double)(kernel.QuadPart + user.QuadPart) / 1e7;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0.0;
+
+	return (double)usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + (double)usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+enum DecodePath
+{
+	kDecodePlanar,			// unpackV210, as the video encoder feeds FFV1
+	kDecodeBgr48			// convertV210ToBgr48, as the stills writers feed OpenCV
+};
+
+// One decode path on its own threads, fed through a bounded queue as the encoder and stills
+// stages are. Output buffers belong to each thread and are made before it takes its first frame
+class DecodeStage
+{
+public:
+	DecodeStage(DecodePath path, unsigned threadCount, unsigned queueDepth) :
+		m_path(path),
+		m_queue(queueDepth),
+		m_stopping(false),
+		m_framesDone(0),
+		m_busyMicroseconds(0)
+	{
+		for (unsigned threadIdx = 0; threadIdx < threadCount; threadIdx++)
+			m_threads.push_back(std::thread(&DecodeStage::decodeThread, this));
+	}
+
+	~DecodeStage()
+	{
+		stop();
+	}
+
+	// takes over the caller's buffer references; waits for room, so the source runs at this stage's pace when it is the slowest
+	bool		submit(const CaptureFrame& frame)
+	{
+		if (m_queue.push(frame))
+			return true;
+
+		CaptureFrame dropped = frame;
+		dropped.release();
+		return false;
+	}
+
+	// decodes what is still queued, then returns
+	void		stop()
+	{
+		m_stopping = true;
+		m_queue.close();
+		for (std::thread& thread : m_threads)
+		{
+			if (thread.joinable())
+				thread.join();
+		}
+	}
+
+	const char*	name() const { return (m_path == kDecodePlanar) ? "unpack_v210" : "v210_to_bgr48"; }
+	uint64_t	framesDone() const { return m_framesDone; }
+	double		busySeconds() const { return m_busyMicroseconds / 1e6; }
+	unsigned	threadCount() const { return (unsigned)m_threads.size(); }
+
+	// what one eye costs this path in memory traffic, reading the v210 and writing the output
+	static uint64_t	bytesPerEye(DecodePath path, int width, int height, int rowBytes)
+	{
+		const uint64_t output = (path == kDecodePlanar) ? (uint64_t)height * (width + 2 * ((width + 1) / 2)) * sizeof(uint16_t)
+			: (uint64_t)width * height * 3 * sizeof(uint16_t);
+		return (uint64_t)rowBytes * height + output;
+	}
+
+private:
+	void		decodeThread()
+	{
+		const int chromaWidth = (kFrameWidth + 1) / 2;
+		std::vector<uint16_t> planes((size_t)kFrameHeight * (kFrameWidth + 2 * chromaWidth));
+		std::vector<uint16_t> bgr((size_t)kFrameWidth * kFrameHeight * 3);
+		CaptureFrame frame;
+
+		for (;;)
+		{
+			if (!m_queue.pop(frame, std::chrono::milliseconds(100)))
+			{
+				if (m_stopping)
+					break;
+				continue;
+			}
+
+			const int64_t startTime = steadyClockMicroseconds();
+			for (unsigned eyeIdx = 0; eyeIdx < frame.eyeCount(); eyeIdx++)
+			{
+				const uint8_t* v210 = frame.eye[eyeIdx]->GetBytes();
+				if (m_path == kDecodePlanar)
+				{
+					uint16_t* y = planes.data();
+					uint16_t* cb = y + (size_t)kFrameWidth * frame.height;
+					uint16_t* cr = cb + (size_t)chromaWidth * frame.height;
+					unpackV210(v210, frame.rowBytes, frame.width, frame.height, y, kFrameWidth * sizeof(uint16_t),
+						cb, chromaWidth * sizeof(uint16_t), cr, chromaWidth * sizeof(uint16_t));
+				}
+				else
+				{
+					convertV210ToBgr48(v210, frame.rowBytes, frame.width, frame.height, bgr.data(), kFrameWidth * 3 * sizeof(uint16_t));
+				}
+			}
+			m_busyMicroseconds += steadyClockMicroseconds() - startTime;
+
+			frame.release();
+			++m_framesDone;
+		}
+	}
+
+	DecodePath					m_path;
+	FrameQueue					m_queue;
+	std::atomic<bool>			m_stopping;
+	std::vector<std::thread>	m_threads;
+	std::atomic<uint64_t>		m_framesDone;
+	std::atomic<int64_t>		m_busyMicroseconds;
+};
+
+// Colour bars with a bright bar moving across them, one frame per position; the right eye is
+// the same picture shifted, as SimulatedDeckLink makes them
+static std::vector<uint8_t> makeSourceFrame(unsigned eyeIdx, unsigned frameIdx, int rowBytes)
+{
+	static const uint16_t kBarLuma[] = { 940, 877, 753, 690, 314, 251, 128, 64 };
+	static const uint16_t kBarCb[] = { 512, 64, 615, 167, 857, 409, 960, 512 };
+	static const uint16_t kBarCr[] = { 512, 553, 64, 105, 919, 960, 471, 512 };
+	const int chromaWidth = (kFrameWidth + 1) / 2;
+	const int shift = (eyeIdx == kEyeRight) ? kFrameWidth / 64 : 0;
+	const int barStart = (int)(frameIdx * kFrameWidth / kSourceFrames);
+	std::vector<uint16_t> y(kFrameWidth), cb(chromaWidth), cr(chromaWidth);
+	std::vector<uint8_t> frame((size_t)rowBytes * kFrameHeight, 0);
+
+	for (int row = 0; row < kFrameHeight; row++)
+	{
+		for (int x = 0; x < kFrameWidth; x++)
+		{
+			const int bar = (((x + shift) % kFrameWidth) * 8) / kFrameWidth;
+			const bool moving = (row > kFrameHeight / 3 && row < 2 * kFrameHeight / 3 && x >= barStart && x < barStart + kFrameWidth / 32);
+			y[x] = moving ? 940 : kBarLuma[bar];
+			if ((x & 1) == 0)
+			{
+				cb[x / 2] = moving ? 512 : kBarCb[bar];
+				cr[x / 2] = moving ? 512 : kBarCr[bar];
+			}
+		}
+		packV210Row(y.data(), cb.data(), cr.data(), kFrameWidth, frame.data() + (size_t)row * rowBytes);
+	}
+
+	return frame;
+}
+
+// best copy rate of kBandwidthProbeBytes, counting the bytes read and the bytes written, in GB/s
+static double measureCopyBandwidth()
+{
+	std::unique_ptr<uint8_t[]> source(new uint8_t[kBandwidthProbeBytes]);
+	std::unique_ptr<uint8_t[]> destination(new uint8_t[kBandwidthProbeBytes]);
+	double bestSeconds = 0.0;
+
+	memset(source.get(), 0x5A, kBandwidthProbeBytes);
+	memset(destination.get(), 0, kBandwidthProbeBytes);
+	for (int pass = 0; pass < 8; pass++)
+	{
+		const auto startTime = std::chrono::steady_clock::now();
+		memcpy(destination.get(), source.get(), kBandwidthProbeBytes);
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		if (pass == 0 || seconds < bestSeconds)
+			bestSeconds = seconds;
+	}
+
+	return (bestSeconds > 0.0) ? 2.0 * kBandwidthProbeBytes / bestSeconds / 1e9 : 0.0;
+}
+
+// the counters at one instant; the results are the difference between two of them
+struct BenchmarkSample
+{
+	int64_t		time;				// steadyClockMicroseconds()
+	double		cpuSeconds;
+	uint64_t	allocations;
+	uint64_t	allocatedBytes;
+	uint64_t	framesIngested;
+	int64_t		ingestMicroseconds;	// copying into the pool
+	int64_t		stallMicroseconds;	// waiting for a free pool buffer or for room in a stage's queue
+	uint64_t	framesRecorded;
+	uint64_t	bytesRecorded;
+	uint64_t	framesDecoded[2];
+	double		decodeSeconds[2];
+};
+
+static std::string jsonString(const char* text)
+{
+	std::string quoted = "\"";
+	for (const char* character = text; *character; character++)
+	{
+		if (*character == '"' || *character == '\\')
+			quoted += '\\';
+		quoted += *character;
+	}
+	return quoted + "\"";
+}
+
+static const char* compilerName(char* buffer, size_t bufferSize)
+{
+#if defined(_MSC_VER)
+	snprintf(buffer, bufferSize, "msvc %d", _MSC_VER);
+#elif defined(__clang__)
+	snprintf(buffer, bufferSize, "clang %s", __clang_version__);
+#elif defined(__GNUC__)
+	snprintf(buffer, bufferSize, "gcc %s", __VERSION__);
+#else
+	snprintf(buffer, bufferSize, "unknown");
+#endif
+	return buffer;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* resultsPath = (argc > 1) ? argv[1] : kResultsPath;
+	const char* sinkPath = kSinkPath ? kSinkPath : kNullSinkPath;
+	const int rowBytes = (int)rowBytesForV210(kFrameWidth);
+	const size_t payloadBytes = (size_t)rowBytes * kFrameHeight;
+	std::vector<std::vector<uint8_t>> sourceFrames[kEyeCount];
+	BenchmarkSample samples[2] = {};
+	uint64_t framesIngested = 0;
+	int64_t ingestMicroseconds = 0;
+	int64_t stallMicroseconds = 0;
+	char compiler[128];
+
+	printf("Pipeline benchmark: %dx%d v210, %u eye%s, %u s warm-up then %u s measured, recording to %s\n", kFrameWidth, kFrameHeight, kEyeCountToRun,
+		(kEyeCountToRun > 1) ? "s" : "", kWarmupSeconds, kMeasureSeconds, sinkPath);
+
+	const double copyGBps = measureCopyBandwidth();
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCountToRun; eyeIdx++)
+	{
+		for (unsigned frameIdx = 0; frameIdx < kSourceFrames; frameIdx++)
+			sourceFrames[eyeIdx].push_back(makeSourceFrame(eyeIdx, frameIdx, rowBytes));
+	}
+
+	// the format every frame shares; the card's callback fills in the same fields
+	CaptureFrame format = {};
+	format.pixelFormat = kPixelFormatV210;
+	format.width = kFrameWidth;
+	format.height = kFrameHeight;
+	format.rowBytes = rowBytes;
+	format.timeScale = kTimeScale;
+	format.streamDuration = kFrameDuration;
+	format.eye[kEyeLeft] = nullptr;
+	format.eye[kEyeRight] = nullptr;
+
+	FramePool pool(payloadBytes, kFramePoolBuffers);
+	RawRecorder recorder(kRecorderQueueDepth, kRecorderBackend, kRecordsInFlight, false);
+	{
+		// the frames themselves count their buffers; only the format says how many there will be
+		CaptureFrame openFormat = format;
+		openFormat.formatEyeCount = kEyeCountToRun;
+		if (!recorder.open(sinkPath, openFormat, kSinkPath ? kRecordPreallocateBytes : 0, &pool))
+		{
+			fprintf(stderr, "Could not open the recorder sink %s\n", sinkPath);
+			return 1;
+		}
+	}
+
+	std::unique_ptr<DecodeStage> decoders[2];
+	decoders[kDecodePlanar].reset(new DecodeStage(kDecodePlanar, kDecodeThreads, kStageQueueDepth));
+	decoders[kDecodeBgr48].reset(new DecodeStage(kDecodeBgr48, kDecodeThreads, kStageQueueDepth));
+
+	// the source: what the capture callback does with each frame, as fast as the stages take them
+	const int64_t startTime = steadyClockMicroseconds();
+	const int64_t measureTime = startTime + kWarmupSeconds * 1000000ll;
+	const int64_t endTime = measureTime + kMeasureSeconds * 1000000ll;
+	unsigned sampleCount = 0;
+
+	while (sampleCount < 2)
+	{
+		const int64_t now = steadyClockMicroseconds();
+		if (now >= ((sampleCount == 0) ? measureTime : endTime))
+		{
+			BenchmarkSample& sample = samples[sampleCount++];
+			const RecorderStats recorderStats = recorder.stats();
+			sample.time = now;
+			sample.cpuSeconds = processCpuSeconds();
+			sample.allocations = s_allocations.load(std::memory_order_relaxed);
+			sample.allocatedBytes = s_allocatedBytes.load(std::memory_order_relaxed);
+			sample.framesIngested = framesIngested;
+			sample.ingestMicroseconds = ingestMicroseconds;
+			sample.stallMicroseconds = stallMicroseconds;
+			sample.framesRecorded = recorderStats.framesWritten;
+			sample.bytesRecorded = recorderStats.bytesWritten;
+			for (unsigned pathIdx = 0; pathIdx < 2; pathIdx++)
+			{
+				sample.framesDecoded[pathIdx] = decoders[pathIdx]->framesDone();
+				sample.decodeSeconds[pathIdx] = decoders[pathIdx]->busySeconds();
+			}
+			continue;
+		}
+
+		CaptureFrame frame = format;
+		frame.frameNumber = framesIngested;
+		frame.streamTime = (int64_t)framesIngested * kFrameDuration;
+		frame.arrivalTime = now;
+		frame.anchorTime = now;
+		frame.hardwareTime = now;
+
+		// the stereo split: each eye is copied out of the card's frame into a pool buffer of its own
+		for (unsigned eyeIdx = 0; eyeIdx < kEyeCountToRun; eyeIdx++)
+		{
+			FrameBuffer* buffer = pool.acquire();
+			if (buffer == nullptr)
+			{
+				const int64_t stallStart = steadyClockMicroseconds();
+				while ((buffer = pool.acquire()) == nullptr)
+					std::this_thread::yield();
+				stallMicroseconds += steadyClockMicroseconds() - stallStart;
+			}
+
+			const int64_t copyStart = steadyClockMicroseconds();
+			memcpy(buffer->GetBytes(), sourceFrames[eyeIdx][framesIngested % kSourceFrames].data(), payloadBytes);
+			buffer->SetSize(payloadBytes);
+			frame.eye[eyeIdx] = buffer;
+			ingestMicroseconds += steadyClockMicroseconds() - copyStart;
+		}
+
+		// one reference for each decode path, and the recorder keeps the pool's
+		const int64_t submitStart = steadyClockMicroseconds();
+		frame.retain();
+		frame.retain();
+		decoders[kDecodePlanar]->submit(frame);
+		decoders[kDecodeBgr48]->submit(frame);
+		recorder.submitBlocking(frame);
+		stallMicroseconds += steadyClockMicroseconds() - submitStart;
+		framesIngested++;
+	}
+
+	const std::string backendName = recorder.backendName();
+	decoders[kDecodePlanar]->stop();
+	decoders[kDecodeBgr48]->stop();
+	recorder.close();
+
+	// results over the measured window
+	const BenchmarkSample& first = samples[0];
+	const BenchmarkSample& last = samples[1];
+	const double seconds = (last.time - first.time) / 1e6;
+	const uint64_t frames = last.framesIngested - first.framesIngested;
+	const double perFrame = (frames > 0) ? 1.0 / frames : 0.0;
+	const double fps = (seconds > 0.0) ? frames / seconds : 0.0;
+	const double cpuSeconds = last.cpuSeconds - first.cpuSeconds;
+
+	// memory traffic each stage causes by its own accounting: the ingest copy reads and writes each
+	// eye, each decode path reads it and writes its output, and a file sink reads it once more.
+	// The null device takes a write without reading the buffer
+	const uint64_t ingestBytes = 2 * (uint64_t)payloadBytes;
+	const uint64_t recordBytes = kSinkPath ? (uint64_t)payloadBytes : 0;
+	const uint64_t decodeBytes = DecodeStage::bytesPerEye(kDecodePlanar, kFrameWidth, kFrameHeight, rowBytes)
+		+ DecodeStage::bytesPerEye(kDecodeBgr48, kFrameWidth, kFrameHeight, rowBytes);
+	const uint64_t trafficPerFrame = kEyeCountToRun * (ingestBytes + recordBytes + decodeBytes);
+
+	FILE* results = fopen(resultsPath, "w");
+	if (results == nullptr)
+	{
+		fprintf(stderr, "Could not create results file %s\n", resultsPath);
+		return 1;
+	}
+
+	fprintf(results, "{\n");
+	fprintf(results, "  \"benchmark\": \"pipeline\",\n");
+	fprintf(results, "  \"build\": { \"compiler\": %s, \"configuration\": \"%s\", \"pointer_bits\": %u, \"date\": \"%s\" },\n",
+		jsonString(compilerName(compiler, sizeof(compiler))).c_str(),
+#ifdef NDEBUG
+		"release",
+#else
+		"debug",
+#endif
+		(unsigned)(sizeof(void*) * 8), __DATE__);
+	fprintf(results, "  \"host\": { \"hardware_threads\": %u, \"memcpy_gbps\": %.3f },\n", std::thread::hardware_concurrency(), copyGBps);
+	fprintf(results, "  \"config\": { \"width\": %d, \"height\": %d, \"row_bytes\": %d, \"eyes\": %u, \"pool_buffers\": %u, \"decode_threads\": %u, "
+		"\"sink\": %s, \"backend\": \"%s\", \"warmup_seconds\": %u },\n",
+		kFrameWidth, kFrameHeight, rowBytes, kEyeCountToRun, kFramePoolBuffers, kDecodeThreads, jsonString(sinkPath).c_str(), backendName.c_str(), kWarmupSeconds);
+	fprintf(results, "  \"results\": {\n");
+	fprintf(results, "    \"seconds\": %.3f,\n", seconds);
+	fprintf(results, "    \"frames\": %llu,\n", (unsigned long long)frames);
+	fprintf(results, "    \"fps\": %.2f,\n", fps);
+	fprintf(results, "    \"cpu_ms_per_frame\": %.3f,\n", cpuSeconds * 1000.0 * perFrame);
+	fprintf(results, "    \"cpu_cores\": %.2f,\n", (seconds > 0.0) ? cpuSeconds / seconds : 0.0);
+	fprintf(results, "    \"allocations_per_frame\": %.3f,\n", (last.allocations - first.allocations) * perFrame);
+	fprintf(results, "    \"allocated_bytes_per_frame\": %.1f,\n", (last.allocatedBytes - first.allocatedBytes) * perFrame);
+	fprintf(results, "    \"memory_bytes_per_frame\": %llu,\n", (unsigned long long)trafficPerFrame);
+	fprintf(results, "    \"memory_gbps\": %.3f,\n", trafficPerFrame * fps / 1e9);
+	fprintf(results, "    \"backpressure_ms_per_frame\": %.3f\n", (last.stallMicroseconds - first.stallMicroseconds) / 1000.0 * perFrame);
+	fprintf(results, "  },\n");
+	fprintf(results, "  \"stages\": [\n");
+	fprintf(results, "    { \"name\": \"ingest\", \"threads\": 1, \"frames\": %llu, \"busy_ms_per_frame\": %.3f },\n",
+		(unsigned long long)frames, (last.ingestMicroseconds - first.ingestMicroseconds) / 1000.0 * perFrame);
+	for (unsigned pathIdx = 0; pathIdx < 2; pathIdx++)
+	{
+		const uint64_t decoded = last.framesDecoded[pathIdx] - first.framesDecoded[pathIdx];
+		fprintf(results, "    { \"name\": \"%s\", \"threads\": %u, \"frames\": %llu, \"busy_ms_per_frame\": %.3f },\n", decoders[pathIdx]->name(),
+			decoders[pathIdx]->threadCount(), (unsigned long long)decoded, (decoded > 0) ? (last.decodeSeconds[pathIdx] - first.decodeSeconds[pathIdx]) * 1000.0 / decoded : 0.0);
+	}
+	fprintf(results, "    { \"name\": \"recorder\", \"threads\": 1, \"frames\": %llu, \"bytes\": %llu, \"dropped\": %llu }\n",
+		(unsigned long long)(last.framesRecorded - first.framesRecorded), (unsigned long long)(last.bytesRecorded - first.bytesRecorded),
+		(unsigned long long)recorder.framesDropped());
+	fprintf(results, "  ]\n");
+	fprintf(results, "}\n");
+	fclose(results);
+
+	printf("%.1f fps, %.2f ms CPU per frame, %.1f allocations per frame, %.2f GB/s of memory traffic (memcpy gets %.2f GB/s); results in %s\n",
+		fps, cpuSeconds * 1000.0 * perFrame, (last.allocations - first.allocations) * perFrame, trafficPerFrame * fps / 1e9, copyGBps, resultsPath);
+
+	if (kSinkPath)
+		remove(kSinkPath);
+
+	return 0;
+}
@@ -0,0 +1,300 @@
+// replay test: plays a recording through the card-facing side of the pipeline on Linux, re-records it and checks the copy against the original
+//
+// The capture programs replay a recording into their whole pipeline when kReplayPath is set, but
+// they are Windows programs. This one needs no card and no Visual Studio: it takes the frames
+// ArchiveReplaySource delivers through IDeckLinkInputCallback, copies both eyes into a FramePool as
+// the capture callback does, records them with RawRecorder, then reads the copy back with
+// FrameArchive and compares every frame's numbers, times, flags and payloads with the original.
+// Only the SDK headers are used, none of its library. From this directory:
+//   g++ -O2 -std=c++17 -I../DeckLinkStereoCaptureTest -I<DeckLink SDK>/Linux/include main.cpp
+//     ../DeckLinkStereoCaptureTest/{ArchiveReplaySource,BinaryLog,FrameArchive,FramePool,FrameQueue,IoUringWriteBackend,LatencyHistogram,LatencyTracker,RawRecorder,StaticSceneDetector,StripeCompressor,ThreadPoolWriteBackend,TraceRecorder,V210Unpack,WriteBackend}.cpp
+//     `pkg-config --cflags --libs opencv4` -lpthread
+// adding -luring, -llz4 and -lzstd where those headers are installed. Run as
+//   ./a.out recording.dlraw [copy.dlraw]
+// it exits with 0 when the copy matches
+#include "ArchiveReplaySource.h"
+#include "CaptureFrame.h"
+#include "FrameArchive.h"
+#include "FramePool.h"
+#include "RawRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Run parameters
+const char* const         kCopyPath = "DeckLinkReplayTest.dlraw";	// overridden by the second argument
+const WriteBackendType    kRecorderBackend = kWriteBackendIoUring;
+const unsigned            kRecorderQueueDepth = 16;
+const unsigned            kRecordsInFlight = 4;
+
+// Receives the replayed frames as DeckLinkDevice receives a card's: the payloads are copied into
+// pooled buffers and handed to the recorder, and the SDK frames go back as soon as the callback
+// returns. The source archive is only used to look up each frame's original frame number, which
+// the SDK frame does not carry
+class ReplayRecorder : public IDeckLinkInputCallback
+{
+public:
+	ReplayRecorder(const FrameArchive& original, FramePool* pool, RawRecorder* recorder) :
+		m_original(original), m_pool(pool), m_recorder(recorder), m_framesRecorded(0), m_framesFailed(0), m_refCount(1)
+	{
+	}
+
+	uint64_t	framesRecorded() const { return m_framesRecorded; }
+	uint64_t	framesFailed() const { return m_framesFailed; }
+
+	// IDeckLinkInputCallback interface
+	virtual HRESULT	STDMETHODCALLTYPE	VideoInputFormatChanged(BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode* newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags)
+	{
+		return S_OK;
+	}
+
+	virtual HRESULT	STDMETHODCALLTYPE	VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket)
+	{
+		if (videoFrame == nullptr)
+			return S_OK;
+
+		BMDTimeValue time;
+		BMDTimeValue duration;
+		BMDTimeValue hwTime;
+		const int64_t timeScale = m_original.header().timeScale;
+		if (videoFrame->GetStreamTime(&time, &duration, timeScale) != S_OK ||
+			videoFrame->GetHardwareReferenceTimestamp(1000000, &hwTime, NULL) != S_OK)
+		{
+			m_framesFailed++;
+			return S_OK;
+		}
+
+		const long long originalIdx = m_original.findByStreamTime(time);
+		CaptureFrame frame = {};
+		frame.frameNumber = (originalIdx >= 0) ? m_original.entry((size_t)originalIdx).frameNumber : m_framesRecorded.load();
+		frame.streamTime = time;
+		frame.streamDuration = duration;
+		frame.timeScale = timeScale;
+		frame.hardwareTime = hwTime;
+		frame.arrivalTime = steadyClockMicroseconds();
+		frame.anchorTime = frame.arrivalTime;
+		frame.flags = videoFrame->GetFlags();
+		frame.pixelFormat = videoFrame->GetPixelFormat();
+		frame.width = (int32_t)videoFrame->GetWidth();
+		frame.height = (int32_t)videoFrame->GetHeight();
+		frame.rowBytes = (int32_t)videoFrame->GetRowBytes();
+		frame.eye[kEyeLeft] = copyToPool(videoFrame);
+
+		if (m_original.header().eyeCount > 1)
+		{
+			IDeckLinkVideoFrame3DExtensions* videoFrameExtensions = NULL;
+			IDeckLinkVideoFrame* videoFrameRight = NULL;
+			if (videoFrame->QueryInterface(IID_IDeckLinkVideoFrame3DExtensions, (void**)&videoFrameExtensions) == S_OK)
+			{
+				if (videoFrameExtensions->GetFrameForRightEye(&videoFrameRight) == S_OK)
+				{
+					frame.eye[kEyeRight] = copyToPool(videoFrameRight);
+					videoFrameRight->Release();
+				}
+				videoFrameExtensions->Release();
+			}
+		}
+
+		if (frame.eye[kEyeLeft] == nullptr || (m_original.header().eyeCount > 1 && frame.eye[kEyeRight] == nullptr))
+		{
+			fprintf(stderr, "Could not copy frame %llu\n", (unsigned long long)frame.frameNumber);
+			m_framesFailed++;
+			frame.release();
+			return S_OK;
+		}
+
+		// the recorder takes over the buffer references; waiting for room paces the replay to the disk
+		if (m_recorder->submitBlocking(frame))
+			m_framesRecorded++;
+		else
+			m_framesFailed++;
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID* ppv)
+	{
+		return E_NOINTERFACE;
+	}
+
+	virtual ULONG	STDMETHODCALLTYPE	AddRef(void)
+	{
+		return ++m_refCount;
+	}
+
+	virtual ULONG	STDMETHODCALLTYPE	Release(void)
+	{
+		// lives on main()'s stack
+		return --m_refCount;
+	}
+
+private:
+	// the replay waits for the recorder to hand buffers back rather than drop frames
+	FrameBuffer* copyToPool(IDeckLinkVideoFrame* videoFrame)
+	{
+		void* frameBytes = nullptr;
+		const size_t payloadBytes = (size_t)videoFrame->GetRowBytes() * videoFrame->GetHeight();
+		if (videoFrame->GetBytes(&frameBytes) != S_OK || frameBytes == nullptr || payloadBytes > m_pool->bufferSize())
+			return nullptr;
+
+		FrameBuffer* buffer = m_pool->acquire();
+		while (buffer == nullptr)
+		{
+			std::this_thread::yield();
+			buffer = m_pool->acquire();
+		}
+
+		memcpy(buffer->GetBytes(), frameBytes, payloadBytes);
+		buffer->SetSize(payloadBytes);
+		return buffer;
+	}
+
+	const FrameArchive&		m_original;
+	FramePool*				m_pool;
+	RawRecorder*			m_recorder;
+	std::atomic<uint64_t>	m_framesRecorded;
+	std::atomic<uint64_t>	m_framesFailed;
+	std::atomic<ULONG>		m_refCount;
+};
+
+// payloads come back decompressed, so a compressed original compares with its raw copy
+static bool samePayload(FrameArchive& original, FrameArchive& copy, size_t frameIdx, unsigned eye)
+{
+	const cv::Mat expected = original.frame(frameIdx, eye);
+	const cv::Mat actual = copy.frame(frameIdx, eye);
+	if (expected.empty() || actual.empty() || expected.rows != actual.rows || expected.cols != actual.cols || expected.type() != actual.type())
+		return false;
+
+	const size_t rowBytes = expected.cols * expected.elemSize();
+	for (int row = 0; row < expected.rows; row++)
+	{
+		if (memcmp(expected.ptr(row), actual.ptr(row), rowBytes) != 0)
+			return false;
+	}
+	return true;
+}
+
+// every frame of the original must be in the copy, in order, with the same numbers, times, flags and pictures
+static unsigned compareArchives(FrameArchive& original, FrameArchive& copy)
+{
+	const RecordingFileHeader& expected = original.header();
+	const RecordingFileHeader& actual = copy.header();
+	if (actual.pixelFormat != expected.pixelFormat || actual.width != expected.width || actual.height != expected.height ||
+		actual.rowBytes != expected.rowBytes || actual.eyeCount != expected.eyeCount || actual.timeScale != expected.timeScale)
+	{
+		fprintf(stderr, "The copy's format differs from the original's\n");
+		return 1;
+	}
+	if (copy.frameCount() != original.frameCount())
+	{
+		fprintf(stderr, "The copy holds %zu frames, the original %zu\n", copy.frameCount(), original.frameCount());
+		return 1;
+	}
+
+	unsigned mismatches = 0;
+	for (size_t frameIdx = 0; frameIdx < original.frameCount(); frameIdx++)
+	{
+		const FrameRecordHeader* expectedRecord = original.recordHeader(frameIdx);
+		const FrameRecordHeader* actualRecord = copy.recordHeader(frameIdx);
+		if (expectedRecord == nullptr || actualRecord == nullptr)
+		{
+			fprintf(stderr, "Frame %zu: could not read the record\n", frameIdx);
+			mismatches++;
+			continue;
+		}
+
+		bool matches = actualRecord->frameNumber == expectedRecord->frameNumber &&
+			actualRecord->streamTime == expectedRecord->streamTime &&
+			actualRecord->streamDuration == expectedRecord->streamDuration &&
+			actualRecord->hardwareTime == expectedRecord->hardwareTime &&
+			actualRecord->flags == expectedRecord->flags;
+		for (unsigned eye = 0; eye < expected.eyeCount && matches; eye++)
+			matches = samePayload(original, copy, frameIdx, eye);
+
+		if (!matches)
+		{
+			fprintf(stderr, "Frame %zu (number %llu) differs\n", frameIdx, (unsigned long long)expectedRecord->frameNumber);
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s recording.dlraw [copy.dlraw]\n", argv[0]);
+		return 1;
+	}
+	const std::string originalPath = argv[1];
+	const std::string copyPath = (argc > 2) ? argv[2] : kCopyPath;
+	if (copyPath == originalPath)
+	{
+		fprintf(stderr, "Could not record over the recording being replayed\n");
+		return 1;
+	}
+
+	ArchiveReplaySource source;
+	FrameArchive original;
+	if (!source.open(originalPath) || !original.open(originalPath))
+	{
+		fprintf(stderr, "Could not open %s\n", originalPath.c_str());
+		return 1;
+	}
+
+	const RecordingFileHeader& header = source.header();
+	CaptureFrame format = {};
+	format.pixelFormat = header.pixelFormat;
+	format.width = header.width;
+	format.height = header.height;
+	format.rowBytes = header.rowBytes;
+	format.timeScale = header.timeScale;
+	format.streamDuration = source.frameDuration();
+	format.formatEyeCount = header.eyeCount;
+
+	// enough buffers for every frame the recorder may hold, queued or being written, plus the one being copied
+	FramePool pool((size_t)header.payloadBytes, (kRecorderQueueDepth + kRecordsInFlight + 1) * header.eyeCount);
+	RawRecorder recorder(kRecorderQueueDepth, kRecorderBackend, kRecordsInFlight, false);
+	if (!recorder.open(copyPath, format, 0, &pool))
+	{
+		fprintf(stderr, "Could not open %s for recording\n", copyPath.c_str());
+		return 1;
+	}
+
+	ReplayRecorder callback(original, &pool, &recorder);
+	printf("Replaying %zu frames of %s into %s...\n", source.frameCount(), originalPath.c_str(), copyPath.c_str());
+	if (!source.start(&callback, kReplayAsFastAsPossible, false))
+	{
+		fprintf(stderr, "Could not start the replay\n");
+		recorder.close();
+		return 1;
+	}
+	source.waitUntilFinished();
+	const ReplayStats replayStats = source.stats();
+	recorder.close();
+
+	printf("Replayed %llu frames at %.1f fps; %llu skipped, %llu recorded, %llu failed\n",
+		(unsigned long long)replayStats.framesDelivered, replayStats.deliveredFps, (unsigned long long)replayStats.framesSkipped,
+		(unsigned long long)callback.framesRecorded(), (unsigned long long)callback.framesFailed());
+
+	FrameArchive copy;
+	if (!copy.open(copyPath))
+	{
+		fprintf(stderr, "Could not open the copy %s\n", copyPath.c_str());
+		return 1;
+	}
+
+	const unsigned mismatches = compareArchives(original, copy);
+	if (mismatches != 0 || replayStats.framesSkipped != 0 || callback.framesFailed() != 0)
+	{
+		printf("FAILED: %u frames differ\n", mismatches);
+		return 1;
+	}
+
+	printf("The copy matches the original\n");
+	return 0;
+}
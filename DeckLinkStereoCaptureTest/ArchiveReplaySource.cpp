@@ -0,0 +1,316 @@
+// archive replay: plays a recording into an IDeckLinkInputCallback, the way a card delivers captured frames
+#include "ArchiveReplaySource.h"
+#include "CaptureFrame.h"
+
+#include <stdio.h>
+#include <chrono>
+
+static const int64_t kMicrosecondsPerSecond = 1000000;
+
+// how often the replay thread prints its statistics
+static const std::chrono::seconds kStatsInterval(10);
+
+// the OS sleeps in coarse steps; the last stretch before a frame is due is spent yielding instead
+static const int64_t kSpinUs = 2000;
+
+// value in units of 1/from, in units of 1/to; split so that microsecond hardware times do not overflow
+static int64_t rescaleTime(int64_t value, int64_t from, int64_t to)
+{
+	return (value / from) * to + (value % from) * to / from;
+}
+
+// one eye of one recorded frame; the left eye carries the right one for the 3D extensions
+class ReplayVideoFrame : public IDeckLinkVideoInputFrame, public IDeckLinkVideoFrame3DExtensions
+{
+private:
+	const RecordingFileHeader&	m_fileHeader;
+	const FrameRecordHeader&	m_record;
+	cv::Mat					m_payload;			// owns decompressed payloads, or views the mapping
+	int64_t					m_timeOffset;		// added to stream times, in m_fileHeader.timeScale units
+	int64_t					m_hardwareOffset;	// added to hardware times, in microseconds
+	ReplayVideoFrame*		m_rightEye;
+
+	std::atomic<ULONG>	m_refCount;
+
+public:
+	ReplayVideoFrame(const RecordingFileHeader& fileHeader, const FrameRecordHeader& record, const cv::Mat& payload,
+		int64_t timeOffset, int64_t hardwareOffset, ReplayVideoFrame* rightEye) :
+		m_fileHeader(fileHeader), m_record(record), m_payload(payload), m_timeOffset(timeOffset),
+		m_hardwareOffset(hardwareOffset), m_rightEye(rightEye), m_refCount(1)
+	{
+	}
+	virtual ~ReplayVideoFrame()
+	{
+		if (m_rightEye)
+			m_rightEye->Release();
+	}
+
+	// IDeckLinkVideoFrame interface
+	virtual long			STDMETHODCALLTYPE	GetWidth(void) { return m_fileHeader.width; };
+	virtual long			STDMETHODCALLTYPE	GetHeight(void) { return m_fileHeader.height; };
+	virtual long			STDMETHODCALLTYPE	GetRowBytes(void) { return m_fileHeader.rowBytes; };
+	virtual BMDFrameFlags	STDMETHODCALLTYPE	GetFlags(void) { return (BMDFrameFlags)m_record.flags; };
+	virtual BMDPixelFormat	STDMETHODCALLTYPE	GetPixelFormat(void) { return (BMDPixelFormat)m_fileHeader.pixelFormat; };
+
+	virtual HRESULT			STDMETHODCALLTYPE	GetBytes(void** buffer)
+	{
+		*buffer = (void*)m_payload.data;
+		return S_OK;
+	}
+
+	// Dummy implementations of remaining methods in IDeckLinkVideoFrame
+	virtual HRESULT			STDMETHODCALLTYPE	GetAncillaryData(IDeckLinkVideoFrameAncillary** ancillary) { return E_NOTIMPL; };
+	virtual HRESULT			STDMETHODCALLTYPE	GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode** timecode) { return E_NOTIMPL; };
+
+	// IDeckLinkVideoInputFrame interface
+	virtual HRESULT			STDMETHODCALLTYPE	GetStreamTime(BMDTimeValue* frameTime, BMDTimeValue* frameDuration, BMDTimeScale timeScale)
+	{
+		*frameTime = rescaleTime(m_record.streamTime + m_timeOffset, m_fileHeader.timeScale, timeScale);
+		*frameDuration = rescaleTime(m_record.streamDuration, m_fileHeader.timeScale, timeScale);
+		return S_OK;
+	}
+
+	virtual HRESULT			STDMETHODCALLTYPE	GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue* frameTime, BMDTimeValue* frameDuration)
+	{
+		*frameTime = rescaleTime(m_record.hardwareTime + m_hardwareOffset, kMicrosecondsPerSecond, timeScale);
+		if (frameDuration)
+			*frameDuration = rescaleTime(m_record.streamDuration, m_fileHeader.timeScale, timeScale);
+		return S_OK;
+	}
+
+	// IDeckLinkVideoFrame3DExtensions interface, for dual-stream 3D recordings
+	virtual BMDVideo3DPackingFormat	STDMETHODCALLTYPE	Get3DPackingFormat(void) { return bmdVideo3DPackingLeftOnly; };
+
+	virtual HRESULT			STDMETHODCALLTYPE	GetFrameForRightEye(IDeckLinkVideoFrame** rightEyeFrame)
+	{
+		if (m_rightEye == nullptr)
+			return E_FAIL;
+
+		m_rightEye->AddRef();
+		*rightEyeFrame = (IDeckLinkVideoInputFrame*)m_rightEye;
+		return S_OK;
+	}
+
+	// IUnknown interface
+	virtual HRESULT			STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID* ppv)
+	{
+		if (ppv == NULL)
+			return E_INVALIDARG;
+
+		*ppv = NULL;
+		if (isSameIid(iid, IID_IUnknown) || isSameIid(iid, IID_IDeckLinkVideoFrame) || isSameIid(iid, IID_IDeckLinkVideoInputFrame))
+			*ppv = (IDeckLinkVideoInputFrame*)this;
+		else if (isSameIid(iid, IID_IDeckLinkVideoFrame3DExtensions) && m_rightEye != nullptr)
+			*ppv = (IDeckLinkVideoFrame3DExtensions*)this;
+		else
+			return E_NOINTERFACE;
+
+		AddRef();
+		return S_OK;
+	}
+
+	virtual ULONG			STDMETHODCALLTYPE	AddRef(void)
+	{
+		return ++m_refCount;
+	}
+
+	virtual ULONG			STDMETHODCALLTYPE	Release(void)
+	{
+		ULONG newRefValue = --m_refCount;
+		if (newRefValue == 0)
+			delete this;
+
+		return newRefValue;
+	}
+};
+
+ArchiveReplaySource::ArchiveReplaySource() :
+	m_callback(nullptr),
+	m_pacing(kReplayOriginalCadence),
+	m_loop(false),
+	m_running(false),
+	m_framesDelivered(0),
+	m_framesLate(0),
+	m_framesSkipped(0),
+	m_passesCompleted(0),
+	m_callbackTotalUs(0),
+	m_callbackMaxUs(0),
+	m_startUs(0),
+	m_endUs(0)
+{
+}
+
+ArchiveReplaySource::~ArchiveReplaySource()
+{
+	stop();
+}
+
+bool ArchiveReplaySource::open(const std::string& path)
+{
+	if (m_running || !m_archive.open(path))
+		return false;
+
+	if (m_archive.frameCount() == 0)
+	{
+		fprintf(stderr, "%s holds no frames to replay\n", path.c_str());
+		return false;
+	}
+
+	printf("Replay: %s, %zu frames of %dx%d, %u eyes%s\n", path.c_str(), m_archive.frameCount(), header().width, header().height,
+		header().eyeCount, m_archive.isCompressed() ? ", compressed" : "");
+	return true;
+}
+
+int64_t ArchiveReplaySource::frameDuration() const
+{
+	for (size_t frameIdx = 0; frameIdx < m_archive.frameCount(); frameIdx++)
+	{
+		const FrameRecordHeader* record = m_archive.recordHeader(frameIdx);
+		if (record && record->streamDuration > 0)
+			return record->streamDuration;
+	}
+	return 0;
+}
+
+bool ArchiveReplaySource::start(IDeckLinkInputCallback* callback, ReplayPacing pacing, bool loop)
+{
+	if (m_running || callback == nullptr || m_archive.frameCount() == 0)
+		return false;
+
+	if (m_replay.joinable())
+		m_replay.join();
+
+	m_callback = callback;
+	m_callback->AddRef();
+	m_pacing = pacing;
+	m_loop = loop;
+	m_framesDelivered = 0;
+	m_framesLate = 0;
+	m_framesSkipped = 0;
+	m_passesCompleted = 0;
+	m_callbackTotalUs = 0;
+	m_callbackMaxUs = 0;
+	m_startUs = steadyClockMicroseconds();
+	m_endUs = 0;
+
+	m_running = true;
+	m_replay = std::thread(&ArchiveReplaySource::replayThread, this);
+	return true;
+}
+
+void ArchiveReplaySource::waitUntilFinished()
+{
+	if (m_replay.joinable())
+		m_replay.join();
+}
+
+void ArchiveReplaySource::stop()
+{
+	m_running = false;
+	waitUntilFinished();
+}
+
+ReplayStats ArchiveReplaySource::stats()
+{
+	ReplayStats stats = {};
+	const uint64_t framesDelivered = m_framesDelivered;
+	const int64_t endUs = m_endUs;
+
+	stats.framesDelivered = framesDelivered;
+	stats.framesLate = m_framesLate;
+	stats.framesSkipped = m_framesSkipped;
+	stats.passesCompleted = m_passesCompleted;
+	stats.elapsedSeconds = ((endUs != 0 ? endUs : steadyClockMicroseconds()) - m_startUs) / 1e6;
+	stats.deliveredFps = stats.elapsedSeconds > 0.0 ? framesDelivered / stats.elapsedSeconds : 0.0;
+	stats.meanCallbackMs = framesDelivered ? (m_callbackTotalUs / 1000.0) / framesDelivered : 0.0;
+	stats.maxCallbackMs = m_callbackMaxUs / 1000.0;
+	return stats;
+}
+
+void ArchiveReplaySource::replayThread()
+{
+	const RecordingFileHeader& fileHeader = m_archive.header();
+	const size_t frameCount = m_archive.frameCount();
+	const ArchiveIndexEntry& first = m_archive.entry(0);
+	const ArchiveIndexEntry& last = m_archive.entry(frameCount - 1);
+	const int64_t frameDurationTicks = frameDuration();
+	const int64_t frameDurationUs = rescaleTime(frameDurationTicks, fileHeader.timeScale, kMicrosecondsPerSecond);
+	std::chrono::steady_clock::time_point lastStats = std::chrono::steady_clock::now();
+	int64_t timeOffset = 0;
+	int64_t hardwareOffset = 0;
+
+	while (m_running)
+	{
+		for (size_t frameIdx = 0; frameIdx < frameCount && m_running; frameIdx++)
+		{
+			const FrameRecordHeader* record = m_archive.recordHeader(frameIdx);
+			if (record == nullptr)
+			{
+				++m_framesSkipped;
+				continue;
+			}
+
+			if (m_pacing == kReplayOriginalCadence)
+			{
+				const int64_t dueUs = m_startUs + rescaleTime(record->streamTime + timeOffset - first.streamTime, fileHeader.timeScale, kMicrosecondsPerSecond);
+				int64_t nowUs = steadyClockMicroseconds();
+				if (dueUs - nowUs > kSpinUs)
+					std::this_thread::sleep_for(std::chrono::microseconds(dueUs - nowUs - kSpinUs));
+				while ((nowUs = steadyClockMicroseconds()) < dueUs)
+					std::this_thread::yield();
+				if (nowUs - dueUs > frameDurationUs)
+					++m_framesLate;
+			}
+
+			const cv::Mat left = m_archive.frame(frameIdx, kEyeLeft);
+			const cv::Mat right = (record->eyeCount > 1) ? m_archive.frame(frameIdx, kEyeRight) : cv::Mat();
+			if (left.empty() || (record->eyeCount > 1 && right.empty()))
+			{
+				++m_framesSkipped;
+				continue;
+			}
+
+			ReplayVideoFrame* rightEye = (record->eyeCount > 1) ? new ReplayVideoFrame(fileHeader, *record, right, timeOffset, hardwareOffset, nullptr) : nullptr;
+			ReplayVideoFrame* videoFrame = new ReplayVideoFrame(fileHeader, *record, left, timeOffset, hardwareOffset, rightEye);
+
+			const int64_t callbackStartUs = steadyClockMicroseconds();
+			m_callback->VideoInputFrameArrived(videoFrame, nullptr);
+			const uint64_t callbackUs = (uint64_t)(steadyClockMicroseconds() - callbackStartUs);
+			videoFrame->Release();
+
+			m_callbackTotalUs += callbackUs;
+			if (callbackUs > m_callbackMaxUs)
+				m_callbackMaxUs = callbackUs;
+			++m_framesDelivered;
+
+			if (std::chrono::steady_clock::now() - lastStats >= kStatsInterval)
+			{
+				printStats();
+				lastStats = std::chrono::steady_clock::now();
+			}
+		}
+
+		if (!m_running)
+			break;
+		++m_passesCompleted;
+		if (!m_loop)
+			break;
+
+		// the next pass starts one frame after the last one of this pass
+		timeOffset += last.streamTime + frameDurationTicks - first.streamTime;
+		hardwareOffset += last.hardwareTime + frameDurationUs - first.hardwareTime;
+	}
+
+	m_endUs = steadyClockMicroseconds();
+	m_running = false;
+	m_callback->Release();
+	printStats();
+}
+
+void ArchiveReplaySource::printStats()
+{
+	ReplayStats current = stats();
+	printf("Replay: %llu frames in %.1f s (%.1f fps), %llu late, %llu skipped, %u passes, callback mean %.2f / max %.2f ms\n",
+		(unsigned long long)current.framesDelivered, current.elapsedSeconds, current.deliveredFps, (unsigned long long)current.framesLate,
+		(unsigned long long)current.framesSkipped, current.passesCompleted, current.meanCallbackMs, current.maxCallbackMs);
+}
@@ -0,0 +1,77 @@
+// archive replay: plays a recording into an IDeckLinkInputCallback, the way a card delivers captured frames
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "DeckLinkSdk.h"
+#include "FrameArchive.h"
+
+enum ReplayPacing
+{
+	kReplayOriginalCadence,		// frames are spaced as their recorded stream times were
+	kReplayAsFastAsPossible,	// each frame as soon as the callback has returned from the last
+};
+
+struct ReplayStats
+{
+	uint64_t	framesDelivered;
+	uint64_t	framesLate;			// delivered more than a frame after their time; original cadence only
+	uint64_t	framesSkipped;		// records that could not be read or decompressed
+	unsigned	passesCompleted;
+	double		elapsedSeconds;
+	double		deliveredFps;
+	double		meanCallbackMs;		// time spent inside VideoInputFrameArrived
+	double		maxCallbackMs;
+};
+
+// Every record becomes an IDeckLinkVideoInputFrame with its recorded stream time, hardware
+// reference time and flags, and frames of dual-stream 3D recordings answer
+// IDeckLinkVideoFrame3DExtensions with their right eye. Uncompressed payloads are handed over
+// straight from the mapped file; compressed ones are decompressed first. As with the SDK, a frame
+// is only valid during the callback unless the callback keeps a reference. When looping, times
+// carry on increasing from one pass to the next, as if capture had never stopped
+class ArchiveReplaySource
+{
+public:
+	ArchiveReplaySource();
+	~ArchiveReplaySource();
+
+	bool		open(const std::string& path);
+
+	const RecordingFileHeader&	header() const { return m_archive.header(); }
+	size_t		frameCount() const { return m_archive.frameCount(); }
+
+	// of the first frame, in header().timeScale units
+	int64_t		frameDuration() const;
+
+	// calls callback->VideoInputFrameArrived for every recorded frame, on the replay thread
+	bool		start(IDeckLinkInputCallback* callback, ReplayPacing pacing, bool loop);
+
+	// returns once every frame has been delivered, so never while looping
+	void		waitUntilFinished();
+	void		stop();
+
+	bool		isRunning() const { return m_running; }
+	ReplayStats	stats();
+
+private:
+	void		replayThread();
+	void		printStats();
+
+	FrameArchive				m_archive;
+	IDeckLinkInputCallback*		m_callback;
+	ReplayPacing				m_pacing;
+	bool						m_loop;
+	std::thread					m_replay;
+	std::atomic<bool>			m_running;
+	std::atomic<uint64_t>		m_framesDelivered;
+	std::atomic<uint64_t>		m_framesLate;
+	std::atomic<uint64_t>		m_framesSkipped;
+	std::atomic<unsigned>		m_passesCompleted;
+	std::atomic<uint64_t>		m_callbackTotalUs;
+	std::atomic<uint64_t>		m_callbackMaxUs;
+	std::atomic<int64_t>		m_startUs;
+	std::atomic<int64_t>		m_endUs;			// 0 while replaying
+};
@@ -0,0 +1,470 @@
+// binary log: fixed-size records in per-thread rings, formatted or written out by a background thread
+#include "BinaryLog.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// how long the drain thread sleeps between passes over the rings
+static const std::chrono::milliseconds kDrainInterval(10);
+
+// one thread's records; only that thread writes head, only the drain thread writes tail, and
+// each sits on its own cache line so neither side keeps taking the line from the other
+struct BinaryLogRing
+{
+	std::vector<BinaryLogRecord>	records;		// a power of two of them
+	uint64_t						mask;
+	unsigned						index;
+	alignas(64) std::atomic<uint64_t>	head;
+	uint64_t						cachedTail;		// writing thread only; tail is only read again when this says full
+	std::atomic<uint64_t>			dropped;
+	alignas(64) std::atomic<uint64_t>	tail;
+	uint64_t						droppedReported;	// drain thread only
+};
+
+// rings outlive the log, so a thread that still has one never writes to freed memory
+static std::mutex							s_ringsMutex;
+static std::vector<std::unique_ptr<BinaryLogRing>>	s_rings;
+static thread_local BinaryLogRing*			s_threadRing = nullptr;
+
+static std::atomic<bool>	s_running(false);
+static std::atomic<bool>	s_draining(false);
+static std::thread			s_drainer;
+static unsigned				s_recordsPerThread = 0;
+static FILE*				s_text = nullptr;
+static std::mutex			s_textMutex;		// keeps s_text open while a thread prints to it with the log stopped
+static FILE*				s_binary = nullptr;
+static std::map<const char*, uint32_t>	s_stringIds;	// drain thread only, for the binary file
+
+struct DrainedRecord
+{
+	BinaryLogRecord	record;
+	unsigned		thread;
+};
+
+static BinaryLogRing* threadRing()
+{
+	if (s_threadRing != nullptr)
+		return s_threadRing;
+
+	std::unique_ptr<BinaryLogRing> ring(new BinaryLogRing());
+	unsigned capacity = 1;
+	while (capacity < s_recordsPerThread)
+		capacity <<= 1;
+	ring->records.resize(capacity);
+	ring->mask = capacity - 1;
+	ring->head = 0;
+	ring->cachedTail = 0;
+	ring->tail = 0;
+	ring->dropped = 0;
+	ring->droppedReported = 0;
+
+	std::lock_guard<std::mutex> guard(s_ringsMutex);
+	ring->index = (unsigned)s_rings.size();
+	s_threadRing = ring.get();
+	s_rings.push_back(std::move(ring));
+	return s_threadRing;
+}
+
+static void printRecord(const BinaryLogRecord& record)
+{
+	char text[1024];
+	BinaryLog::format(text, sizeof(text), record.format, record.argCount, record.args);
+	fputs(text, (record.level == kLogWarning) ? stderr : (s_text ? s_text : stdout));
+}
+
+static uint32_t binaryStringId(const char* string)
+{
+	std::map<const char*, uint32_t>::const_iterator known = s_stringIds.find(string);
+	if (known != s_stringIds.end())
+		return known->second;
+
+	const uint32_t id = (uint32_t)s_stringIds.size();
+	const size_t length = std::min(strlen(string), (size_t)UINT16_MAX);
+	const uint16_t length16 = (uint16_t)length;
+	s_stringIds[string] = id;
+	fputc('S', s_binary);
+	fwrite(&id, sizeof(id), 1, s_binary);
+	fwrite(&length16, sizeof(length16), 1, s_binary);
+	fwrite(string, 1, length, s_binary);
+	return id;
+}
+
+// the conversion character of each printf specification in format, in order
+static unsigned conversions(const char* format, char* found, unsigned maxFound)
+{
+	unsigned count = 0;
+	for (const char* c = format; *c != '\0' && count < maxFound; c++)
+	{
+		if (*c != '%')
+			continue;
+		c++;
+		while (*c != '\0' && strchr("-+ #0123456789.*hljztL", *c) != nullptr)
+		{
+			// a * width or precision takes an argument of its own
+			if (*c == '*' && count < maxFound)
+				found[count++] = '*';
+			c++;
+		}
+		if (*c == '\0')
+			break;
+		if (*c != '%' && count < maxFound)
+			found[count++] = *c;
+	}
+	return count;
+}
+
+static void writeBinaryRecord(const BinaryLogRecord& record, unsigned thread)
+{
+	char kinds[kBinaryLogMaxArgs];
+	const unsigned kindCount = conversions(record.format, kinds, kBinaryLogMaxArgs);
+	uint64_t args[kBinaryLogMaxArgs];
+
+	// strings go in first, so a reader has them before the record
+	const uint32_t formatId = binaryStringId(record.format);
+	for (unsigned argIdx = 0; argIdx < record.argCount; argIdx++)
+	{
+		const char* string = (const char*)(uintptr_t)record.args[argIdx];
+		args[argIdx] = (argIdx < kindCount && kinds[argIdx] == 's' && string != nullptr) ? binaryStringId(string) : record.args[argIdx];
+	}
+
+	const uint16_t thread16 = (uint16_t)thread;
+	const int64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::duration(record.time)).count();
+	fputc('R', s_binary);
+	fputc(record.level, s_binary);
+	fputc(record.argCount, s_binary);
+	fwrite(&thread16, sizeof(thread16), 1, s_binary);
+	fwrite(&timeNs, sizeof(timeNs), 1, s_binary);
+	fwrite(&formatId, sizeof(formatId), 1, s_binary);
+	fwrite(args, sizeof(uint64_t), record.argCount, s_binary);
+}
+
+static void drainOnce(std::vector<DrainedRecord>& batch)
+{
+	std::vector<BinaryLogRing*> rings;
+	{
+		std::lock_guard<std::mutex> guard(s_ringsMutex);
+		for (std::unique_ptr<BinaryLogRing>& ring : s_rings)
+			rings.push_back(ring.get());
+	}
+
+	batch.clear();
+	for (BinaryLogRing* ring : rings)
+	{
+		const uint64_t head = ring->head.load(std::memory_order_acquire);
+		uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+		for (; tail != head; tail++)
+			batch.push_back({ ring->records[tail & ring->mask], ring->index });
+		ring->tail.store(tail, std::memory_order_release);
+
+		const uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+		if (dropped != ring->droppedReported)
+		{
+			fprintf(stderr, "Log ring of thread %u full, %llu records lost\n", ring->index, (unsigned long long)(dropped - ring->droppedReported));
+			ring->droppedReported = dropped;
+		}
+	}
+
+	// each ring is in order already; this merges them
+	std::stable_sort(batch.begin(), batch.end(), [](const DrainedRecord& a, const DrainedRecord& b) { return a.record.time < b.record.time; });
+	for (const DrainedRecord& drained : batch)
+	{
+		if (s_binary)
+			writeBinaryRecord(drained.record, drained.thread);
+		else
+			printRecord(drained.record);
+	}
+
+	if (!batch.empty())
+		fflush(s_binary ? s_binary : (s_text ? s_text : stdout));
+}
+
+static void drainThread()
+{
+	std::vector<DrainedRecord> batch;
+
+	while (s_draining)
+	{
+		drainOnce(batch);
+		std::this_thread::sleep_for(kDrainInterval);
+	}
+	drainOnce(batch);
+}
+
+bool BinaryLog::start(const char* textPath, const char* binaryPath, unsigned recordsPerThread)
+{
+	if (s_running)
+		return true;
+
+	s_recordsPerThread = std::max(recordsPerThread, 2u);
+	s_stringIds.clear();
+	if (binaryPath != nullptr)
+	{
+		s_binary = fopen(binaryPath, "wb");
+		if (s_binary == nullptr)
+		{
+			fprintf(stderr, "Could not create log file %s\n", binaryPath);
+			return false;
+		}
+		fwrite(kBinaryLogMagic, sizeof(kBinaryLogMagic), 1, s_binary);
+	}
+	else if (textPath != nullptr)
+	{
+		std::lock_guard<std::mutex> guard(s_textMutex);
+		s_text = fopen(textPath, "w");
+		if (s_text == nullptr)
+		{
+			fprintf(stderr, "Could not create log file %s\n", textPath);
+			return false;
+		}
+	}
+
+	s_draining = true;
+	s_drainer = std::thread(drainThread);
+	s_running = true;
+	return true;
+}
+
+void BinaryLog::stop()
+{
+	if (!s_running)
+		return;
+
+	s_running = false;
+	s_draining = false;
+	s_drainer.join();
+
+	// only the drain thread writes the binary file, but a thread that found the log stopped may
+	// still be printing to the text file
+	if (s_binary)
+		fclose(s_binary);
+	s_binary = nullptr;
+
+	std::lock_guard<std::mutex> guard(s_textMutex);
+	if (s_text)
+		fclose(s_text);
+	s_text = nullptr;
+}
+
+bool BinaryLog::isRunning()
+{
+	return s_running;
+}
+
+bool BinaryLog::write(BinaryLogLevel level, const char* format, unsigned argCount, const uint64_t* args)
+{
+	if (!s_running.load(std::memory_order_relaxed))
+	{
+		BinaryLogRecord record;
+		record.format = format;
+		record.level = (uint8_t)level;
+		record.argCount = (uint8_t)argCount;
+		memcpy(record.args, args, argCount * sizeof(uint64_t));
+
+		std::lock_guard<std::mutex> guard(s_textMutex);
+		printRecord(record);
+		return true;
+	}
+
+	BinaryLogRing* ring = threadRing();
+	const uint64_t head = ring->head.load(std::memory_order_relaxed);
+	if (head - ring->cachedTail > ring->mask)
+	{
+		ring->cachedTail = ring->tail.load(std::memory_order_acquire);
+		if (head - ring->cachedTail > ring->mask)
+		{
+			ring->dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+	}
+
+	BinaryLogRecord& record = ring->records[head & ring->mask];
+	record.time = std::chrono::steady_clock::now().time_since_epoch().count();
+	record.format = format;
+	record.level = (uint8_t)level;
+	record.argCount = (uint8_t)argCount;
+	for (unsigned argIdx = 0; argIdx < argCount; argIdx++)
+		record.args[argIdx] = args[argIdx];
+	ring->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+// Each conversion is handed to snprintf on its own, with the length its argument was widened to,
+// so the arguments never have to match the types the format was written for
+void BinaryLog::format(char* text, size_t textSize, const char* format, unsigned argCount, const uint64_t* args)
+{
+	size_t used = 0;
+	unsigned argIdx = 0;
+
+	if (textSize == 0)
+		return;
+	text[0] = '\0';
+
+	for (const char* c = format; *c != '\0' && used + 1 < textSize; )
+	{
+		if (*c != '%')
+		{
+			text[used++] = *c++;
+			text[used] = '\0';
+			continue;
+		}
+
+		// the flags, width and precision are kept, and the length replaced by the widened one
+		std::string spec("%");
+		c++;
+		while (*c != '\0' && strchr("-+ #0123456789.*", *c) != nullptr)
+		{
+			if (*c != '*')
+			{
+				spec += *c++;
+				continue;
+			}
+
+			// a * width or precision is written into the spec from its argument; a negative
+			// precision counts as none, as with printf
+			const int value = (argIdx < argCount) ? (int)(int64_t)args[argIdx] : 0;
+			argIdx++;
+			c++;
+			if (value < 0 && spec.back() == '.')
+				spec.pop_back();
+			else
+				spec += std::to_string(value);
+		}
+		while (*c != '\0' && strchr("hljztL", *c) != nullptr)
+			c++;
+		if (*c == '\0')
+			break;
+
+		const char conversion = *c++;
+		const uint64_t arg = (argIdx < argCount) ? args[argIdx] : 0;
+		int written;
+
+		switch (conversion)
+		{
+		case '%':
+			written = snprintf(text + used, textSize - used, "%%");
+			argIdx--;
+			break;
+
+		case 'd': case 'i':
+			written = snprintf(text + used, textSize - used, (spec + "ll" + conversion).c_str(), (long long)arg);
+			break;
+
+		case 'u': case 'x': case 'X': case 'o':
+			written = snprintf(text + used, textSize - used, (spec + "ll" + conversion).c_str(), (unsigned long long)arg);
+			break;
+
+		case 'c':
+			written = snprintf(text + used, textSize - used, (spec + conversion).c_str(), (int)arg);
+			break;
+
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		{
+			double value;
+			memcpy(&value, &arg, sizeof(value));
+			written = snprintf(text + used, textSize - used, (spec + conversion).c_str(), value);
+			break;
+		}
+
+		case 's':
+			written = snprintf(text + used, textSize - used, (spec + conversion).c_str(), arg ? (const char*)(uintptr_t)arg : "(null)");
+			break;
+
+		case 'p':
+			written = snprintf(text + used, textSize - used, (spec + conversion).c_str(), (void*)(uintptr_t)arg);
+			break;
+
+		default:
+			written = snprintf(text + used, textSize - used, "%s%c", spec.c_str(), conversion);
+			argIdx--;
+			break;
+		}
+
+		argIdx++;
+		if (written > 0)
+			used = std::min(used + (size_t)written, textSize - 1);
+	}
+}
+
+bool decodeBinaryLog(const char* path, FILE* out)
+{
+	FILE* in = fopen(path, "rb");
+	char magic[sizeof(kBinaryLogMagic)];
+	std::vector<std::string> strings;
+	int64_t firstTimeNs = -1;
+	bool ok = true;
+
+	if (in == nullptr)
+	{
+		fprintf(stderr, "Could not open log file %s\n", path);
+		return false;
+	}
+	if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, kBinaryLogMagic, sizeof(magic)) != 0)
+	{
+		fprintf(stderr, "%s is not a binary log\n", path);
+		fclose(in);
+		return false;
+	}
+
+	int kind;
+	while (ok && (kind = fgetc(in)) != EOF)
+	{
+		if (kind == 'S')
+		{
+			uint32_t id;
+			uint16_t length;
+			ok = fread(&id, sizeof(id), 1, in) == 1 && fread(&length, sizeof(length), 1, in) == 1 && id == strings.size();
+			if (!ok)
+				break;
+			std::string string(length, '\0');
+			ok = length == 0 || fread(&string[0], 1, length, in) == length;
+			strings.push_back(string);
+		}
+		else if (kind == 'R')
+		{
+			const int level = fgetc(in);
+			const int argCount = fgetc(in);
+			uint16_t thread;
+			int64_t timeNs;
+			uint32_t formatId;
+			uint64_t args[kBinaryLogMaxArgs];
+			char kinds[kBinaryLogMaxArgs];
+			char text[1024];
+
+			ok = level != EOF && argCount >= 0 && argCount <= (int)kBinaryLogMaxArgs &&
+				fread(&thread, sizeof(thread), 1, in) == 1 && fread(&timeNs, sizeof(timeNs), 1, in) == 1 &&
+				fread(&formatId, sizeof(formatId), 1, in) == 1 && formatId < strings.size() &&
+				fread(args, sizeof(uint64_t), argCount, in) == (size_t)argCount;
+			if (!ok)
+				break;
+
+			// string ids back to the strings, which live as long as this loop does
+			const unsigned kindCount = conversions(strings[formatId].c_str(), kinds, kBinaryLogMaxArgs);
+			for (int argIdx = 0; argIdx < argCount; argIdx++)
+			{
+				if ((unsigned)argIdx < kindCount && kinds[argIdx] == 's' && args[argIdx] < strings.size())
+					args[argIdx] = (uint64_t)(uintptr_t)strings[(size_t)args[argIdx]].c_str();
+			}
+
+			if (firstTimeNs < 0)
+				firstTimeNs = timeNs;
+			BinaryLog::format(text, sizeof(text), strings[formatId].c_str(), (unsigned)argCount, args);
+			fprintf(out, "%12.6f %2u %c %s", (timeNs - firstTimeNs) / 1e9, thread, (level == kLogWarning) ? 'W' : 'I', text);
+			if (text[0] == '\0' || text[strlen(text) - 1] != '\n')
+				fputc('\n', out);
+		}
+		else
+		{
+			ok = false;
+		}
+	}
+
+	if (!ok)
+		fprintf(stderr, "%s is damaged after %zu strings\n", path, strings.size());
+	fclose(in);
+	return ok;
+}
@@ -0,0 +1,121 @@
+// binary log: fixed-size records in per-thread rings, formatted or written out by a background thread
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+
+const unsigned	kBinaryLogMaxArgs = 7;
+
+enum BinaryLogLevel
+{
+	kLogInfo = 0,		// to the text output
+	kLogWarning = 1		// to stderr
+};
+
+// what a thread hands to the log, copied whole into its ring; 80 bytes
+struct BinaryLogRecord
+{
+	int64_t		time;				// std::chrono::steady_clock ticks
+	const char*	format;				// a printf format, which must outlive the log: a literal
+	uint8_t		level;				// BinaryLogLevel
+	uint8_t		argCount;
+	uint64_t	args[kBinaryLogMaxArgs];	// integers widened to 64 bits, doubles as their bits, strings as pointers
+};
+
+// Binary log files start with kBinaryLogMagic, followed by entries of two kinds, each led by its kind byte:
+//   'S' uint32 id, uint16 length, the characters: a string, sent once before the first record using it
+//   'R' uint8 level, uint8 argCount, uint16 thread, int64 time in ns, uint32 format id, uint64 args[argCount]
+// with %s arguments given as string ids
+const char		kBinaryLogMagic[8] = { 'D', 'L', 'K', 'L', 'O', 'G', '0', '1' };
+
+// A thread's first record gives it its own ring, which it is the only writer of, so writing a record
+// is a clock read, a few stores and a release; a full ring drops the record and counts it rather
+// than wait. A background thread drains the rings every few milliseconds, puts what it found in time
+// order and formats it, or writes it to a binary file as it is, for decodeBinaryLog. When the log is
+// not running, records are formatted and printed on the spot, as printf would. Format arguments must
+// be integers, enums, floating point or string literals; a %s argument is read when the record is
+// drained, so it must not be a buffer that changes
+class BinaryLog
+{
+public:
+	// textPath nullptr writes to the console; binaryPath, when set, keeps the records binary instead
+	static bool		start(const char* textPath, const char* binaryPath, unsigned recordsPerThread);
+
+	// drains what is left and stops the thread; records written while it stops may be lost
+	static void		stop();
+
+	static bool		isRunning();
+
+	// false when the writing thread's ring was full
+	static bool		write(BinaryLogLevel level, const char* format, unsigned argCount, const uint64_t* args);
+
+	// formats one record's arguments as printf would have, * widths and precisions included
+	static void		format(char* text, size_t textSize, const char* format, unsigned argCount, const uint64_t* args);
+};
+
+// writes a binary log file out as text, with each record's thread and time
+bool decodeBinaryLog(const char* path, FILE* out);
+
+inline uint64_t binaryLogArg(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+inline uint64_t binaryLogArg(float value)
+{
+	return binaryLogArg((double)value);
+}
+
+inline uint64_t binaryLogArg(const char* value)
+{
+	return (uint64_t)(uintptr_t)value;
+}
+
+inline uint64_t binaryLogArg(const void* value)
+{
+	return (uint64_t)(uintptr_t)value;
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, uint64_t>::type binaryLogArg(T value)
+{
+	return (uint64_t)(int64_t)value;
+}
+
+// logs a printf-style message without formatting it on the calling thread
+template<typename... Args>
+inline void logInfo(const char* format, Args... args)
+{
+	static_assert(sizeof...(Args) <= kBinaryLogMaxArgs, "too many log arguments");
+	const uint64_t packed[kBinaryLogMaxArgs + 1] = { binaryLogArg(args)... };
+	BinaryLog::write(kLogInfo, format, (unsigned)sizeof...(Args), packed);
+}
+
+template<typename... Args>
+inline void logWarning(const char* format, Args... args)
+{
+	static_assert(sizeof...(Args) <= kBinaryLogMaxArgs, "too many log arguments");
+	const uint64_t packed[kBinaryLogMaxArgs + 1] = { binaryLogArg(args)... };
+	BinaryLog::write(kLogWarning, format, (unsigned)sizeof...(Args), packed);
+}
+
+// runs the log for as long as it is in scope, for main()
+class BinaryLogScope
+{
+public:
+	BinaryLogScope(bool enable, const char* textPath, const char* binaryPath, unsigned recordsPerThread)
+	{
+		if (enable)
+			BinaryLog::start(textPath, binaryPath, recordsPerThread);
+	}
+	~BinaryLogScope()
+	{
+		BinaryLog::stop();
+	}
+};
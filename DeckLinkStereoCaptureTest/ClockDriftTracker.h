@@ -0,0 +1,109 @@
+// clock drift: how a device's card clock and each eye's stream clock run against the host, and the card-to-host time mapping
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "CaptureFrame.h"
+
+struct ClockDriftStats
+{
+	uint64_t	frames[kEyeCount];
+	double		cardDriftPpm;				// card reference clock against the host steady clock; positive when the card runs fast
+	double		streamDriftPpm[kEyeCount];	// each eye's stream time against the card clock
+	double		eyeDriftPpm;				// right eye stream time against the left
+	double		eyeOffsetMs;				// right eye stream time less the left, smoothed
+	double		jitterMs[kEyeCount];		// rms of the callback's arrival interval less the hardware timestamp interval
+	double		maxCadenceErrorMs[kEyeCount];	// largest gap between the hardware timestamp interval and the stream duration
+	uint64_t	cadenceEvents;				// frames whose hardware interval left kCadenceTolerance of their stream time
+	uint64_t	driftEvents;				// times a drift rate went past kDriftTolerancePpm
+};
+
+// A linear fit, weighted to the last windowSamples samples, updated in constant time per sample:
+// exponentially weighted means, variance and covariance about the first sample
+class DriftRegression
+{
+public:
+	DriftRegression();
+
+	void		add(int64_t x, int64_t y, double windowSamples);
+
+	bool		isReady() const { return m_samples >= 2 && m_varX > 0; }
+	uint64_t	samples() const { return m_samples; }
+	double		slope() const { return isReady() ? m_covXY / m_varX : 1.0; }
+	int64_t		lastX() const { return m_lastX; }
+	double		spanX() const { return (double)(m_lastX - m_originX); }
+	double		predict(int64_t x) const;
+
+private:
+	uint64_t	m_samples;
+	int64_t		m_originX;
+	int64_t		m_originY;
+	int64_t		m_lastX;
+	double		m_meanX;
+	double		m_meanY;
+	double		m_varX;
+	double		m_covXY;
+};
+
+// Every frame of every eye goes in with its hardware timestamp, stream time and the host time it
+// arrived, and each callback may add a reading of the card's reference clock taken against the host
+// clock, which is the tighter of the two for the mapping. Fits of host time on card time and of each
+// eye's stream time on card time give the drift rates; the arrival intervals give the jitter.
+// Cadence and drift leaving tolerance are logged as they happen. Only the capture callback thread
+// may add to it; stats() and hardwareToHost() may be called from any thread
+class ClockDriftTracker
+{
+public:
+	explicit ClockDriftTracker(unsigned deviceIndex);
+
+	// times in microseconds, the host's on the steady clock; the left eye of a frame goes in before the right
+	void		addFrame(CaptureEye eye, int64_t hardwareTime, int64_t streamTime, int64_t streamDuration, int64_t timeScale, int64_t hostTime);
+	void		addClockReading(int64_t cardTime, int64_t hostTime);
+
+	// the steady clock time, in microseconds, that the card clock read hardwareTime at; false until
+	// there have been enough readings to fit
+	bool		hardwareToHost(int64_t hardwareTime, int64_t* hostTime) const;
+
+	ClockDriftStats	stats() const;
+	void		printStats() const;
+
+private:
+	struct EyeState
+	{
+		bool		started;
+		int64_t		lastHardwareTime;
+		int64_t		lastStreamTime;
+		int64_t		lastHostTime;
+		double		meanSquareJitter;
+		bool		offCadence;
+		DriftRegression	stream;		// stream time in microseconds on hardware time
+	};
+
+	void		publish();
+	void		checkDrift();
+
+	unsigned				m_deviceIndex;
+	EyeState				m_eyes[kEyeCount];
+	DriftRegression			m_card;			// host time on card time
+	DriftRegression			m_eyeOffset;	// right less left stream time on hardware time
+	int64_t					m_leftStreamUs;
+	bool					m_haveLeft;
+	bool					m_drifting;
+
+	// published for other threads at the end of every addFrame and addClockReading: a writer bumps
+	// m_sequence to odd, stores, and bumps it to even again; readers retry when it moved under them
+	std::atomic<uint32_t>	m_sequence;
+	std::atomic<int64_t>	m_mapOriginX;
+	std::atomic<double>		m_mapBaseY;		// host time at m_mapOriginX
+	std::atomic<double>		m_mapSlope;
+	std::atomic<bool>		m_mapReady;
+	std::atomic<uint64_t>	m_frames[kEyeCount];
+	std::atomic<double>		m_cardDriftPpm;
+	std::atomic<double>		m_streamDriftPpm[kEyeCount];
+	std::atomic<double>		m_eyeDriftPpm;
+	std::atomic<double>		m_eyeOffsetMs;
+	std::atomic<double>		m_jitterMs[kEyeCount];
+	std::atomic<double>		m_maxCadenceErrorMs[kEyeCount];
+	std::atomic<uint64_t>	m_cadenceEvents;
+	std::atomic<uint64_t>	m_driftEvents;
+};
@@ -0,0 +1,81 @@
+// frame continuity: finds dropped, repeated and out-of-sequence frames from their stream times as they arrive
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include "CaptureFrame.h"
+
+enum ContinuityEvent
+{
+	kContinuityDrop,			// stream time skipped ahead by whole frames
+	kContinuityDuplicate,		// the same stream time again
+	kContinuityDiscontinuity,	// stream time went back, off the frame cadence, or too far ahead to be drops
+	kContinuityBacklog,			// the driver had more frames queued behind this one than it should
+	kContinuityEventCount
+};
+
+// what was closest to overflowing when an event was seen, which is what it is blamed on
+enum SaturatedStage
+{
+	kSaturatedNone,				// nothing on our side: the frames never reached the card
+	kSaturatedCallback,			// the capture callback itself fell behind the driver
+	kSaturatedFramePool,
+	kSaturatedRecorder,
+	kSaturatedEncoder,
+	kSaturatedStills,
+	kSaturatedPublisher,
+	kSaturatedProcessing,
+	kSaturatedStageCount
+};
+
+struct ContinuityStats
+{
+	uint64_t	frames[kEyeCount];
+	uint64_t	framesDropped[kEyeCount];	// frames missing from the sequence, not drop events
+	uint64_t	duplicates[kEyeCount];
+	uint64_t	discontinuities[kEyeCount];
+	uint64_t	backlogEvents;
+	unsigned	maxBacklog;					// most frames the driver has held back behind one callback
+	uint64_t	blamed[kSaturatedStageCount];	// events of every kind, by what was saturated at the time
+};
+
+// Each eye's stream times are checked against the previous frame's plus its duration, the frame
+// cadence the card promises. Frames lost before the card, on the card, or because the callback
+// was too slow all show up as gaps. The driver's count of frames queued behind the current one
+// tells a slow callback apart. When something is found, saturatedStage is asked what to blame,
+// and the event is logged with it. Only the capture callback thread may call check()
+class ContinuityTracker
+{
+public:
+	explicit ContinuityTracker(unsigned deviceIndex);
+
+	// driverBacklog is what GetAvailableVideoFrameCount returned in the callback for this frame
+	void		check(CaptureEye eye, int64_t streamTime, int64_t streamDuration, int64_t timeScale, unsigned driverBacklog,
+					const std::function<SaturatedStage()>& saturatedStage);
+
+	ContinuityStats	stats();
+	void		printStats();
+
+	static const char*	stageName(SaturatedStage stage);
+
+private:
+	struct EyeState
+	{
+		bool		started;
+		int64_t		lastStreamTime;
+	};
+
+	void		report(ContinuityEvent event, CaptureEye eye, int64_t streamTime, int64_t timeScale, uint64_t count, SaturatedStage stage);
+
+	unsigned				m_deviceIndex;
+	EyeState				m_eyes[kEyeCount];
+	bool					m_backlogged;		// the last frame already counted as a backlog event
+	std::atomic<uint64_t>	m_frames[kEyeCount];
+	std::atomic<uint64_t>	m_framesDropped[kEyeCount];
+	std::atomic<uint64_t>	m_duplicates[kEyeCount];
+	std::atomic<uint64_t>	m_discontinuities[kEyeCount];
+	std::atomic<uint64_t>	m_backlogEvents;
+	std::atomic<unsigned>	m_maxBacklog;
+	std::atomic<uint64_t>	m_blamed[kSaturatedStageCount];
+};
@@ -0,0 +1,53 @@
+// the DeckLink SDK interfaces on Windows and Linux, for the classes that implement them in place of a card
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// The Windows SDK is COM, from the MIDL-generated header; the Linux SDK declares the same
+// interfaces over the stand-ins for the COM types in its LinuxCOM.h. The two differ in the types
+// of booleans, 64-bit integers and strings, and in how interface IDs compare, so a class
+// implementing an SDK interface uses the names below and builds on both without platform.h
+#ifdef _WIN32
+#include <string>
+#include <Windows.h>
+#include <oleauto.h>
+#include "DeckLinkAPI_h.h"
+
+typedef BOOL		SdkBool;
+typedef LONGLONG	SdkInt64;
+typedef BSTR		SdkString;
+
+// a string the SDK's caller frees as it frees the SDK's own; ASCII only
+inline SdkString newSdkString(const char* text)
+{
+	const std::wstring wide(text, text + strlen(text));
+	return SysAllocString(wide.c_str());
+}
+
+inline bool isSameIid(REFIID first, REFIID second)
+{
+	return IsEqualIID(first, second) != 0;
+}
+#else
+#include <stdlib.h>
+#include "DeckLinkAPI.h"
+
+#ifndef STDMETHODCALLTYPE
+#define STDMETHODCALLTYPE
+#endif
+
+typedef bool		SdkBool;
+typedef int64_t		SdkInt64;
+typedef const char*	SdkString;
+
+inline SdkString newSdkString(const char* text)
+{
+	return strdup(text);
+}
+
+inline bool isSameIid(REFIID first, REFIID second)
+{
+	return memcmp(&first, &second, sizeof(REFIID)) == 0;
+}
+#endif
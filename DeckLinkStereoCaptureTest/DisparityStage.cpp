@@ -0,0 +1,242 @@
+// stereo disparity processing stage: live depth from a reduced-resolution rectified luma pair, on threads of its own
+#include "DisparityStage.h"
+#include "LatencyTracker.h"
+#include "MetricsRegistry.h"
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <string>
+
+// how often the stage prints its statistics while matching
+static const int64_t kStatsIntervalUs = 10 * 1000000;
+
+// upper bounds of the match time buckets, in seconds
+static const double kMatchTimeBounds[] = { 0.005, 0.01, 0.02, 0.04, 0.08, 0.16, 0.32, 0.64 };
+
+DisparityStage::DisparityStage(unsigned deviceIndex, const char* calibrationPath, double scale, DisparityMatcher matcher, int disparities, int blockSize,
+	unsigned threadCount, double budgetMs) :
+	m_deviceIndex(deviceIndex),
+	m_calibrationPath(calibrationPath),
+	m_scale(scale),
+	m_matcher(matcher),
+	m_disparities((disparities + 15) / 16 * 16),	// both matchers want a multiple of 16
+	m_blockSize(blockSize | 1),						// and an odd block
+	m_threadCount(threadCount ? threadCount : 1),
+	m_budgetMs(budgetMs),
+	m_running(false),
+	m_pairsOffered(0),
+	m_pairsStale(0),
+	m_mapsPublished(0),
+	m_mapsOutrun(0),
+	m_matchTotalUs(0),
+	m_matchCount(0),
+	m_lagLastUs(0),
+	m_startUs(0),
+	m_lastStatsUs(0)
+{
+	const std::string labels = "device=\"" + std::to_string(deviceIndex) + "\"";
+	m_mapsMetric = MetricsRegistry::counter("decklink_disparity_maps_total", "Disparity maps published.", labels);
+	m_staleMetric = MetricsRegistry::counter("decklink_disparity_stale_pairs_total", "Rectified pairs replaced by a newer one before they were matched.", labels);
+	m_matchTimeMetric = MetricsRegistry::histogram("decklink_disparity_match_seconds", "Time one disparity map took to match.", labels,
+		kMatchTimeBounds, sizeof(kMatchTimeBounds) / sizeof(kMatchTimeBounds[0]));
+}
+
+DisparityStage::~DisparityStage()
+{
+	stop();
+}
+
+bool DisparityStage::start(const CaptureFrame& format)
+{
+	// one eye: the pipeline leaves this stage out as soon as it sees it takes a stereo pair
+	if (format.eyeCount() < kEyeCount)
+		return true;
+
+	if (m_running || !m_rectifier.load(m_calibrationPath.c_str(), format.width, format.height, m_scale))
+		return false;
+
+	m_pending.reset();
+	m_latest.reset();
+	m_pairsOffered = 0;
+	m_pairsStale = 0;
+	m_mapsPublished = 0;
+	m_mapsOutrun = 0;
+	m_matchTotalUs = 0;
+	m_matchCount = 0;
+	m_lagLastUs = 0;
+	m_startUs = steadyClockMicroseconds();
+	m_lastStatsUs = m_startUs;
+
+	printf("Disparity on device #%u: %s over %d disparities at %dx%d, %u threads\n", m_deviceIndex,
+		(m_matcher == kDisparitySemiGlobal) ? "semi-global matching" : "block matching", m_disparities,
+		m_rectifier.outputSize().width, m_rectifier.outputSize().height, m_threadCount);
+
+	m_running = true;
+	for (unsigned threadIdx = 0; threadIdx < m_threadCount; threadIdx++)
+		m_threads.push_back(std::thread(&DisparityStage::matcherThread, this, threadIdx));
+	return true;
+}
+
+void DisparityStage::stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (!m_running)
+			return;
+		m_running = false;
+	}
+
+	// a pair still waiting is not worth matching any more
+	m_pairReady.notify_all();
+	for (std::thread& thread : m_threads)
+		thread.join();
+	m_threads.clear();
+	m_pending.reset();
+
+	printStats();
+}
+
+void DisparityStage::process(const ProcessingInput& input)
+{
+	std::unique_ptr<Pair> pair;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (!m_spare.empty())
+		{
+			pair = std::move(m_spare.back());
+			m_spare.pop_back();
+		}
+	}
+	if (!pair)
+		pair.reset(new Pair());
+
+	m_rectifier.rectify(*input.frame, kEyeCount, kInputLuma, pair->luma);
+	pair->frame = *input.frame;
+	pair->frame.eye[kEyeLeft] = nullptr;
+	pair->frame.eye[kEyeRight] = nullptr;
+
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (m_pending)
+		{
+			m_spare.push_back(std::move(m_pending));
+			++m_pairsStale;
+			m_staleMetric->add();
+		}
+		m_pending = std::move(pair);
+	}
+	++m_pairsOffered;
+	m_pairReady.notify_one();
+}
+
+cv::Ptr<cv::StereoMatcher> DisparityStage::createMatcher() const
+{
+	if (m_matcher == kDisparityBlockMatching)
+		return cv::StereoBM::create(m_disparities, m_blockSize);
+
+	// the smoothness penalties OpenCV suggests for one channel
+	const int area = m_blockSize * m_blockSize;
+	return cv::StereoSGBM::create(0, m_disparities, m_blockSize, 8 * area, 32 * area, 1, 63, 10, 100, 2, cv::StereoSGBM::MODE_SGBM_3WAY);
+}
+
+void DisparityStage::matcherThread(unsigned threadIdx)
+{
+	TraceRecorder::nameThread("disparity", threadIdx);
+
+	// the matchers keep state between calls, so every thread has its own
+	cv::Ptr<cv::StereoMatcher> matcher = createMatcher();
+
+	for (;;)
+	{
+		std::unique_ptr<Pair> pair;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_pairReady.wait(lock, [this]() { return !m_running || m_pending; });
+			if (!m_running)
+				break;
+			pair = std::move(m_pending);
+		}
+
+		std::shared_ptr<DisparityMap> map(new DisparityMap());
+		const int64_t startUs = steadyClockMicroseconds();
+		{
+			TraceSpan span("match", pair->frame.frameNumber);
+			matcher->compute(pair->luma[kEyeLeft], pair->luma[kEyeRight], map->disparity);
+		}
+		map->computedTime = steadyClockMicroseconds();
+
+		const uint64_t matchUs = (uint64_t)(map->computedTime - startUs);
+		m_matchTotalUs += matchUs;
+		++m_matchCount;
+		m_matchTimeMetric->observe(matchUs / 1e6);
+
+		const CaptureFrame& frame = pair->frame;
+		map->frameNumber = frame.frameNumber;
+		map->streamTime = frame.streamTime;
+		map->timeScale = frame.timeScale;
+		map->hardwareTime = frame.hardwareTime;
+		map->arrivalTime = frame.arrivalTime;
+		if (frame.arrivalTime != 0)
+			m_lagLastUs = (uint64_t)(map->computedTime - frame.arrivalTime);
+		recordLatency(frame, kLatencyDisparity);
+		publish(map);
+
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			m_spare.push_back(std::move(pair));
+		}
+
+		const int64_t nowUs = steadyClockMicroseconds();
+		int64_t lastStatsUs = m_lastStatsUs;
+		if (nowUs - lastStatsUs >= kStatsIntervalUs && m_lastStatsUs.compare_exchange_strong(lastStatsUs, nowUs))
+			printStats();
+	}
+}
+
+void DisparityStage::publish(const std::shared_ptr<const DisparityMap>& map)
+{
+	// the listener is called under the lock too, so it sees the maps in order
+	std::lock_guard<std::mutex> guard(m_mutex);
+	if (m_latest && m_latest->frameNumber >= map->frameNumber)
+	{
+		++m_mapsOutrun;
+		return;
+	}
+
+	m_latest = map;
+	++m_mapsPublished;
+	m_mapsMetric->add();
+	if (m_listener)
+		m_listener(map);
+}
+
+std::shared_ptr<const DisparityMap> DisparityStage::latest()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	return m_latest;
+}
+
+DisparityStats DisparityStage::stats()
+{
+	DisparityStats stats = {};
+	const uint64_t matchCount = m_matchCount;
+	const double seconds = (steadyClockMicroseconds() - m_startUs) / 1e6;
+
+	stats.pairsOffered = m_pairsOffered;
+	stats.pairsStale = m_pairsStale;
+	stats.mapsPublished = m_mapsPublished;
+	stats.mapsOutrun = m_mapsOutrun;
+	stats.meanMatchMs = matchCount ? (m_matchTotalUs / 1000.0) / matchCount : 0.0;
+	stats.mapsPerSecond = (seconds > 0) ? stats.mapsPublished / seconds : 0.0;
+	stats.lastLagMs = m_lagLastUs / 1000.0;
+	return stats;
+}
+
+void DisparityStage::printStats()
+{
+	const DisparityStats current = stats();
+
+	printf("Disparity on device #%u: %llu maps (%.1f/s) from %llu pairs, %llu stale, %llu outrun, match mean %.1f ms, lag %.1f ms\n", m_deviceIndex,
+		(unsigned long long)current.mapsPublished, current.mapsPerSecond, (unsigned long long)current.pairsOffered, (unsigned long long)current.pairsStale,
+		(unsigned long long)current.mapsOutrun, current.meanMatchMs, current.lastLagMs);
+}
@@ -0,0 +1,124 @@
+// stereo disparity processing stage: live depth from a reduced-resolution rectified luma pair, on threads of its own
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ProcessingPipeline.h"
+#include "StereoRectifier.h"
+
+class LatencyTracker;
+class MetricCounter;
+class MetricHistogram;
+
+enum DisparityMatcher
+{
+	kDisparityBlockMatching,		// cv::StereoBM: fast, and sparse on little texture
+	kDisparitySemiGlobal			// cv::StereoSGBM in its 3-way mode: denser, several times slower
+};
+
+// one disparity map, with the timing of the frame it was computed from
+struct DisparityMap
+{
+	cv::Mat		disparity;			// CV_16S, in 1/16 pixels at the reduced resolution; negative where unknown
+	uint64_t	frameNumber;
+	int64_t		streamTime;			// in timeScale units
+	int64_t		timeScale;
+	int64_t		hardwareTime;		// microseconds, as in CaptureFrame
+	int64_t		arrivalTime;		// steady clock microseconds
+	int64_t		computedTime;		// steady clock microseconds when the map was done
+};
+
+struct DisparityStats
+{
+	uint64_t	pairsOffered;		// rectified pairs handed to the matcher threads
+	uint64_t	pairsStale;			// replaced by a newer pair before a thread got to them
+	uint64_t	mapsPublished;
+	uint64_t	mapsOutrun;			// finished after a newer map, so never published
+	double		meanMatchMs;
+	double		mapsPerSecond;		// since start()
+	double		lastLagMs;			// frame arrival to its map being published
+};
+
+// Rectifies and downscales the luma of both eyes in one pass on the processing thread, which is
+// all process() does, and leaves the pair in a single slot for the matcher threads. A newer pair
+// replaces one still waiting there, so the matchers always work on the most recent frame and
+// their speed never holds up the pipeline, let alone capture. Each matcher thread has a matcher
+// of its own; maps are published in frame order, and a map finished after a newer one is dropped
+class DisparityStage : public ProcessingStage
+{
+public:
+	DisparityStage(unsigned deviceIndex, const char* calibrationPath, double scale, DisparityMatcher matcher, int disparities, int blockSize,
+		unsigned threadCount, double budgetMs);
+	~DisparityStage();
+
+	const char*		name() const override { return "disparity"; }
+	unsigned		inputs() const override { return kInputStereoPair; }
+	double			budgetMs() const override { return m_budgetMs; }
+
+	bool			start(const CaptureFrame& format) override;
+	void			stop() override;
+	void			process(const ProcessingInput& input) override;
+
+	// called on a matcher thread with every map published; set before start()
+	void			setListener(const std::function<void(const std::shared_ptr<const DisparityMap>&)>& listener) { m_listener = listener; }
+
+	// the newest map, or nullptr before the first
+	std::shared_ptr<const DisparityMap>	latest();
+
+	// reprojects the maps' disparities, divided by 16, to 3D with cv::reprojectImageTo3D
+	const cv::Mat&	reprojection() const { return m_rectifier.reprojection(); }
+
+	DisparityStats	stats();
+
+private:
+	struct Pair
+	{
+		cv::Mat			luma[kEyeCount];
+		CaptureFrame	frame;			// timing only; its buffers are not held
+	};
+
+	void			matcherThread(unsigned threadIdx);
+	cv::Ptr<cv::StereoMatcher>	createMatcher() const;
+	void			publish(const std::shared_ptr<const DisparityMap>& map);
+	void			printStats();
+
+	unsigned		m_deviceIndex;
+	std::string		m_calibrationPath;
+	double			m_scale;
+	DisparityMatcher	m_matcher;
+	int				m_disparities;
+	int				m_blockSize;
+	unsigned		m_threadCount;
+	double			m_budgetMs;
+	StereoRectifier	m_rectifier;
+	std::function<void(const std::shared_ptr<const DisparityMap>&)>	m_listener;
+
+	std::mutex		m_mutex;
+	std::condition_variable	m_pairReady;
+	std::unique_ptr<Pair>	m_pending;		// the newest pair no thread has taken yet
+	std::vector<std::unique_ptr<Pair>>	m_spare;
+	std::shared_ptr<const DisparityMap>	m_latest;
+	bool			m_running;
+	std::vector<std::thread>	m_threads;
+
+	std::atomic<uint64_t>	m_pairsOffered;
+	std::atomic<uint64_t>	m_pairsStale;
+	std::atomic<uint64_t>	m_mapsPublished;
+	std::atomic<uint64_t>	m_mapsOutrun;
+	std::atomic<uint64_t>	m_matchTotalUs;
+	std::atomic<uint64_t>	m_matchCount;
+	std::atomic<uint64_t>	m_lagLastUs;
+	int64_t			m_startUs;
+	std::atomic<int64_t>	m_lastStatsUs;
+
+	MetricCounter*		m_mapsMetric;
+	MetricCounter*		m_staleMetric;
+	MetricHistogram*	m_matchTimeMetric;
+};
@@ -0,0 +1,362 @@
+// read-only, memory-mapped access to the frame archives written by RawRecorder
+#include "FrameArchive.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+FrameArchive::FrameArchive() :
+	m_data(nullptr),
+	m_size(0),
+	m_header(nullptr),
+	m_entries(nullptr),
+	m_entryCount(0),
+#ifdef _WIN32
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(NULL)
+#else
+	m_file(-1)
+#endif
+{
+}
+
+FrameArchive::~FrameArchive()
+{
+	close();
+}
+
+bool FrameArchive::open(const std::string& path)
+{
+	const IndexRecordHeader* finalIndex = nullptr;
+
+	close();
+
+#ifdef _WIN32
+	LARGE_INTEGER fileSize;
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+	if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx((HANDLE)m_file, &fileSize))
+	{
+		fprintf(stderr, "Could not open archive %s - error = %lu\n", path.c_str(), GetLastError());
+		goto bail;
+	}
+	m_size = (uint64_t)fileSize.QuadPart;
+	if (m_size < kRecordHeaderBytes)
+		goto bail;
+
+	m_mapping = CreateFileMappingA((HANDLE)m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL)
+		goto bail;
+	m_data = (const uint8_t*)MapViewOfFile((HANDLE)m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_data == nullptr)
+		goto bail;
+#else
+	struct stat fileStat;
+	m_file = ::open(path.c_str(), O_RDONLY);
+	if (m_file < 0 || fstat(m_file, &fileStat) != 0)
+	{
+		fprintf(stderr, "Could not open archive %s\n", path.c_str());
+		goto bail;
+	}
+	m_size = (uint64_t)fileStat.st_size;
+	if (m_size < kRecordHeaderBytes)
+		goto bail;
+
+	m_data = (const uint8_t*)mmap(nullptr, (size_t)m_size, PROT_READ, MAP_SHARED, m_file, 0);
+	if (m_data == MAP_FAILED)
+	{
+		m_data = nullptr;
+		goto bail;
+	}
+#endif
+
+	m_header = (const RecordingFileHeader*)m_data;
+	if (memcmp(m_header->magic, kRecordingMagic, sizeof(m_header->magic)) != 0 || m_header->version < kRecordingMinVersion || m_header->version > kRecordingVersion)
+	{
+		fprintf(stderr, "%s is not a version %u to %u frame archive\n", path.c_str(), kRecordingMinVersion, kRecordingVersion);
+		goto bail;
+	}
+	if (isCompressed() && !StripeCompressor::isAvailable((CompressionCodec)m_header->compression))
+	{
+		fprintf(stderr, "%s is compressed with %s, which this build cannot decompress\n", path.c_str(), StripeCompressor::codecName((CompressionCodec)m_header->compression));
+		goto bail;
+	}
+
+	// a clean archive: use the final index straight out of the mapping
+	finalIndex = indexBlock(m_header->indexOffset);
+	if (finalIndex != nullptr && finalIndex->isFinal)
+	{
+		m_entries = (const ArchiveIndexEntry*)((const uint8_t*)finalIndex + kRecordHeaderBytes);
+		m_entryCount = (size_t)finalIndex->entryCount;
+		return true;
+	}
+
+	// the recording was interrupted: rebuild the index from the checkpoints and whatever follows them
+	fprintf(stderr, "Archive %s was not closed cleanly, recovering its index\n", path.c_str());
+	if (!loadCheckpoints())
+		goto bail;
+
+	m_entries = m_recovered.data();
+	m_entryCount = m_recovered.size();
+	return true;
+
+bail:
+	close();
+	return false;
+}
+
+void FrameArchive::close()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != NULL)
+		CloseHandle((HANDLE)m_mapping);
+	if (m_file != INVALID_HANDLE_VALUE)
+		CloseHandle((HANDLE)m_file);
+	m_mapping = NULL;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_data)
+		munmap((void*)m_data, (size_t)m_size);
+	if (m_file >= 0)
+		::close(m_file);
+	m_file = -1;
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+	m_header = nullptr;
+	m_entries = nullptr;
+	m_entryCount = 0;
+	m_recovered.clear();
+	m_decompressor.reset();
+}
+
+long long FrameArchive::findByStreamTime(int64_t streamTime) const
+{
+	const ArchiveIndexEntry* end = m_entries + m_entryCount;
+	const ArchiveIndexEntry* next = std::upper_bound(m_entries, end, streamTime,
+		[](int64_t value, const ArchiveIndexEntry& entry) { return value < entry.streamTime; });
+	return (long long)(next - m_entries) - 1;
+}
+
+long long FrameArchive::findByHardwareTime(int64_t hardwareTime) const
+{
+	const ArchiveIndexEntry* end = m_entries + m_entryCount;
+	const ArchiveIndexEntry* next = std::upper_bound(m_entries, end, hardwareTime,
+		[](int64_t value, const ArchiveIndexEntry& entry) { return value < entry.hardwareTime; });
+	return (long long)(next - m_entries) - 1;
+}
+
+long long FrameArchive::findByFrameNumber(uint64_t frameNumber) const
+{
+	const ArchiveIndexEntry* end = m_entries + m_entryCount;
+	const ArchiveIndexEntry* next = std::upper_bound(m_entries, end, frameNumber,
+		[](uint64_t value, const ArchiveIndexEntry& entry) { return value < entry.frameNumber; });
+	return (long long)(next - m_entries) - 1;
+}
+
+const FrameRecordHeader* FrameArchive::recordHeader(size_t frameIdx) const
+{
+	if (frameIdx >= m_entryCount)
+		return nullptr;
+
+	const ArchiveIndexEntry& indexEntry = m_entries[frameIdx];
+	if ((indexEntry.flags & kIndexEntryWriteFailed) || indexEntry.offset + indexEntry.recordBytes > m_size)
+		return nullptr;
+
+	const FrameRecordHeader* header = (const FrameRecordHeader*)(m_data + indexEntry.offset);
+	if (header->magic != kFrameRecordMagic || header->frameNumber != indexEntry.frameNumber)
+		return nullptr;
+
+	return header;
+}
+
+const FrameRecordHeader* FrameArchive::payloadHeader(size_t frameIdx) const
+{
+	const FrameRecordHeader* header = recordHeader(frameIdx);
+	if (header == nullptr || !(header->recordFlags & kFrameRecordRepeat))
+		return header;
+
+	// references come first and are never repeats themselves
+	if (header->referenceOffset < kRecordHeaderBytes || header->referenceOffset >= m_entries[frameIdx].offset)
+		return nullptr;
+	const long long referenceIdx = findByFrameNumber(header->referenceFrame);
+	if (referenceIdx < 0 || m_entries[referenceIdx].offset != header->referenceOffset || (m_entries[referenceIdx].flags & kIndexEntryRepeat))
+		return nullptr;
+	return recordHeader((size_t)referenceIdx);
+}
+
+const uint8_t* FrameArchive::payload(size_t frameIdx, unsigned eye, uint64_t* storedBytes) const
+{
+	const FrameRecordHeader* header = payloadHeader(frameIdx);
+	if (header == nullptr || eye >= header->eyeCount || eye >= kArchiveMaxEyes)
+		return nullptr;
+
+	// each eye is padded to a page; compressed eyes vary in size
+	uint64_t offset = kRecordHeaderBytes;
+	for (unsigned eyeIdx = 0; eyeIdx < eye; eyeIdx++)
+		offset += alignToPage(storedPayloadBytes(*m_header, *header, eyeIdx));
+
+	const uint64_t bytes = storedPayloadBytes(*m_header, *header, eye);
+	if (offset + bytes > header->recordBytes && header->recordBytes != 0)
+		return nullptr;
+
+	if (storedBytes)
+		*storedBytes = bytes;
+	return (const uint8_t*)header + offset;
+}
+
+cv::Mat FrameArchive::frameView(size_t frameIdx, unsigned eye) const
+{
+	const FrameRecordHeader* header = payloadHeader(frameIdx);
+	if (header == nullptr || isPayloadCompressed(*m_header, *header))
+		return cv::Mat();
+
+	const uint8_t* bytes = payload(frameIdx, eye);
+	if (bytes == nullptr)
+		return cv::Mat();
+
+	// the mapping is read-only; OpenCV only takes non-const data, so views must not be written to
+	return wrapPayload(bytes);
+}
+
+cv::Mat FrameArchive::frame(size_t frameIdx, unsigned eye)
+{
+	const FrameRecordHeader* header = payloadHeader(frameIdx);
+	uint64_t storedBytes = 0;
+	const uint8_t* bytes;
+	cv::Mat decompressed;
+
+	if (header == nullptr)
+		return cv::Mat();
+	if (!isPayloadCompressed(*m_header, *header))
+		return frameView(frameIdx, eye);
+
+	bytes = payload(frameIdx, eye, &storedBytes);
+	if (bytes == nullptr)
+		return cv::Mat();
+
+	if (!m_decompressor)
+		m_decompressor.reset(new StripeCompressor((CompressionCodec)m_header->compression, 0, std::max(std::thread::hardware_concurrency(), 1u)));
+
+	// rows keep their full rowBytes, so the payload decompresses straight into the image
+	if (m_header->pixelFormat == kArchivePixelFormatUYVY)
+		decompressed.create(m_header->height, m_header->rowBytes / 2, CV_8UC2);
+	else
+		decompressed.create(m_header->height, m_header->rowBytes, CV_8UC1);
+
+	if (!m_decompressor->decompress(bytes, (size_t)storedBytes, decompressed.data, (size_t)m_header->payloadBytes))
+	{
+		fprintf(stderr, "Could not decompress frame %zu\n", frameIdx);
+		return cv::Mat();
+	}
+	return (m_header->pixelFormat == kArchivePixelFormatUYVY) ? decompressed.colRange(0, m_header->width) : decompressed;
+}
+
+cv::Mat FrameArchive::frameAtStreamTime(int64_t streamTime, unsigned eye)
+{
+	long long frameIdx = findByStreamTime(streamTime);
+	return (frameIdx < 0) ? cv::Mat() : frame((size_t)frameIdx, eye);
+}
+
+cv::Mat FrameArchive::frameAtHardwareTime(int64_t hardwareTime, unsigned eye)
+{
+	long long frameIdx = findByHardwareTime(hardwareTime);
+	return (frameIdx < 0) ? cv::Mat() : frame((size_t)frameIdx, eye);
+}
+
+cv::Mat FrameArchive::wrapPayload(const uint8_t* bytes) const
+{
+	if (m_header->pixelFormat == kArchivePixelFormatUYVY)
+		return cv::Mat(m_header->height, m_header->width, CV_8UC2, (void*)bytes, (size_t)m_header->rowBytes);
+
+	return cv::Mat(m_header->height, m_header->rowBytes, CV_8UC1, (void*)bytes, (size_t)m_header->rowBytes);
+}
+
+const IndexRecordHeader* FrameArchive::indexBlock(uint64_t offset) const
+{
+	if (offset < kRecordHeaderBytes || offset + kRecordHeaderBytes > m_size)
+		return nullptr;
+
+	const IndexRecordHeader* header = (const IndexRecordHeader*)(m_data + offset);
+	if (header->magic != kIndexRecordMagic || offset + header->recordBytes > m_size
+		|| kRecordHeaderBytes + header->entryCount * sizeof(ArchiveIndexEntry) > header->recordBytes)
+		return nullptr;
+
+	return header;
+}
+
+bool FrameArchive::loadCheckpoints()
+{
+	std::vector<const IndexRecordHeader*> chain;
+	uint64_t scanFrom = kRecordHeaderBytes;
+
+	// walk back from the newest checkpoint, then replay the chain oldest first
+	for (const IndexRecordHeader* checkpoint = indexBlock(m_header->lastCheckpoint); checkpoint != nullptr; checkpoint = indexBlock(checkpoint->previousCheckpoint))
+	{
+		chain.push_back(checkpoint);
+		if (chain.size() > m_size / kRecordHeaderBytes)
+			return false;	// a corrupt chain that loops
+	}
+
+	for (auto checkpoint = chain.rbegin(); checkpoint != chain.rend(); ++checkpoint)
+	{
+		const ArchiveIndexEntry* entries = (const ArchiveIndexEntry*)((const uint8_t*)*checkpoint + kRecordHeaderBytes);
+		m_recovered.insert(m_recovered.end(), entries, entries + (*checkpoint)->entryCount);
+	}
+
+	if (!chain.empty())
+		scanFrom = m_header->lastCheckpoint + chain.front()->recordBytes;
+
+	scanRecords(scanFrom);
+	return true;
+}
+
+// indexes the records from offset on by following their recordBytes, stopping at the first
+// page that is neither a frame record nor an index block (normally the zeroed preallocation)
+void FrameArchive::scanRecords(uint64_t offset)
+{
+	while (offset + kRecordHeaderBytes <= m_size)
+	{
+		const uint32_t magic = *(const uint32_t*)(m_data + offset);
+
+		if (magic == kFrameRecordMagic)
+		{
+			const FrameRecordHeader* header = (const FrameRecordHeader*)(m_data + offset);
+			if (header->recordBytes < kRecordHeaderBytes || offset + header->recordBytes > m_size)
+				break;
+
+			ArchiveIndexEntry indexEntry = {};
+			indexEntry.frameNumber = header->frameNumber;
+			indexEntry.streamTime = header->streamTime;
+			indexEntry.hardwareTime = header->hardwareTime;
+			indexEntry.offset = offset;
+			indexEntry.recordBytes = (uint32_t)header->recordBytes;
+			indexEntry.flags = (header->recordFlags & kFrameRecordRepeat) ? kIndexEntryRepeat : 0;
+			m_recovered.push_back(indexEntry);
+			offset += header->recordBytes;
+		}
+		else if (magic == kIndexRecordMagic)
+		{
+			const IndexRecordHeader* header = indexBlock(offset);
+			if (header == nullptr)
+				break;
+			offset += header->recordBytes;
+		}
+		else
+		{
+			break;
+		}
+	}
+}
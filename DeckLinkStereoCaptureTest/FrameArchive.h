@@ -0,0 +1,71 @@
+// read-only, memory-mapped access to the frame archives written by RawRecorder
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "FrameArchiveFormat.h"
+#include "StripeCompressor.h"
+
+class FrameArchive
+{
+public:
+	FrameArchive();
+	~FrameArchive();
+
+	// maps the whole file and finds its index. A cleanly closed archive uses the final index in
+	// place; otherwise the checkpoint chain is loaded and the records after it are scanned
+	bool		open(const std::string& path);
+	void		close();
+
+	const RecordingFileHeader&	header() const { return *m_header; }
+	bool		wasClosedCleanly() const { return m_header->indexOffset != 0; }
+	bool		isCompressed() const { return m_header->compression != kArchiveCompressionNone; }
+	size_t		frameCount() const { return m_entryCount; }
+	const ArchiveIndexEntry&	entry(size_t frameIdx) const { return m_entries[frameIdx]; }
+
+	// O(log n) seeks; each returns the last frame at or before the requested key, or -1
+	long long	findByStreamTime(int64_t streamTime) const;
+	long long	findByHardwareTime(int64_t hardwareTime) const;
+	long long	findByFrameNumber(uint64_t frameNumber) const;
+
+	// points into the mapping; nullptr if the frame never made it to disk intact.
+	// The payload is stored as it is on disk, so compressed for a compressed archive.
+	// A repeat record's payloads are those of its reference, which payloadHeader() returns
+	const FrameRecordHeader*	recordHeader(size_t frameIdx) const;
+	const FrameRecordHeader*	payloadHeader(size_t frameIdx) const;
+	const uint8_t*				payload(size_t frameIdx, unsigned eye, uint64_t* storedBytes = nullptr) const;
+
+	// Zero-copy view of one eye, valid while the archive stays open; empty for compressed records.
+	// 8-bit payloads come back as CV_8UC2 UYVY images; v210 payloads as CV_8UC1 with one row of
+	// rowBytes bytes per video line
+	cv::Mat		frameView(size_t frameIdx, unsigned eye) const;
+
+	// frameView() for uncompressed records; otherwise decompresses into a newly allocated
+	// image of the same shape, using all cores
+	cv::Mat		frame(size_t frameIdx, unsigned eye);
+	cv::Mat		frameAtStreamTime(int64_t streamTime, unsigned eye);
+	cv::Mat		frameAtHardwareTime(int64_t hardwareTime, unsigned eye);
+
+private:
+	bool		loadCheckpoints();
+	void		scanRecords(uint64_t offset);
+	const IndexRecordHeader*	indexBlock(uint64_t offset) const;
+	cv::Mat		wrapPayload(const uint8_t* bytes) const;
+
+	const uint8_t*				m_data;
+	uint64_t					m_size;
+	const RecordingFileHeader*	m_header;
+	const ArchiveIndexEntry*	m_entries;		// final index inside the mapping, or m_recovered
+	size_t						m_entryCount;
+	std::vector<ArchiveIndexEntry>	m_recovered;
+	std::unique_ptr<StripeCompressor>	m_decompressor;
+#ifdef _WIN32
+	void*						m_file;
+	void*						m_mapping;
+#else
+	int							m_file;
+#endif
+};
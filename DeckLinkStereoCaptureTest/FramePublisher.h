@@ -0,0 +1,70 @@
+// frame publication: copies captured frames into a shared-memory ring that other local processes read
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "CaptureFrame.h"
+#include "FrameQueue.h"
+#include "SharedFrameRingFormat.h"
+
+struct PublisherStats
+{
+	uint64_t	framesPublished;
+	uint64_t	framesDropped;		// refused because the queue was full
+	unsigned	queueDepth;			// frames waiting for the publisher thread
+	double		meanCopyMs;			// copying one frame, all eyes, into its slot
+	double		maxCopyMs;
+	double		lastLagMs;			// frame arrival to its slot being complete
+	double		meanLagMs;
+};
+
+// Owns the shared-memory ring laid out in SharedFrameRingFormat.h. Frames are copied into the
+// ring's slots by the publisher's own thread, oldest slot first, whether or not anyone is
+// reading, so readers can neither hold up capture nor stop the ring from moving on. Readers
+// attach and detach at any time with FrameRingClient
+class FramePublisher
+{
+public:
+	explicit FramePublisher(unsigned queueDepth);
+	~FramePublisher();
+
+	// creates the ring, replacing a stale one left behind under the same name
+	bool		open(const std::string& name, const CaptureFrame& format, unsigned slotCount);
+
+	// hands a frame to the publisher thread without blocking. The publisher takes over the
+	// caller's buffer references, and releases them itself if the frame has to be dropped
+	bool		submit(const CaptureFrame& frame);
+
+	// publishes everything still queued, marks the ring closed and unmaps it. Readers
+	// already attached keep their mapping; the name is gone for new ones
+	void		close();
+
+	bool		isOpen() const { return m_running; }
+	PublisherStats	stats();
+
+private:
+	void		publisherThread();
+	void		publishFrame(const CaptureFrame& frame);
+	void		unmap();
+	void		printStats();
+
+	FrameQueue					m_queue;
+	std::thread					m_publisher;
+	std::atomic<bool>			m_running;
+	std::string					m_objectName;
+	uint8_t*					m_data;
+	uint64_t					m_size;
+	SharedRingHeader*			m_header;
+#ifdef _WIN32
+	void*						m_mapping;
+#else
+	int							m_file;
+#endif
+	std::atomic<uint64_t>		m_framesPublished;
+	std::atomic<uint64_t>		m_copyTotalUs;
+	std::atomic<uint64_t>		m_copyMaxUs;
+	std::atomic<uint64_t>		m_lagTotalUs;
+	std::atomic<uint64_t>		m_lagLastUs;
+};
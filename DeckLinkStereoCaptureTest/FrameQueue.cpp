@@ -0,0 +1,71 @@
+// bounded hand-off queue between the capture callback and a pipeline stage thread
+#include "FrameQueue.h"
+
+FrameQueue::FrameQueue(unsigned capacity) :
+	m_slots(capacity),
+	m_head(0),
+	m_count(0),
+	m_closed(false),
+	m_dropCount(0)
+{
+}
+
+bool FrameQueue::tryPush(const CaptureFrame& frame)
+{
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (!m_closed && m_count < m_slots.size())
+		{
+			m_slots[(m_head + m_count) % m_slots.size()] = frame;
+			++m_count;
+			m_notEmpty.notify_one();
+			return true;
+		}
+	}
+
+	++m_dropCount;
+	return false;
+}
+
+bool FrameQueue::push(const CaptureFrame& frame)
+{
+	std::unique_lock<std::mutex> guard(m_mutex);
+	m_notFull.wait(guard, [this]() { return m_closed || m_count < m_slots.size(); });
+	if (m_closed)
+		return false;
+
+	m_slots[(m_head + m_count) % m_slots.size()] = frame;
+	++m_count;
+	m_notEmpty.notify_one();
+	return true;
+}
+
+bool FrameQueue::pop(CaptureFrame& frame, std::chrono::milliseconds timeout)
+{
+	std::unique_lock<std::mutex> guard(m_mutex);
+	if (!m_notEmpty.wait_for(guard, timeout, [this]() { return m_closed || m_count > 0; }))
+		return false;
+
+	if (m_count == 0)
+		return false;
+
+	frame = m_slots[m_head];
+	m_head = (m_head + 1) % m_slots.size();
+	--m_count;
+	m_notFull.notify_one();
+	return true;
+}
+
+void FrameQueue::close()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	m_closed = true;
+	m_notEmpty.notify_all();
+	m_notFull.notify_all();
+}
+
+unsigned FrameQueue::depth()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	return m_count;
+}
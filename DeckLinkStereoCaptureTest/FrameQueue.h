@@ -0,0 +1,42 @@
+// bounded hand-off queue between the capture callback and a pipeline stage thread
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "CaptureFrame.h"
+
+class FrameQueue
+{
+public:
+	explicit FrameQueue(unsigned capacity);
+
+	// non-blocking; returns false (and counts a drop) when the queue is full or closed.
+	// This is the only push the capture callback is allowed to use
+	bool		tryPush(const CaptureFrame& frame);
+
+	// blocking push for producers that are not on the capture thread
+	bool		push(const CaptureFrame& frame);
+
+	// waits up to timeout for a frame; returns false on timeout or once closed and drained
+	bool		pop(CaptureFrame& frame, std::chrono::milliseconds timeout);
+
+	// wake all waiters; pending frames can still be popped
+	void		close();
+
+	unsigned	depth();
+	unsigned	capacity() const { return (unsigned)m_slots.size(); }
+	uint64_t	dropCount() const { return m_dropCount; }
+
+private:
+	std::vector<CaptureFrame>	m_slots;
+	unsigned					m_head;
+	unsigned					m_count;
+	bool						m_closed;
+	std::mutex					m_mutex;
+	std::condition_variable		m_notEmpty;
+	std::condition_variable		m_notFull;
+	std::atomic<uint64_t>		m_dropCount;
+};
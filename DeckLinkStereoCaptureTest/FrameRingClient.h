@@ -0,0 +1,74 @@
+// frame ring client: zero-copy access to the frames a FramePublisher places in shared memory, from another process
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "SharedFrameRingFormat.h"
+
+// one published frame, as handed out by FrameRingClient
+struct SharedFrameView
+{
+	uint64_t	sequence;			// counts published frames; consecutive unless frames were missed
+	uint64_t	generation;			// of the slot when the view was taken
+	uint64_t	frameNumber;
+	int64_t		streamTime;
+	int64_t		streamDuration;
+	int64_t		hardwareTime;		// microseconds
+	int64_t		publishTime;		// publisher's steadyClockMicroseconds(); only comparable on the same machine
+	uint32_t	flags;
+	unsigned	eyeCount;
+	cv::Mat		eye[kSharedRingMaxEyes];	// views into the ring, laid out as FrameArchive::frameView()
+};
+
+// Maps a ring read-only and follows it from frame to frame. The images of a view point straight
+// into the ring, so nothing is copied, but the publisher never waits: once it comes round to the
+// slot again the pixels change under the view. Take what is needed from the images, then call
+// isIntact(); if it says false, the publisher overtook the reader and the result must be thrown
+// away. A ring of N slots leaves a reader about N - 1 frame times to do that in
+class FrameRingClient
+{
+public:
+	FrameRingClient();
+	~FrameRingClient();
+
+	// the name the publisher was opened with; fails while nothing is publishing under it
+	bool		attach(const std::string& name);
+	void		detach();
+
+	bool		isAttached() const { return m_header != nullptr; }
+	const SharedRingHeader&	header() const { return *m_header; }
+
+	// false once the publisher has closed the ring; frames already published can still be read
+	bool		isPublishing() const;
+
+	// the newest complete frame, and carries on from it on the next call to nextFrame()
+	bool		latestFrame(SharedFrameView& view);
+
+	// waits up to timeoutMs for the frame after the last one handed out. A reader that has
+	// fallen a whole ring behind skips ahead to the newest frame; the frames it passed over
+	// are counted by framesMissed()
+	bool		nextFrame(SharedFrameView& view, unsigned timeoutMs);
+
+	// whether the slot behind view still holds the frame it was taken from
+	bool		isIntact(const SharedFrameView& view) const;
+
+	uint64_t	framesMissed() const { return m_framesMissed; }
+	uint64_t	framesTorn() const { return m_framesTorn; }
+
+private:
+	bool		takeView(uint64_t sequence, SharedFrameView& view);
+	cv::Mat		wrapPayload(const uint8_t* bytes) const;
+
+	const uint8_t*				m_data;
+	uint64_t					m_size;
+	const SharedRingHeader*		m_header;
+	uint64_t					m_nextSequence;
+	uint64_t					m_framesMissed;
+	mutable uint64_t			m_framesTorn;
+#ifdef _WIN32
+	void*						m_mapping;
+#else
+	int							m_file;
+#endif
+};
@@ -0,0 +1,242 @@
+// frame server client: borrows full-resolution frames from a FrameServer in another process, without copying them
+#include "FrameServerClient.h"
+#include "FrameArchiveFormat.h"
+#include "FramePool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_MEMFD
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// how long a release waits for the server to confirm it
+static const unsigned kReleaseTimeoutMs = 1000;
+
+FrameServerClient::FrameServerClient() :
+	m_socket(-1),
+	m_lastStatus(kFrameReplyFrame)
+{
+}
+
+FrameServerClient::~FrameServerClient()
+{
+	disconnect();
+}
+
+#ifdef HAVE_MEMFD
+
+bool FrameServerClient::isAvailable()
+{
+	return true;
+}
+
+bool FrameServerClient::connect(const std::string& socketPath)
+{
+	struct sockaddr_un address = {};
+
+	disconnect();
+	if (socketPath.size() >= sizeof(address.sun_path))
+		return false;
+
+	address.sun_family = AF_UNIX;
+	memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+	m_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (m_socket < 0 || ::connect(m_socket, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		fprintf(stderr, "Could not connect to the frame server at %s - errno = %d\n", socketPath.c_str(), errno);
+		disconnect();
+		return false;
+	}
+	return true;
+}
+
+void FrameServerClient::disconnect()
+{
+	// the server takes back whatever we still hold
+	if (m_socket >= 0)
+		close(m_socket);
+	m_socket = -1;
+}
+
+bool FrameServerClient::grab(ServedFrame& frame, unsigned timeoutMs)
+{
+	FrameServerReply reply;
+	int fds[kFrameServerMaxEyes];
+	unsigned fdCount = 0;
+	bool ok = true;
+
+	memset(frame.mapping, 0, sizeof(frame.mapping));
+	if (!sendRequest(kFrameRequestGrab, 0) || !receiveReply(reply, fds, &fdCount, timeoutMs))
+	{
+		disconnect();
+		return false;
+	}
+	if (reply.status != kFrameReplyFrame)
+		return false;
+
+	if (fdCount != reply.eyeCount || reply.eyeCount == 0 || reply.bufferBytes < (uint64_t)reply.rowBytes * reply.height)
+		ok = false;
+
+	frame.leaseId = reply.leaseId;
+	frame.leaseMilliseconds = reply.leaseMilliseconds;
+	frame.frameNumber = reply.frameNumber;
+	frame.streamTime = reply.streamTime;
+	frame.streamDuration = reply.streamDuration;
+	frame.timeScale = reply.timeScale;
+	frame.hardwareTime = reply.hardwareTime;
+	frame.flags = reply.flags;
+	frame.pixelFormat = reply.pixelFormat;
+	frame.width = reply.width;
+	frame.height = reply.height;
+	frame.rowBytes = reply.rowBytes;
+	frame.eyeCount = reply.eyeCount;
+	frame.mappingBytes = reply.bufferBytes;
+
+	// the mappings keep the buffers alive, so the descriptors can go straight away
+	for (unsigned eyeIdx = 0; eyeIdx < fdCount; eyeIdx++)
+	{
+		void* data = ok ? mmap(nullptr, (size_t)frame.mappingBytes, PROT_READ, MAP_SHARED, fds[eyeIdx], 0) : MAP_FAILED;
+		close(fds[eyeIdx]);
+		if (data == MAP_FAILED)
+		{
+			ok = false;
+			continue;
+		}
+
+		frame.mapping[eyeIdx] = data;
+		if (frame.pixelFormat == kArchivePixelFormatUYVY)
+			frame.eye[eyeIdx] = cv::Mat(frame.height, frame.width, CV_8UC2, data, (size_t)frame.rowBytes);
+		else
+			frame.eye[eyeIdx] = cv::Mat(frame.height, frame.rowBytes, CV_8UC1, data, (size_t)frame.rowBytes);
+	}
+
+	if (!ok)
+	{
+		fprintf(stderr, "Could not map frame %llu from the frame server\n", (unsigned long long)frame.frameNumber);
+		release(frame);
+		return false;
+	}
+	return true;
+}
+
+bool FrameServerClient::release(ServedFrame& frame)
+{
+	FrameServerReply reply;
+	unsigned fdCount = 0;
+
+	for (unsigned eyeIdx = 0; eyeIdx < kFrameServerMaxEyes; eyeIdx++)
+	{
+		frame.eye[eyeIdx] = cv::Mat();
+		if (frame.mapping[eyeIdx])
+			munmap(frame.mapping[eyeIdx], (size_t)frame.mappingBytes);
+		frame.mapping[eyeIdx] = nullptr;
+	}
+
+	if (!sendRequest(kFrameRequestRelease, frame.leaseId) || !receiveReply(reply, nullptr, &fdCount, kReleaseTimeoutMs))
+	{
+		disconnect();
+		return false;
+	}
+	return reply.status == kFrameReplyReleased;
+}
+
+bool FrameServerClient::sendRequest(FrameRequestType type, uint64_t leaseId)
+{
+	FrameServerRequest request = {};
+
+	if (m_socket < 0)
+		return false;
+
+	request.magic = kFrameServerMagic;
+	request.version = kFrameServerVersion;
+	request.type = type;
+	request.leaseId = leaseId;
+	return send(m_socket, &request, sizeof(request), MSG_NOSIGNAL) == (ssize_t)sizeof(request);
+}
+
+bool FrameServerClient::receiveReply(FrameServerReply& reply, int* fds, unsigned* fdCount, unsigned timeoutMs)
+{
+	struct pollfd pollFd = { m_socket, POLLIN, 0 };
+	struct iovec data = { &reply, sizeof(reply) };
+	struct msghdr message = {};
+	union
+	{
+		char			buffer[CMSG_SPACE(sizeof(int) * kFrameServerMaxEyes)];
+		struct cmsghdr	align;
+	} control;
+
+	*fdCount = 0;
+	if (poll(&pollFd, 1, (int)timeoutMs) <= 0)
+		return false;
+
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+	if (recvmsg(m_socket, &message, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(reply) || reply.magic != kFrameServerMagic)
+		return false;
+
+	for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+	{
+		if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		const unsigned count = (unsigned)((header->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		for (unsigned fdIdx = 0; fdIdx < count; fdIdx++)
+		{
+			int fd;
+			memcpy(&fd, CMSG_DATA(header) + fdIdx * sizeof(int), sizeof(int));
+			if (fds != nullptr && *fdCount < kFrameServerMaxEyes)
+				fds[(*fdCount)++] = fd;
+			else
+				close(fd);	// not expected here
+		}
+	}
+
+	m_lastStatus = (FrameReplyStatus)reply.status;
+	return true;
+}
+
+#else
+
+bool FrameServerClient::isAvailable()
+{
+	return false;
+}
+
+bool FrameServerClient::connect(const std::string& socketPath)
+{
+	return false;
+}
+
+void FrameServerClient::disconnect()
+{
+}
+
+bool FrameServerClient::grab(ServedFrame& frame, unsigned timeoutMs)
+{
+	return false;
+}
+
+bool FrameServerClient::release(ServedFrame& frame)
+{
+	return false;
+}
+
+bool FrameServerClient::sendRequest(FrameRequestType type, uint64_t leaseId)
+{
+	return false;
+}
+
+bool FrameServerClient::receiveReply(FrameServerReply& reply, int* fds, unsigned* fdCount, unsigned timeoutMs)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,63 @@
+// frame server client: borrows full-resolution frames from a FrameServer in another process, without copying them
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include "FrameServerProtocol.h"
+
+// one leased frame. The images are read-only mappings of the capture process's own pool
+// buffers, laid out as FrameArchive::frameView(); they stay valid until the frame is released
+struct ServedFrame
+{
+	uint64_t	leaseId;
+	uint32_t	leaseMilliseconds;	// the server revokes the lease, and disconnects, after this long
+	uint64_t	frameNumber;
+	int64_t		streamTime;
+	int64_t		streamDuration;
+	int64_t		timeScale;
+	int64_t		hardwareTime;		// microseconds
+	uint32_t	flags;
+	uint32_t	pixelFormat;
+	int32_t		width;
+	int32_t		height;
+	int32_t		rowBytes;
+	unsigned	eyeCount;
+	cv::Mat		eye[kFrameServerMaxEyes];
+
+	// mappings behind eye[], undone by FrameServerClient::release()
+	void*		mapping[kFrameServerMaxEyes];
+	uint64_t	mappingBytes;
+};
+
+// Requests are answered in order, so a client is used from one thread at a time
+class FrameServerClient
+{
+public:
+	FrameServerClient();
+	~FrameServerClient();
+
+	static bool	isAvailable();
+
+	bool		connect(const std::string& socketPath);
+	void		disconnect();
+	bool		isConnected() const { return m_socket >= 0; }
+
+	// waits up to timeoutMs for a frame this client has not had before. Fails when the client
+	// already holds its quota of frames, and on a timeout, which also ends the connection since
+	// the reply could still arrive later
+	bool		grab(ServedFrame& frame, unsigned timeoutMs);
+
+	// unmaps the frame and hands it back to the server
+	bool		release(ServedFrame& frame);
+
+	// the status of the last reply, to tell a quota refusal from a lost connection
+	FrameReplyStatus	lastStatus() const { return m_lastStatus; }
+
+private:
+	bool		receiveReply(FrameServerReply& reply, int* fds, unsigned* fdCount, unsigned timeoutMs);
+	bool		sendRequest(FrameRequestType type, uint64_t leaseId);
+
+	int					m_socket;
+	FrameReplyStatus	m_lastStatus;
+};
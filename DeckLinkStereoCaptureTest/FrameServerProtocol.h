@@ -0,0 +1,76 @@
+// messages between FrameServer and FrameServerClient on the frame server's Unix domain socket
+#pragma once
+
+#include <stdint.h>
+
+// Frame server protocol
+//
+// The socket is SOCK_SEQPACKET, so every message arrives whole. A client sends requests and the
+// server answers each one with a reply, in order.
+//
+// kFrameRequestGrab
+//   Asks for the next frame the client has not had yet; the server answers once one arrives.
+//   The reply carries one memfd descriptor per eye as SCM_RIGHTS ancillary data. The memfds are
+//   sealed against resizing. On kernels that have F_SEAL_FUTURE_WRITE they are also sealed
+//   against writing; on older ones the descriptor sent is a read-only reopening of the memfd.
+//   Either way it can only be mapped read-only. The frame is leased to the client until it sends
+//   kFrameRequestRelease with the lease id, disconnects, or holds it past the lease time.
+//   A grab that would take the client, or all clients together, over their lease quota is
+//   answered with kFrameReplyOverQuota and no descriptors.
+//
+// kFrameRequestRelease
+//   Gives a leased frame back; the server answers with kFrameReplyReleased, or with
+//   kFrameReplyUnknownLease if the lease had already been revoked.
+//
+// A lease that runs out is revoked: the server drops its references, so the buffers go back to
+// the capture pool and will be overwritten, and closes the connection, since a client that
+// overran its lease has stopped answering or lost track of its frames
+
+const uint32_t	kFrameServerMagic = 0x53524644;		// "DFRS"
+const uint32_t	kFrameServerVersion = 1;
+const unsigned	kFrameServerMaxEyes = 2;
+
+enum FrameRequestType
+{
+	kFrameRequestGrab = 1,
+	kFrameRequestRelease = 2,
+};
+
+enum FrameReplyStatus
+{
+	kFrameReplyFrame = 0,			// a lease, with its descriptors
+	kFrameReplyReleased = 1,
+	kFrameReplyOverQuota = 2,
+	kFrameReplyUnknownLease = 3,
+	kFrameReplyBadRequest = 4,
+};
+
+struct FrameServerRequest
+{
+	uint32_t	magic;				// kFrameServerMagic
+	uint32_t	version;			// kFrameServerVersion
+	uint32_t	type;				// FrameRequestType
+	uint32_t	reserved;
+	uint64_t	leaseId;			// kFrameRequestRelease
+};
+
+struct FrameServerReply
+{
+	uint32_t	magic;				// kFrameServerMagic
+	uint32_t	status;				// FrameReplyStatus
+	uint64_t	leaseId;
+	uint32_t	leaseMilliseconds;	// how long the client may hold the frame
+	uint32_t	eyeCount;			// descriptors attached, left eye first
+	uint64_t	bufferBytes;		// size of each memfd; the payload is at its start
+	uint64_t	frameNumber;
+	int64_t		streamTime;
+	int64_t		streamDuration;
+	int64_t		timeScale;
+	int64_t		hardwareTime;		// microseconds
+	uint32_t	flags;				// BMDFrameFlags
+	uint32_t	pixelFormat;		// BMDPixelFormat
+	int32_t		width;
+	int32_t		height;
+	int32_t		rowBytes;
+	uint32_t	reserved;
+};
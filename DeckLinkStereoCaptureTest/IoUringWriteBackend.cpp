@@ -0,0 +1,180 @@
+// Linux io_uring write backend: batched submissions, several writes in flight, optional registered buffers
+#include "IoUringWriteBackend.h"
+
+#include <stdio.h>
+
+#ifdef HAVE_IO_URING
+#include <liburing.h>
+#include <sys/uio.h>
+
+IoUringWriteBackend::IoUringWriteBackend(unsigned entries) :
+	m_ring(new io_uring()),
+	m_buffersRegistered(false),
+	m_pendingWrites(entries)
+{
+	m_freeSlots.reserve(entries);
+	for (unsigned slotIdx = entries; slotIdx > 0; slotIdx--)
+		m_freeSlots.push_back(slotIdx - 1);
+}
+
+IoUringWriteBackend* IoUringWriteBackend::create(unsigned queueDepth)
+{
+	// a frame record is a header plus one write per eye, so leave room for three writes per record
+	const unsigned entries = queueDepth * 3;
+
+	IoUringWriteBackend* backend = new IoUringWriteBackend(entries);
+	int result = io_uring_queue_init(entries, backend->m_ring, 0);
+	if (result < 0)
+	{
+		fprintf(stderr, "Could not set up io_uring - result = %d\n", result);
+		delete backend->m_ring;
+		backend->m_ring = nullptr;
+		delete backend;
+		return nullptr;
+	}
+
+	return backend;
+}
+
+IoUringWriteBackend::~IoUringWriteBackend()
+{
+	if (m_ring)
+	{
+		if (m_buffersRegistered)
+			io_uring_unregister_buffers(m_ring);
+		io_uring_queue_exit(m_ring);
+		delete m_ring;
+	}
+}
+
+bool IoUringWriteBackend::registerBuffers(const std::vector<WriteBuffer>& buffers)
+{
+	std::vector<iovec> iovecs(buffers.size());
+	for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++)
+	{
+		iovecs[bufferIdx].iov_base = buffers[bufferIdx].data;
+		iovecs[bufferIdx].iov_len = buffers[bufferIdx].bytes;
+	}
+
+	// pinning counts against RLIMIT_MEMLOCK; without it we still work, just without fixed buffers
+	int result = io_uring_register_buffers(m_ring, iovecs.data(), (unsigned)iovecs.size());
+	if (result < 0)
+	{
+		fprintf(stderr, "Could not register %zu buffers with io_uring (check the memlock limit) - result = %d\n", buffers.size(), result);
+		return false;
+	}
+
+	m_buffersRegistered = true;
+	return true;
+}
+
+bool IoUringWriteBackend::submit(const WriteRequest* requests, unsigned count)
+{
+	// all or nothing: the recorder gives a refused batch's buffers back straight away, so none of
+	// it may reach the kernel. Entries left over from a failed submission go out first
+	if (count > m_freeSlots.size())
+		return false;
+	if (io_uring_sq_space_left(m_ring) < count && io_uring_sq_ready(m_ring) > 0)
+		io_uring_submit(m_ring);
+	if (io_uring_sq_space_left(m_ring) < count)
+		return false;
+
+	for (unsigned requestIdx = 0; requestIdx < count; requestIdx++)
+	{
+		const WriteRequest& request = requests[requestIdx];
+		io_uring_sqe* sqe = io_uring_get_sqe(m_ring);
+
+		if (m_buffersRegistered && request.bufferIndex >= 0)
+			io_uring_prep_write_fixed(sqe, m_file, request.data, (unsigned)request.bytes, request.offset, request.bufferIndex);
+		else
+			io_uring_prep_write(sqe, m_file, request.data, (unsigned)request.bytes, request.offset);
+
+		unsigned slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		m_pendingWrites[slot].tag = request.tag;
+		m_pendingWrites[slot].bytes = request.bytes;
+		io_uring_sqe_set_data(sqe, (void*)(uintptr_t)slot);
+	}
+
+	// the entries are the ring's now, whether or not this call hands them over; a failed
+	// submission leaves them queued for the next submit() or reap() to push out
+	m_inFlight += count;
+
+	// one system call for the whole batch
+	int result = io_uring_submit(m_ring);
+	if (result < 0)
+		fprintf(stderr, "io_uring submission failed, retrying with the next batch - result = %d\n", result);
+	return true;
+}
+
+unsigned IoUringWriteBackend::reap(WriteCompletion* completions, unsigned maxCompletions, bool wait)
+{
+	unsigned count = 0;
+
+	// entries a failed submission left queued would never complete; waiting on them would hang
+	if (io_uring_sq_ready(m_ring) > 0 && io_uring_submit(m_ring) < 0)
+		wait = false;
+
+	while (count < maxCompletions && m_inFlight > 0)
+	{
+		io_uring_cqe* cqe = nullptr;
+		int result = (wait && count == 0) ? io_uring_wait_cqe(m_ring, &cqe) : io_uring_peek_cqe(m_ring, &cqe);
+		if (result < 0 || cqe == nullptr)
+			break;
+
+		unsigned slot = (unsigned)(uintptr_t)io_uring_cqe_get_data(cqe);
+		completions[count].tag = m_pendingWrites[slot].tag;
+		completions[count].ok = (cqe->res >= 0 && (uint64_t)cqe->res == m_pendingWrites[slot].bytes);
+		if (!completions[count].ok)
+			fprintf(stderr, "io_uring write failed - result = %d\n", cqe->res);
+
+		io_uring_cqe_seen(m_ring, cqe);
+		m_freeSlots.push_back(slot);
+		--m_inFlight;
+		++count;
+	}
+
+	return count;
+}
+
+void IoUringWriteBackend::stop()
+{
+	WriteCompletion completion;
+
+	// the recorder drains its writes before closing; this only catches writes abandoned after an error
+	while (m_inFlight > 0 && reap(&completion, 1, true) > 0)
+	{
+	}
+}
+
+#else
+
+IoUringWriteBackend* IoUringWriteBackend::create(unsigned queueDepth)
+{
+	return nullptr;
+}
+
+IoUringWriteBackend::~IoUringWriteBackend()
+{
+}
+
+bool IoUringWriteBackend::registerBuffers(const std::vector<WriteBuffer>& buffers)
+{
+	return false;
+}
+
+bool IoUringWriteBackend::submit(const WriteRequest* requests, unsigned count)
+{
+	return false;
+}
+
+unsigned IoUringWriteBackend::reap(WriteCompletion* completions, unsigned maxCompletions, bool wait)
+{
+	return 0;
+}
+
+void IoUringWriteBackend::stop()
+{
+}
+
+#endif
@@ -0,0 +1,45 @@
+// Linux io_uring write backend: batched submissions, several writes in flight, optional registered buffers
+#pragma once
+
+#include <vector>
+#include "WriteBackend.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<liburing.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+struct io_uring;
+
+class IoUringWriteBackend : public WriteBackend
+{
+public:
+	// returns nullptr when io_uring is not compiled in or the kernel refuses to set up a ring
+	static IoUringWriteBackend*	create(unsigned queueDepth);
+	virtual ~IoUringWriteBackend();
+
+	virtual const char*	name() const override { return "io_uring"; }
+
+	virtual bool		registerBuffers(const std::vector<WriteBuffer>& buffers) override;
+	virtual bool		submit(const WriteRequest* requests, unsigned count) override;
+	virtual unsigned	reap(WriteCompletion* completions, unsigned maxCompletions, bool wait) override;
+
+protected:
+	virtual void		stop() override;
+
+private:
+	explicit IoUringWriteBackend(unsigned entries);
+
+	// what we need to know about a write once its completion comes back
+	struct PendingWrite
+	{
+		void*		tag;
+		uint64_t	bytes;
+	};
+
+	io_uring*					m_ring;
+	bool						m_buffersRegistered;
+	std::vector<PendingWrite>	m_pendingWrites;
+	std::vector<unsigned>		m_freeSlots;
+};
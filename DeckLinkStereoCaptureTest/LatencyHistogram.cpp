@@ -0,0 +1,92 @@
+// latency histogram: lock-free log-linear buckets in the style of HdrHistogram, for percentiles of microsecond latencies
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const uint64_t kLatencyMaxUs = (1ull << kLatencyMaxBits) - 1;
+static const unsigned kSubBucketHalfCount = 1u << kLatencySubBucketBits;
+
+static unsigned floorLog2(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long bit;
+	_BitScanReverse64(&bit, value | 1);
+	return (unsigned)bit;
+#else
+	return 63 - (unsigned)__builtin_clzll(value | 1);
+#endif
+}
+
+LatencyHistogram::LatencyHistogram() :
+	m_count(0),
+	m_totalUs(0),
+	m_maxUs(0)
+{
+	for (std::atomic<uint64_t>& bucket : m_buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+// Values below twice the sub-bucket count have a bucket each. Above that, each power of two
+// [2^n, 2^(n+1)) is split into kSubBucketHalfCount buckets of 2^(n - kLatencySubBucketBits)
+unsigned LatencyHistogram::bucketIndex(uint64_t valueUs)
+{
+	const unsigned log2 = floorLog2(valueUs);
+	const unsigned shift = (log2 > kLatencySubBucketBits) ? log2 - kLatencySubBucketBits : 0;
+	return (shift << kLatencySubBucketBits) + (unsigned)(valueUs >> shift);
+}
+
+uint64_t LatencyHistogram::highestInBucket(unsigned index)
+{
+	const unsigned shift = (index < 2 * kSubBucketHalfCount) ? 0 : (index >> kLatencySubBucketBits) - 1;
+	const uint64_t lowest = (uint64_t)(index - (shift << kLatencySubBucketBits)) << shift;
+	return lowest + (1ull << shift) - 1;
+}
+
+void LatencyHistogram::record(int64_t valueUs)
+{
+	const uint64_t value = std::min((uint64_t)std::max(valueUs, (int64_t)0), kLatencyMaxUs);
+
+	m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	m_totalUs.fetch_add(value, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t maxUs = m_maxUs.load(std::memory_order_relaxed);
+	while (value > maxUs && !m_maxUs.compare_exchange_weak(maxUs, value, std::memory_order_relaxed))
+		;
+}
+
+uint64_t LatencyHistogram::valueAtFraction(double fraction) const
+{
+	// the buckets are summed instead of trusting m_count, which a concurrent record may not have reached
+	uint64_t total = 0;
+	for (const std::atomic<uint64_t>& bucket : m_buckets)
+		total += bucket.load(std::memory_order_relaxed);
+	if (total == 0)
+		return 0;
+
+	const uint64_t wanted = std::max((uint64_t)(fraction * total + 0.5), (uint64_t)1);
+	uint64_t seen = 0;
+	for (unsigned index = 0; index < kLatencyBucketCount; index++)
+	{
+		seen += m_buckets[index].load(std::memory_order_relaxed);
+		if (seen >= wanted)
+			return std::min(highestInBucket(index), m_maxUs.load(std::memory_order_relaxed));
+	}
+	return m_maxUs.load(std::memory_order_relaxed);
+}
+
+LatencySummary LatencyHistogram::summary() const
+{
+	LatencySummary summary = {};
+	summary.count = count();
+	summary.meanMs = summary.count ? (m_totalUs.load(std::memory_order_relaxed) / 1000.0) / summary.count : 0.0;
+	summary.p50Ms = valueAtFraction(0.5) / 1000.0;
+	summary.p99Ms = valueAtFraction(0.99) / 1000.0;
+	summary.p999Ms = valueAtFraction(0.999) / 1000.0;
+	summary.maxMs = m_maxUs.load(std::memory_order_relaxed) / 1000.0;
+	return summary;
+}
@@ -0,0 +1,49 @@
+// latency histogram: lock-free log-linear buckets in the style of HdrHistogram, for percentiles of microsecond latencies
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// values up to 2^kLatencyMaxBits microseconds (about 36 minutes) are told apart; longer ones count as that
+const unsigned	kLatencyMaxBits = 31;
+// each power of two is split into 2^kLatencySubBucketBits buckets, so values are kept to within 1%
+const unsigned	kLatencySubBucketBits = 7;
+const unsigned	kLatencyBucketCount = (kLatencyMaxBits - kLatencySubBucketBits + 1) << kLatencySubBucketBits;
+
+struct LatencySummary
+{
+	uint64_t	count;
+	double		meanMs;
+	double		p50Ms;
+	double		p99Ms;
+	double		p999Ms;
+	double		maxMs;
+};
+
+// Any number of threads may record at once, each record being a few relaxed atomic adds; a summary
+// may be taken at any time, and counts what was recorded by then. Nothing is ever reset, so the
+// percentiles cover everything since the histogram was made
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	// negative values, from a clock stepping back, count as 0
+	void			record(int64_t valueUs);
+
+	uint64_t		count() const { return m_count.load(std::memory_order_relaxed); }
+
+	// the highest value the given fraction of recorded values (0.99 for p99) do not exceed, in microseconds
+	uint64_t		valueAtFraction(double fraction) const;
+
+	LatencySummary	summary() const;
+
+private:
+	static unsigned	bucketIndex(uint64_t valueUs);
+	static uint64_t	highestInBucket(unsigned index);
+
+	std::atomic<uint64_t>	m_buckets[kLatencyBucketCount];
+	std::atomic<uint64_t>	m_count;
+	std::atomic<uint64_t>	m_totalUs;
+	std::atomic<uint64_t>	m_maxUs;
+};
@@ -0,0 +1,59 @@
+// per-device latency tracking: how long after the card timestamped a frame each pipeline stage was done with it
+#include "LatencyTracker.h"
+
+#include <stdio.h>
+
+// how often the latencies are printed while capturing
+static const int64_t kStatsIntervalUs = 10 * 1000000;
+
+LatencyTracker::LatencyTracker(unsigned deviceIndex) :
+	m_deviceIndex(deviceIndex),
+	m_lastStatsUs(steadyClockMicroseconds())
+{
+}
+
+void LatencyTracker::record(LatencyStage stage, int64_t anchorTime)
+{
+	const int64_t nowUs = steadyClockMicroseconds();
+	m_stages[stage].record(nowUs - anchorTime);
+
+	// the printing is left to the stage threads, never the capture callback
+	if (stage == kLatencyCallback || stage == kLatencyPooled)
+		return;
+
+	int64_t lastStatsUs = m_lastStatsUs;
+	if (nowUs - lastStatsUs >= kStatsIntervalUs && m_lastStatsUs.compare_exchange_strong(lastStatsUs, nowUs))
+		printStats();
+}
+
+const char* LatencyTracker::stageName(LatencyStage stage)
+{
+	switch (stage)
+	{
+	case kLatencyCallback:		return "callback";
+	case kLatencyPooled:		return "pooled";
+	case kLatencyVideoDecoded:	return "video decoded";
+	case kLatencyVideoEncoded:	return "video encoded";
+	case kLatencyStillsDecoded:	return "stills decoded";
+	case kLatencyStillsWritten:	return "stills written";
+	case kLatencyRecorded:		return "recorded";
+	case kLatencyPublished:		return "published";
+	case kLatencyProcessed:		return "processed";
+	case kLatencyDisparity:		return "disparity";
+	default:					return "unknown";
+	}
+}
+
+void LatencyTracker::printStats() const
+{
+	printf("Device #%u latency from hardware timestamp, p50 / p99 / p99.9 / max ms:\n", m_deviceIndex);
+	for (unsigned stageIdx = 0; stageIdx < kLatencyStageCount; stageIdx++)
+	{
+		const LatencySummary current = summary((LatencyStage)stageIdx);
+		if (current.count == 0)
+			continue;
+
+		printf("  %-15s %8.2f %8.2f %8.2f %8.2f  (%llu frames)\n", stageName((LatencyStage)stageIdx),
+			current.p50Ms, current.p99Ms, current.p999Ms, current.maxMs, (unsigned long long)current.count);
+	}
+}
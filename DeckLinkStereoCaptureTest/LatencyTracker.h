@@ -0,0 +1,54 @@
+// per-device latency tracking: how long after the card timestamped a frame each pipeline stage was done with it
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "CaptureFrame.h"
+#include "LatencyHistogram.h"
+
+// the points in the pipeline a frame's latency is measured at
+enum LatencyStage
+{
+	kLatencyCallback,			// VideoInputFrameArrived entered
+	kLatencyPooled,				// copied into the frame pool and handed to every stage
+	kLatencyVideoDecoded,		// unpacked for the encoder, every eye
+	kLatencyVideoEncoded,		// encoded and handed to the muxer, every eye
+	kLatencyStillsDecoded,		// converted to BGR for the stills, every eye
+	kLatencyStillsWritten,		// every still of the frame written
+	kLatencyRecorded,			// its record written to the raw recording
+	kLatencyPublished,			// its shared-memory ring slot complete
+	kLatencyProcessed,			// every processing stage that ran on it done
+	kLatencyDisparity,			// its disparity map published
+	kLatencyStageCount
+};
+
+// One histogram per stage, fed from whichever thread finishes with a frame. All latencies are on
+// the steady clock, from the frame's CaptureFrame::anchorTime: its hardware timestamp, moved onto
+// the steady clock with a reading of the card's reference clock taken in the callback. Frames
+// recorded through a pre-roll count the time they spent waiting for the trigger
+class LatencyTracker
+{
+public:
+	explicit LatencyTracker(unsigned deviceIndex);
+
+	void			record(LatencyStage stage, int64_t anchorTime);
+
+	LatencySummary	summary(LatencyStage stage) const { return m_stages[stage].summary(); }
+
+	static const char*	stageName(LatencyStage stage);
+
+	// prints every stage that has seen a frame
+	void			printStats() const;
+
+private:
+	unsigned				m_deviceIndex;
+	LatencyHistogram		m_stages[kLatencyStageCount];
+	std::atomic<int64_t>	m_lastStatsUs;
+};
+
+// records that a stage is done with frame, for frames that carry a tracker
+inline void recordLatency(const CaptureFrame& frame, LatencyStage stage)
+{
+	if (frame.latency)
+		frame.latency->record(stage, frame.anchorTime);
+}
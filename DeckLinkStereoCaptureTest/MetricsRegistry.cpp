@@ -0,0 +1,520 @@
+// metrics registry: counters, gauges and histograms, exported in the Prometheus text format to a file and over HTTP on loopback
+#include "MetricsRegistry.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+typedef SOCKET MetricsSocket;
+static const MetricsSocket kNoSocket = INVALID_SOCKET;
+static void closeSocket(MetricsSocket socket) { closesocket(socket); }
+#else
+typedef int MetricsSocket;
+static const MetricsSocket kNoSocket = -1;
+static void closeSocket(MetricsSocket socket) { close(socket); }
+#endif
+
+// how long the export threads wait, on the clock or the listening socket, before looking at the stop flag again
+static const int kStopPollMs = 100;
+
+// a request larger than this is not one we serve
+static const size_t kMaxRequestBytes = 4096;
+
+// a client that takes longer than this to send its request or read the reply is dropped; it only
+// holds up other scrapes, since the file is written by a thread of its own
+static const unsigned kClientTimeoutMs = 1000;
+
+static const char kContentType[] = "text/plain; version=0.0.4; charset=utf-8";
+
+enum MetricType
+{
+	kMetricTypeCounter,
+	kMetricTypeGauge,
+	kMetricTypeHistogram
+};
+
+// one set of labels of a family; only the metric of the family's type is set
+struct MetricSeries
+{
+	std::string							labels;
+	std::unique_ptr<MetricCounter>		counter;
+	std::unique_ptr<MetricGauge>		gauge;
+	std::unique_ptr<MetricHistogram>	histogram;
+};
+
+struct MetricFamily
+{
+	std::string			name;
+	std::string			help;
+	MetricType			type;
+	std::vector<std::unique_ptr<MetricSeries>>	series;
+};
+
+struct MetricCollector
+{
+	const void*				owner;
+	std::function<void()>	collect;
+};
+
+// families are formatted in the order they were first registered in
+static std::mutex									s_metricsMutex;
+static std::vector<std::unique_ptr<MetricFamily>>	s_families;
+static std::vector<std::unique_ptr<MetricSeries>>	s_mismatched;	// asked for as a second type; updated but never exported
+static std::vector<MetricCollector>				s_collectors;
+
+static std::mutex		s_exportMutex;		// startExport() and stopExport()
+static std::atomic<bool>	s_exporting(false);
+static std::thread		s_exporter;			// writes the file
+static std::thread		s_server;			// answers HTTP requests
+static std::string		s_exportPath;
+static MetricsSocket	s_listener = kNoSocket;
+static std::chrono::milliseconds	s_exportInterval(1000);
+
+static uint64_t doubleBits(double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static double bitsDouble(uint64_t bits)
+{
+	double value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+void MetricGauge::set(double value)
+{
+	m_bits.store(doubleBits(value), std::memory_order_relaxed);
+}
+
+double MetricGauge::value() const
+{
+	return bitsDouble(m_bits.load(std::memory_order_relaxed));
+}
+
+MetricHistogram::MetricHistogram(const double* upperBounds, unsigned boundCount) :
+	m_boundCount(boundCount < kMetricMaxBuckets ? boundCount : kMetricMaxBuckets),
+	m_sumBits(doubleBits(0.0))
+{
+	for (unsigned boundIdx = 0; boundIdx < m_boundCount; boundIdx++)
+		m_bounds[boundIdx] = upperBounds[boundIdx];
+	for (std::atomic<uint64_t>& bucket : m_buckets)
+		bucket = 0;
+}
+
+void MetricHistogram::observe(double value)
+{
+	unsigned bucketIdx = 0;
+	while (bucketIdx < m_boundCount && value > m_bounds[bucketIdx])
+		bucketIdx++;
+	m_buckets[bucketIdx].fetch_add(1, std::memory_order_relaxed);
+
+	// a histogram usually has a single observer, so this rarely goes round more than once
+	uint64_t sumBits = m_sumBits.load(std::memory_order_relaxed);
+	while (!m_sumBits.compare_exchange_weak(sumBits, doubleBits(bitsDouble(sumBits) + value), std::memory_order_relaxed))
+		;
+}
+
+double MetricHistogram::sum() const
+{
+	return bitsDouble(m_sumBits.load(std::memory_order_relaxed));
+}
+
+// the series of name and labels, made on first use; one that is never exported when name was registered as another type
+static MetricSeries* findSeries(const char* name, const char* help, MetricType type, const std::string& labels)
+{
+	MetricFamily* family = nullptr;
+	for (std::unique_ptr<MetricFamily>& candidate : s_families)
+	{
+		if (candidate->name == name)
+			family = candidate.get();
+	}
+
+	if (family == nullptr)
+	{
+		s_families.emplace_back(new MetricFamily());
+		family = s_families.back().get();
+		family->name = name;
+		family->help = help;
+		family->type = type;
+	}
+	else if (family->type != type)
+	{
+		fprintf(stderr, "Metric %s is already registered as another type, not exporting it\n", name);
+		s_mismatched.emplace_back(new MetricSeries());
+		return s_mismatched.back().get();
+	}
+
+	for (std::unique_ptr<MetricSeries>& series : family->series)
+	{
+		if (series->labels == labels)
+			return series.get();
+	}
+
+	family->series.emplace_back(new MetricSeries());
+	family->series.back()->labels = labels;
+	return family->series.back().get();
+}
+
+MetricCounter* MetricsRegistry::counter(const char* name, const char* help, const std::string& labels)
+{
+	std::lock_guard<std::mutex> guard(s_metricsMutex);
+	MetricSeries* series = findSeries(name, help, kMetricTypeCounter, labels);
+	if (!series->counter)
+		series->counter.reset(new MetricCounter());
+	return series->counter.get();
+}
+
+MetricGauge* MetricsRegistry::gauge(const char* name, const char* help, const std::string& labels)
+{
+	std::lock_guard<std::mutex> guard(s_metricsMutex);
+	MetricSeries* series = findSeries(name, help, kMetricTypeGauge, labels);
+	if (!series->gauge)
+		series->gauge.reset(new MetricGauge());
+	return series->gauge.get();
+}
+
+MetricHistogram* MetricsRegistry::histogram(const char* name, const char* help, const std::string& labels, const double* upperBounds, unsigned boundCount)
+{
+	std::lock_guard<std::mutex> guard(s_metricsMutex);
+	MetricSeries* series = findSeries(name, help, kMetricTypeHistogram, labels);
+	if (!series->histogram)
+		series->histogram.reset(new MetricHistogram(upperBounds, boundCount));
+	return series->histogram.get();
+}
+
+void MetricsRegistry::addCollector(const void* owner, const std::function<void()>& collect)
+{
+	std::lock_guard<std::mutex> guard(s_metricsMutex);
+	s_collectors.push_back({ owner, collect });
+}
+
+void MetricsRegistry::removeCollectors(const void* owner)
+{
+	std::lock_guard<std::mutex> guard(s_metricsMutex);
+	for (size_t collectorIdx = s_collectors.size(); collectorIdx-- > 0;)
+	{
+		if (s_collectors[collectorIdx].owner == owner)
+			s_collectors.erase(s_collectors.begin() + collectorIdx);
+	}
+}
+
+static void appendValue(std::string& text, double value)
+{
+	char number[32];
+	if (std::isnan(value))
+		text += "NaN";
+	else if (std::isinf(value))
+		text += (value > 0) ? "+Inf" : "-Inf";
+	else
+	{
+		snprintf(number, sizeof(number), "%.10g", value);
+		text += number;
+	}
+}
+
+static void appendSample(std::string& text, const std::string& name, const char* suffix, const std::string& labels, const char* extraLabel, double value)
+{
+	text += name;
+	text += suffix;
+	if (!labels.empty() || extraLabel != nullptr)
+	{
+		text += '{';
+		text += labels;
+		if (extraLabel != nullptr)
+		{
+			if (!labels.empty())
+				text += ',';
+			text += extraLabel;
+		}
+		text += '}';
+	}
+	text += ' ';
+	appendValue(text, value);
+	text += '\n';
+}
+
+std::string MetricsRegistry::exposition()
+{
+	static const char* const kTypeNames[] = { "counter", "gauge", "histogram" };
+	std::string text;
+	char bucketLabel[48];
+
+	std::lock_guard<std::mutex> guard(s_metricsMutex);
+	for (MetricCollector& collector : s_collectors)
+		collector.collect();
+
+	for (std::unique_ptr<MetricFamily>& family : s_families)
+	{
+		text += "# HELP " + family->name + " " + family->help + "\n";
+		text += "# TYPE " + family->name + " " + kTypeNames[family->type] + "\n";
+
+		for (std::unique_ptr<MetricSeries>& series : family->series)
+		{
+			switch (family->type)
+			{
+			case kMetricTypeCounter:
+				appendSample(text, family->name, "", series->labels, nullptr, (double)series->counter->value());
+				break;
+
+			case kMetricTypeGauge:
+				appendSample(text, family->name, "", series->labels, nullptr, series->gauge->value());
+				break;
+
+			case kMetricTypeHistogram:
+			{
+				// buckets are exported cumulative, ending with the count of everything
+				const MetricHistogram& histogram = *series->histogram;
+				uint64_t cumulative = 0;
+				for (unsigned bucketIdx = 0; bucketIdx < histogram.bucketCount(); bucketIdx++)
+				{
+					cumulative += histogram.bucket(bucketIdx);
+					if (bucketIdx + 1 < histogram.bucketCount())
+						snprintf(bucketLabel, sizeof(bucketLabel), "le=\"%.10g\"", histogram.upperBound(bucketIdx));
+					else
+						snprintf(bucketLabel, sizeof(bucketLabel), "le=\"+Inf\"");
+					appendSample(text, family->name, "_bucket", series->labels, bucketLabel, (double)cumulative);
+				}
+				appendSample(text, family->name, "_sum", series->labels, nullptr, histogram.sum());
+				appendSample(text, family->name, "_count", series->labels, nullptr, (double)cumulative);
+				break;
+			}
+			}
+		}
+	}
+	return text;
+}
+
+// written beside the file and renamed over it, so a reader never sees half of one
+static void writeExportFile()
+{
+	const std::string text = MetricsRegistry::exposition();
+	const std::string partialPath = s_exportPath + ".partial";
+
+	FILE* file = fopen(partialPath.c_str(), "wb");
+	if (file == nullptr)
+	{
+		fprintf(stderr, "Could not write metrics to %s\n", partialPath.c_str());
+		return;
+	}
+	const bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+	if (fclose(file) != 0 || !written)
+	{
+		fprintf(stderr, "Could not write metrics to %s\n", partialPath.c_str());
+		return;
+	}
+
+#ifdef _WIN32
+	if (!MoveFileExA(partialPath.c_str(), s_exportPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+#else
+	if (rename(partialPath.c_str(), s_exportPath.c_str()) != 0)
+#endif
+		fprintf(stderr, "Could not replace %s\n", s_exportPath.c_str());
+}
+
+static void setClientTimeout(MetricsSocket client)
+{
+#ifdef _WIN32
+	const DWORD timeout = kClientTimeoutMs;
+#else
+	struct timeval timeout;
+	timeout.tv_sec = kClientTimeoutMs / 1000;
+	timeout.tv_usec = (kClientTimeoutMs % 1000) * 1000;
+#endif
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof(timeout));
+}
+
+static void sendAll(MetricsSocket client, const std::string& data)
+{
+	size_t sent = 0;
+	while (sent < data.size())
+	{
+		const int count = (int)send(client, data.data() + sent, (int)(data.size() - sent), 0);
+		if (count <= 0)
+			return;
+		sent += (size_t)count;
+	}
+}
+
+// one request per connection: GET /metrics, or GET / for the same, and anything else is not found
+static void serveClient(MetricsSocket client)
+{
+	std::string request;
+	char buffer[1024];
+
+	setClientTimeout(client);
+	while (request.find("\r\n\r\n") == std::string::npos && request.size() < kMaxRequestBytes)
+	{
+		const int count = (int)recv(client, buffer, sizeof(buffer), 0);
+		if (count <= 0)
+			return;
+		request.append(buffer, (size_t)count);
+	}
+
+	std::string body;
+	std::string status;
+	if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+	{
+		status = "200 OK";
+		body = MetricsRegistry::exposition();
+	}
+	else
+	{
+		status = "404 Not Found";
+		body = "Metrics are at /metrics\n";
+	}
+
+	sendAll(client, "HTTP/1.1 " + status + "\r\nContent-Type: " + kContentType + "\r\nContent-Length: " + std::to_string(body.size()) +
+		"\r\nConnection: close\r\n\r\n" + body);
+}
+
+static MetricsSocket openListener(unsigned short port)
+{
+	MetricsSocket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == kNoSocket)
+		return kNoSocket;
+
+	const int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	// loopback only: the metrics are for whoever is on this machine
+	struct sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		closeSocket(listener);
+		return kNoSocket;
+	}
+	return listener;
+}
+
+static void exportThread()
+{
+	std::chrono::steady_clock::time_point nextWrite = std::chrono::steady_clock::now();
+
+	while (s_exporting)
+	{
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now >= nextWrite)
+		{
+			writeExportFile();
+			nextWrite += s_exportInterval;
+			if (nextWrite < now)
+				nextWrite = now + s_exportInterval;
+		}
+
+		std::this_thread::sleep_until(std::min(nextWrite, std::chrono::steady_clock::now() + std::chrono::milliseconds(kStopPollMs)));
+	}
+
+	writeExportFile();
+}
+
+// one client at a time, so a slow one only delays the scrapes behind it
+static void serverThread()
+{
+	while (s_exporting)
+	{
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(s_listener, &readable);
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = kStopPollMs * 1000;
+		if (select((int)s_listener + 1, &readable, nullptr, nullptr, &timeout) <= 0)
+			continue;
+
+		MetricsSocket client = accept(s_listener, nullptr, nullptr);
+		if (client == kNoSocket)
+			continue;
+		serveClient(client);
+		closeSocket(client);
+	}
+}
+
+bool MetricsRegistry::startExport(const char* path, unsigned short port, unsigned intervalMs)
+{
+	std::lock_guard<std::mutex> control(s_exportMutex);
+	if (s_exporting)
+		return true;
+
+	s_exportPath = path ? path : "";
+	s_exportInterval = std::chrono::milliseconds(intervalMs ? intervalMs : 1000);
+
+	if (port != 0)
+	{
+#ifdef _WIN32
+		WSADATA wsaData;
+		if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		{
+			fprintf(stderr, "Could not initialize Winsock\n");
+			return false;
+		}
+#endif
+		s_listener = openListener(port);
+		if (s_listener == kNoSocket)
+		{
+			fprintf(stderr, "Could not listen for metrics requests on 127.0.0.1:%u\n", (unsigned)port);
+#ifdef _WIN32
+			WSACleanup();
+#endif
+		}
+		else
+			printf("Metrics at http://127.0.0.1:%u/metrics\n", (unsigned)port);
+	}
+	if (!s_exportPath.empty())
+		printf("Metrics written to %s every %u ms\n", s_exportPath.c_str(), (unsigned)s_exportInterval.count());
+
+	s_exporting = true;
+	if (!s_exportPath.empty())
+		s_exporter = std::thread(exportThread);
+	if (s_listener != kNoSocket)
+		s_server = std::thread(serverThread);
+	return true;
+}
+
+void MetricsRegistry::stopExport()
+{
+	std::lock_guard<std::mutex> control(s_exportMutex);
+	if (!s_exporting)
+		return;
+
+	s_exporting = false;
+	if (s_exporter.joinable())
+		s_exporter.join();
+	if (s_server.joinable())
+		s_server.join();
+
+	if (s_listener != kNoSocket)
+	{
+		closeSocket(s_listener);
+		s_listener = kNoSocket;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+}
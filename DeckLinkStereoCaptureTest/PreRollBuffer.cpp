@@ -0,0 +1,202 @@
+// pre-roll: the last few seconds of captured frames held in RAM, written to the recorder on a trigger
+#include "PreRollBuffer.h"
+
+#include <signal.h>
+#include <stdio.h>
+
+// how often the flusher thread prints its statistics
+static const std::chrono::seconds kStatsInterval(10);
+
+#ifdef SIGUSR1
+static const int kTriggerSignal = SIGUSR1;
+#else
+static const int kTriggerSignal = SIGBREAK;
+#endif
+
+// bumped by the signal handler; every flusher thread compares it with the count it last saw
+static volatile sig_atomic_t s_signalTriggers = 0;
+
+static void onTriggerSignal(int signalNumber)
+{
+	s_signalTriggers = s_signalTriggers + 1;
+
+	// the Windows runtime puts the default handler back before calling us
+	signal(signalNumber, onTriggerSignal);
+}
+
+void PreRollBuffer::enableSignalTrigger()
+{
+	signal(kTriggerSignal, onTriggerSignal);
+}
+
+PreRollBuffer::PreRollBuffer(unsigned capacityFrames, unsigned postRollFrames, RawRecorder* recorder) :
+	m_recorder(recorder),
+	m_ring(capacityFrames > 0 ? capacityFrames : 1),
+	m_head(0),
+	m_count(0),
+	m_postRollFrames(postRollFrames),
+	m_running(false),
+	m_triggered(false),
+	m_recordThrough(0),
+	m_newestFrame(0),
+	m_framesRecorded(0),
+	m_framesOverwritten(0),
+	m_triggers(0)
+{
+}
+
+PreRollBuffer::~PreRollBuffer()
+{
+	stop();
+}
+
+bool PreRollBuffer::start()
+{
+	if (m_running || m_recorder == nullptr)
+		return false;
+
+	printf("Pre-roll: holding %zu frames, recording %u more after each trigger\n", m_ring.size(), m_postRollFrames);
+
+	m_running = true;
+	m_flusher = std::thread(&PreRollBuffer::flusherThread, this);
+	return true;
+}
+
+void PreRollBuffer::submit(const CaptureFrame& frame)
+{
+	CaptureFrame overwritten = {};
+
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (m_count == m_ring.size())
+		{
+			overwritten = m_ring[m_head];
+			m_head = (m_head + 1) % m_ring.size();
+			--m_count;
+		}
+
+		m_ring[(m_head + m_count) % m_ring.size()] = frame;
+		++m_count;
+		m_newestFrame = frame.frameNumber;
+		if (m_triggered)
+			m_frameReady.notify_one();
+	}
+
+	// released outside the lock; the pool has its own
+	if (overwritten.eye[kEyeLeft] != nullptr)
+	{
+		++m_framesOverwritten;
+		overwritten.release();
+	}
+}
+
+void PreRollBuffer::trigger()
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	const uint64_t recordThrough = m_newestFrame + m_postRollFrames;
+
+	if (!m_triggered || recordThrough > m_recordThrough)
+		m_recordThrough = recordThrough;
+	m_triggered = true;
+	++m_triggers;
+	m_frameReady.notify_one();
+}
+
+void PreRollBuffer::stop()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_frameReady.notify_one();
+	}
+	if (m_flusher.joinable())
+		m_flusher.join();
+
+	// whatever is left was never triggered
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		for (; m_count > 0; --m_count, m_head = (m_head + 1) % m_ring.size())
+			m_ring[m_head].release();
+	}
+
+	printStats();
+}
+
+PreRollStats PreRollBuffer::stats()
+{
+	PreRollStats stats = {};
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	stats.framesHeld = (unsigned)m_count;
+	stats.capacity = (unsigned)m_ring.size();
+	stats.framesRecorded = m_framesRecorded;
+	stats.framesOverwritten = m_framesOverwritten;
+	stats.triggers = m_triggers;
+	stats.recording = m_triggered;
+	return stats;
+}
+
+bool PreRollBuffer::frontIsTriggered() const
+{
+	return m_triggered && m_count > 0 && m_ring[m_head].frameNumber <= m_recordThrough;
+}
+
+void PreRollBuffer::flusherThread()
+{
+	std::chrono::steady_clock::time_point lastStats = std::chrono::steady_clock::now();
+	sig_atomic_t signalTriggers = s_signalTriggers;
+
+	while (true)
+	{
+		if (s_signalTriggers != signalTriggers)
+		{
+			signalTriggers = s_signalTriggers;
+			trigger();
+		}
+
+		CaptureFrame frame = {};
+		{
+			std::unique_lock<std::mutex> guard(m_mutex);
+			m_frameReady.wait_for(guard, std::chrono::milliseconds(100), [this]() { return !m_running || frontIsTriggered(); });
+
+			if (frontIsTriggered())
+			{
+				frame = m_ring[m_head];
+				m_head = (m_head + 1) % m_ring.size();
+				--m_count;
+			}
+			else if (m_triggered && m_newestFrame > m_recordThrough)
+			{
+				// the post-roll has gone by and every frame it covers has been handed over
+				m_triggered = false;
+				printf("Pre-roll: recording ended after frame %llu\n", (unsigned long long)m_recordThrough);
+			}
+			else if (!m_running)
+			{
+				break;
+			}
+		}
+
+		// the recorder may make us wait here; the callback carries on filling the ring meanwhile
+		if (frame.eye[kEyeLeft] != nullptr && m_recorder->submitBlocking(frame))
+			++m_framesRecorded;
+
+		if (std::chrono::steady_clock::now() - lastStats >= kStatsInterval)
+		{
+			printStats();
+			lastStats = std::chrono::steady_clock::now();
+		}
+	}
+}
+
+void PreRollBuffer::printStats()
+{
+	PreRollStats current = stats();
+	printf("Pre-roll: %u / %u frames held, %llu recorded, %llu overwritten, %llu triggers%s\n",
+		current.framesHeld, current.capacity, (unsigned long long)current.framesRecorded,
+		(unsigned long long)current.framesOverwritten, (unsigned long long)current.triggers,
+		current.recording ? ", recording" : "");
+}
@@ -0,0 +1,72 @@
+// pre-roll: the last few seconds of captured frames held in RAM, written to the recorder on a trigger
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CaptureFrame.h"
+#include "RawRecorder.h"
+
+struct PreRollStats
+{
+	unsigned	framesHeld;			// frames in the ring, waiting to be recorded or overwritten
+	unsigned	capacity;
+	uint64_t	framesRecorded;		// handed to the recorder
+	uint64_t	framesOverwritten;	// pushed out of the ring without being recorded
+	uint64_t	triggers;
+	bool		recording;			// a trigger is still being served
+};
+
+// Holds the newest capacityFrames frames as retained pool buffers, so memory use is fixed by the
+// size of the frame pool; nothing is copied. Nothing reaches the recorder until trigger() is
+// called: the frames already held (the pre-roll) and postRollFrames more are then handed over
+// in capture order by the buffer's own thread, which may wait on the recorder without holding
+// up the capture callback. Triggering again while a recording is in progress extends it
+class PreRollBuffer
+{
+public:
+	PreRollBuffer(unsigned capacityFrames, unsigned postRollFrames, RawRecorder* recorder);
+	~PreRollBuffer();
+
+	bool		start();
+
+	// hands a frame to the ring without blocking. The ring takes over the caller's buffer
+	// references; once full, the oldest frame is released to make room
+	void		submit(const CaptureFrame& frame);
+
+	// records the pre-roll and the next postRollFrames frames. Safe from any thread
+	void		trigger();
+
+	// finishes handing over a recording that was triggered, then releases whatever is left
+	void		stop();
+
+	bool		isRunning() const { return m_running; }
+	PreRollStats	stats();
+
+	// makes SIGUSR1 (Ctrl+Break on Windows) trigger every running pre-roll buffer
+	static void	enableSignalTrigger();
+
+private:
+	void		flusherThread();
+	bool		frontIsTriggered() const;
+	void		printStats();
+
+	RawRecorder*				m_recorder;
+	std::vector<CaptureFrame>	m_ring;
+	size_t						m_head;
+	size_t						m_count;
+	unsigned					m_postRollFrames;
+	std::mutex					m_mutex;
+	std::condition_variable		m_frameReady;
+	std::thread					m_flusher;
+	std::atomic<bool>			m_running;
+	bool						m_triggered;		// guarded by m_mutex, as are the frame numbers below
+	uint64_t					m_recordThrough;	// last frame number the current trigger covers
+	uint64_t					m_newestFrame;
+	std::atomic<uint64_t>		m_framesRecorded;
+	std::atomic<uint64_t>		m_framesOverwritten;
+	std::atomic<uint64_t>		m_triggers;
+};
@@ -0,0 +1,574 @@
+// streaming recorder: appends untouched frame payloads to one preallocated file
+#include "RawRecorder.h"
+#include "BinaryLog.h"
+#include "LatencyTracker.h"
+#include "TraceRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+// how often the writer thread prints its statistics while recording
+static const std::chrono::seconds kStatsInterval(10);
+
+static uint8_t* allocatePages(size_t pageCount)
+{
+#ifdef _WIN32
+	return (uint8_t*)_aligned_malloc(pageCount * kRecordHeaderBytes, kFramePoolAlignment);
+#else
+	void* pages = nullptr;
+	if (posix_memalign(&pages, kFramePoolAlignment, pageCount * kRecordHeaderBytes) != 0)
+		return nullptr;
+	return (uint8_t*)pages;
+#endif
+}
+
+static void freePages(uint8_t* pages)
+{
+#ifdef _WIN32
+	_aligned_free(pages);
+#else
+	free(pages);
+#endif
+}
+
+RawRecorder::RawRecorder(unsigned queueDepth, WriteBackendType backendType, unsigned recordsInFlight, bool directIO) :
+	m_queue(queueDepth),
+	m_running(false),
+	m_backendType(backendType),
+	m_directIO(directIO),
+	m_pool(nullptr),
+	m_records(recordsInFlight > 0 ? recordsInFlight : 1),
+	m_headerPages(nullptr),
+	m_fileHeaderPage(nullptr),
+	m_compressionCodec(kCompressionNone),
+	m_compressionLevel(0),
+	m_compressionThreads(1),
+	m_stripesPerEye(1),
+	m_compressionActive(true),
+	m_repeatThreshold(-1.0),
+	m_maxRepeats(0),
+	m_referenceOffset(0),
+	m_storedPages(nullptr),
+	m_storedEyeBytes(0),
+	m_checkpointStart(0),
+	m_lastCheckpoint(0),
+	m_payloadBytes(0),
+	m_recordStride(0),
+	m_writeOffset(0),
+	m_reservedBytes(0),
+	m_reserveChunk(0),
+	m_framesOffered(0),
+	m_framesWritten(0),
+	m_bytesWritten(0),
+	m_writeErrors(0),
+	m_framesRepeated(0),
+	m_latencyCount(0),
+	m_latencyTotalUs(0),
+	m_latencyMaxUs(0),
+	m_latencyLastUs(0)
+{
+}
+
+RawRecorder::~RawRecorder()
+{
+	close();
+}
+
+void RawRecorder::enableCompression(CompressionCodec codec, int level, unsigned threadCount, unsigned stripesPerEye)
+{
+	if (m_running)
+		return;
+
+	m_compressionCodec = codec;
+	m_compressionLevel = level;
+	m_compressionThreads = threadCount > 0 ? threadCount : 1;
+	m_stripesPerEye = stripesPerEye > 0 ? stripesPerEye : 1;
+}
+
+void RawRecorder::setCompressionActive(bool active)
+{
+	m_compressionActive = active;
+}
+
+void RawRecorder::enableRepeats(double threshold, unsigned maxRepeats)
+{
+	if (m_running)
+		return;
+
+	m_repeatThreshold = threshold;
+	m_maxRepeats = maxRepeats;
+}
+
+bool RawRecorder::open(const std::string& path, const CaptureFrame& format, uint64_t preallocateBytes, FramePool* pool)
+{
+	RecordingFileHeader* fileHeader = nullptr;
+	std::vector<WriteBuffer> buffers;
+	bool registered = false;
+
+	if (m_running)
+		return false;
+
+	if (m_compressionCodec != kCompressionNone && !StripeCompressor::isAvailable(m_compressionCodec))
+	{
+		fprintf(stderr, "Recorder was built without %s support, recording uncompressed\n", StripeCompressor::codecName(m_compressionCodec));
+		m_compressionCodec = kCompressionNone;
+	}
+
+	m_pool = pool;
+	m_payloadBytes = (uint64_t)format.rowBytes * format.height;
+	m_storedEyeBytes = alignToPage(m_payloadBytes);
+	if (m_compressionCodec != kCompressionNone)
+		m_storedEyeBytes = alignToPage(StripeCompressor::maxStoredBytes((size_t)m_payloadBytes, m_stripesPerEye));
+	m_recordStride = kRecordHeaderBytes + format.eyeCount() * m_storedEyeBytes;
+
+	m_headerPages = allocatePages(m_records.size() + 1);
+	if (m_headerPages == nullptr)
+		return false;
+	m_fileHeaderPage = m_headerPages + m_records.size() * kRecordHeaderBytes;
+
+	// compressed payloads are written from our own buffers, so the pool buffers can go back early
+	if (m_compressionCodec != kCompressionNone)
+	{
+		m_storedPages = allocatePages((size_t)(m_records.size() * kEyeCount * m_storedEyeBytes / kRecordHeaderBytes));
+		if (m_storedPages == nullptr)
+			goto bail;
+		m_compressor.reset(new StripeCompressor(m_compressionCodec, m_compressionLevel, m_compressionThreads));
+	}
+
+	m_sceneDetector.reset();
+	if (m_repeatThreshold >= 0 && m_maxRepeats > 0)
+	{
+		if (format.pixelFormat == kArchivePixelFormatV210)
+			m_sceneDetector.reset(new StaticSceneDetector(m_repeatThreshold, m_maxRepeats));
+		else
+			fprintf(stderr, "Recorder can only detect unchanged frames in v210, storing every frame in full\n");
+	}
+	m_referenceOffset = 0;
+
+	m_backend.reset(createWriteBackend(m_backendType, (unsigned)m_records.size()));
+	if (!m_backend->open(path, m_directIO))
+		goto bail;
+
+	// pool buffers keep their pool index; our header pages follow them
+	for (unsigned bufferIdx = 0; bufferIdx < pool->capacity(); bufferIdx++)
+		buffers.push_back({ pool->buffer(bufferIdx)->GetBytes(), pool->buffer(bufferIdx)->GetCapacity() });
+	for (size_t recordIdx = 0; recordIdx < m_records.size(); recordIdx++)
+		buffers.push_back({ m_headerPages + recordIdx * kRecordHeaderBytes, kRecordHeaderBytes });
+	for (size_t storedIdx = 0; m_storedPages && storedIdx < m_records.size() * kEyeCount; storedIdx++)
+		buffers.push_back({ m_storedPages + storedIdx * m_storedEyeBytes, (size_t)m_storedEyeBytes });
+	registered = m_backend->registerBuffers(buffers);
+
+	m_freeRecords.clear();
+	for (size_t recordIdx = 0; recordIdx < m_records.size(); recordIdx++)
+	{
+		PendingRecord& record = m_records[recordIdx];
+		record.headerPage = m_headerPages + recordIdx * kRecordHeaderBytes;
+		record.headerBufferIndex = registered ? (int)(pool->capacity() + recordIdx) : -1;
+		for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		{
+			const size_t storedIdx = recordIdx * kEyeCount + eyeIdx;
+			record.stored[eyeIdx] = m_storedPages ? m_storedPages + storedIdx * m_storedEyeBytes : nullptr;
+			record.storedBufferIndex[eyeIdx] = (registered && m_storedPages) ? (int)(pool->capacity() + m_records.size() + storedIdx) : -1;
+		}
+		m_freeRecords.push_back(&record);
+	}
+
+	m_writeOffset = 0;
+	m_reservedBytes = 0;
+	m_reserveChunk = alignToPage(preallocateBytes > m_recordStride ? preallocateBytes : m_recordStride);
+	m_framesOffered = 0;
+	m_framesWritten = 0;
+	m_bytesWritten = 0;
+	m_writeErrors = 0;
+	m_framesRepeated = 0;
+	m_latencyCount = 0;
+	m_latencyTotalUs = 0;
+	m_latencyMaxUs = 0;
+	m_latencyLastUs = 0;
+	m_index.clear();
+	m_index.reserve((size_t)(m_reserveChunk / m_recordStride) + 1);
+	m_checkpointStart = 0;
+	m_lastCheckpoint = 0;
+
+	// reserve the whole expected recording now, so the writer never waits on block allocation
+	if (!m_backend->reserve(m_reserveChunk))
+		goto bail;
+	m_reservedBytes = m_reserveChunk;
+
+	memset(m_fileHeaderPage, 0, kRecordHeaderBytes);
+	fileHeader = (RecordingFileHeader*)m_fileHeaderPage;
+	memcpy(fileHeader->magic, kRecordingMagic, sizeof(fileHeader->magic));
+	fileHeader->version = kRecordingVersion;
+	fileHeader->headerBytes = (uint32_t)kRecordHeaderBytes;
+	fileHeader->pixelFormat = format.pixelFormat;
+	fileHeader->width = format.width;
+	fileHeader->height = format.height;
+	fileHeader->rowBytes = format.rowBytes;
+	fileHeader->eyeCount = format.eyeCount();
+	fileHeader->compression = m_compressionCodec;
+	fileHeader->timeScale = format.timeScale;
+	fileHeader->payloadBytes = m_payloadBytes;
+	fileHeader->recordStride = m_recordStride;
+
+	if (!m_backend->writeSync(m_fileHeaderPage, kRecordHeaderBytes, 0))
+		goto bail;
+	m_writeOffset = kRecordHeaderBytes;
+
+	printf("Recorder: %s backend, %s I/O, %zu records in flight%s\n", m_backend->name(), m_backend->isDirectIO() ? "direct" : "buffered",
+		m_records.size(), registered ? ", registered buffers" : "");
+	if (m_sceneDetector)
+		printf("Recorder: unchanged frames stored as repeats below %.1f luma levels, at most %u in a row\n", m_repeatThreshold, m_maxRepeats);
+	if (m_compressor)
+		printf("Recorder: %s compression level %d, %u threads, %u stripes per eye%s\n", StripeCompressor::codecName(m_compressionCodec),
+			m_compressionLevel, m_compressor->threadCount(), m_stripesPerEye, m_compressionActive ? "" : ", on standby");
+
+	m_running = true;
+	m_writer = std::thread(&RawRecorder::writerThread, this);
+	return true;
+
+bail:
+	fprintf(stderr, "Could not prepare recording file %s\n", path.c_str());
+	if (m_backend)
+		m_backend->close(0);
+	freeBuffers();
+	return false;
+}
+
+bool RawRecorder::submit(const CaptureFrame& frame)
+{
+	++m_framesOffered;
+	if (m_running && m_queue.tryPush(frame))
+		return true;
+
+	CaptureFrame dropped = frame;
+	dropped.release();
+	return false;
+}
+
+bool RawRecorder::submitBlocking(const CaptureFrame& frame)
+{
+	++m_framesOffered;
+	if (m_running && m_queue.push(frame))
+		return true;
+
+	CaptureFrame dropped = frame;
+	dropped.release();
+	return false;
+}
+
+void RawRecorder::close()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	m_queue.close();
+	if (m_writer.joinable())
+		m_writer.join();
+
+	// the final index makes the archive seekable without scanning; it goes after the last record
+	RecordingFileHeader* fileHeader = (RecordingFileHeader*)m_fileHeaderPage;
+	fileHeader->indexOffset = writeIndexBlock(0, true);
+	fileHeader->frameCount = m_index.size();
+	writeFileHeader();
+
+	m_backend->close(m_writeOffset);
+	printStats();
+	freeBuffers();
+}
+
+RecorderStats RawRecorder::stats()
+{
+	RecorderStats stats = {};
+	const uint64_t latencyCount = m_latencyCount;
+
+	stats.framesWritten = m_framesWritten;
+	stats.bytesWritten = m_bytesWritten;
+	stats.framesOffered = m_framesOffered;
+	stats.framesDropped = m_queue.dropCount();
+	stats.writeErrors = m_writeErrors;
+	stats.framesRepeated = m_framesRepeated;
+	stats.queueDepth = m_queue.depth();
+	stats.queueCapacity = m_queue.capacity();
+	stats.writesInFlight = m_backend ? m_backend->inFlight() : 0;
+	stats.lastLatencyMs = m_latencyLastUs / 1000.0;
+	stats.meanLatencyMs = latencyCount ? (m_latencyTotalUs / 1000.0) / latencyCount : 0.0;
+	stats.maxLatencyMs = m_latencyMaxUs / 1000.0;
+	stats.compressing = isCompressing();
+	if (m_compressor)
+		stats.compression = m_compressor->stats();
+	return stats;
+}
+
+void RawRecorder::writerThread()
+{
+	TraceRecorder::nameThread("recorder");
+
+	std::vector<WriteRequest> requests;
+	std::vector<WriteCompletion> completions(m_records.size() * (kEyeCount + 1));
+	std::chrono::steady_clock::time_point lastStats = std::chrono::steady_clock::now();
+	CaptureFrame frame;
+
+	requests.reserve(completions.size());
+
+	// keep going after close() until the queue has been drained and every write has landed
+	while (m_running || m_queue.depth() > 0 || m_backend->inFlight() > 0)
+	{
+		// batch every queued frame we have a free record for into one submission.
+		// Only the first pop waits, and only briefly while writes are outstanding
+		requests.clear();
+		while (!m_freeRecords.empty())
+		{
+			const unsigned waitMs = !requests.empty() ? 0 : (m_backend->inFlight() > 0 ? 1 : 100);
+			if (!m_queue.pop(frame, std::chrono::milliseconds(waitMs)))
+				break;
+
+			prepareRecord(frame, requests);
+		}
+
+		// checkpoint the index so that a crash never leaves more than a few seconds to re-index
+		if (m_index.size() - m_checkpointStart >= kIndexCheckpointFrames)
+		{
+			TraceSpan checkpointSpan("index checkpoint");
+			RecordingFileHeader* fileHeader = (RecordingFileHeader*)m_fileHeaderPage;
+			const uint64_t checkpoint = writeIndexBlock(m_checkpointStart, false);
+			if (checkpoint != 0)
+			{
+				m_lastCheckpoint = checkpoint;
+				m_checkpointStart = m_index.size();
+				fileHeader->lastCheckpoint = checkpoint;
+				fileHeader->frameCount = m_index.size();
+				writeFileHeader();
+			}
+		}
+
+		bool submitted = true;
+		if (!requests.empty())
+		{
+			TraceSpan submitSpan("submit writes");
+			submitted = m_backend->submit(requests.data(), (unsigned)requests.size());
+		}
+		if (!submitted)
+		{
+			// nothing of this batch is in flight; give the records back
+			for (size_t requestIdx = 0; requestIdx < requests.size(); requestIdx++)
+			{
+				PendingRecord* record = (PendingRecord*)requests[requestIdx].tag;
+				record->failed = true;
+				if (--record->remainingWrites == 0)
+					completeRecord(record);
+			}
+		}
+
+		// retire finished writes; block only when every record is busy
+		unsigned completed;
+		{
+			TraceSpan reapSpan("reap writes");
+			completed = m_backend->reap(completions.data(), (unsigned)completions.size(), m_freeRecords.empty());
+		}
+		for (unsigned completionIdx = 0; completionIdx < completed; completionIdx++)
+		{
+			PendingRecord* record = (PendingRecord*)completions[completionIdx].tag;
+			if (!completions[completionIdx].ok)
+				record->failed = true;
+			if (--record->remainingWrites == 0)
+				completeRecord(record);
+		}
+
+		if (std::chrono::steady_clock::now() - lastStats >= kStatsInterval)
+		{
+			printStats();
+			lastStats = std::chrono::steady_clock::now();
+		}
+	}
+}
+
+void RawRecorder::prepareRecord(const CaptureFrame& frame, std::vector<WriteRequest>& requests)
+{
+	TraceSpan prepareSpan("prepare record", frame.frameNumber);
+
+	if (m_writeOffset + m_recordStride > m_reservedBytes)
+	{
+		if (m_backend->reserve(m_reservedBytes + m_reserveChunk))
+			m_reservedBytes += m_reserveChunk;
+	}
+
+	// the signature is taken before anything else, so a repeat costs no more than its header page
+	double difference = 0.0;
+	const bool repeat = m_sceneDetector && m_sceneDetector->isRepeat(frame, difference);
+	const unsigned eyeCount = repeat ? 0 : frame.eyeCount();
+	const bool compress = !repeat && isCompressing();
+	PendingRecord* record = m_freeRecords.back();
+	m_freeRecords.pop_back();
+	record->frame = frame;
+	record->recordBytes = kRecordHeaderBytes;
+	record->indexEntry = m_index.size();
+	record->remainingWrites = 1 + eyeCount;
+	record->failed = false;
+	record->submitted = std::chrono::steady_clock::now();
+
+	memset(record->headerPage, 0, sizeof(FrameRecordHeader));
+	FrameRecordHeader* header = (FrameRecordHeader*)record->headerPage;
+	header->magic = kFrameRecordMagic;
+	header->eyeCount = eyeCount;
+	header->frameNumber = frame.frameNumber;
+	header->streamTime = frame.streamTime;
+	header->streamDuration = frame.streamDuration;
+	header->hardwareTime = frame.hardwareTime;
+	header->flags = frame.flags;
+	header->payloadBytes = m_payloadBytes;
+	if (repeat)
+	{
+		header->eyeCount = frame.eyeCount();
+		header->recordFlags = kFrameRecordRepeat;
+		header->referenceOffset = m_referenceOffset;
+		header->referenceFrame = m_sceneDetector->referenceFrame();
+		++m_framesRepeated;
+		logInfo("Frame %llu unchanged from frame %llu (%.2f luma levels), stored as a repeat\n", frame.frameNumber, header->referenceFrame, difference);
+	}
+	else if (m_compressor && !compress)
+	{
+		header->recordFlags = kFrameRecordStoredRaw;
+	}
+	if (!repeat)
+		m_referenceOffset = m_writeOffset;
+
+	for (unsigned eyeIdx = 0; eyeIdx < eyeCount; eyeIdx++)
+	{
+		uint64_t storedBytes = m_payloadBytes;
+		if (compress)
+		{
+			TraceSpan compressSpan("compress", frame.frameNumber);
+			storedBytes = m_compressor->compress(frame.eye[eyeIdx]->GetBytes(), (size_t)m_payloadBytes, (size_t)frame.rowBytes, m_stripesPerEye, record->stored[eyeIdx], (size_t)m_storedEyeBytes);
+			memset(record->stored[eyeIdx] + storedBytes, 0, (size_t)(alignToPage(storedBytes) - storedBytes));
+		}
+		header->storedBytes[eyeIdx] = storedBytes;
+		record->recordBytes += alignToPage(storedBytes);
+	}
+	header->recordBytes = record->recordBytes;
+
+	// the compressed copies are all the write needs, and a repeat needs nothing, so the pool gets its buffers back now
+	if (compress || repeat)
+		record->frame.release();
+
+	ArchiveIndexEntry entry = {};
+	entry.frameNumber = frame.frameNumber;
+	entry.streamTime = frame.streamTime;
+	entry.hardwareTime = frame.hardwareTime;
+	entry.offset = m_writeOffset;
+	entry.recordBytes = (uint32_t)record->recordBytes;
+	entry.flags = repeat ? kIndexEntryRepeat : 0;
+	m_index.push_back(entry);
+
+	requests.push_back({ record->headerPage, kRecordHeaderBytes, m_writeOffset, record->headerBufferIndex, record });
+	m_writeOffset += kRecordHeaderBytes;
+
+	for (unsigned eyeIdx = 0; eyeIdx < eyeCount; eyeIdx++)
+	{
+		const uint64_t paddedBytes = alignToPage(header->storedBytes[eyeIdx]);
+		if (compress)
+		{
+			requests.push_back({ record->stored[eyeIdx], paddedBytes, m_writeOffset, record->storedBufferIndex[eyeIdx], record });
+		}
+		else
+		{
+			// pool buffers are page-rounded, so the padded payload can be written straight from them
+			FrameBuffer* buffer = frame.eye[eyeIdx];
+			requests.push_back({ buffer->GetBytes(), paddedBytes, m_writeOffset, (int)buffer->GetIndex(), record });
+		}
+		m_writeOffset += paddedBytes;
+	}
+}
+
+void RawRecorder::completeRecord(PendingRecord* record)
+{
+	const uint64_t latencyUs = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - record->submitted).count();
+
+	if (record->failed)
+	{
+		m_index[record->indexEntry].flags |= kIndexEntryWriteFailed;
+		++m_writeErrors;
+
+		// repeats of a record that never made it to disk would have nothing to show
+		const FrameRecordHeader* header = (const FrameRecordHeader*)record->headerPage;
+		if (m_sceneDetector && !(header->recordFlags & kFrameRecordRepeat) && header->frameNumber == m_sceneDetector->referenceFrame())
+			m_sceneDetector->reset();
+	}
+	else
+	{
+		++m_framesWritten;
+		m_bytesWritten += record->recordBytes;
+		recordLatency(record->frame, kLatencyRecorded);
+	}
+
+	m_latencyLastUs = latencyUs;
+	m_latencyTotalUs += latencyUs;
+	++m_latencyCount;
+	if (latencyUs > m_latencyMaxUs)
+		m_latencyMaxUs = latencyUs;
+
+	record->frame.release();
+	m_freeRecords.push_back(record);
+}
+
+// writes the entries from firstEntry on as an index block at the current end of the file;
+// returns its offset, or 0 if it could not be written
+uint64_t RawRecorder::writeIndexBlock(size_t firstEntry, bool isFinal)
+{
+	const size_t entryCount = m_index.size() - firstEntry;
+	const uint64_t blockBytes = kRecordHeaderBytes + alignToPage(entryCount * sizeof(ArchiveIndexEntry));
+	const uint64_t offset = m_writeOffset;
+
+	uint8_t* block = allocatePages((size_t)(blockBytes / kRecordHeaderBytes));
+	if (block == nullptr)
+		return 0;
+	memset(block, 0, (size_t)blockBytes);
+
+	IndexRecordHeader* header = (IndexRecordHeader*)block;
+	header->magic = kIndexRecordMagic;
+	header->isFinal = isFinal ? 1 : 0;
+	header->entryCount = entryCount;
+	header->previousCheckpoint = m_lastCheckpoint;
+	header->recordBytes = blockBytes;
+	if (entryCount > 0)
+		memcpy(block + kRecordHeaderBytes, &m_index[firstEntry], entryCount * sizeof(ArchiveIndexEntry));
+
+	// small and infrequent, so it is written synchronously by the writer thread
+	const bool written = m_backend->writeSync(block, blockBytes, offset);
+	freePages(block);
+	if (!written)
+		return 0;
+
+	m_writeOffset += blockBytes;
+	return offset;
+}
+
+void RawRecorder::writeFileHeader()
+{
+	if (!m_backend->writeSync(m_fileHeaderPage, kRecordHeaderBytes, 0))
+		fprintf(stderr, "Could not update the recording file header\n");
+}
+
+void RawRecorder::freeBuffers()
+{
+	m_backend.reset();
+	m_compressor.reset();
+	freePages(m_headerPages);
+	freePages(m_storedPages);
+	m_headerPages = nullptr;
+	m_fileHeaderPage = nullptr;
+	m_storedPages = nullptr;
+}
+
+void RawRecorder::printStats()
+{
+	RecorderStats current = stats();
+	printf("Recorder: %llu frames (%.1f MB), %llu repeats, %llu dropped, %llu write errors, queue %u, in flight %u, latency last %.2f / mean %.2f / max %.2f ms\n",
+		(unsigned long long)current.framesWritten, current.bytesWritten / 1e6, (unsigned long long)current.framesRepeated, (unsigned long long)current.framesDropped, (unsigned long long)current.writeErrors,
+		current.queueDepth, current.writesInFlight, current.lastLatencyMs, current.meanLatencyMs, current.maxLatencyMs);
+	if (current.compressing)
+		printf("Recorder: compression ratio %.2f, %.0f MB/s last / %.0f MB/s mean on %u threads, stripe last %.2f / mean %.2f / max %.2f ms\n",
+			current.compression.ratio, current.compression.lastMBps, current.compression.meanMBps, current.compression.threadCount,
+			current.compression.lastStripeMs, current.compression.meanStripeMs, current.compression.maxStripeMs);
+}
@@ -0,0 +1,148 @@
+// streaming recorder: appends untouched frame payloads to one preallocated file
+// (format described in FrameArchiveFormat.h)
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CaptureFrame.h"
+#include "FrameArchiveFormat.h"
+#include "FrameQueue.h"
+#include "StaticSceneDetector.h"
+#include "StripeCompressor.h"
+#include "WriteBackend.h"
+
+// frames between two index checkpoints; bounds what a crash costs to re-index by scanning
+const unsigned	kIndexCheckpointFrames = 300;
+
+struct RecorderStats
+{
+	uint64_t	framesWritten;
+	uint64_t	bytesWritten;
+	uint64_t	framesOffered;		// submitted, whether queued or dropped
+	uint64_t	framesDropped;		// refused because the queue was full
+	uint64_t	writeErrors;		// records lost to a failed write
+	uint64_t	framesRepeated;		// stored as a repeat record of an unchanged earlier frame
+	unsigned	queueDepth;			// frames waiting for the writer thread
+	unsigned	queueCapacity;
+	unsigned	writesInFlight;		// writes handed to the backend and not yet complete
+	double		lastLatencyMs;		// backend submission to completion of a whole record
+	double		meanLatencyMs;
+	double		maxLatencyMs;
+	bool		compressing;
+	CompressionStats	compression;	// only filled in while compressing, or while it is on standby
+};
+
+class RawRecorder
+{
+public:
+	// recordsInFlight bounds how many frame records the backend may be writing at once
+	RawRecorder(unsigned queueDepth, WriteBackendType backendType, unsigned recordsInFlight, bool directIO);
+	~RawRecorder();
+
+	// compresses payloads before they are written, stripesPerEye stripes at a time on threadCount
+	// threads (the writer thread included). Call before open(); kCompressionNone turns it off again
+	void		enableCompression(CompressionCodec codec, int level, unsigned threadCount, unsigned stripesPerEye);
+
+	// With compression enabled, switches it on and off between frames while recording; records
+	// written while it is off are stored raw. Off before open() keeps the compressor on standby
+	void		setCompressionActive(bool active);
+	bool		isCompressing() const { return m_compressor != nullptr && m_compressionActive; }
+	bool		isCompressionOnStandby() const { return m_compressor != nullptr && !m_compressionActive; }
+
+	// stores a frame whose picture has not changed since the last full record as a repeat record,
+	// its header alone, as decided by a StaticSceneDetector(threshold, maxRepeats). Every repeat is
+	// logged. Call before open(); only v210 recordings have repeats
+	void		enableRepeats(double threshold, unsigned maxRepeats);
+
+	// creates the file, writes the file header and reserves preallocateBytes on disk.
+	// Buffers of pool are registered with the backend, where it supports that
+	bool		open(const std::string& path, const CaptureFrame& format, uint64_t preallocateBytes, FramePool* pool);
+
+	// hands a frame to the writer thread without blocking. The recorder takes over the
+	// caller's buffer references, and releases them itself if the frame has to be dropped
+	bool		submit(const CaptureFrame& frame);
+
+	// the same, but waits for room in the queue; for stages feeding the recorder from their own thread
+	bool		submitBlocking(const CaptureFrame& frame);
+
+	// writes everything still queued and the final index, then trims the preallocated tail and closes the file
+	void		close();
+
+	bool		isOpen() const { return m_running; }
+	uint64_t	framesWritten() const { return m_framesWritten; }
+	uint64_t	bytesWritten() const { return m_bytesWritten; }
+	uint64_t	framesDropped() const { return m_queue.dropCount(); }
+	unsigned	queueDepth() { return m_queue.depth(); }
+	const char*	backendName() const { return m_backend ? m_backend->name() : "none"; }
+	RecorderStats	stats();
+
+private:
+	// a frame record on its way to disk
+	struct PendingRecord
+	{
+		CaptureFrame	frame;
+		uint8_t*		headerPage;
+		int				headerBufferIndex;
+		uint8_t*		stored[kEyeCount];			// compressed payloads, when compressing
+		int				storedBufferIndex[kEyeCount];
+		uint64_t		recordBytes;
+		size_t			indexEntry;
+		unsigned		remainingWrites;
+		bool			failed;
+		std::chrono::steady_clock::time_point	submitted;
+	};
+
+	void		writerThread();
+	void		prepareRecord(const CaptureFrame& frame, std::vector<WriteRequest>& requests);
+	void		completeRecord(PendingRecord* record);
+	uint64_t	writeIndexBlock(size_t firstEntry, bool isFinal);
+	void		writeFileHeader();
+	void		freeBuffers();
+	void		printStats();
+
+	FrameQueue					m_queue;
+	std::thread					m_writer;
+	std::atomic<bool>			m_running;
+	WriteBackendType			m_backendType;
+	bool						m_directIO;
+	std::unique_ptr<WriteBackend>	m_backend;
+	FramePool*					m_pool;
+	std::vector<PendingRecord>	m_records;
+	std::vector<PendingRecord*>	m_freeRecords;
+	uint8_t*					m_headerPages;		// one per record in flight, plus one for the file header
+	uint8_t*					m_fileHeaderPage;
+	CompressionCodec			m_compressionCodec;
+	int							m_compressionLevel;
+	unsigned					m_compressionThreads;
+	unsigned					m_stripesPerEye;
+	std::atomic<bool>			m_compressionActive;
+	std::unique_ptr<StripeCompressor>	m_compressor;
+	double						m_repeatThreshold;	// negative while repeats are off
+	unsigned					m_maxRepeats;
+	std::unique_ptr<StaticSceneDetector>	m_sceneDetector;
+	uint64_t					m_referenceOffset;	// of the newest full record, which repeats refer to
+	uint8_t*					m_storedPages;		// kEyeCount compressed payloads per record in flight
+	uint64_t					m_storedEyeBytes;	// padded room for one stored eye
+	std::vector<ArchiveIndexEntry>	m_index;
+	size_t						m_checkpointStart;	// first entry not yet in a checkpoint
+	uint64_t					m_lastCheckpoint;
+	uint64_t					m_payloadBytes;
+	uint64_t					m_recordStride;
+	uint64_t					m_writeOffset;
+	uint64_t					m_reservedBytes;
+	uint64_t					m_reserveChunk;
+	std::atomic<uint64_t>		m_framesOffered;
+	std::atomic<uint64_t>		m_framesWritten;
+	std::atomic<uint64_t>		m_bytesWritten;
+	std::atomic<uint64_t>		m_writeErrors;
+	std::atomic<uint64_t>		m_framesRepeated;
+	std::atomic<uint64_t>		m_latencyCount;
+	std::atomic<uint64_t>		m_latencyTotalUs;
+	std::atomic<uint64_t>		m_latencyMaxUs;
+	std::atomic<uint64_t>		m_latencyLastUs;
+};
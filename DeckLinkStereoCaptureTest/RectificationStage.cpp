@@ -0,0 +1,57 @@
+// stereo rectification processing stage: keeps the newest rectified pair for whatever wants to look at it
+#include "RectificationStage.h"
+
+#include <utility>
+
+RectificationStage::RectificationStage(const char* calibrationPath, unsigned representation, bool fuseDecode, double budgetMs) :
+	m_calibrationPath(calibrationPath),
+	m_representation(representation),
+	m_fuseDecode(fuseDecode),
+	m_budgetMs(budgetMs),
+	m_latestFrameNumber(0),
+	m_latestStreamTime(0)
+{
+}
+
+bool RectificationStage::start(const CaptureFrame& format)
+{
+	// a calibration only holds for the resolution it was made at, so it is read again for every capture
+	if (!m_rectifier.load(m_calibrationPath.c_str(), format.width, format.height))
+		return false;
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		m_latest[eyeIdx].release();
+	return true;
+}
+
+void RectificationStage::process(const ProcessingInput& input)
+{
+	if (m_fuseDecode)
+		m_rectifier.rectify(*input.frame, input.eyeCount, m_representation, m_working);
+	else if (m_representation == kInputBgr16)
+		m_rectifier.rectify(input.bgr16, input.eyeCount, m_working);
+	else if (m_representation == kInputLuma)
+		m_rectifier.rectify(input.luma, input.eyeCount, m_working);
+	else
+		m_rectifier.rectify(input.bgr8, input.eyeCount, m_working);
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+	for (unsigned eyeIdx = 0; eyeIdx < input.eyeCount; eyeIdx++)
+		std::swap(m_working[eyeIdx], m_latest[eyeIdx]);
+	m_latestFrameNumber = input.frame->frameNumber;
+	m_latestStreamTime = input.frame->streamTime;
+}
+
+bool RectificationStage::latest(cv::Mat pair[kEyeCount], uint64_t& frameNumber, int64_t& streamTime)
+{
+	std::lock_guard<std::mutex> guard(m_mutex);
+	if (m_latest[kEyeLeft].empty())
+		return false;
+
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+		m_latest[eyeIdx].copyTo(pair[eyeIdx]);
+	frameNumber = m_latestFrameNumber;
+	streamTime = m_latestStreamTime;
+	return true;
+}
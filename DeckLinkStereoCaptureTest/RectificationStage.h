@@ -0,0 +1,42 @@
+// stereo rectification processing stage: keeps the newest rectified pair for whatever wants to look at it
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include "ProcessingPipeline.h"
+#include "StereoRectifier.h"
+
+// Rectifies both eyes of every frame it gets to with a StereoRectifier loaded when capture starts.
+// Fused, it decodes the v210 itself a stripe at a time; otherwise it rectifies the pipeline's shared
+// decode, which is cheaper only when another stage takes the same representation anyway
+class RectificationStage : public ProcessingStage
+{
+public:
+	// representation is kInputBgr8, kInputBgr16 or kInputLuma
+	RectificationStage(const char* calibrationPath, unsigned representation, bool fuseDecode, double budgetMs);
+
+	const char*		name() const override { return "rectification"; }
+	unsigned		inputs() const override { return kInputStereoPair | (m_fuseDecode ? 0 : m_representation); }
+	double			budgetMs() const override { return m_budgetMs; }
+
+	bool			start(const CaptureFrame& format) override;
+	void			process(const ProcessingInput& input) override;
+
+	// copies out the newest rectified pair; false before the first
+	bool			latest(cv::Mat pair[kEyeCount], uint64_t& frameNumber, int64_t& streamTime);
+
+	const StereoRectifier&	rectifier() const { return m_rectifier; }
+
+private:
+	std::string		m_calibrationPath;
+	unsigned		m_representation;
+	bool			m_fuseDecode;
+	double			m_budgetMs;
+	StereoRectifier	m_rectifier;
+	cv::Mat			m_working[kEyeCount];	// rectified into by process(), then swapped with the newest
+	std::mutex		m_mutex;
+	cv::Mat			m_latest[kEyeCount];
+	uint64_t		m_latestFrameNumber;
+	int64_t			m_latestStreamTime;
+};
@@ -0,0 +1,91 @@
+// layout of the shared-memory frame ring written by FramePublisher and read by FrameRingClient
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+
+// Shared frame ring layout (one named shared-memory object per device, every block on a 4096 byte page)
+//
+//   [ring header page][slot 0][slot 1]...[slot slotCount-1]
+//
+// Ring header (SharedRingHeader, padded to one page)
+//   Describes the video format and the slots, and counts the frames published so far. Frame
+//   sequence s (counting from 0) goes into slot s % slotCount, so a reader that knows the
+//   count knows where the newest frame is.
+//
+// Slot (slotStride bytes)
+//   A SharedSlotHeader padded to one page, then one payload per eye (left, then right), each
+//   padded to a page. Payloads are the untouched bytes the SDK delivered, as in a frame archive.
+//
+// Sequence lock
+//   There is one writer and any number of readers, and the writer never waits for a reader.
+//   The slot generation is 2s+1 while sequence s is being written into the slot and 2s+2 once
+//   it is complete. A reader takes the generation before touching the slot and checks it again
+//   when done: if it is odd or has changed, the writer came round and the read is torn.
+//   Readers map the ring read-only and never write to it
+
+const size_t	kSharedRingPageBytes = 4096;
+const size_t	kSharedRingHeaderBytes = kSharedRingPageBytes;
+const char		kSharedRingMagic[8] = { 'D', 'L', 'K', 'R', 'I', 'N', 'G', '1' };
+const uint32_t	kSharedRingVersion = 1;
+const unsigned	kSharedRingMaxEyes = 2;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring is shared between processes, so its atomics cannot use locks");
+
+struct SharedRingHeader
+{
+	char		magic[8];			// kSharedRingMagic; written last, once the header is complete
+	uint32_t	version;			// kSharedRingVersion
+	uint32_t	headerBytes;		// kSharedRingHeaderBytes
+	uint32_t	slotCount;
+	uint32_t	eyeCount;			// 1 for mono, 2 for dual-stream 3D
+	uint32_t	pixelFormat;		// BMDPixelFormat of the payloads
+	int32_t		width;
+	int32_t		height;
+	int32_t		rowBytes;
+	int64_t		timeScale;			// units of the stream times in the slot headers
+	uint64_t	payloadBytes;		// bytes of one eye, before padding
+	uint64_t	slotStride;			// bytes from one slot to the next
+	uint32_t	deviceIndex;
+	uint32_t	reserved;
+	std::atomic<uint64_t>	framesPublished;	// sequence of the next frame; the newest complete one is framesPublished - 1
+	std::atomic<uint32_t>	publishing;			// 0 once the publisher has closed the ring
+};
+
+struct SharedSlotHeader
+{
+	std::atomic<uint64_t>	generation;		// 2s+1 while sequence s is written, 2s+2 once complete
+	uint64_t	sequence;
+	uint64_t	frameNumber;
+	int64_t		streamTime;
+	int64_t		streamDuration;
+	int64_t		hardwareTime;		// microseconds
+	int64_t		publishTime;		// steadyClockMicroseconds() when the slot was complete
+	uint32_t	flags;				// BMDFrameFlags
+	uint32_t	reserved;
+};
+
+static_assert(sizeof(SharedRingHeader) <= kSharedRingHeaderBytes, "ring header must fit its page");
+static_assert(sizeof(SharedSlotHeader) <= kSharedRingPageBytes, "slot header must fit its page");
+
+inline uint64_t alignToSharedRingPage(uint64_t bytes)
+{
+	return (bytes + kSharedRingPageBytes - 1) & ~(uint64_t)(kSharedRingPageBytes - 1);
+}
+
+inline uint64_t sharedSlotGeneration(uint64_t sequence, bool complete)
+{
+	return 2 * sequence + (complete ? 2 : 1);
+}
+
+// the name other processes open the ring by; a "Local\" object on Windows and a POSIX shm object elsewhere
+inline std::string sharedRingObjectName(const std::string& name)
+{
+#ifdef _WIN32
+	return "Local\\" + name;
+#else
+	return "/" + name;
+#endif
+}
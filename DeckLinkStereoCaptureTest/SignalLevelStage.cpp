@@ -0,0 +1,68 @@
+// signal level processing stage: warns when an eye's picture goes black, as with a capped lens or a camera that lost power
+#include "SignalLevelStage.h"
+#include "BinaryLog.h"
+
+#include <stdio.h>
+
+static const int kSampleSpacing = 16;		// pixels between samples, across and down
+
+static const char* const kEyeNames[kEyeCount] = { "left", "right" };
+
+SignalLevelStage::SignalLevelStage(unsigned deviceIndex, double blackLevel, double budgetMs) :
+	m_deviceIndex(deviceIndex),
+	m_blackLevel(blackLevel),
+	m_budgetMs(budgetMs),
+	m_eyeCount(1)
+{
+}
+
+bool SignalLevelStage::start(const CaptureFrame& format)
+{
+	m_eyeCount = format.eyeCount();
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		m_black[eyeIdx] = false;
+		m_blackFrames[eyeIdx] = 0;
+	}
+	return true;
+}
+
+void SignalLevelStage::stop()
+{
+	for (unsigned eyeIdx = 0; eyeIdx < m_eyeCount; eyeIdx++)
+	{
+		if (m_blackFrames[eyeIdx] > 0)
+			printf("Device #%u: %llu %s eye frames were black\n", m_deviceIndex, (unsigned long long)m_blackFrames[eyeIdx], kEyeNames[eyeIdx]);
+	}
+}
+
+void SignalLevelStage::process(const ProcessingInput& input)
+{
+	for (unsigned eyeIdx = 0; eyeIdx < input.eyeCount; eyeIdx++)
+	{
+		const cv::Mat& luma = input.luma[eyeIdx];
+		uint64_t sum = 0;
+		uint64_t samples = 0;
+		for (int row = kSampleSpacing / 2; row < luma.rows; row += kSampleSpacing)
+		{
+			const uint8_t* line = luma.ptr<uint8_t>(row);
+			for (int col = kSampleSpacing / 2; col < luma.cols; col += kSampleSpacing, samples++)
+				sum += line[col];
+		}
+		if (samples == 0)
+			continue;
+
+		const double mean = (double)sum / samples;
+		const bool black = mean < m_blackLevel;
+		if (black)
+			++m_blackFrames[eyeIdx];
+		if (black != m_black[eyeIdx])
+		{
+			if (black)
+				logWarning("Device #%u: %s eye went black at frame %llu, mean luma %.1f\n", m_deviceIndex, kEyeNames[eyeIdx], input.frame->frameNumber, mean);
+			else
+				logInfo("Device #%u: %s eye picture back at frame %llu, mean luma %.1f\n", m_deviceIndex, kEyeNames[eyeIdx], input.frame->frameNumber, mean);
+			m_black[eyeIdx] = black;
+		}
+	}
+}
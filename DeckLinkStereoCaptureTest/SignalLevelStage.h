@@ -0,0 +1,29 @@
+// signal level processing stage: warns when an eye's picture goes black, as with a capped lens or a camera that lost power
+#pragma once
+
+#include <stdint.h>
+#include "ProcessingPipeline.h"
+
+// Averages a sparse grid of each eye's luma and logs when the mean falls to black and when it
+// comes back. A camera with no picture still sends a valid signal, so nothing before this notices
+class SignalLevelStage : public ProcessingStage
+{
+public:
+	SignalLevelStage(unsigned deviceIndex, double blackLevel, double budgetMs);
+
+	const char*		name() const override { return "signal level"; }
+	unsigned		inputs() const override { return kInputLuma | ((m_eyeCount > 1) ? kInputStereoPair : 0); }
+	double			budgetMs() const override { return m_budgetMs; }
+
+	bool			start(const CaptureFrame& format) override;
+	void			stop() override;
+	void			process(const ProcessingInput& input) override;
+
+private:
+	unsigned		m_deviceIndex;
+	double			m_blackLevel;		// 8-bit video range, where black is 16
+	double			m_budgetMs;
+	unsigned		m_eyeCount;
+	bool			m_black[kEyeCount];
+	uint64_t		m_blackFrames[kEyeCount];
+};
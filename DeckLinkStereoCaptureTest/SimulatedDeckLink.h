@@ -0,0 +1,119 @@
+// simulated DeckLink card: generates v210 test patterns through the SDK interfaces, for running without hardware
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DeckLinkSdk.h"
+
+struct SimulatedMode;
+
+struct SimulatedDeckLinkStats
+{
+	uint64_t	framesDelivered;
+	uint64_t	framesDropped;		// skipped because the callback fell too far behind, as a card drops them
+	double		deliveredFps;
+	double		meanCallbackMs;		// time spent inside VideoInputFrameArrived
+	double		maxCallbackMs;
+};
+
+// Stands in for an IDeckLink, answering QueryInterface for the IDeckLinkInput, IDeckLinkStatus,
+// IDeckLinkNotification and IDeckLinkConfiguration parts of a card, which is all DeckLinkDevice
+// uses, so setup, prepareForCapture and startCapture run on it unchanged. The card sees a signal
+// in signalMode: enabling another mode gets frames flagged bmdFrameHasNoInputSource, as on
+// hardware. Frames are bmdFormat10BitYUV colour bars with a bar moving across them; with
+// bmdVideoInputDualStream3D the right eye is the same picture shifted, as a near object would be.
+// speed scales the frame rate; 0 delivers each frame as soon as the callback returns the last.
+// The patterns are made once, when input is enabled, so many simulated cards cost little more
+// than the callbacks they drive
+class SimulatedDeckLink : public IDeckLink, public IDeckLinkInput, public IDeckLinkStatus, public IDeckLinkNotification, public IDeckLinkConfiguration
+{
+public:
+	SimulatedDeckLink(BMDDisplayMode signalMode, double speed, unsigned index);
+
+	// the modes a simulated card can generate; false for any other
+	static bool		isModeSupported(BMDDisplayMode displayMode);
+
+	SimulatedDeckLinkStats	stats();
+
+	// IUnknown interface
+	virtual HRESULT	STDMETHODCALLTYPE	QueryInterface(REFIID iid, LPVOID* ppv) override;
+	virtual ULONG	STDMETHODCALLTYPE	AddRef() override;
+	virtual ULONG	STDMETHODCALLTYPE	Release() override;
+
+	// IDeckLink interface
+	virtual HRESULT	STDMETHODCALLTYPE	GetModelName(SdkString* modelName) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetDisplayName(SdkString* displayName) override;
+
+	// IDeckLinkInput interface
+	virtual HRESULT	STDMETHODCALLTYPE	DoesSupportVideoMode(BMDVideoConnection connection, BMDDisplayMode requestedMode, BMDPixelFormat requestedPixelFormat, BMDVideoInputConversionMode conversionMode, BMDSupportedVideoModeFlags flags, BMDDisplayMode* actualMode, SdkBool* supported) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetDisplayMode(BMDDisplayMode displayMode, IDeckLinkDisplayMode** resultDisplayMode) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetDisplayModeIterator(IDeckLinkDisplayModeIterator** iterator) override;
+	virtual HRESULT	STDMETHODCALLTYPE	SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback* previewCallback) override;
+	virtual HRESULT	STDMETHODCALLTYPE	EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags) override;
+	virtual HRESULT	STDMETHODCALLTYPE	DisableVideoInput() override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetAvailableVideoFrameCount(unsigned int* availableFrameCount) override;
+	virtual HRESULT	STDMETHODCALLTYPE	SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator* theAllocator) override;
+	virtual HRESULT	STDMETHODCALLTYPE	EnableAudioInput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, unsigned int channelCount) override;
+	virtual HRESULT	STDMETHODCALLTYPE	DisableAudioInput() override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetAvailableAudioSampleFrameCount(unsigned int* availableSampleFrameCount) override;
+	virtual HRESULT	STDMETHODCALLTYPE	StartStreams() override;
+	virtual HRESULT	STDMETHODCALLTYPE	StopStreams() override;
+	virtual HRESULT	STDMETHODCALLTYPE	PauseStreams() override;
+	virtual HRESULT	STDMETHODCALLTYPE	FlushStreams() override;
+	virtual HRESULT	STDMETHODCALLTYPE	SetCallback(IDeckLinkInputCallback* theCallback) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue* hardwareTime, BMDTimeValue* timeInFrame, BMDTimeValue* ticksPerFrame) override;
+
+	// IDeckLinkStatus interface
+	virtual HRESULT	STDMETHODCALLTYPE	GetFlag(BMDDeckLinkStatusID statusID, SdkBool* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetInt(BMDDeckLinkStatusID statusID, SdkInt64* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetFloat(BMDDeckLinkStatusID statusID, double* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetString(BMDDeckLinkStatusID statusID, SdkString* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetBytes(BMDDeckLinkStatusID statusID, void* buffer, unsigned int* bufferSize) override;
+
+	// IDeckLinkNotification interface
+	virtual HRESULT	STDMETHODCALLTYPE	Subscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback) override;
+	virtual HRESULT	STDMETHODCALLTYPE	Unsubscribe(BMDNotifications topic, IDeckLinkNotificationCallback* theCallback) override;
+
+	// IDeckLinkConfiguration interface; settings are kept but change nothing
+	virtual HRESULT	STDMETHODCALLTYPE	SetFlag(BMDDeckLinkConfigurationID cfgID, SdkBool value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetFlag(BMDDeckLinkConfigurationID cfgID, SdkBool* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	SetInt(BMDDeckLinkConfigurationID cfgID, SdkInt64 value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetInt(BMDDeckLinkConfigurationID cfgID, SdkInt64* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	SetFloat(BMDDeckLinkConfigurationID cfgID, double value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetFloat(BMDDeckLinkConfigurationID cfgID, double* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	SetString(BMDDeckLinkConfigurationID cfgID, SdkString value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	GetString(BMDDeckLinkConfigurationID cfgID, SdkString* value) override;
+	virtual HRESULT	STDMETHODCALLTYPE	WriteConfigurationToPreferences() override;
+
+private:
+	virtual ~SimulatedDeckLink();
+
+	void		generatePatterns(const SimulatedMode& mode, bool stereo, bool signal);
+	void		streamThread();
+	void		notifySubscribers(BMDNotifications topic, uint64_t param1, uint64_t param2);
+	void		printStats();
+
+	std::atomic<ULONG>				m_refCount;
+	unsigned						m_index;
+	BMDDisplayMode					m_signalMode;
+	double							m_speed;
+	std::mutex						m_mutex;			// guards the callbacks and the settings
+	IDeckLinkInputCallback*			m_callback;
+	std::vector<IDeckLinkNotificationCallback*>	m_subscribers;
+	std::map<BMDDeckLinkConfigurationID, SdkInt64>	m_settings;		// flags are kept as 0 or 1
+	const SimulatedMode*			m_mode;				// enabled input mode, or nullptr
+	BMDVideoInputFlags				m_inputFlags;
+	long							m_rowBytes;
+	std::vector<std::vector<uint8_t>>	m_patterns[2];	// a cycle of frames per eye
+	std::thread						m_stream;
+	std::atomic<bool>				m_streaming;
+	std::atomic<uint64_t>			m_framesDelivered;
+	std::atomic<uint64_t>			m_framesDropped;
+	std::atomic<uint64_t>			m_callbackTotalUs;
+	std::atomic<uint64_t>			m_callbackMaxUs;
+	std::atomic<int64_t>			m_startUs;
+};
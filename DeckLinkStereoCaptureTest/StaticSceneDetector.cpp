@@ -0,0 +1,116 @@
+// static scene detection: a cheap luma signature of every frame, to tell when the picture has stopped changing
+#include "StaticSceneDetector.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2_SIGNATURE 1
+#endif
+
+// rows summed into a signature; the rows in between add little to a block's mean
+static const unsigned kSignatureRowStep = 4;
+
+// sums the six luma samples of each of groupCount v210 groups
+static uint32_t sumLumaGroups(const uint8_t* groups, int groupCount)
+{
+#ifdef HAVE_SSE2_SIGNATURE
+	// per word, in lanes 0 to 3: Y0 sits in bits 10-19 of word 0, Y1 and Y2 in bits 0-9 and 20-29
+	// of word 1, Y3 in bits 10-19 of word 2 and Y4 and Y5 in bits 0-9 and 20-29 of word 3
+	const __m128i middleMask = _mm_setr_epi32(0x3FF, 0, 0x3FF, 0);
+	const __m128i outerMask = _mm_setr_epi32(0, 0x3FF, 0, 0x3FF);
+	__m128i sums = _mm_setzero_si128();
+	for (int groupIdx = 0; groupIdx < groupCount; groupIdx++)
+	{
+		const __m128i words = _mm_loadu_si128((const __m128i*)(groups + 16 * groupIdx));
+		sums = _mm_add_epi32(sums, _mm_and_si128(_mm_srli_epi32(words, 10), middleMask));
+		sums = _mm_add_epi32(sums, _mm_and_si128(words, outerMask));
+		sums = _mm_add_epi32(sums, _mm_and_si128(_mm_srli_epi32(words, 20), outerMask));
+	}
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+	sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (uint32_t)_mm_cvtsi128_si32(sums);
+#else
+	uint32_t sum = 0;
+	for (int groupIdx = 0; groupIdx < groupCount; groupIdx++)
+	{
+		uint32_t words[4];
+		memcpy(words, groups + 16 * groupIdx, sizeof(words));
+		sum += ((words[0] >> 10) & 0x3FF) + (words[1] & 0x3FF) + ((words[1] >> 20) & 0x3FF)
+			+ ((words[2] >> 10) & 0x3FF) + (words[3] & 0x3FF) + ((words[3] >> 20) & 0x3FF);
+	}
+	return sum;
+#endif
+}
+
+void computeSceneSignature(const uint8_t* v210, size_t rowBytes, int width, int height, unsigned rowStep, SceneSignature& signature)
+{
+	const int groupCount = width / 6;
+	int blockStart[kSignatureColumns + 1];
+
+	memset(&signature, 0, sizeof(signature));
+	for (unsigned column = 0; column <= kSignatureColumns; column++)
+		blockStart[column] = (int)(column * groupCount / kSignatureColumns);
+
+	for (int row = (int)rowStep / 2; row < height; row += (int)rowStep)
+	{
+		const uint8_t* line = v210 + (size_t)row * rowBytes;
+		const unsigned blockRow = (unsigned)(row * (int)kSignatureRows / height);
+		for (unsigned column = 0; column < kSignatureColumns; column++)
+		{
+			const unsigned block = blockRow * kSignatureColumns + column;
+			const int groups = blockStart[column + 1] - blockStart[column];
+			signature.sums[block] += sumLumaGroups(line + 16 * blockStart[column], groups);
+			signature.samples[block] += 6 * groups;
+		}
+	}
+}
+
+StaticSceneDetector::StaticSceneDetector(double threshold, unsigned maxRepeats) :
+	m_threshold(threshold),
+	m_maxRepeats(maxRepeats),
+	m_hasReference(false),
+	m_referenceEyes(0),
+	m_referenceFrame(0),
+	m_repeats(0)
+{
+}
+
+bool StaticSceneDetector::isRepeat(const CaptureFrame& frame, double& difference)
+{
+	const unsigned eyeCount = frame.eyeCount();
+	for (unsigned eyeIdx = 0; eyeIdx < eyeCount; eyeIdx++)
+		computeSceneSignature(frame.eye[eyeIdx]->GetBytes(), (size_t)frame.rowBytes, frame.width, frame.height, kSignatureRowStep, m_current[eyeIdx]);
+
+	difference = -1.0;
+	if (m_hasReference && eyeCount == m_referenceEyes)
+	{
+		difference = 0.0;
+		for (unsigned eyeIdx = 0; eyeIdx < eyeCount; eyeIdx++)
+		{
+			for (unsigned block = 0; block < kSignatureBlocks; block++)
+			{
+				const uint32_t samples = m_current[eyeIdx].samples[block];
+				if (samples == 0)
+					continue;
+				const double change = fabs(((double)m_current[eyeIdx].sums[block] - (double)m_reference[eyeIdx].sums[block]) / samples);
+				if (change > difference)
+					difference = change;
+			}
+		}
+
+		if (difference <= m_threshold && m_repeats < m_maxRepeats)
+		{
+			++m_repeats;
+			return true;
+		}
+	}
+
+	memcpy(m_reference, m_current, sizeof(m_reference));
+	m_hasReference = true;
+	m_referenceEyes = eyeCount;
+	m_referenceFrame = frame.frameNumber;
+	m_repeats = 0;
+	return false;
+}
@@ -0,0 +1,53 @@
+// static scene detection: a cheap luma signature of every frame, to tell when the picture has stopped changing
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "CaptureFrame.h"
+
+// the grid of blocks a signature sums the luma of, 16:9 like the picture
+const unsigned	kSignatureColumns = 16;
+const unsigned	kSignatureRows = 9;
+const unsigned	kSignatureBlocks = kSignatureColumns * kSignatureRows;
+
+struct SceneSignature
+{
+	uint32_t	sums[kSignatureBlocks];		// 10-bit luma, summed over the block's sampled pixels
+	uint32_t	samples[kSignatureBlocks];
+};
+
+// Sums the luma of every rowStep'th row of a v210 frame into the blocks of signature, straight
+// from the packed words and a whole six-pixel group at a time (with SSE2 where available). Pixels
+// past the last whole group of a row are left out
+void computeSceneSignature(const uint8_t* v210, size_t rowBytes, int width, int height, unsigned rowStep, SceneSignature& signature);
+
+// Compares every frame's signature, eye by eye, with the signature of the last frame stored in
+// full, the reference. A frame whose block means all stay within threshold of the reference's is
+// a repeat, unless maxRepeats repeats of that reference have been stored already; anything else
+// becomes the new reference. Comparing with the reference rather than the previous frame means
+// a slow drift still ends the run once it adds up to the threshold
+class StaticSceneDetector
+{
+public:
+	// threshold is in 10-bit luma code values of a block's mean
+	StaticSceneDetector(double threshold, unsigned maxRepeats);
+
+	// true when frame can be stored as a repeat of referenceFrame(); difference is the largest
+	// change in any block's mean, or -1 for a frame that could not be compared
+	bool		isRepeat(const CaptureFrame& frame, double& difference);
+
+	// the next frame becomes the reference whatever it looks like, as after a failed write
+	void		reset() { m_hasReference = false; }
+
+	uint64_t	referenceFrame() const { return m_referenceFrame; }
+
+private:
+	double			m_threshold;
+	unsigned		m_maxRepeats;
+	bool			m_hasReference;
+	unsigned		m_referenceEyes;
+	uint64_t		m_referenceFrame;
+	unsigned		m_repeats;				// of the current reference
+	SceneSignature	m_reference[kEyeCount];
+	SceneSignature	m_current[kEyeCount];
+};
@@ -0,0 +1,167 @@
+// stereo rectification: undistorts and row-aligns both eyes with fixed-point remap tables computed once from a calibration
+#include "StereoRectifier.h"
+#include "ProcessingPipeline.h"
+#include "V210Unpack.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+static const int kStripeRows = 64;		// output rows remapped as one task
+
+StereoRectifier::StereoRectifier() :
+	m_width(0),
+	m_height(0)
+{
+}
+
+bool StereoRectifier::load(const char* calibrationPath, int width, int height, double outputScale)
+{
+	cv::FileStorage calibration(calibrationPath, cv::FileStorage::READ);
+	if (!calibration.isOpened())
+	{
+		fprintf(stderr, "Could not open stereo calibration %s\n", calibrationPath);
+		return false;
+	}
+
+	cv::Mat cameraMatrix[kEyeCount], distortion[kEyeCount], rotation, translation;
+	calibration["M1"] >> cameraMatrix[kEyeLeft];
+	calibration["D1"] >> distortion[kEyeLeft];
+	calibration["M2"] >> cameraMatrix[kEyeRight];
+	calibration["D2"] >> distortion[kEyeRight];
+	calibration["R"] >> rotation;
+	calibration["T"] >> translation;
+	if (cameraMatrix[kEyeLeft].empty() || cameraMatrix[kEyeRight].empty() || rotation.empty() || translation.empty())
+	{
+		fprintf(stderr, "Could not find M1, M2, R and T in stereo calibration %s\n", calibrationPath);
+		return false;
+	}
+
+	m_width = width;
+	m_height = height;
+	m_outputSize = cv::Size((int)(width * outputScale + 0.5), (int)(height * outputScale + 0.5));
+
+	// rectifying straight into the output size scales the projections, so nothing is resized afterwards
+	cv::Mat rectification[kEyeCount], projection[kEyeCount];
+	cv::stereoRectify(cameraMatrix[kEyeLeft], distortion[kEyeLeft], cameraMatrix[kEyeRight], distortion[kEyeRight], cv::Size(width, height), rotation, translation,
+		rectification[kEyeLeft], rectification[kEyeRight], projection[kEyeLeft], projection[kEyeRight], m_reprojection, cv::CALIB_ZERO_DISPARITY, 0, m_outputSize);
+
+	for (unsigned eyeIdx = 0; eyeIdx < kEyeCount; eyeIdx++)
+	{
+		cv::Mat map1, map2;
+		cv::initUndistortRectifyMap(cameraMatrix[eyeIdx], distortion[eyeIdx], rectification[eyeIdx], projection[eyeIdx], m_outputSize, CV_16SC2, map1, map2);
+		buildStripes(eyeIdx, map1, map2);
+	}
+
+	printf("Stereo rectification from %s: %dx%d to %dx%d in %u stripes per eye\n", calibrationPath, width, height, m_outputSize.width, m_outputSize.height,
+		(unsigned)m_stripes[kEyeLeft].size());
+	return true;
+}
+
+void StereoRectifier::buildStripes(unsigned eye, const cv::Mat& map1, const cv::Mat& map2)
+{
+	m_stripes[eye].clear();
+	for (int outTop = 0; outTop < map1.rows; outTop += kStripeRows)
+	{
+		Stripe stripe;
+		stripe.outTop = outTop;
+		stripe.outRows = std::min(kStripeRows, map1.rows - outTop);
+
+		// bilinear interpolation reads the row below each coordinate too
+		int minRow = m_height;
+		int maxRow = -1;
+		for (int row = outTop; row < outTop + stripe.outRows; row++)
+		{
+			const int16_t* coords = map1.ptr<int16_t>(row);
+			for (int col = 0; col < map1.cols; col++)
+			{
+				const int srcRow = coords[2 * col + 1];
+				if (srcRow + 1 < 0 || srcRow >= m_height)
+					continue;
+				minRow = std::min(minRow, srcRow);
+				maxRow = std::max(maxRow, srcRow + 1);
+			}
+		}
+		stripe.srcTop = std::max(minRow, 0);
+		stripe.srcRows = (maxRow >= stripe.srcTop) ? std::min(maxRow + 1, m_height) - stripe.srcTop : 0;
+
+		stripe.map1 = map1.rowRange(outTop, outTop + stripe.outRows).clone();
+		stripe.map2 = map2.rowRange(outTop, outTop + stripe.outRows).clone();
+		for (int row = 0; row < stripe.map1.rows; row++)
+		{
+			int16_t* coords = stripe.map1.ptr<int16_t>(row);
+			for (int col = 0; col < stripe.map1.cols; col++)
+				coords[2 * col + 1] = (int16_t)(coords[2 * col + 1] - stripe.srcTop);
+		}
+		m_stripes[eye].push_back(stripe);
+	}
+}
+
+void StereoRectifier::remapStripe(const Stripe& stripe, const cv::Mat& band, const cv::Scalar& border, cv::Mat& rectified) const
+{
+	cv::Mat output = rectified.rowRange(stripe.outTop, stripe.outTop + stripe.outRows);
+	if (stripe.srcRows == 0)
+		output.setTo(border);
+	else
+		cv::remap(band, output, stripe.map1, stripe.map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT, border);
+}
+
+void StereoRectifier::rectify(const CaptureFrame& frame, unsigned eyeCount, unsigned representation, cv::Mat rectified[kEyeCount]) const
+{
+	const int type = (representation == kInputBgr16) ? CV_16UC3 : (representation == kInputLuma) ? CV_8UC1 : CV_8UC3;
+	const cv::Scalar border = (representation == kInputLuma) ? cv::Scalar(16) : cv::Scalar();
+	for (unsigned eyeIdx = 0; eyeIdx < eyeCount; eyeIdx++)
+		rectified[eyeIdx].create(m_outputSize, type);
+
+	const int stripeCount = (int)m_stripes[kEyeLeft].size();
+	cv::parallel_for_(cv::Range(0, (int)eyeCount * stripeCount), [&](const cv::Range& range)
+		{
+			// each thread decodes its bands into images of its own, reused from one frame to the next
+			static thread_local cv::Mat band16, band, cb, cr;
+			for (int task = range.start; task < range.end; task++)
+			{
+				const unsigned eyeIdx = (unsigned)(task / stripeCount);
+				const Stripe& stripe = m_stripes[eyeIdx][task % stripeCount];
+				const uint8_t* v210 = frame.eye[eyeIdx]->GetBytes() + (size_t)stripe.srcTop * frame.rowBytes;
+				if (stripe.srcRows > 0)
+				{
+					if (representation == kInputLuma)
+					{
+						band16.create(stripe.srcRows, frame.width, CV_16UC1);
+						cb.create(stripe.srcRows, (frame.width + 1) / 2, CV_16UC1);
+						cr.create(stripe.srcRows, (frame.width + 1) / 2, CV_16UC1);
+						unpackV210(v210, (size_t)frame.rowBytes, frame.width, stripe.srcRows, (uint16_t*)band16.data, band16.step, (uint16_t*)cb.data, cb.step,
+							(uint16_t*)cr.data, cr.step);
+						band16.convertTo(band, CV_8U, 1.0 / 4.0);
+					}
+					else
+					{
+						band16.create(stripe.srcRows, frame.width, CV_16UC3);
+						convertV210ToBgr48(v210, (size_t)frame.rowBytes, frame.width, stripe.srcRows, (uint16_t*)band16.data, band16.step);
+						if (representation == kInputBgr16)
+							band = band16;
+						else
+							band16.convertTo(band, CV_8U, 1.0 / 257.0);
+					}
+				}
+				remapStripe(stripe, band, border, rectified[eyeIdx]);
+			}
+		});
+}
+
+void StereoRectifier::rectify(const cv::Mat images[kEyeCount], unsigned eyeCount, cv::Mat rectified[kEyeCount]) const
+{
+	for (unsigned eyeIdx = 0; eyeIdx < eyeCount; eyeIdx++)
+		rectified[eyeIdx].create(m_outputSize, images[eyeIdx].type());
+
+	const int stripeCount = (int)m_stripes[kEyeLeft].size();
+	cv::parallel_for_(cv::Range(0, (int)eyeCount * stripeCount), [&](const cv::Range& range)
+		{
+			for (int task = range.start; task < range.end; task++)
+			{
+				const unsigned eyeIdx = (unsigned)(task / stripeCount);
+				const Stripe& stripe = m_stripes[eyeIdx][task % stripeCount];
+				const cv::Mat band = images[eyeIdx].rowRange(stripe.srcTop, stripe.srcTop + stripe.srcRows);
+				remapStripe(stripe, band, cv::Scalar(), rectified[eyeIdx]);
+			}
+		});
+}
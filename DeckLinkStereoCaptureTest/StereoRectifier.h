@@ -0,0 +1,57 @@
+// stereo rectification: undistorts and row-aligns both eyes with fixed-point remap tables computed once from a calibration
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "CaptureFrame.h"
+
+// Reads a stereo calibration once and precomputes each eye's maps in the compact fixed-point form
+// cv::remap is fastest with: CV_16SC2 integer coordinates plus CV_16UC1 interpolation table indices.
+// The maps are cut into stripes of output rows, each knowing the band of source rows it reads, so
+// the stripes of both eyes are remapped in parallel. Rectifying straight from v210 decodes only each
+// stripe's band, so the unrectified image is never written out whole. The calibration is an OpenCV
+// FileStorage file (YAML or XML) holding M1, D1, M2 and D2 from the per-eye calibration and R and T
+// from stereoCalibrate, at the capture resolution
+class StereoRectifier
+{
+public:
+	StereoRectifier();
+
+	// builds the maps for width x height frames, rectifying into images scaled by outputScale;
+	// false when the calibration cannot be read
+	bool		load(const char* calibrationPath, int width, int height, double outputScale = 1.0);
+
+	bool		isLoaded() const { return !m_stripes[kEyeLeft].empty(); }
+	cv::Size	outputSize() const { return m_outputSize; }
+
+	// reprojects disparities between the rectified images, at the output scale, to 3D
+	const cv::Mat&	reprojection() const { return m_reprojection; }
+
+	// decodes and rectifies a frame's v210 eyes in one pass; representation is one of kInputBgr8,
+	// kInputBgr16 or kInputLuma, with the same ranges as the processing pipeline's
+	void		rectify(const CaptureFrame& frame, unsigned eyeCount, unsigned representation, cv::Mat rectified[kEyeCount]) const;
+
+	// rectifies images already decoded at the full frame size
+	void		rectify(const cv::Mat images[kEyeCount], unsigned eyeCount, cv::Mat rectified[kEyeCount]) const;
+
+private:
+	struct Stripe
+	{
+		int			outTop;
+		int			outRows;
+		int			srcTop;			// the band of source rows the stripe's maps read from
+		int			srcRows;		// 0 when every pixel of the stripe falls outside the source
+		cv::Mat		map1;			// CV_16SC2, rows relative to srcTop
+		cv::Mat		map2;			// CV_16UC1
+	};
+
+	void		buildStripes(unsigned eye, const cv::Mat& map1, const cv::Mat& map2);
+	void		remapStripe(const Stripe& stripe, const cv::Mat& band, const cv::Scalar& border, cv::Mat& rectified) const;
+
+	int			m_width;
+	int			m_height;
+	cv::Size	m_outputSize;
+	cv::Mat		m_reprojection;
+	std::vector<Stripe>	m_stripes[kEyeCount];
+};
@@ -0,0 +1,65 @@
+// text overlays: labels burned into preview images from glyphs rendered once into a cached atlas
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Every printable ASCII character of one Hershey font, size and stroke, rendered once with
+// cv::putText and anti-aliasing into cells of the same width, so a label lays out like a fixed-
+// width font and a changing digit never moves its neighbours. Coverage is kept as blend weights
+// in the range of the images' depth (CV_8U or CV_16U), so drawing is a multiply-add and a shift
+// per channel. Atlases are immutable once built and shared by every overlay that asks for one
+class GlyphAtlas
+{
+public:
+	// the atlas for a font, size, stroke and depth, built on first use
+	static std::shared_ptr<const GlyphAtlas>	get(int fontFace, double fontScale, int thickness, int depth);
+
+	int				depth() const { return m_depth; }
+	int				cellWidth() const { return m_cellWidth; }
+	int				cellHeight() const { return m_cellHeight; }
+	unsigned		weightShift() const { return m_weightShift; }
+
+	// cellHeight rows of cellWidth weights; characters without a glyph come out blank
+	const uint32_t*	glyph(char character) const;
+
+private:
+	GlyphAtlas(int fontFace, double fontScale, int thickness, int depth);
+
+	int				m_depth;
+	int				m_cellWidth;
+	int				m_cellHeight;
+	unsigned		m_weightShift;		// a weight of 1 << m_weightShift is fully opaque
+	std::vector<uint32_t>	m_weights;	// one cell per glyph, from ' ' to '~'
+};
+
+// One line of text drawn over BGR images of the atlas's depth. The line's weights are kept
+// between draws and only the cells whose character changed are copied from the atlas again, so a
+// running timecode costs the blend and little else. One overlay per thread: draw() is not safe
+// to call concurrently
+class TextOverlay
+{
+public:
+	// color is BGR in 8-bit values, scaled up for 16-bit images
+	TextOverlay(const std::shared_ptr<const GlyphAtlas>& atlas, const cv::Scalar& color);
+
+	int				width(size_t length) const { return (int)length * m_atlas->cellWidth(); }
+	int				height() const { return m_atlas->cellHeight(); }
+
+	// blends text into image with its top left corner at origin, clipped to the image
+	void			draw(cv::Mat& image, const char* text, cv::Point origin);
+
+private:
+	void			layout(const char* text);
+
+	template <typename Pixel>
+	void			blend(cv::Mat& image, cv::Point origin) const;
+
+	std::shared_ptr<const GlyphAtlas>	m_atlas;
+	uint32_t		m_color[3];
+	std::string		m_text;				// what m_line holds
+	std::vector<uint32_t>	m_line;		// cellHeight rows of the whole line's weights
+};
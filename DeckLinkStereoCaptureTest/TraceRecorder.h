@@ -0,0 +1,84 @@
+// pipeline tracing: scoped spans from every thread, written as a Chrome JSON trace for chrome://tracing or Perfetto
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+const uint64_t	kTraceNoFrame = UINT64_MAX;
+
+// one finished span, as a thread hands it to the trace; 32 bytes
+struct TraceEvent
+{
+	const char*	name;			// a literal, read when the trace is written
+	int64_t		begin;			// std::chrono::steady_clock ticks
+	int64_t		end;
+	uint64_t	frameNumber;	// shown with the span, or kTraceNoFrame
+};
+
+// Tracing is off until start() and can be turned on and off while capturing. When off, a span costs
+// one relaxed load and a branch. When on, each thread gets its own single-writer ring of events the
+// first time it ends a span, and a background thread moves them into the trace file as they come,
+// so a trace can run as long as the disk lasts; a thread that gets a ring's worth ahead of it loses
+// spans, which are counted. Every thread shows on the same timeline, under the name it gave nameThread
+class TraceRecorder
+{
+public:
+	static bool		start(const char* path, unsigned eventsPerThread);
+
+	// writes what is left and closes the file; spans ending after this are not in it
+	static void		stop();
+
+	static bool		isTracing() { return s_tracing.load(std::memory_order_relaxed); }
+
+	// the name the calling thread shows under, with number appended when it is not UINT32_MAX.
+	// Cheap to call again with the same name, so a callback thread may call it every time
+	static void		nameThread(const char* name, unsigned number = UINT32_MAX);
+
+	static void		addSpan(const char* name, int64_t begin, int64_t end, uint64_t frameNumber);
+
+	static int64_t	now() { return std::chrono::steady_clock::now().time_since_epoch().count(); }
+
+private:
+	static std::atomic<bool>	s_tracing;
+};
+
+// times the scope it is declared in, when tracing
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char* name, uint64_t frameNumber = kTraceNoFrame) :
+		m_name(TraceRecorder::isTracing() ? name : nullptr),
+		m_frameNumber(frameNumber),
+		m_begin(m_name ? TraceRecorder::now() : 0)
+	{
+	}
+	~TraceSpan()
+	{
+		if (m_name)
+			TraceRecorder::addSpan(m_name, m_begin, TraceRecorder::now(), m_frameNumber);
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char*	m_name;
+	uint64_t	m_frameNumber;
+	int64_t		m_begin;
+};
+
+// traces for as long as it is in scope when enabled, and stops any trace still running when it ends, for main()
+class TraceScope
+{
+public:
+	TraceScope(bool enable, const char* path, unsigned eventsPerThread)
+	{
+		if (enable)
+			TraceRecorder::start(path, eventsPerThread);
+	}
+	~TraceScope()
+	{
+		TraceRecorder::stop();
+	}
+};
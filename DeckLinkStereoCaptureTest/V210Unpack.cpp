@@ -0,0 +1,121 @@
+// unpacking of the SDK's v210 (bmdFormat10BitYUV) payloads into planar 10-bit 4:2:2
+#include "V210Unpack.h"
+
+#include <string.h>
+#include <vector>
+
+// one group of six pixels: four words in, six luma and three samples of each chroma out
+static inline void unpackGroup(const uint8_t* group, uint16_t* y, uint16_t* cb, uint16_t* cr)
+{
+	uint32_t words[4];
+	memcpy(words, group, sizeof(words));
+
+	cb[0] = (uint16_t)(words[0] & 0x3FF);
+	y[0] = (uint16_t)((words[0] >> 10) & 0x3FF);
+	cr[0] = (uint16_t)((words[0] >> 20) & 0x3FF);
+	y[1] = (uint16_t)(words[1] & 0x3FF);
+	cb[1] = (uint16_t)((words[1] >> 10) & 0x3FF);
+	y[2] = (uint16_t)((words[1] >> 20) & 0x3FF);
+	cr[1] = (uint16_t)(words[2] & 0x3FF);
+	y[3] = (uint16_t)((words[2] >> 10) & 0x3FF);
+	cb[2] = (uint16_t)((words[2] >> 20) & 0x3FF);
+	y[4] = (uint16_t)(words[3] & 0x3FF);
+	cr[2] = (uint16_t)((words[3] >> 10) & 0x3FF);
+	y[5] = (uint16_t)((words[3] >> 20) & 0x3FF);
+}
+
+void unpackV210Row(const uint8_t* v210, int width, uint16_t* y, uint16_t* cb, uint16_t* cr)
+{
+	int x = 0;
+	for (; x + 6 <= width; x += 6, v210 += 16)
+		unpackGroup(v210, y + x, cb + x / 2, cr + x / 2);
+
+	// widths that are not a multiple of six end in a partly used group
+	if (x < width)
+	{
+		uint16_t groupY[6], groupCb[3], groupCr[3];
+		unpackGroup(v210, groupY, groupCb, groupCr);
+		memcpy(y + x, groupY, (width - x) * sizeof(uint16_t));
+		memcpy(cb + x / 2, groupCb, ((width - x + 1) / 2) * sizeof(uint16_t));
+		memcpy(cr + x / 2, groupCr, ((width - x + 1) / 2) * sizeof(uint16_t));
+	}
+}
+
+static inline void packGroup(const uint16_t* y, const uint16_t* cb, const uint16_t* cr, uint8_t* group)
+{
+	uint32_t words[4];
+
+	words[0] = (uint32_t)(cb[0] & 0x3FF) | (uint32_t)(y[0] & 0x3FF) << 10 | (uint32_t)(cr[0] & 0x3FF) << 20;
+	words[1] = (uint32_t)(y[1] & 0x3FF) | (uint32_t)(cb[1] & 0x3FF) << 10 | (uint32_t)(y[2] & 0x3FF) << 20;
+	words[2] = (uint32_t)(cr[1] & 0x3FF) | (uint32_t)(y[3] & 0x3FF) << 10 | (uint32_t)(cb[2] & 0x3FF) << 20;
+	words[3] = (uint32_t)(y[4] & 0x3FF) | (uint32_t)(cr[2] & 0x3FF) << 10 | (uint32_t)(y[5] & 0x3FF) << 20;
+	memcpy(group, words, sizeof(words));
+}
+
+void packV210Row(const uint16_t* y, const uint16_t* cb, const uint16_t* cr, int width, uint8_t* v210)
+{
+	int x = 0;
+	for (; x + 6 <= width; x += 6, v210 += 16)
+		packGroup(y + x, cb + x / 2, cr + x / 2, v210);
+
+	// the rest of a partly used group repeats the last pixel pair
+	if (x < width)
+	{
+		uint16_t groupY[6], groupCb[3], groupCr[3];
+		for (int groupIdx = 0; groupIdx < 6; groupIdx++)
+		{
+			const int source = (x + groupIdx < width) ? x + groupIdx : width - 1;
+			groupY[groupIdx] = y[source];
+			if (groupIdx % 2 == 0)
+			{
+				groupCb[groupIdx / 2] = cb[source / 2];
+				groupCr[groupIdx / 2] = cr[source / 2];
+			}
+		}
+		packGroup(groupY, groupCb, groupCr, v210);
+	}
+}
+
+void unpackV210(const uint8_t* v210, size_t rowBytes, int width, int height,
+	uint16_t* y, size_t yStride, uint16_t* cb, size_t cbStride, uint16_t* cr, size_t crStride)
+{
+	for (int row = 0; row < height; row++)
+	{
+		unpackV210Row(v210 + row * rowBytes, width,
+			(uint16_t*)((uint8_t*)y + row * yStride),
+			(uint16_t*)((uint8_t*)cb + row * cbStride),
+			(uint16_t*)((uint8_t*)cr + row * crStride));
+	}
+}
+
+static inline uint16_t clampTo16(int32_t value)
+{
+	return (uint16_t)(value < 0 ? 0 : (value > 65535 ? 65535 : value));
+}
+
+void convertV210ToBgr48(const uint8_t* v210, size_t rowBytes, int width, int height, uint16_t* bgr, size_t bgrStride)
+{
+	// BT.709 for 10-bit video range (Y 64-940, Cb/Cr 64-960 around 512), scaled to 0-65535, in 1/1024ths
+	const int32_t kLuma = (int32_t)(65535.0 / 876.0 * 1024.0 + 0.5);
+	const int32_t kCrToR = (int32_t)(1.5748 * 65535.0 / 896.0 * 1024.0 + 0.5);
+	const int32_t kCbToG = (int32_t)(0.187324 * 65535.0 / 896.0 * 1024.0 + 0.5);
+	const int32_t kCrToG = (int32_t)(0.468124 * 65535.0 / 896.0 * 1024.0 + 0.5);
+	const int32_t kCbToB = (int32_t)(1.8556 * 65535.0 / 896.0 * 1024.0 + 0.5);
+	std::vector<uint16_t> y(width), cb((width + 1) / 2), cr((width + 1) / 2);
+
+	for (int row = 0; row < height; row++)
+	{
+		uint16_t* out = (uint16_t*)((uint8_t*)bgr + row * bgrStride);
+		unpackV210Row(v210 + row * rowBytes, width, y.data(), cb.data(), cr.data());
+
+		for (int x = 0; x < width; x++, out += 3)
+		{
+			const int32_t luma = ((int32_t)y[x] - 64) * kLuma + 512;
+			const int32_t blue = (int32_t)cb[x / 2] - 512;
+			const int32_t red = (int32_t)cr[x / 2] - 512;
+			out[0] = clampTo16((luma + blue * kCbToB) / 1024);
+			out[1] = clampTo16((luma - blue * kCbToG - red * kCrToG) / 1024);
+			out[2] = clampTo16((luma + red * kCrToR) / 1024);
+		}
+	}
+}
@@ -0,0 +1,28 @@
+// unpacking of the SDK's v210 (bmdFormat10BitYUV) payloads into planar 10-bit 4:2:2
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// One v210 row holds groups of six pixels in four little endian 32-bit words, each word
+// carrying three 10-bit components:
+//   word 0: Cb0  Y0  Cr0
+//   word 1: Y1   Cb1 Y2
+//   word 2: Cr1  Y3  Cb2
+//   word 3: Y4   Cr2 Y5
+// Rows are padded to a multiple of 128 bytes (see rowBytesForV210()).
+
+// unpacks width pixels into width luma and (width + 1) / 2 samples of each chroma component;
+// the 10-bit values are stored as is, in the low bits of each uint16_t
+void unpackV210Row(const uint8_t* v210, int width, uint16_t* y, uint16_t* cb, uint16_t* cr);
+
+// the other way round, for generating test frames; the padding at the end of the row is left alone
+void packV210Row(const uint16_t* y, const uint16_t* cb, const uint16_t* cr, int width, uint8_t* v210);
+
+// unpacks a whole frame; strides are in bytes, as in AVFrame::linesize and cv::Mat::step
+void unpackV210(const uint8_t* v210, size_t rowBytes, int width, int height,
+	uint16_t* y, size_t yStride, uint16_t* cb, size_t cbStride, uint16_t* cr, size_t crStride);
+
+// converts a whole frame to interleaved 16-bit BGR, the layout of a CV_16UC3 cv::Mat. BT.709,
+// video range in and full range out; both pixels of a pair share their chroma sample
+void convertV210ToBgr48(const uint8_t* v210, size_t rowBytes, int width, int height, uint16_t* bgr, size_t bgrStride);
@@ -0,0 +1,384 @@
+// background lossless encoding of captured frames to a video file (FFV1 in Matroska, via FFmpeg)
+#include "VideoEncoder.h"
+#include "FrameArchiveFormat.h"
+#include "LatencyTracker.h"
+#include "MetricsRegistry.h"
+#include "TraceRecorder.h"
+#include "V210Unpack.h"
+
+#include <stdio.h>
+
+#ifdef HAVE_FFMPEG
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+}
+#ifdef _MSC_VER
+#pragma comment(lib, "avcodec.lib")
+#pragma comment(lib, "avformat.lib")
+#pragma comment(lib, "avutil.lib")
+#endif
+#endif
+
+// how often the encoder thread prints its statistics while encoding
+static const std::chrono::seconds kStatsInterval(10);
+
+// FFV1 version 3 codes every frame as independent slices, which is what its slice threading
+// spreads over the threads; 24 is one of the slice layouts it accepts and keeps 8-16 threads busy
+static const int kFfv1Slices = 24;
+
+struct VideoEncoder::EyeStream
+{
+#ifdef HAVE_FFMPEG
+	AVCodecContext*	codec;
+	AVStream*		stream;
+	AVFrame*		picture;
+	AVPacket*		packet;
+#endif
+};
+
+VideoEncoder::VideoEncoder(unsigned queueDepth, unsigned sliceThreads) :
+	m_queue(queueDepth),
+	m_running(false),
+	m_sliceThreads(sliceThreads > 0 ? sliceThreads : 1),
+	m_decimation(1),
+	m_formatContext(nullptr),
+	m_decodeTime(nullptr),
+	m_framesEncoded(0),
+	m_framesSkipped(0),
+	m_encodeErrors(0),
+	m_bytesWritten(0),
+	m_lagCount(0),
+	m_lagTotalUs(0),
+	m_lagMaxUs(0),
+	m_lagLastUs(0)
+{
+}
+
+VideoEncoder::~VideoEncoder()
+{
+	close();
+}
+
+bool VideoEncoder::isAvailable()
+{
+#ifdef HAVE_FFMPEG
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool VideoEncoder::open(const std::string& path, const CaptureFrame& format)
+{
+#ifdef HAVE_FFMPEG
+	AVFormatContext* formatContext = nullptr;
+	const AVCodec* codec = nullptr;
+	int result;
+
+	if (m_running)
+		return false;
+
+	if (format.pixelFormat != kArchivePixelFormatV210)
+	{
+		fprintf(stderr, "Video encoding only supports 10-bit YUV capture\n");
+		return false;
+	}
+
+	result = avformat_alloc_output_context2(&formatContext, nullptr, "matroska", path.c_str());
+	if (result < 0 || formatContext == nullptr)
+	{
+		fprintf(stderr, "Could not create video file %s - error = %d\n", path.c_str(), result);
+		return false;
+	}
+	m_formatContext = formatContext;
+
+	codec = avcodec_find_encoder(AV_CODEC_ID_FFV1);
+	if (codec == nullptr)
+	{
+		fprintf(stderr, "FFmpeg was built without the FFV1 encoder\n");
+		goto bail;
+	}
+
+	for (unsigned eyeIdx = 0; eyeIdx < format.eyeCount(); eyeIdx++)
+	{
+		EyeStream* eye = new EyeStream();
+		m_eyes.push_back(eye);
+		eye->codec = avcodec_alloc_context3(codec);
+		eye->stream = avformat_new_stream(formatContext, nullptr);
+		eye->picture = av_frame_alloc();
+		eye->packet = av_packet_alloc();
+		if (!eye->codec || !eye->stream || !eye->picture || !eye->packet)
+			goto bail;
+
+		// stream times go in untouched, so the file keeps the capture timing
+		AVCodecContext* context = eye->codec;
+		context->width = format.width;
+		context->height = format.height;
+		context->pix_fmt = AV_PIX_FMT_YUV422P10LE;
+		context->time_base = AVRational{ 1, (int)format.timeScale };
+		context->gop_size = 1;
+		context->level = 3;
+		context->slices = kFfv1Slices;
+		context->thread_type = FF_THREAD_SLICE;
+		context->thread_count = (int)m_sliceThreads;
+		if (formatContext->oformat->flags & AVFMT_GLOBALHEADER)
+			context->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		av_opt_set_int(context->priv_data, "slicecrc", 1, 0);
+
+		result = avcodec_open2(context, codec, nullptr);
+		if (result < 0)
+		{
+			fprintf(stderr, "Could not open the FFV1 encoder - error = %d\n", result);
+			goto bail;
+		}
+
+		avcodec_parameters_from_context(eye->stream->codecpar, context);
+		eye->stream->time_base = context->time_base;
+		if (format.eyeCount() > 1)
+			av_dict_set(&eye->stream->metadata, "title", (eyeIdx == kEyeLeft) ? "left" : "right", 0);
+
+		eye->picture->format = context->pix_fmt;
+		eye->picture->width = context->width;
+		eye->picture->height = context->height;
+		if (av_frame_get_buffer(eye->picture, 0) < 0)
+			goto bail;
+	}
+
+	result = avio_open(&formatContext->pb, path.c_str(), AVIO_FLAG_WRITE);
+	if (result < 0)
+	{
+		fprintf(stderr, "Could not create video file %s - error = %d\n", path.c_str(), result);
+		goto bail;
+	}
+
+	result = avformat_write_header(formatContext, nullptr);
+	if (result < 0)
+	{
+		fprintf(stderr, "Could not write the header of %s - error = %d\n", path.c_str(), result);
+		goto bail;
+	}
+
+	m_framesEncoded = 0;
+	m_framesSkipped = 0;
+	m_encodeErrors = 0;
+	m_bytesWritten = 0;
+	m_lagCount = 0;
+	m_lagTotalUs = 0;
+	m_lagMaxUs = 0;
+	m_lagLastUs = 0;
+
+	printf("Encoder: FFV1 yuv422p10 to %s, %u streams, %d slices on %u threads\n", path.c_str(), format.eyeCount(), kFfv1Slices, m_sliceThreads);
+
+	m_running = true;
+	m_encoder = std::thread(&VideoEncoder::encoderThread, this);
+	return true;
+
+bail:
+	releaseStreams();
+	return false;
+#else
+	fprintf(stderr, "Video encoding needs FFmpeg, which this build does not have\n");
+	return false;
+#endif
+}
+
+bool VideoEncoder::submit(const CaptureFrame& frame)
+{
+	if (m_running && frame.frameNumber % m_decimation != 0)
+	{
+		CaptureFrame skipped = frame;
+		skipped.release();
+		++m_framesSkipped;
+		return true;
+	}
+
+	if (m_running && m_queue.tryPush(frame))
+		return true;
+
+	CaptureFrame dropped = frame;
+	dropped.release();
+	return false;
+}
+
+void VideoEncoder::setDecimation(unsigned decimation)
+{
+	m_decimation = decimation > 0 ? decimation : 1;
+}
+
+void VideoEncoder::close()
+{
+	if (!m_running)
+		return;
+
+	m_running = false;
+	m_queue.close();
+	if (m_encoder.joinable())
+		m_encoder.join();
+
+#ifdef HAVE_FFMPEG
+	// flush whatever the encoders still hold, then finish the file
+	for (EyeStream* eye : m_eyes)
+	{
+		avcodec_send_frame(eye->codec, nullptr);
+		drainPackets(*eye);
+	}
+	av_write_trailer((AVFormatContext*)m_formatContext);
+#endif
+
+	printStats();
+	releaseStreams();
+}
+
+EncoderStats VideoEncoder::stats()
+{
+	EncoderStats stats = {};
+	const uint64_t lagCount = m_lagCount;
+
+	stats.framesEncoded = m_framesEncoded;
+	stats.framesDropped = m_queue.dropCount();
+	stats.framesSkipped = m_framesSkipped;
+	stats.encodeErrors = m_encodeErrors;
+	stats.bytesWritten = m_bytesWritten;
+	stats.queueDepth = m_queue.depth();
+	stats.lastLagMs = m_lagLastUs / 1000.0;
+	stats.meanLagMs = lagCount ? (m_lagTotalUs / 1000.0) / lagCount : 0.0;
+	stats.maxLagMs = m_lagMaxUs / 1000.0;
+	return stats;
+}
+
+void VideoEncoder::encoderThread()
+{
+	TraceRecorder::nameThread("video encoder");
+	std::chrono::steady_clock::time_point lastStats = std::chrono::steady_clock::now();
+	CaptureFrame frame;
+
+	// keep going after close() until the queue has been drained
+	while (m_running || m_queue.depth() > 0)
+	{
+		if (m_queue.pop(frame, std::chrono::milliseconds(100)))
+		{
+			if (encodeFrame(frame))
+				++m_framesEncoded;
+			else
+				++m_encodeErrors;
+
+			if (frame.arrivalTime != 0)
+			{
+				const uint64_t lagUs = (uint64_t)(steadyClockMicroseconds() - frame.arrivalTime);
+				m_lagLastUs = lagUs;
+				m_lagTotalUs += lagUs;
+				++m_lagCount;
+				if (lagUs > m_lagMaxUs)
+					m_lagMaxUs = lagUs;
+			}
+
+			frame.release();
+		}
+
+		if (std::chrono::steady_clock::now() - lastStats >= kStatsInterval)
+		{
+			printStats();
+			lastStats = std::chrono::steady_clock::now();
+		}
+	}
+}
+
+bool VideoEncoder::encodeFrame(const CaptureFrame& frame)
+{
+	bool ok = true;
+
+#ifdef HAVE_FFMPEG
+	for (unsigned eyeIdx = 0; eyeIdx < m_eyes.size() && eyeIdx < frame.eyeCount(); eyeIdx++)
+	{
+		EyeStream& eye = *m_eyes[eyeIdx];
+		AVFrame* picture = eye.picture;
+
+		// the encoder may still reference the previous picture
+		if (av_frame_make_writable(picture) < 0)
+		{
+			ok = false;
+			continue;
+		}
+
+		{
+			TraceSpan unpackSpan("unpack v210", frame.frameNumber);
+			const std::chrono::steady_clock::time_point unpackStart = std::chrono::steady_clock::now();
+			unpackV210(frame.eye[eyeIdx]->GetBytes(), (size_t)frame.rowBytes, frame.width, frame.height,
+				(uint16_t*)picture->data[0], (size_t)picture->linesize[0],
+				(uint16_t*)picture->data[1], (size_t)picture->linesize[1],
+				(uint16_t*)picture->data[2], (size_t)picture->linesize[2]);
+			if (m_decodeTime)
+				m_decodeTime->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - unpackStart).count());
+		}
+		picture->pts = frame.streamTime;
+		if (eyeIdx + 1 == frame.eyeCount())
+			recordLatency(frame, kLatencyVideoDecoded);
+
+		TraceSpan encodeSpan("encode", frame.frameNumber);
+		if (avcodec_send_frame(eye.codec, picture) < 0 || !drainPackets(eye))
+			ok = false;
+	}
+
+	if (ok)
+		recordLatency(frame, kLatencyVideoEncoded);
+#endif
+
+	return ok;
+}
+
+// hands every packet the encoder has ready to the muxer
+bool VideoEncoder::drainPackets(EyeStream& eye)
+{
+#ifdef HAVE_FFMPEG
+	while (true)
+	{
+		int result = avcodec_receive_packet(eye.codec, eye.packet);
+		if (result == AVERROR(EAGAIN) || result == AVERROR_EOF)
+			return true;
+		if (result < 0)
+			return false;
+
+		m_bytesWritten += eye.packet->size;
+		av_packet_rescale_ts(eye.packet, eye.codec->time_base, eye.stream->time_base);
+		eye.packet->stream_index = eye.stream->index;
+		if (av_interleaved_write_frame((AVFormatContext*)m_formatContext, eye.packet) < 0)
+			return false;
+	}
+#else
+	return false;
+#endif
+}
+
+void VideoEncoder::releaseStreams()
+{
+#ifdef HAVE_FFMPEG
+	for (EyeStream* eye : m_eyes)
+	{
+		avcodec_free_context(&eye->codec);
+		av_frame_free(&eye->picture);
+		av_packet_free(&eye->packet);
+		delete eye;
+	}
+
+	AVFormatContext* formatContext = (AVFormatContext*)m_formatContext;
+	if (formatContext)
+	{
+		if (formatContext->pb)
+			avio_closep(&formatContext->pb);
+		avformat_free_context(formatContext);
+	}
+#endif
+
+	m_eyes.clear();
+	m_formatContext = nullptr;
+}
+
+void VideoEncoder::printStats()
+{
+	EncoderStats current = stats();
+	printf("Encoder: %llu frames (%.1f MB), %llu dropped, %llu skipped, %llu errors, queue %u, lag last %.1f / mean %.1f / max %.1f ms\n",
+		(unsigned long long)current.framesEncoded, current.bytesWritten / 1e6, (unsigned long long)current.framesDropped, (unsigned long long)current.framesSkipped,
+		(unsigned long long)current.encodeErrors, current.queueDepth, current.lastLagMs, current.meanLagMs, current.maxLagMs);
+}
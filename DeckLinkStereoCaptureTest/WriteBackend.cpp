@@ -0,0 +1,178 @@
+// asynchronous file write backends used by the recorder
+#include "WriteBackend.h"
+#include "ThreadPoolWriteBackend.h"
+#include "IoUringWriteBackend.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+WriteBackend::WriteBackend() :
+#ifdef _WIN32
+	m_file(INVALID_HANDLE_VALUE),
+#else
+	m_file(-1),
+#endif
+	m_directIO(false),
+	m_regularFile(true),
+	m_inFlight(0)
+{
+}
+
+WriteBackend::~WriteBackend()
+{
+}
+
+bool WriteBackend::open(const std::string& path, bool directIO)
+{
+	m_directIO = directIO;
+
+#ifdef _WIN32
+	DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+	if (directIO)
+		flags |= FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH;
+
+	m_file = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, flags, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Could not create recording file %s - error = %lu\n", path.c_str(), GetLastError());
+		return false;
+	}
+	m_regularFile = (GetFileType((HANDLE)m_file) == FILE_TYPE_DISK);
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+	if (directIO)
+		flags |= O_DIRECT;
+#endif
+
+	m_file = ::open(path.c_str(), flags, 0644);
+	if (m_file < 0 && directIO && errno == EINVAL)
+	{
+		// some filesystems (tmpfs, for one) refuse O_DIRECT; carry on through the page cache
+		fprintf(stderr, "Direct I/O not supported for %s, using buffered writes\n", path.c_str());
+		m_directIO = false;
+		m_file = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if (m_file < 0)
+	{
+		fprintf(stderr, "Could not create recording file %s - errno = %d\n", path.c_str(), errno);
+		return false;
+	}
+
+	struct stat fileStat;
+	m_regularFile = (fstat(m_file, &fileStat) != 0 || S_ISREG(fileStat.st_mode));
+#endif
+
+	if (!start())
+	{
+		close(0);
+		return false;
+	}
+
+	return true;
+}
+
+bool WriteBackend::reserve(uint64_t bytes)
+{
+	if (!m_regularFile)
+		return true;
+
+#ifdef _WIN32
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)bytes;
+	if (!SetFilePointerEx((HANDLE)m_file, size, NULL, FILE_BEGIN) || !SetEndOfFile((HANDLE)m_file))
+	{
+		fprintf(stderr, "Could not preallocate %llu bytes for recording - error = %lu\n", (unsigned long long)bytes, GetLastError());
+		return false;
+	}
+#else
+	if (posix_fallocate(m_file, 0, (off_t)bytes) != 0)
+	{
+		fprintf(stderr, "Could not preallocate %llu bytes for recording\n", (unsigned long long)bytes);
+		return false;
+	}
+#endif
+	return true;
+}
+
+bool WriteBackend::writeSync(const void* data, uint64_t bytes, uint64_t offset)
+{
+#ifdef _WIN32
+	OVERLAPPED overlapped = {};
+	DWORD written = 0;
+	overlapped.Offset = (DWORD)(offset & 0xFFFFFFFF);
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	if (!WriteFile((HANDLE)m_file, data, (DWORD)bytes, &written, &overlapped) || written != bytes)
+	{
+		fprintf(stderr, "Recording write failed - error = %lu\n", GetLastError());
+		return false;
+	}
+#else
+	const uint8_t* source = (const uint8_t*)data;
+	while (bytes > 0)
+	{
+		ssize_t written = pwrite(m_file, source, bytes, (off_t)offset);
+		if (written <= 0)
+		{
+			fprintf(stderr, "Recording write failed - errno = %d\n", errno);
+			return false;
+		}
+		source += written;
+		offset += written;
+		bytes -= written;
+	}
+#endif
+	return true;
+}
+
+void WriteBackend::close(uint64_t finalBytes)
+{
+	stop();
+
+#ifdef _WIN32
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		// trim the unused part of the preallocation
+		if (m_regularFile)
+		{
+			LARGE_INTEGER size;
+			size.QuadPart = (LONGLONG)finalBytes;
+			SetFilePointerEx((HANDLE)m_file, size, NULL, FILE_BEGIN);
+			SetEndOfFile((HANDLE)m_file);
+		}
+		CloseHandle((HANDLE)m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_file >= 0)
+	{
+		// trim the unused part of the preallocation
+		if (m_regularFile && ftruncate(m_file, (off_t)finalBytes) != 0)
+			fprintf(stderr, "Could not trim recording file\n");
+		::close(m_file);
+		m_file = -1;
+	}
+#endif
+}
+
+WriteBackend* createWriteBackend(WriteBackendType type, unsigned queueDepth)
+{
+	if (type == kWriteBackendIoUring)
+	{
+		WriteBackend* backend = IoUringWriteBackend::create(queueDepth);
+		if (backend)
+			return backend;
+
+		fprintf(stderr, "io_uring is not available, falling back to the thread pool write backend\n");
+	}
+
+	return new ThreadPoolWriteBackend(queueDepth);
+}
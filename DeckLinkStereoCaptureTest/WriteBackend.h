@@ -0,0 +1,86 @@
+// asynchronous file write backends used by the recorder
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+enum WriteBackendType
+{
+	kWriteBackendThreadPool,	// positional writes from a small pool of threads; available everywhere
+	kWriteBackendIoUring		// Linux io_uring; falls back to the thread pool where unavailable
+};
+
+// One positional write. Data must stay valid until the matching completion has been reaped
+struct WriteRequest
+{
+	const void*		data;
+	uint64_t		bytes;
+	uint64_t		offset;
+	int				bufferIndex;	// index into the registered buffers, or -1 if the data is not in one
+	void*			tag;			// returned untouched in the matching WriteCompletion
+};
+
+struct WriteCompletion
+{
+	void*			tag;
+	bool			ok;
+};
+
+struct WriteBuffer
+{
+	void*			data;
+	size_t			bytes;
+};
+
+// Owns the file and the synchronous operations on it (header writes, preallocation, trimming);
+// derived classes provide the asynchronous submission/completion path for frame records.
+// With directIO the page cache is bypassed, so every request must use aligned data, offset and size
+class WriteBackend
+{
+public:
+	WriteBackend();
+	virtual ~WriteBackend();
+
+	virtual const char*	name() const = 0;
+
+	bool			open(const std::string& path, bool directIO);
+	bool			reserve(uint64_t bytes);
+	bool			writeSync(const void* data, uint64_t bytes, uint64_t offset);
+	void			close(uint64_t finalBytes);
+
+	// pins buffers that later requests will reference by bufferIndex; optional
+	virtual bool	registerBuffers(const std::vector<WriteBuffer>& buffers) { return false; }
+
+	// queues a batch of writes; all of them are issued together. All or nothing: on false, no
+	// write of the batch is in flight and its buffers are the caller's again
+	virtual bool	submit(const WriteRequest* requests, unsigned count) = 0;
+
+	// collects finished writes; with wait set, blocks until at least one write is done
+	virtual unsigned	reap(WriteCompletion* completions, unsigned maxCompletions, bool wait) = 0;
+
+	unsigned		inFlight() const { return m_inFlight; }
+	bool			isDirectIO() const { return m_directIO; }
+
+	// false for a device such as /dev/null or NUL, which has nothing to preallocate or trim
+	bool			isRegularFile() const { return m_regularFile; }
+
+protected:
+	// called once the file is open, and before it is closed
+	virtual bool	start() { return true; }
+	virtual void	stop() {}
+
+#ifdef _WIN32
+	void*					m_file;
+#else
+	int						m_file;
+#endif
+	bool					m_directIO;
+	bool					m_regularFile;
+	std::atomic<unsigned>	m_inFlight;
+};
+
+// creates the requested backend, or the thread pool backend if the requested one is not available here
+WriteBackend* createWriteBackend(WriteBackendType type, unsigned queueDepth);
@@ -5,8 +5,34 @@
 #include "DeckLinkAPI_h.h"
 #include "Uyvy8VideoFrame.h"
 #include "Xle10VideoFrame.h"
+#include "ArchiveReplaySource.h"
+#include "BinaryLog.h"
+#include "CaptureFrame.h"
+#include "ClockDriftTracker.h"
+#include "ContinuityTracker.h"
+#include "DeviceMetrics.h"
+#include "DisparityStage.h"
+#include "FramePool.h"
+#include "FramePublisher.h"
+#include "FrameServer.h"
+#include "LatencyTracker.h"
+#include "PreRollBuffer.h"
+#include "ProcessingPipeline.h"
+#include "RawRecorder.h"
+#include "RectificationStage.h"
+#include "SignalLevelStage.h"
+#include "SimulatedDeckLink.h"
+#include "StillWriterPool.h"
+#include "ThroughputGovernor.h"
+#include "TraceRecorder.h"
+#include "VideoEncoder.h"
+#include <algorithm>
 #include <array>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <thread>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
@@ -40,6 +66,139 @@ const INT32_UNSIGNED kSynchronizedCaptureGroup = 2;
 
 static const BMDTimeScale kMicroSecondsTimeScale = 1000000;
 
+// Recording parameters
+// raw payloads are copied into the frame pool on the callback thread and written by the recorder's own thread
+const char* const         kRecordingPathFormat = "DeckLinkCapture_%u.dlraw";
+const unsigned            kFramePoolBuffers = 64;			// per device; one buffer per eye per frame, shared by the recorder and encoder queues
+const unsigned            kRecorderQueueDepth = 16;		// frames waiting for the writer before we start dropping
+const unsigned            kRecordPreallocateSeconds = 60;	// reserved up front, and again each time the file fills
+const WriteBackendType    kRecorderBackend = kWriteBackendIoUring;	// falls back to the thread pool backend where unavailable
+const unsigned            kRecordsInFlight = 4;			// frame records the backend may be writing at once
+const bool                kRecorderDirectIO = true;		// bypass the page cache; our buffers are page aligned
+const CompressionCodec    kRecorderCompression = kCompressionNone;	// kCompressionLZ4 or kCompressionZstd when the disks cannot keep up with raw video
+const int                 kRecorderCompressionLevel = 1;
+const unsigned            kCompressionThreads = 4;			// including the recorder's writer thread
+const unsigned            kCompressionStripes = 16;		// per eye; a few more stripes than threads evens out the load
+const bool                kStoreRepeats = false;			// store frames of a still picture as repeats of the last full record
+const double              kRepeatThreshold = 1.0;			// largest change of any block's mean luma, in 10-bit code values
+const unsigned            kMaxRepeats = 250;				// repeats of one full record before the next frame is stored in full again
+
+// Replay parameters
+// set kReplayPath to a recording to feed the pipeline from it instead of a DeckLink card
+const char* const         kReplayPath = nullptr;
+const ReplayPacing        kReplayPacing = kReplayOriginalCadence;	// kReplayAsFastAsPossible finds the highest frame rate the pipeline sustains
+const bool                kReplayLoop = false;
+const char* const         kReplayRecordingPathFormat = "DeckLinkReplay_%u.dlraw";	// never the recording being replayed
+const char* const         kReplayVideoPathFormat = "DeckLinkReplay_%u.mkv";
+
+// Simulated card parameters
+// set kSimulatedDevices to capture from that many simulated cards instead of a DeckLink card, to load test without hardware
+const unsigned            kSimulatedDevices = 0;
+const BMDDisplayMode      kSimulatedSignalMode = kDisplayMode;	// the signal the simulated cards see; any other mode captures as no input
+const double              kSimulatedSpeed = 1.0;			// times the mode's frame rate; 0 delivers frames as fast as the pipeline takes them
+
+// Throughput governor parameters
+// watches the recorder queue, and takes these steps in order while it predicts the queue will overflow.
+// A pre-roll flush fills the queue on purpose, so the governor may take a step during one
+const bool                kGovernRecording = true;
+const GovernorStep        kGovernorLadder[] = { kGovernorCompressRecording, kGovernorStills8Bit, kGovernorStopStills, kGovernorHalveVideoRate };
+const CompressionCodec    kGovernorCompression = kCompressionLZ4;	// kept on standby for the first step when kRecorderCompression is off
+const unsigned            kGovernorRecoverSeconds = 60;	// idle queue time before a step is undone; 0 keeps every step taken
+
+// Pre-roll parameters
+// with a pre-roll, the recorder only gets the frames around a trigger (t <RETURN>, or SIGUSR1 / Ctrl+Break):
+// the last kPreRollSeconds, held in the frame pool, and kPostRollSeconds after
+const unsigned            kPreRollSeconds = 0;				// 0 records everything; each second of 1080 v210 takes about 166 MB of pool per eye
+const unsigned            kPostRollSeconds = 30;
+
+// Video file parameters
+// a lossless FFV1 copy of the capture, encoded on its own thread from the same pooled frames
+const bool                kEncodeVideo = true;				// needs FFmpeg; capture carries on without it
+const char* const         kVideoPathFormat = "DeckLinkCapture_%u.mkv";
+const unsigned            kEncoderQueueDepth = 8;			// frames waiting for the encoder before it starts dropping
+const unsigned            kEncoderThreads = 8;				// FFV1 slice threads
+
+// Still image parameters
+// BGR stills of every frame, converted and written by a pool of threads from the same pooled frames
+const bool                kWriteStills = false;
+const char* const         kStillPathTemplate = "test{depth}_{eye}_{timecode}.tif";	// {device} {frame} {timecode} {eye} {depth}
+const unsigned            kStillDepths = kStillDepth8 | kStillDepth16;
+const int                 kStillCompressionLevel = 0;		// PNG zlib level; TIFF is written with LZW when above 0
+const unsigned            kStillThreads = 0;				// 0 to use every core
+const unsigned            kStillQueueDepth = 8;
+const bool                kLabelStills = false;			// burn timecode, device and eye into the stills; recordings stay untouched
+const double              kLabelFontScale = 2.0;			// FONT_HERSHEY_SIMPLEX
+const int                 kLabelThickness = 3;
+const cv::Scalar          kLabelColor = CV_RGB(255, 255, 0);	// 8-bit values, scaled for 16-bit stills
+
+// Frame publication parameters
+// the newest frames in a shared-memory ring, for other processes on this machine to read with FrameRingClient
+const bool                kPublishFrames = true;
+const char* const         kPublishNameFormat = "DeckLinkFrames_%u";	// per device; "Local\\" is added on Windows and "/" elsewhere
+const unsigned            kPublishSlots = 8;				// a reader has about this many frame times to finish with a frame
+const unsigned            kPublishQueueDepth = 4;
+
+// Frame server parameters
+// lends frames to short-lived local tools over a Unix domain socket, as memfds of the pool buffers themselves.
+// Needs memfds, so only Linux builds serve frames
+const bool                kServeFrames = true;
+const char* const         kFrameServerPathFormat = "/tmp/DeckLinkFrames_%u.sock";
+const unsigned            kServeLeasesPerClient = 4;		// frames one client may hold at once
+const unsigned            kServeLeasesTotal = 8;			// frames all clients together may hold; the pool grows by this many
+const unsigned            kServeLeaseMilliseconds = 5000;	// a client holding a frame longer is disconnected
+
+// Processing parameters
+// per-frame processing stages registered with a device run on threads of their own, each within a time budget;
+// frames they cannot keep up with are not processed, and capture goes on regardless
+const unsigned            kProcessingThreads = 2;
+const unsigned            kProcessingQueueDepth = 4;
+const bool                kMonitorSignalLevel = false;		// warn when an eye's picture goes black
+const double              kSignalBlackLevel = 20.0;			// mean 8-bit luma below which a picture is black; black is 16
+const double              kSignalLevelBudgetMs = 2.0;
+
+// Rectification parameters
+// rectifies both eyes of dual-stream 3D capture as a processing stage, from a stereoCalibrate result at the capture resolution
+const bool                kRectifyStereo = false;
+const char* const         kStereoCalibrationPath = "StereoCalibration.yml";	// M1, D1, M2, D2, R and T
+const unsigned            kRectifyRepresentation = kInputBgr8;	// kInputBgr8, kInputBgr16 or kInputLuma
+const bool                kRectifyFusedDecode = true;		// decode each stripe's source rows itself, rather than the shared full-frame decode
+const double              kRectifyBudgetMs = 20.0;
+
+// Disparity parameters
+// live disparity maps from dual-stream 3D capture, matched on threads of their own from the newest rectified pair;
+// uses the rectification's calibration
+const bool                kComputeDisparity = false;
+const double              kDisparityScale = 0.5;			// of the capture resolution, in each direction
+const DisparityMatcher    kDisparityMatcher = kDisparityBlockMatching;
+const int                 kDisparityCount = 64;				// at the reduced resolution; rounded up to a multiple of 16
+const int                 kDisparityBlockSize = 15;			// odd; 3 to 11 suits semi-global matching
+const unsigned            kDisparityThreads = 2;
+const double              kDisparityBudgetMs = 4.0;			// for rectifying the pair; matching is not on the pipeline's time
+
+// Logging parameters
+// per-frame messages are written by a background thread, so the capture callback never waits on the console
+const bool                kAsyncLog = true;
+const char* const         kLogTextPath = nullptr;			// nullptr prints to the console
+const char* const         kLogBinaryPath = nullptr;		// set to keep the records binary, for decodeBinaryLog to read later
+const unsigned            kLogRecordsPerThread = 4096;		// records a thread can get ahead of the log by before they are lost
+
+// Tracing parameters
+// a Chrome JSON trace of every pipeline stage, for chrome://tracing or ui.perfetto.dev; type trace <RETURN> while capturing to start or stop one
+const bool                kTraceAtStart = false;
+const char* const         kTracePathFormat = "DeckLinkTrace_%u.json";	// numbered from 0 for each trace taken
+const unsigned            kTraceEventsPerThread = 65536;	// spans a thread can get ahead of the trace file by before they are lost
+
+// Metrics parameters
+// counters, gauges and histograms for every device and stage, in the Prometheus text format
+const bool                kExportMetrics = true;
+const char* const         kMetricsPath = "DeckLinkMetrics.prom";	// rewritten every kMetricsIntervalMs; nullptr for none
+const unsigned short      kMetricsPort = 9464;				// served at http://127.0.0.1:9464/metrics; 0 for none
+const unsigned            kMetricsIntervalMs = 1000;
+
+// Continuity parameters
+// gaps and repeats in the stream times are blamed on whichever queue was at least this full when they were seen
+const double              kSaturatedQueueFill = 0.75;
+
 class DeckLinkDevice;
 
 class InputCallback : public IDeckLinkInputCallback
@@ -130,9 +289,9 @@ public:
 		m_deckLinkInput(nullptr),
 		m_inputCallback(nullptr),
 		m_deckLinkOutput(nullptr),
-		m_frameConverter(nullptr),
-		m_deckLinkBuffer(nullptr)
 		//m_outputCallback(nullptr)
+		m_frameCount(0),
+		m_hasInputSource(true)
 	{
 	}
 
@@ -140,15 +299,10 @@ public:
 	{
 
 		m_index = index;
+		m_metrics.reset(new DeviceMetrics(index));
+		addConfiguredProcessingStages();
 		m_deckLink = deckLink;  // THIS IS THE ISSUE!
 
-		// initialize our converter
-		if (GetDeckLinkVideoConversion(&m_frameConverter) != S_OK) {
-			printf("Frame converter initialization failed...\n");
-		} else {
-			printf("Converter initialized!\n");
-		}
-
 		//BSTR deckLinkDisplayName;
 		//deckLink->GetDisplayName(&deckLinkDisplayName);
 		//fprintf(stdout, "Trying to setup: %S\n", CString(deckLinkDisplayName));
@@ -244,6 +398,20 @@ public:
 
 	}
 
+	// stands in for setup() when frames come from a replay instead of a card
+	void setupReplay(unsigned index)
+	{
+		m_index = index;
+		m_metrics.reset(new DeviceMetrics(index));
+		addConfiguredProcessingStages();
+		m_inputCallback = new InputCallback(this);
+	}
+
+	IDeckLinkInputCallback* inputCallback()
+	{
+		return m_inputCallback;
+	}
+
 	HRESULT waitForSignalLock()
 	{
 		// When performing synchronized capture, all participating devices need to have their signal locked
@@ -272,8 +440,21 @@ public:
 		m_signalCondition.notify_all();
 	}
 
+	// the card's signal lock, for the metrics
+	void notifySignalLockChanged()
+	{
+		BOOL locked = false;
+		if (m_deckLinkStatus && m_deckLinkStatus->GetFlag(bmdDeckLinkStatusVideoInputSignalLocked, &locked) == S_OK)
+			m_metrics->setSignalLocked(locked != 0);
+	}
+
 	HRESULT prepareForCapture()
 	{
+		IDeckLinkDisplayMode* displayMode = nullptr;
+		BMDTimeValue frameDuration = 0;
+		BMDTimeScale frameTimeScale = 0;
+		CaptureFrame format = {};
+
 		// Enable video input
 		HRESULT result = m_deckLinkInput->EnableVideoInput(kDisplayMode, kPixelFormat, kInputFlag);
 		if (result != S_OK)
@@ -282,6 +463,168 @@ public:
 			goto bail;
 		}
 
+		// Size the frame pool and the recording from the display mode we are about to capture
+		result = m_deckLinkInput->GetDisplayMode(kDisplayMode, &displayMode);
+		if (result != S_OK)
+		{
+			fprintf(stderr, "Could not obtain the display mode - result = %08x\n", result);
+			goto bail;
+		}
+		displayMode->GetFrameRate(&frameDuration, &frameTimeScale);
+
+		format.deviceIndex = m_index;
+		format.timeScale = kTimeScale;
+		format.pixelFormat = kPixelFormat;
+		format.width = (int32_t)displayMode->GetWidth();
+		format.height = (int32_t)displayMode->GetHeight();
+		format.rowBytes = (int32_t)rowBytesForV210(format.width);
+		displayMode->Release();
+
+		notifySignalLockChanged();
+		result = prepareStages(format, (kInputFlag & bmdVideoInputDualStream3D) ? 2 : 1, frameDuration, frameTimeScale, kRecordingPathFormat, kVideoPathFormat);
+
+	bail:
+		return result;
+	}
+
+	// sizes the stages from a recording instead of a display mode, to replay it in place of a card
+	HRESULT prepareForReplay(const RecordingFileHeader& header, int64_t frameDuration)
+	{
+		CaptureFrame format = {};
+
+		if (frameDuration <= 0)
+		{
+			fprintf(stderr, "Could not tell the frame rate of the recording\n");
+			return E_FAIL;
+		}
+		if (header.eyeCount < 2)
+		{
+			fprintf(stderr, "Replay needs a dual-stream 3D recording\n");
+			return E_FAIL;
+		}
+
+		format.deviceIndex = m_index;
+		format.timeScale = header.timeScale;
+		format.pixelFormat = header.pixelFormat;
+		format.width = header.width;
+		format.height = header.height;
+		format.rowBytes = header.rowBytes;
+		return prepareStages(format, header.eyeCount, frameDuration, header.timeScale, kReplayRecordingPathFormat, kReplayVideoPathFormat);
+	}
+
+	// creates the frame pool and every stage the callback hands frames of format to
+	HRESULT prepareStages(CaptureFrame format, unsigned eyeCount, BMDTimeValue frameDuration, BMDTimeScale frameTimeScale, const char* recordingPathFormat, const char* videoPathFormat)
+	{
+		// the collector reads the stages this replaces
+		MetricsRegistry::removeCollectors(this);
+
+		HRESULT result = S_OK;
+		char recordingPath[260];
+		char videoPath[260];
+
+		// the pre-roll holds on to its frames' pool buffers, and so do the frame server's leases and
+		// the newest frame it keeps for the next grab, so the pool grows by that many
+		const unsigned preRollFrames = (unsigned)((kPreRollSeconds * (uint64_t)frameTimeScale + frameDuration - 1) / frameDuration);
+		const bool serveFrames = kServeFrames && FrameServer::isAvailable();
+		const unsigned servedFrames = serveFrames ? kServeLeasesTotal + 1 : 0;
+		m_latency.reset(new LatencyTracker(m_index));
+		m_continuity.reset(new ContinuityTracker(m_index));
+		m_clocks.reset(new ClockDriftTracker(m_index));
+		m_framePool.reset(new FramePool((size_t)format.rowBytes * format.height, kFramePoolBuffers + (preRollFrames + servedFrames) * eyeCount, serveFrames));
+
+		// dual-stream 3D recordings carry both eyes in every record
+		format.formatEyeCount = eyeCount;
+
+		snprintf(recordingPath, sizeof(recordingPath), recordingPathFormat, m_index);
+		m_recorder.reset(new RawRecorder(kRecorderQueueDepth, kRecorderBackend, kRecordsInFlight, kRecorderDirectIO));
+		m_recorder->enableCompression(kRecorderCompression, kRecorderCompressionLevel, kCompressionThreads, kCompressionStripes);
+		if (kStoreRepeats)
+			m_recorder->enableRepeats(kRepeatThreshold, kMaxRepeats);
+		if (kGovernRecording && kRecorderCompression == kCompressionNone && StripeCompressor::isAvailable(kGovernorCompression) &&
+			std::find(std::begin(kGovernorLadder), std::end(kGovernorLadder), kGovernorCompressRecording) != std::end(kGovernorLadder))
+		{
+			m_recorder->enableCompression(kGovernorCompression, kRecorderCompressionLevel, kCompressionThreads, kCompressionStripes);
+			m_recorder->setCompressionActive(false);
+		}
+		if (!m_recorder->open(recordingPath, format, kRecordPreallocateSeconds * (uint64_t)frameTimeScale / (uint64_t)frameDuration * (kRecordHeaderBytes + format.eyeCount() * alignToPage((uint64_t)format.rowBytes * format.height)), m_framePool.get()))
+		{
+			result = E_FAIL;
+			goto bail;
+		}
+		printf("Recording device #%u to %s\n", m_index, recordingPath);
+
+		if (preRollFrames > 0)
+		{
+			m_preRoll.reset(new PreRollBuffer(preRollFrames, (unsigned)(kPostRollSeconds * (uint64_t)frameTimeScale / frameDuration), m_recorder.get()));
+			m_preRoll->start();
+			PreRollBuffer::enableSignalTrigger();
+			printf("Pre-roll of %u s on device #%u uses %.1f GB of frame pool\n", kPreRollSeconds, m_index, m_framePool->capacity() * (double)m_framePool->bufferSize() / 1e9);
+		}
+
+		if (kEncodeVideo)
+		{
+			snprintf(videoPath, sizeof(videoPath), videoPathFormat, m_index);
+			m_encoder.reset(new VideoEncoder(kEncoderQueueDepth, kEncoderThreads));
+			m_encoder->setDecodeTimeMetric(m_metrics->videoDecodeTime());
+			if (!m_encoder->open(videoPath, format))
+			{
+				// the raw recording is what matters; carry on without the video file
+				fprintf(stderr, "Not encoding a video file for device #%u\n", m_index);
+				m_encoder.reset();
+			}
+		}
+
+		if (kWriteStills)
+		{
+			m_stills.reset(new StillWriterPool(kStillThreads ? kStillThreads : std::thread::hardware_concurrency(), kStillQueueDepth));
+			m_stills->setDecodeTimeMetric(m_metrics->stillsDecodeTime());
+			if (kLabelStills)
+				m_stills->setOverlay(cv::FONT_HERSHEY_SIMPLEX, kLabelFontScale, kLabelThickness, kLabelColor);
+			m_stills->start(kStillPathTemplate, kStillDepths, kStillCompressionLevel);
+		}
+
+		if (kPublishFrames)
+		{
+			char publishName[64];
+			snprintf(publishName, sizeof(publishName), kPublishNameFormat, m_index);
+			m_publisher.reset(new FramePublisher(kPublishQueueDepth));
+			if (!m_publisher->open(publishName, format, kPublishSlots))
+				m_publisher.reset();
+		}
+
+		if (serveFrames && m_framePool->isShareable())
+		{
+			char socketPath[260];
+			snprintf(socketPath, sizeof(socketPath), kFrameServerPathFormat, m_index);
+			m_frameServer.reset(new FrameServer(kServeLeasesPerClient, kServeLeasesTotal, kServeLeaseMilliseconds));
+			if (!m_frameServer->start(socketPath))
+				m_frameServer.reset();
+		}
+
+		if (kGovernRecording)
+		{
+			m_governor.reset(new ThroughputGovernor(m_recorder.get()));
+			for (GovernorStep step : kGovernorLadder)
+				addGovernorStep(step);
+			if (!m_governor->start(kGovernorRecoverSeconds))
+				m_governor.reset();	// nothing it could step down
+		}
+
+		if (!m_processingStages.empty())
+		{
+			m_processing.reset(new ProcessingPipeline(m_index, kProcessingThreads, kProcessingQueueDepth));
+			for (const std::shared_ptr<ProcessingStage>& stage : m_processingStages)
+				m_processing->addStage(stage);
+			if (!m_processing->start(format))
+				m_processing.reset();	// no stage to run on this capture
+		}
+
+		MetricsRegistry::addCollector(this, [this]()
+			{
+				m_metrics->collect(m_framePool.get(), m_recorder.get(), m_encoder.get(), m_stills.get(), m_publisher.get(), m_continuity.get(), m_clocks.get(),
+					m_processing.get());
+			});
+
 	bail:
 		return result;
 	}
@@ -314,7 +657,8 @@ public:
 
 	HRESULT cleanUpFromCapture()
 	{
-		HRESULT result = m_deckLinkInput->DisableVideoInput();
+		// a replay has no input to disable
+		HRESULT result = m_deckLinkInput ? m_deckLinkInput->DisableVideoInput() : S_OK;
 		if (result != S_OK)
 		{
 			fprintf(stderr, "Could not disable - result = %08x\n", result);
@@ -322,110 +666,147 @@ public:
 		}
 
 	bail:
+		MetricsRegistry::removeCollectors(this);
+
+		// no more frames can arrive, so let every stage drain its queue and close its files.
+		// The governor acts on the stages and the pre-roll feeds the recorder, so they go first
+		if (m_governor)
+		{
+			m_governor->stop();
+		}
+		if (m_preRoll)
+		{
+			m_preRoll->stop();
+		}
+		if (m_recorder)
+		{
+			m_recorder->close();
+		}
+		if (m_encoder)
+		{
+			m_encoder->close();
+		}
+		if (m_stills)
+		{
+			m_stills->stop();
+		}
+		if (m_publisher)
+		{
+			m_publisher->close();
+		}
+		if (m_frameServer)
+		{
+			m_frameServer->stop();
+		}
+		if (m_processing)
+		{
+			m_processing->stop();
+		}
+		if (m_latency)
+		{
+			m_latency->printStats();
+		}
+		if (m_continuity)
+		{
+			m_continuity->printStats();
+		}
+		if (m_clocks)
+		{
+			m_clocks->printStats();
+		}
 		return result;
 	}
 
-	// FRAME CONVERSION TO 8 BIT BGR IMAGE
-	// convert video frame into something we can deal with using OpenCV
-	// p_outputFrame should be a pointer to something like:  cv::Mat cvFrameBGR8(frameHeight, frameWidth, CV_8UC3);
-	HRESULT extractCVMat8(IDeckLinkVideoFrame* videoFrame, int32_t frameWidth, int32_t frameHeight, cv::Mat* p_outputMatrix) {
-
-		// create a new frame in 8 bit YUV (4:2:2 UYVY format)
-		// and use BMD tools to convert raw frame into this intermediate format
-		// which can be accepted (with conversion) into OpenCV
-		Uyvy8VideoFrame* uyuv8Frame = NULL;
-		uyuv8Frame = new Uyvy8VideoFrame(frameWidth, frameHeight, videoFrame->GetFlags());
-		m_frameConverter->ConvertFrame((IDeckLinkVideoFrame*)videoFrame, uyuv8Frame);
-		m_frameConverter->Release();
-		//printf("Pixel format after BMD frame conversion: 0x%0X\n", uyuv8Frame->GetPixelFormat());  // this check is really a bit silly, we directly set this value in our own frame class...
-
-		// assign pointer to raw pixel bytes in the new frame
-		uyuv8Frame->GetBytes((void**)&m_deckLinkBuffer);
-
-		// create OpenCV frames for the YUV and BGR frames
-		cv::Mat cvFrameYUV8(frameHeight, frameWidth, CV_8UC2);
-
-		// encode intermediate BMD frame directly in the pixels of the OpenCV MAT object
-		uint8_t* frameData = cvFrameYUV8.data;
-		unsigned long writeByteIdx = 0;
-		unsigned long readByteIdx = 0;
-		for (writeByteIdx = 0; writeByteIdx < 2 * (frameHeight * frameWidth); ++writeByteIdx) {
+	// puts a step on the governor's ladder, if this capture has what it acts on
+	void addGovernorStep(GovernorStep step)
+	{
+		RawRecorder* recorder = m_recorder.get();
+		VideoEncoder* encoder = m_encoder.get();
+		StillWriterPool* stills = m_stills.get();
 
-			*frameData = (uint8_t) * ((CHAR*)m_deckLinkBuffer);
-			++frameData;
-			++m_deckLinkBuffer;
+		switch (step)
+		{
+		case kGovernorCompressRecording:
+			if (recorder->isCompressionOnStandby())
+				m_governor->addStep(step, [recorder](bool degrade) { recorder->setCompressionActive(degrade); });
+			break;
+
+		case kGovernorStills8Bit:
+			if (stills && (kStillDepths & kStillDepth16))
+				m_governor->addStep(step, [stills](bool degrade) { stills->setDepths(degrade ? kStillDepth8 : kStillDepths); });
+			break;
+
+		case kGovernorStopStills:
+			if (stills)
+				m_governor->addStep(step, [stills, restoreDepths = 0u](bool degrade) mutable
+					{
+						if (degrade)
+							restoreDepths = stills->depths();
+						stills->setDepths(degrade ? 0 : restoreDepths);
+					});
+			break;
+
+		case kGovernorHalveVideoRate:
+			if (encoder)
+				m_governor->addStep(step, [encoder](bool degrade) { encoder->setDecimation(degrade ? 2 : 1); });
+			break;
 		}
-
-		// release frame
-		uyuv8Frame->Release();
-
-		// convert YUV 4:2:2 to BGR in OpenCV
-		cv::cvtColor(cvFrameYUV8, *p_outputMatrix, cv::COLOR_YUV2BGR_UYVY);
-
-		// done
-		return S_OK;
 	}
 
-	// FRAME CONVERSION TO 16 BIT BGR IMAGE
-	// convert video frame into something we can deal with using OpenCV
-	// p_outputFrame should be a pointer to something like:  cv::Mat cvFrameBGR16(frameHeight, frameWidth, CV_16UC3);
-	HRESULT extractCVMat16(IDeckLinkVideoFrame* videoFrame, int32_t frameWidth, int32_t frameHeight, cv::Mat* p_outputMatrix) {
+	// copy the raw payload of an SDK frame into a pooled buffer, so the SDK gets its frame back right away
+	FrameBuffer* copyToPool(IDeckLinkVideoFrame* videoFrame)
+	{
+		TraceSpan copySpan("copy to pool", m_frameCount);
+		void* frameBytes = nullptr;
+		const size_t payloadBytes = (size_t)videoFrame->GetRowBytes() * videoFrame->GetHeight();
+		if (videoFrame->GetBytes(&frameBytes) != S_OK || payloadBytes > m_framePool->bufferSize())
+			return nullptr;
+
+		FrameBuffer* buffer = m_framePool->acquire();
+		if (buffer == nullptr)
+			return nullptr;
+
+		memcpy(buffer->GetBytes(), frameBytes, payloadBytes);
+		buffer->SetSize(payloadBytes);
+		return buffer;
+	}
 
-		// convert the raw frame into 10-bit RGB
-		Xle10VideoFrame* xle10Frame = NULL;
-		xle10Frame = new Xle10VideoFrame(frameWidth, frameHeight, videoFrame->GetFlags());
-		m_frameConverter->ConvertFrame((IDeckLinkVideoFrame*)videoFrame, xle10Frame);
-		m_frameConverter->Release();
-		//printf("Pixel format after BMD frame conversion: 0x%0X\n", m_newFrameXLE->GetPixelFormat());  // this check is really a bit silly, we directly set this value in our own frame class...
+	// for every frame the card sends without an input source; says so when the signal goes, not at the frame rate
+	void noInputSource()
+	{
+		if (!m_hasInputSource)
+			return;
 
-		// assign pointer to raw pixel bytes in the new frame
-		xle10Frame->GetBytes((void**)&m_deckLinkBuffer);
+		m_hasInputSource = false;
+		logWarning("No input signal on device #%u\n", m_index);
+	}
 
-		// NOW... let's try to get the 10-bit frame values into a 16-bit frame
-		uint16_t* frameData = (uint16_t*)p_outputMatrix->data;
-		uint32_t localPixelData = 0;
-		CHAR* p_localPixelData;
-		for (unsigned int pixelIdx = 0; pixelIdx < (frameWidth * frameHeight); pixelIdx++)
+	HRESULT frameArrived(IDeckLinkVideoInputFrame* videoFrame)
+	{
+		const int64_t arrivalTime = steadyClockMicroseconds();
+		TraceRecorder::nameThread("capture device", m_index);
+		TraceSpan callbackSpan("frame arrived", m_frameCount);
+		if (!m_hasInputSource)
 		{
-			// read next four bytes from deckLinkBuffer into a 32-bit word
-			CHAR* p_localPixelData = (CHAR*)&localPixelData;
-			for (unsigned int byteIdx = 0; byteIdx < 4; byteIdx++)
-			{
-				*p_localPixelData = (CHAR) * ((CHAR*)m_deckLinkBuffer);
-				++m_deckLinkBuffer;
-				++p_localPixelData;
-			}
-
-			//printf("0x%08X\n", localPixelData);
-
-			// extract three 10-bit components from 32-bit word,
-			// convert each to 16-bit representations,
-			// and write out to the 16-bit OpenCV image
-			uint32_t bitMask = 0;
-			uint32_t componentValue10Bit = 0;
-			for (unsigned int componentIdx = 0; componentIdx < 3; componentIdx++)
-			{
-				bitMask = 0xFFC << (10 * componentIdx);
-				componentValue10Bit = (localPixelData & bitMask) >> (10 * componentIdx + 2);
-				*frameData = (uint16_t)(((double)componentValue10Bit) * (65535.0 / 1023.0));
-				++frameData;
-			}
+			m_hasInputSource = true;
+			logInfo("Input signal back on device #%u\n", m_index);
 		}
 
-		// release frame
-		xle10Frame->Release();
+		// the card's clock now, against the steady clock either side of reading it, puts the frame's
+		// hardware timestamp on the steady clock for every stage to measure its latency from
+		BMDTimeValue cardTime = 0;
+		BMDTimeValue cardTimeInFrame;
+		BMDTimeValue cardTicksPerFrame;
+		const bool haveCardTime = m_deckLinkInput != nullptr &&
+			m_deckLinkInput->GetHardwareReferenceClock(kMicroSecondsTimeScale, &cardTime, &cardTimeInFrame, &cardTicksPerFrame) == S_OK;
+		const int64_t cardReadTime = steadyClockMicroseconds();
 
-		// done
-		return S_OK;
-	}
-
-	HRESULT frameArrived(IDeckLinkVideoInputFrame* videoFrame)
-	{
 		BMDTimeValue time;
-		HRESULT result = videoFrame->GetStreamTime(&time, nullptr, kTimeScale);
+		BMDTimeValue duration;
+		HRESULT result = videoFrame->GetStreamTime(&time, &duration, kTimeScale);
 		if (result != S_OK)
 		{
-			fprintf(stderr, "Could not get stream time from frame - result = %08x\n", result);
+			logWarning("Could not get stream time from frame - result = %08x\n", result);
 			return S_OK;
 		}
 
@@ -438,74 +819,245 @@ public:
 		result = videoFrame->GetHardwareReferenceTimestamp(kMicroSecondsTimeScale, &hwTime, NULL);
 		if (result != S_OK)
 		{
-			fprintf(stderr, "Could not get hardware reference time from frame - result = %08x\n", result);
+			logWarning("Could not get hardware reference time from frame - result = %08x\n", result);
 			return S_OK;
 		}
 
+		// a replay's hardware times are the recording's, so its latencies start at the callback
+		const int64_t anchorTime = haveCardTime ? arrivalTime + (cardReadTime - arrivalTime) / 2 - (cardTime - hwTime) : arrivalTime;
+		if (haveCardTime)
+		{
+			m_latency->record(kLatencyCallback, anchorTime);
+			m_clocks->addClockReading(cardTime, arrivalTime + (cardReadTime - arrivalTime) / 2);
+		}
+
+		// frames the driver has queued behind this one mean the callback is not keeping up
+		unsigned driverBacklog = 0;
+		if (m_deckLinkInput)
+			m_deckLinkInput->GetAvailableVideoFrameCount(&driverBacklog);
+		const auto blame = [this, driverBacklog]() { return saturatedStage(driverBacklog); };
+		m_continuity->check(kEyeLeft, time, duration, kTimeScale, driverBacklog, blame);
+		m_clocks->addFrame(kEyeLeft, hwTime, time, duration, kTimeScale, arrivalTime);
+		m_metrics->frameCaptured();
 
-		printf("[%llu.%06llu] Device #%u: Frame %02u:%02u:%02u:%03u arrived\n", hwTime / kMicroSecondsTimeScale, hwTime % kMicroSecondsTimeScale, m_index, hours, minutes, seconds, frames);
+
+		logInfo("[%llu.%06llu] Device #%u: Frame %02u:%02u:%02u:%03u arrived\n", hwTime / kMicroSecondsTimeScale, hwTime % kMicroSecondsTimeScale, m_index, hours, minutes, seconds, frames);
 
 		// get height, width, bytes per row, and pixel format of raw frame
 		// captured from DeckLink
 		const auto frameHeight = (int32_t)videoFrame->GetHeight();
 		const auto frameWidth = (int32_t)videoFrame->GetWidth();
 		const auto rowBytes = videoFrame->GetRowBytes();
-		printf("Width: %d; Height: %d; total bytes per row: %d\n", frameWidth, frameHeight, rowBytes);
-		printf("Raw pixel format: 0x%0X\n", videoFrame->GetPixelFormat());
+		logInfo("Width: %d; Height: %d; total bytes per row: %d\n", frameWidth, frameHeight, rowBytes);
+		logInfo("Raw pixel format: 0x%0X\n", videoFrame->GetPixelFormat());
 
 		// now extract the RIGHT eye frame
 		IDeckLinkVideoFrame3DExtensions* videoFrameExtensions = NULL;
 		IDeckLinkVideoFrame* videoFrameRight = NULL;
 		result = videoFrame->QueryInterface(IID_IDeckLinkVideoFrame3DExtensions, (void**)&videoFrameExtensions);
 		if (result != S_OK) {
-			fprintf(stderr, "Could not retrieve 3D extensions object...\n");
+			logWarning("Could not retrieve 3D extensions object...\n");
+			return S_OK;
 		}
 		result = videoFrameExtensions->GetFrameForRightEye(&videoFrameRight);
 		if (result != S_OK) {
-			fprintf(stderr, "Could not retrieve right eye frame...\n");
+			logWarning("Could not retrieve right eye frame...\n");
+			videoFrameExtensions->Release();
+			return S_OK;
 		}
 
-		// Save the LEFT frame (8 bit)
-		cv::Mat cvFrameBGR8_L(frameHeight, frameWidth, CV_8UC3);
-		extractCVMat8((IDeckLinkVideoFrame*)videoFrame, frameWidth, frameHeight, &cvFrameBGR8_L);
-		cv::imwrite("C:\\Users\\f002r5k\\Desktop\\test8_L.tif", cvFrameBGR8_L);
-		
-		// Save the RIGHT frame (8 bit)
-		cv::Mat cvFrameBGR8_R(frameHeight, frameWidth, CV_8UC3);
-		extractCVMat8((IDeckLinkVideoFrame*)videoFrameRight, frameWidth, frameHeight, &cvFrameBGR8_R);
-		cv::imwrite("C:\\Users\\f002r5k\\Desktop\\test8_R.tif", cvFrameBGR8_R);
-
-		// Save the LEFT frame (16 bit)
-		cv::Mat cvFrameBGR16_L(frameHeight, frameWidth, CV_16UC3);
-		extractCVMat16((IDeckLinkVideoFrame*)videoFrame, frameWidth, frameHeight, &cvFrameBGR16_L);
-		cv::imwrite("C:\\Users\\f002r5k\\Desktop\\test16_L.tif", cvFrameBGR16_L);
+		// the right eye has stream times of its own, from the other input
+		IDeckLinkVideoInputFrame* videoInputFrameRight = NULL;
+		if (videoFrameRight->QueryInterface(IID_IDeckLinkVideoInputFrame, (void**)&videoInputFrameRight) == S_OK)
+		{
+			BMDTimeValue rightTime;
+			BMDTimeValue rightDuration;
+			BMDTimeValue rightHwTime;
+			if (videoInputFrameRight->GetStreamTime(&rightTime, &rightDuration, kTimeScale) == S_OK)
+			{
+				m_continuity->check(kEyeRight, rightTime, rightDuration, kTimeScale, driverBacklog, blame);
+				if (videoInputFrameRight->GetHardwareReferenceTimestamp(kMicroSecondsTimeScale, &rightHwTime, NULL) == S_OK)
+					m_clocks->addFrame(kEyeRight, rightHwTime, rightTime, rightDuration, kTimeScale, arrivalTime);
+			}
+			videoInputFrameRight->Release();
+		}
 
-		// Save the RIGHT frame (16 bit)
-		cv::Mat cvFrameBGR16_R(frameHeight, frameWidth, CV_16UC3);
-		extractCVMat16((IDeckLinkVideoFrame*)videoFrameRight, frameWidth, frameHeight, &cvFrameBGR16_R);
-		cv::imwrite("C:\\Users\\f002r5k\\Desktop\\test16_R.tif", cvFrameBGR16_R);
+		// Hand the untouched LEFT and RIGHT payloads to the recorder
+		// nothing is converted or encoded on this thread
+		CaptureFrame frame = {};
+		frame.deviceIndex = m_index;
+		frame.frameNumber = m_frameCount++;
+		frame.streamTime = time;
+		frame.streamDuration = duration;
+		frame.timeScale = kTimeScale;
+		frame.hardwareTime = hwTime;
+		frame.arrivalTime = arrivalTime;
+		frame.anchorTime = anchorTime;
+		frame.latency = m_latency.get();
+		frame.flags = videoFrame->GetFlags();
+		frame.pixelFormat = videoFrame->GetPixelFormat();
+		frame.width = frameWidth;
+		frame.height = frameHeight;
+		frame.rowBytes = (int32_t)rowBytes;
+		frame.eye[kEyeLeft] = copyToPool((IDeckLinkVideoFrame*)videoFrame);
+		frame.eye[kEyeRight] = copyToPool(videoFrameRight);
 
 		// put away right eye frame objects
 		videoFrameRight->Release();
 		videoFrameExtensions->Release();
 
-		// add something to the frame
-		//char mystr[255];
-		//sprintf_s(mystr, "Frame #%03d", 001);
-		//putText(cvFrameBGR16, (string)mystr, Point(50, cvFrameBGR16.rows / 2), FONT_HERSHEY_SIMPLEX, 5.0, CV_RGB(65535, 65535, 0), 10);
+		if (frame.eye[kEyeLeft] == nullptr || frame.eye[kEyeRight] == nullptr)
+		{
+			logWarning("Frame pool exhausted, dropping frame %llu\n", frame.frameNumber);
+			m_metrics->frameDropped(kSaturatedFramePool);
+			frame.release();
+			return S_OK;
+		}
 
-		// hang here, for now...
-		// TODO: stream to video file, and make sure we release everything properly in the destructor
-		while (1) {};
+		// every stage gets its own buffer references, and releases them when done or when it has to drop the frame
+		TraceSpan handOffSpan("hand off", frame.frameNumber);
+		if (m_encoder)
+		{
+			frame.retain();
+			if (!m_encoder->submit(frame))
+			{
+				logWarning("Encoder queue full, dropping frame %llu from the video file\n", frame.frameNumber);
+				m_metrics->frameDropped(kSaturatedEncoder);
+			}
+		}
+
+		if (m_stills)
+		{
+			frame.retain();
+			if (!m_stills->submit(frame))
+			{
+				logWarning("Still writers busy, no stills for frame %llu\n", frame.frameNumber);
+				m_metrics->frameDropped(kSaturatedStills);
+			}
+		}
+
+		if (m_publisher)
+		{
+			frame.retain();
+			if (!m_publisher->submit(frame))
+			{
+				logWarning("Publisher busy, frame %llu not published\n", frame.frameNumber);
+				m_metrics->frameDropped(kSaturatedPublisher);
+			}
+		}
+
+		if (m_frameServer)
+		{
+			frame.retain();
+			m_frameServer->submit(frame);
+		}
+
+		if (m_processing)
+		{
+			frame.retain();
+			if (!m_processing->submit(frame))
+			{
+				logWarning("Processing stages busy, frame %llu not processed\n", frame.frameNumber);
+				m_metrics->frameDropped(kSaturatedProcessing);
+			}
+		}
+
+		if (m_preRoll)
+			m_preRoll->submit(frame);
+		else if (!m_recorder->submit(frame))
+		{
+			logWarning("Recorder queue full, dropping frame %llu\n", frame.frameNumber);
+			m_metrics->frameDropped(kSaturatedRecorder);
+		}
+		recordLatency(frame, kLatencyPooled);
 
 		return S_OK;
 	}
 
+	// records the pre-roll and what follows it; without a pre-roll everything is being recorded anyway
+	bool triggerRecording()
+	{
+		if (!m_preRoll)
+			return false;
+
+		m_preRoll->trigger();
+		return true;
+	}
+
+	// the stage closest to overflowing, for the continuity tracker to blame a gap on
+	SaturatedStage saturatedStage(unsigned driverBacklog)
+	{
+		SaturatedStage stage = (driverBacklog > 0) ? kSaturatedCallback : kSaturatedNone;
+		double fullest = kSaturatedQueueFill;
+		auto consider = [&stage, &fullest](SaturatedStage candidate, double fill)
+		{
+			if (fill >= fullest)
+			{
+				fullest = fill;
+				stage = candidate;
+			}
+		};
+
+		// a pre-roll keeps most of the pool on purpose, so only a pool without room for both eyes of a frame counts
+		if (m_framePool && m_framePool->available() < kEyeCount)
+			consider(kSaturatedFramePool, 1.0);
+		if (m_recorder)
+		{
+			const RecorderStats recorder = m_recorder->stats();
+			consider(kSaturatedRecorder, recorder.queueCapacity ? (double)recorder.queueDepth / recorder.queueCapacity : 0.0);
+		}
+		if (m_encoder)
+			consider(kSaturatedEncoder, (double)m_encoder->stats().queueDepth / kEncoderQueueDepth);
+		if (m_stills)
+			consider(kSaturatedStills, (double)m_stills->stats().queueDepth / kStillQueueDepth);
+		if (m_publisher)
+			consider(kSaturatedPublisher, (double)m_publisher->stats().queueDepth / kPublishQueueDepth);
+		if (m_processing)
+			consider(kSaturatedProcessing, (double)m_processing->queueDepth() / m_processing->queueCapacity());
+		return stage;
+	}
+
+	// runs stage on every frame of the captures prepared from now on, as far as its budget allows
+	void addProcessingStage(const std::shared_ptr<ProcessingStage>& stage)
+	{
+		m_processingStages.push_back(stage);
+	}
+
+	// the processing stages switched on by the parameters above
+	void addConfiguredProcessingStages()
+	{
+		if (kMonitorSignalLevel)
+			addProcessingStage(std::make_shared<SignalLevelStage>(m_index, kSignalBlackLevel, kSignalLevelBudgetMs));
+		if (kRectifyStereo)
+			addProcessingStage(std::make_shared<RectificationStage>(kStereoCalibrationPath, kRectifyRepresentation, kRectifyFusedDecode, kRectifyBudgetMs));
+		if (kComputeDisparity)
+		{
+			addProcessingStage(std::make_shared<DisparityStage>(m_index, kStereoCalibrationPath, kDisparityScale, kDisparityMatcher, kDisparityCount,
+				kDisparityBlockSize, kDisparityThreads, kDisparityBudgetMs));
+		}
+	}
+
+	// per-stage latencies of this device's frames so far, or nullptr before capture is prepared
+	const LatencyTracker* latency() const
+	{
+		return m_latency.get();
+	}
+
+	// drift of this device's clocks, and the mapping of its hardware timestamps onto the steady clock,
+	// or nullptr before capture is prepared
+	const ClockDriftTracker* clocks() const
+	{
+		return m_clocks.get();
+	}
+
 	~DeckLinkDevice()
 	{
+		MetricsRegistry::removeCollectors(this);
+
 		if (m_inputCallback)
 		{
-			m_deckLinkInput->SetCallback(nullptr);
+			if (m_deckLinkInput)
+				m_deckLinkInput->SetCallback(nullptr);
 			m_inputCallback->Release();
 		}
 
@@ -532,10 +1084,6 @@ public:
 
 		if (m_deckLinkNotification)
 			m_deckLinkNotification->Release();
-
-		if(m_frameConverter)
-			m_frameConverter->Release();
-
 	}
 
 private:
@@ -550,8 +1098,22 @@ private:
 	InputCallback*				m_inputCallback;
 	std::mutex					m_mutex;
 	std::condition_variable		m_signalCondition;
-	IDeckLinkVideoConversion*	m_frameConverter;
-	CHAR*						m_deckLinkBuffer;
+	std::unique_ptr<FramePool>	m_framePool;
+	std::unique_ptr<RawRecorder>	m_recorder;
+	std::unique_ptr<PreRollBuffer>	m_preRoll;
+	std::unique_ptr<VideoEncoder>	m_encoder;
+	std::unique_ptr<StillWriterPool>	m_stills;
+	std::unique_ptr<FramePublisher>	m_publisher;
+	std::unique_ptr<FrameServer>	m_frameServer;
+	std::unique_ptr<ProcessingPipeline>	m_processing;
+	std::vector<std::shared_ptr<ProcessingStage>>	m_processingStages;
+	std::unique_ptr<ThroughputGovernor>	m_governor;
+	std::unique_ptr<LatencyTracker>	m_latency;
+	std::unique_ptr<ContinuityTracker>	m_continuity;
+	std::unique_ptr<ClockDriftTracker>	m_clocks;
+	std::unique_ptr<DeviceMetrics>		m_metrics;
+	uint64_t					m_frameCount;
+	bool						m_hasInputSource;		// callback thread only
 };
 
 HRESULT InputCallback::VideoInputFormatChanged(BMDVideoInputFormatChangedEvents notificationEvents, IDeckLinkDisplayMode* newDisplayMode, BMDDetectedVideoInputFormatFlags detectedSignalFlags)
@@ -563,7 +1125,7 @@ HRESULT InputCallback::VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFra
 {
 	if (!videoFrame || (videoFrame->GetFlags() & bmdFrameHasNoInputSource))
 	{
-		printf("No valid frame\n");
+		m_deckLinkDevice->noInputSource();
 		return S_OK;
 	}
 
@@ -575,6 +1137,12 @@ HRESULT NotificationCallback::Notify(BMDNotifications topic, uint64_t param1, ui
 	if (topic != bmdStatusChanged)
 		return S_OK;
 
+	if ((BMDDeckLinkStatusID)param1 == bmdDeckLinkStatusVideoInputSignalLocked)
+	{
+		m_deckLinkDevice->notifySignalLockChanged();
+		return S_OK;
+	}
+
 	if ((BMDDeckLinkStatusID)param1 != bmdDeckLinkStatusDetectedVideoInputMode)
 		return S_OK;
 
@@ -583,6 +1151,117 @@ HRESULT NotificationCallback::Notify(BMDNotifications topic, uint64_t param1, ui
 }
 
 
+// the path for the next trace taken
+static std::string nextTracePath()
+{
+	static unsigned traceNumber = 0;
+	char path[256];
+	snprintf(path, sizeof(path), kTracePathFormat, traceNumber++);
+	return path;
+}
+
+// starts a trace when none is running, otherwise finishes the one that is
+static void toggleTracing()
+{
+	if (TraceRecorder::isTracing())
+		TraceRecorder::stop();
+	else
+		TraceRecorder::start(nextTracePath().c_str(), kTraceEventsPerThread);
+}
+
+// feeds the whole pipeline from a recording instead of a DeckLink card
+static int replayRecording(const char* path)
+{
+	ArchiveReplaySource	source;
+	DeckLinkDevice		device;
+
+	if (!source.open(path))
+		return 1;
+
+	device.setupReplay(0);
+	if (device.prepareForReplay(source.header(), source.frameDuration()) != S_OK)
+		return 1;
+
+	if (kReplayLoop)
+	{
+		printf("Replaying... Press <RETURN> to exit\n");
+		source.start(device.inputCallback(), kReplayPacing, true);
+		getchar();
+		source.stop();
+	}
+	else
+	{
+		printf("Replaying...\n");
+		source.start(device.inputCallback(), kReplayPacing, false);
+		source.waitUntilFinished();
+	}
+
+	printf("Exiting.\n");
+	device.cleanUpFromCapture();
+	return 0;
+}
+
+// captures from simulated cards instead of DeckLink hardware, each device running its own pipeline
+static int captureSimulated(unsigned deviceCount)
+{
+	std::vector<std::unique_ptr<DeckLinkDevice>>	devices;
+	std::string		command;
+	int				exitCode = 0;
+
+	for (unsigned index = 0; index < deviceCount; index++)
+	{
+		std::unique_ptr<DeckLinkDevice> device(new DeckLinkDevice());
+
+		// the device takes over the simulated card's reference
+		if (device->setup(new SimulatedDeckLink(kSimulatedSignalMode, kSimulatedSpeed, index), index) != S_OK ||
+			device->prepareForCapture() != S_OK)
+		{
+			exitCode = 1;
+			break;
+		}
+		devices.push_back(std::move(device));
+	}
+
+	if (exitCode == 0)
+	{
+		fprintf(stdout, "Starting capture from %u simulated cards...\n", deviceCount);
+		for (std::unique_ptr<DeckLinkDevice>& device : devices)
+		{
+			if (device->startCapture() != S_OK)
+				exitCode = 1;
+		}
+	}
+
+	if (exitCode == 0)
+	{
+		if (kPreRollSeconds > 0)
+			printf("Capturing... Type t <RETURN> to record the last %u seconds, <RETURN> to exit\n", kPreRollSeconds);
+		else
+			printf("Capturing... Press <RETURN> to exit\n");
+		while (std::getline(cin, command) && (command == "t" || command == "trace"))
+		{
+			if (command == "trace")
+			{
+				toggleTracing();
+				continue;
+			}
+			for (std::unique_ptr<DeckLinkDevice>& device : devices)
+			{
+				if (device->triggerRecording())
+					printf("Recording triggered\n");
+			}
+		}
+	}
+
+	printf("Exiting.\n");
+	for (std::unique_ptr<DeckLinkDevice>& device : devices)
+	{
+		device->stopCapture();
+		device->cleanUpFromCapture();
+	}
+	return exitCode;
+}
+
 int main(void) {
 
 	IDeckLinkIterator*	deckLinkIterator = nullptr;
@@ -591,8 +1270,21 @@ int main(void) {
 	DeckLinkDevice      device;
 	HRESULT             result;
 	unsigned			index = 0;
+	std::string		command;
 	unsigned int		deckLinkCount = 0;
+	BinaryLogScope		logging(kAsyncLog, kLogTextPath, kLogBinaryPath, kLogRecordsPerThread);
+	MetricsScope		metrics(kExportMetrics, kMetricsPath, kMetricsPort, kMetricsIntervalMs);
+	TraceScope			tracing(kTraceAtStart, kTraceAtStart ? nextTracePath().c_str() : nullptr, kTraceEventsPerThread);
+
+	// no card is needed to replay a recording
+	if (kReplayPath != nullptr)
+		return replayRecording(kReplayPath);
 
+	// nor to load test with simulated ones
+	if (kSimulatedDevices > 0)
+		return captureSimulated(kSimulatedDevices);
+
+	// COM is only for the cards themselves
 	Initialize();
 
 	cout << "Hello, world!" << endl;
@@ -650,9 +1342,18 @@ int main(void) {
 	if (result != S_OK)
 		goto bail;
 
-	// Wait until user presses Enter
-	printf("Capturing... Press <RETURN> to exit\n");
-	getchar();
+	// Wait until user presses Enter; with a pre-roll, t <RETURN> triggers a recording first
+	if (kPreRollSeconds > 0)
+		printf("Capturing... Type t <RETURN> to record the last %u seconds, <RETURN> to exit\n", kPreRollSeconds);
+	else
+		printf("Capturing... Press <RETURN> to exit\n");
+	while (std::getline(cin, command) && (command == "t" || command == "trace"))
+	{
+		if (command == "trace")
+			toggleTracing();
+		else if (device.triggerRecording())
+			printf("Recording triggered\n");
+	}
 
 
 	// Stop capture - This only needs to be performed on one device in the group